@@ -1,28 +1,343 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
 #include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSet>
 #include <QTextDocument>
-#include <QApplication>
-#include <QTime>
+#include <QTimer>
 
-#include "Theme.h"
-#include "Session.h"
+#include "LanguageParser.h"
+#include "PListParser.h"
+#include "Regexp.h"
 #include "SyntaxHighlighter.h"
+#include "Theme.h"
+
+// Headless benchmark of syntax highlighting.
+// It measures grammar load, full parse, re-parse after edits, theme format resolution and
+// highlightBlock separately, and writes a JSON object per measurement in a line.
+
+namespace {
+
+std::atomic<qint64> s_allocationCount(0);
+
+const QString CPP_SCOPE = QStringLiteral("source.c++");
+const QStringList GRAMMAR_FILES = {"grammers/C.tmLanguage", "grammers/C++.tmLanguage"};
+const QString THEME_FILE = QStringLiteral("Monokai.tmTheme");
+const QStringList INPUT_FILES = {"Benchmark_1007.cpp", "Benchmark_12867.cpp"};
+// sizes of the inputs generated by repeating the largest input
+const QList<int> GENERATED_INPUT_SIZES = {1 << 20, 4 << 20};
+// number of edits applied one by one in the re-parse benchmark
+const int EDIT_COUNT = 100;
+
+struct Input {
+  QString name;
+  QString text;
+};
+
+struct Result {
+  // milliseconds of each iteration
+  QList<double> times;
+  // allocations in the first iteration
+  qint64 allocations;
+};
+
+// Runs f the given times and measures each run
+Result measure(int iterations, std::function<void()> f) {
+  Result result;
+  for (int i = 0; i < iterations; i++) {
+    const qint64 allocationsBefore = s_allocationCount.load();
+    QElapsedTimer timer;
+    timer.start();
+    f();
+    result.times.append(timer.nsecsElapsed() / 1e6);
+    if (i == 0) {
+      result.allocations = s_allocationCount.load() - allocationsBefore;
+    }
+  }
+  return result;
+}
+
+double median(QList<double> values) {
+  std::sort(values.begin(), values.end());
+  const int n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Writes a result with the throughput over bytes and lines processed in each iteration
+void report(QFile* out,
+            const QString& benchmark,
+            const QString& input,
+            qint64 bytes,
+            qint64 lines,
+            const Result& result) {
+  const double ms = median(result.times);
+  const double seconds = ms / 1000;
+  QJsonObject obj;
+  obj["benchmark"] = benchmark;
+  obj["input"] = input;
+  obj["iterations"] = result.times.size();
+  obj["median_ms"] = ms;
+  obj["min_ms"] = *std::min_element(result.times.begin(), result.times.end());
+  obj["bytes"] = bytes;
+  obj["lines"] = lines;
+  obj["mb_per_s"] = seconds > 0 ? bytes / seconds / (1 << 20) : 0;
+  obj["lines_per_s"] = seconds > 0 ? lines / seconds : 0;
+  obj["allocations"] = result.allocations;
+  out->write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+  out->write("\n");
+  out->flush();
+}
+
+qint64 byteCount(const QString& text) {
+  return text.toUtf8().size();
+}
+
+qint64 lineCount(const QString& text) {
+  return text.count('\n') + 1;
+}
+
+QString readFile(const QString& path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    qCritical("unable to open %s", qPrintable(path));
+    std::exit(1);
+  }
+  return QString::fromUtf8(file.readAll());
+}
+
+QList<Input> loadInputs(const QString& dataDir) {
+  QList<Input> inputs;
+  for (const auto& name : INPUT_FILES) {
+    inputs.append(Input{name, readFile(dataDir + "/" + name)});
+  }
+  const QString& unit = inputs.last().text;
+  for (int size : GENERATED_INPUT_SIZES) {
+    QString text;
+    text.reserve(size + unit.size());
+    while (text.size() < size) {
+      text += unit;
+    }
+    inputs.append(Input{QString("generated_%1MB.cpp").arg(size >> 20), text});
+  }
+  return inputs;
+}
+
+// Deterministic edits spread over text: typing a character, deleting it and opening a comment
+// which changes the scopes of the rest of the line.
+struct Edit {
+  int position;
+  int charsRemoved;
+  QString insertedText;
+};
 
-int main(int argv, char** args) {
-  Theme* theme = Theme::loadTheme("testdata/Monokai.tmTheme");
+QList<Edit> scriptedEdits(const QString& text) {
+  QList<Edit> edits;
+  const QStringList insertions = {"x", "/*", "\""};
+  for (int i = 0; i < EDIT_COUNT; i++) {
+    const int position = static_cast<int>(static_cast<qint64>(text.size()) * i / EDIT_COUNT);
+    if (i % 4 == 3) {
+      edits.append(Edit{position, 1, ""});
+    } else {
+      edits.append(Edit{position, 0, insertions[i % 4]});
+    }
+  }
+  return edits;
+}
+
+void collectScopes(const core::Node& node, const QString& parentScope, QSet<QString>& scopes) {
+  const QString scope = node.name.isEmpty() ? parentScope : QString(parentScope + " " + node.name);
+  scopes.insert(scope);
+  for (const auto& child : node.children) {
+    collectScopes(child, scope, scopes);
+  }
+}
+
+void benchmarkGrammarLoad(QFile* out, const QString& dataDir, int iterations) {
+  for (const auto& name : GRAMMAR_FILES) {
+    const QString path = dataDir + "/" + name;
+    const qint64 size = QFileInfo(path).size();
+    const auto result = measure(iterations, [&] {
+      QFile file(path);
+      file.open(QIODevice::ReadOnly);
+      core::Language lang(core::PListParser::parsePList(&file).toMap());
+      Q_UNUSED(lang);
+    });
+    report(out, "grammar_load", name, size, 0, result);
+    core::LanguageProvider::loadLanguage(path);
+  }
+}
+
+void benchmarkParse(QFile* out, const Input& input, int iterations) {
+  const auto result = measure(iterations, [&] {
+    std::unique_ptr<core::LanguageParser> parser(
+        core::LanguageParser::create(CPP_SCOPE, input.text));
+    parser->parse();
+  });
+  report(out, "full_parse", input.name, byteCount(input.text), lineCount(input.text), result);
+}
+
+void benchmarkReparse(QFile* out, const Input& input, int iterations) {
+  std::unique_ptr<core::LanguageParser> parser(
+      core::LanguageParser::create(CPP_SCOPE, input.text));
+  const auto rootNode = parser->parse();
+  if (!rootNode) {
+    qCritical("failed to parse %s", qPrintable(input.name));
+    return;
+  }
+  const QList<Edit> edits = scriptedEdits(input.text);
+  const core::ScopeTree tree = core::ScopeTree::fromRootNode(*rootNode);
+
+  // Each edit is applied to the parsed text and re-parsed like ParseScheduler does
+  qint64 reparsedLength = 0;
+  const auto result = measure(iterations, [&] {
+    reparsedLength = 0;
+    for (const auto& edit : edits) {
+      core::LanguageParser editedParser = *parser;
+      core::ScopeTree editedTree = tree;
+      editedTree.adjust(edit.position + edit.charsRemoved,
+                        edit.insertedText.length() - edit.charsRemoved);
+      if (auto region = editedParser.applyEdit(edit.position, edit.charsRemoved,
+                                               edit.insertedText)) {
+        if (auto parsed = editedParser.parse(editedTree, *region)) {
+          reparsedLength += std::get<1>(*parsed).length();
+        }
+      }
+    }
+  });
+  report(out, "reparse_" + QString::number(edits.size()) + "_edits", input.name,
+         byteCount(input.text), lineCount(input.text), result);
+  qDebug("%s: %lld chars re-parsed by %d edits", qPrintable(input.name), reparsedLength,
+         edits.size());
+}
+
+void benchmarkThemeFormat(QFile* out, const QString& dataDir, const Input& input, int iterations) {
+  std::unique_ptr<core::LanguageParser> parser(
+      core::LanguageParser::create(CPP_SCOPE, input.text));
+  const auto rootNode = parser->parse();
+  if (!rootNode) {
+    return;
+  }
+  QSet<QString> scopes;
+  collectScopes(*rootNode, "", scopes);
+
+  // A theme caches resolved formats, so every iteration resolves them with a new theme
+  std::vector<std::unique_ptr<core::Theme>> themes;
+  for (int i = 0; i < iterations; i++) {
+    themes.emplace_back(core::Theme::loadTheme(dataDir + "/" + THEME_FILE));
+  }
+  int i = 0;
+  const auto result = measure(iterations, [&] {
+    core::Theme* theme = themes[i++].get();
+    for (const auto& scope : scopes) {
+      theme->getFormat(scope.trimmed());
+    }
+  });
+  report(out, "theme_format_" + QString::number(scopes.size()) + "_scopes", input.name,
+         byteCount(input.text), lineCount(input.text), result);
+}
+
+void benchmarkHighlightBlock(QFile* out,
+                             const QString& dataDir,
+                             const Input& input,
+                             int iterations) {
+  std::unique_ptr<core::Theme> theme(core::Theme::loadTheme(dataDir + "/" + THEME_FILE));
+  QTextDocument doc(input.text);
+  std::unique_ptr<core::LanguageParser> parser(
+      core::LanguageParser::create(CPP_SCOPE, input.text));
+  core::SyntaxHighlighter highlighter(&doc, std::move(parser), theme.get(), QFont("Helvetica"));
+
+  // wait for the parse in ParseScheduler
+  QEventLoop loop;
+  QObject::connect(&highlighter, &core::SyntaxHighlighter::parseFinished, &loop,
+                   &QEventLoop::quit);
+  QTimer::singleShot(10 * 60 * 1000, &loop, &QEventLoop::quit);
+  loop.exec();
+
+  // rehighlight calls highlightBlock for every block
+  const auto result = measure(iterations, [&] { highlighter.rehighlight(); });
+  report(out, "highlight_block", input.name, byteCount(input.text), lineCount(input.text),
+         result);
+}
+
+// Finds all the occurrences of a plain string by the regex and by the literal searcher
+void benchmarkFind(QFile* out, const Input& input, int iterations) {
+  const QString str = "nullptr";
+  for (bool caseSensitive : {true, false}) {
+    const QString suffix = caseSensitive ? "" : "_ignore_case";
+    const auto regexp = core::Regexp::compile(QString(
+        QLatin1String(caseSensitive ? "(?-i)" : "(?i)") + core::Regexp::escape(str)));
+    const auto literal = core::Regexp::compileLiteral(str, caseSensitive);
+    auto result =
+        measure(iterations, [&] { regexp->findAllStringSubmatchIndex(input.text); });
+    report(out, "find_regex" + suffix, input.name, byteCount(input.text), lineCount(input.text),
+           result);
+    result = measure(iterations, [&] { literal->findAllStringSubmatchIndex(input.text); });
+    report(out, "find_literal" + suffix, input.name, byteCount(input.text),
+           lineCount(input.text), result);
+  }
+}
+}
+
+// Counts allocations in the process
+void* operator new(std::size_t size) {
+  s_allocationCount++;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
 
-  const QVector<QString> files({"testdata/C.tmLanguage", "testdata/C++.tmLanguage"});
+int main(int argc, char** argv) {
+  // run without a display
+  if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  }
+  QApplication app(argc, argv);
 
-  foreach (QString fn, files) { LanguageProvider::loadLanguage(fn); }
+  QCommandLineParser cmdParser;
+  cmdParser.setApplicationDescription(
+      "Syntax highlighting benchmark. Writes a JSON object per measurement in a line.");
+  cmdParser.addHelpOption();
+  QCommandLineOption dataDirOption("data", "Directory of the test data.", "dir", TESTDATA_DIR);
+  QCommandLineOption iterationsOption("iterations", "Iterations of each benchmark.", "n", "5");
+  QCommandLineOption outputOption("output", "Output file. Standard output by default.", "file");
+  cmdParser.addOptions({dataDirOption, iterationsOption, outputOption});
+  cmdParser.process(app);
 
-  QFile file("testdata/syntaxHighlightBenchmark.cpp");
-  file.open(QIODevice::ReadOnly | QIODevice::Text);
-  QTextStream in(&file);
+  const QString dataDir = cmdParser.value(dataDirOption);
+  const int iterations = qMax(1, cmdParser.value(iterationsOption).toInt());
+  QFile out;
+  if (cmdParser.isSet(outputOption)) {
+    out.setFileName(cmdParser.value(outputOption));
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qCritical("unable to open %s", qPrintable(out.fileName()));
+      return 1;
+    }
+  } else {
+    out.open(stdout, QIODevice::WriteOnly);
+  }
 
-  QTextDocument* doc = new QTextDocument(in.readAll());
-  LanguageParser* parser = LanguageParser::create("source.c++", doc->toPlainText());
-  Session::singleton().setTheme(theme);
-  QTime t;
-  t.start();
-  new SyntaxHighlighter(doc, parser);
-  qDebug("elapsed: %d ms", t.elapsed());
+  benchmarkGrammarLoad(&out, dataDir, iterations);
+  for (const auto& input : loadInputs(dataDir)) {
+    benchmarkParse(&out, input, iterations);
+    benchmarkReparse(&out, input, iterations);
+    benchmarkThemeFormat(&out, dataDir, input, iterations);
+    benchmarkHighlightBlock(&out, dataDir, input, iterations);
+    benchmarkFind(&out, input, iterations);
+  }
+  return 0;
 }
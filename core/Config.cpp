@@ -37,6 +37,13 @@ const QString& SHOW_INVISIBLES_KEY = QStringLiteral("show_invisibles");
 const QString& SHOW_TABS_AND_SPACES_KEY = QStringLiteral("show_tabs_and_spaces");
 const QString& WORD_WRAP_KEY = QStringLiteral("word_wrap");
 const QString& SHOW_TOOLBAR_KEY = QStringLiteral("show_toolbar");
+// in MB. A file larger than this is loaded progressively without syntax highlighting
+const QString& LARGE_FILE_SIZE_KEY = QStringLiteral("large_file_size");
+// in characters. A longer line is not highlighted. 0 means no limit
+const QString& MAX_HIGHLIGHTED_LINE_LENGTH_KEY = QStringLiteral("max_highlighted_line_length");
+// comma separated glob patterns
+const QString& FIND_IN_FILES_EXCLUDE_PATTERNS_KEY =
+    QStringLiteral("find_in_files_exclude_patterns");
 
 const QString& DEFAULT_THEME_NAME = QStringLiteral("Tomorrow");
 
@@ -55,6 +62,9 @@ void initKeyTypeHash() {
   keyTypeHashForBuiltinConfigs[SHOW_TABS_AND_SPACES_KEY] = QVariant::Bool;
   keyTypeHashForBuiltinConfigs[WORD_WRAP_KEY] = QVariant::Bool;
   keyTypeHashForBuiltinConfigs[SHOW_TOOLBAR_KEY] = QVariant::Bool;
+  keyTypeHashForBuiltinConfigs[LARGE_FILE_SIZE_KEY] = QVariant::Int;
+  keyTypeHashForBuiltinConfigs[MAX_HIGHLIGHTED_LINE_LENGTH_KEY] = QVariant::Int;
+  keyTypeHashForBuiltinConfigs[FIND_IN_FILES_EXCLUDE_PATTERNS_KEY] = QVariant::String;
 }
 }
 
@@ -152,6 +162,10 @@ void Config::init() {
   s_defaultValueMap.insert(SHOW_TABS_AND_SPACES_KEY, false);
   s_defaultValueMap.insert(WORD_WRAP_KEY, true);
   s_defaultValueMap.insert(SHOW_TOOLBAR_KEY, true);
+  s_defaultValueMap.insert(LARGE_FILE_SIZE_KEY, 10);
+  s_defaultValueMap.insert(MAX_HIGHLIGHTED_LINE_LENGTH_KEY, 20000);
+  s_defaultValueMap.insert(FIND_IN_FILES_EXCLUDE_PATTERNS_KEY,
+                           QStringLiteral(".git/, .hg/, .svn/, node_modules/, *.o, *.obj, *.pyc"));
 
   load();
 
@@ -359,6 +373,25 @@ bool Config::showToolbar() {
   return get(SHOW_TOOLBAR_KEY, defaultValue(SHOW_TOOLBAR_KEY).toBool());
 }
 
+qint64 Config::largeFileSize() {
+  return qint64(get(LARGE_FILE_SIZE_KEY, defaultValue(LARGE_FILE_SIZE_KEY).toInt())) * 1024 * 1024;
+}
+
+int Config::maxHighlightedLineLength() {
+  return get(MAX_HIGHLIGHTED_LINE_LENGTH_KEY,
+             defaultValue(MAX_HIGHLIGHTED_LINE_LENGTH_KEY).toInt());
+}
+
+QStringList Config::findInFilesExcludePatterns() {
+  const QString patterns = get(FIND_IN_FILES_EXCLUDE_PATTERNS_KEY,
+                               defaultValue(FIND_IN_FILES_EXCLUDE_PATTERNS_KEY).toString());
+  QStringList result;
+  for (const auto& pattern : patterns.split(',', QString::SkipEmptyParts)) {
+    result.append(pattern.trimmed());
+  }
+  return result;
+}
+
 Config::Config() : m_theme(nullptr) {}
 
 void Config::load() {
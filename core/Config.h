@@ -8,6 +8,7 @@
 #include <QFontMetrics>
 #include <QFile>
 #include <QString>
+#include <QStringList>
 #include <QObject>
 #include <QFont>
 #include <QDebug>
@@ -67,6 +68,15 @@ class Config : public QObject, public Singleton<Config> {
 
   bool showToolbar();
 
+  // in bytes
+  qint64 largeFileSize();
+
+  // in characters. 0 means no limit
+  int maxHighlightedLineLength();
+
+  // comma separated glob patterns of files and directories which Find in Files skips
+  QStringList findInFilesExcludePatterns();
+
   void init();
   bool contains(const QString& key);
   void addPackageConfigDefinition(const core::ConfigDefinition& def);
@@ -113,6 +113,10 @@ QString Constants::sessionPath() {
   return QStandardPaths::standardLocations(QStandardPaths::AppDataLocation)[0] + "/session.ini";
 }
 
+QString Constants::grammarCachePath() const {
+  return silkHomePath() + "/cache/grammars";
+}
+
 QStringList Constants::themePaths() {
   QStringList themePaths;
   foreach (const QString& path, dataDirectoryPaths()) { themePaths.append(path + "/themes"); }
@@ -35,6 +35,7 @@ class Constants : public QObject, public core::Singleton<Constants> {
   QString silkHomePath() const;
   QString recentOpenHistoryPath();
   QString sessionPath();
+  QString grammarCachePath() const;
   QStringList themePaths();
   QStringList packagesPaths();
   QString userRootPackageJsonPath() const;
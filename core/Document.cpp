@@ -2,8 +2,11 @@
 #include <tuple>
 #include <QPlainTextDocumentLayout>
 #include <QTextCodec>
+#include <QTextCursor>
 #include <QDir>
+#include <QFileInfo>
 #include <QSettings>
+#include <QTimer>
 #include <QUuid>
 
 #include "Document.h"
@@ -54,8 +57,95 @@ boost::optional<std::tuple<QString, QString, BOM>> load(const QString& path,
   const BOM& bom = BOM::guessBOM(contentBytes);
   return std::make_tuple(text, LineSeparator::guess(text).separatorStr(), bom);
 }
+
+bool isLargeFile(const QString& path) {
+  return QFileInfo(path).size() > Config::singleton().largeFileSize();
+}
 }
 
+// Decodes a memory mapped file in chunks, so that a large file is neither read into a byte array
+// nor decoded at once. Encoding, BOM and line separator are guessed from a prefix of the file.
+class DocumentLoader {
+  DISABLE_COPY(DocumentLoader)
+
+ public:
+  static const int PREFIX_SIZE = 256 * 1024;
+  static const int CHUNK_SIZE = 4 * 1024 * 1024;
+
+  static std::unique_ptr<DocumentLoader> open(const QString& path,
+                                              const boost::optional<Encoding>& encoding) {
+    std::unique_ptr<QFile> file(new QFile(path));
+    if (!file->open(QIODevice::ReadOnly)) {
+      return nullptr;
+    }
+
+    const qint64 size = file->size();
+    uchar* data = size > 0 ? file->map(0, size) : nullptr;
+    if (size > 0 && !data) {
+      qWarning("failed to map %s", qPrintable(path));
+      return nullptr;
+    }
+
+    const QByteArray prefix = QByteArray::fromRawData(reinterpret_cast<const char*>(data),
+                                                      int(qMin<qint64>(size, PREFIX_SIZE)));
+    const Encoding& guessedEncoding = encoding ? *encoding : Encoding::guessEncoding(prefix);
+    const QString& separator =
+        LineSeparator::guess(guessedEncoding.codec()->toUnicode(prefix)).separatorStr();
+    return std::unique_ptr<DocumentLoader>(new DocumentLoader(
+        std::move(file), data, size, guessedEncoding, separator, BOM::guessBOM(prefix)));
+  }
+
+  // QFile unmaps the file when it's destroyed
+  ~DocumentLoader() = default;
+
+  Encoding encoding() const { return m_encoding; }
+  QString lineSeparator() const { return m_lineSeparator; }
+  BOM bom() const { return m_bom; }
+  bool atEnd() const { return m_pos >= m_size; }
+  int progress() const { return m_size > 0 ? int(m_pos * 100 / m_size) : 100; }
+
+  QString read() {
+    const int length = int(qMin<qint64>(CHUNK_SIZE, m_size - m_pos));
+    // QTextDecoder keeps a multibyte character split by chunks
+    QString text =
+        m_pending + m_decoder->toUnicode(reinterpret_cast<const char*>(m_data + m_pos), length);
+    m_pos += length;
+    m_pending.clear();
+    // \r\n split by chunks must be inserted at once to be one line separator
+    if (!atEnd() && text.endsWith('\r')) {
+      text.chop(1);
+      m_pending = QStringLiteral("\r");
+    }
+    return text;
+  }
+
+ private:
+  std::unique_ptr<QFile> m_file;
+  const uchar* m_data;
+  qint64 m_size;
+  qint64 m_pos;
+  Encoding m_encoding;
+  QString m_lineSeparator;
+  BOM m_bom;
+  std::unique_ptr<QTextDecoder> m_decoder;
+  QString m_pending;
+
+  DocumentLoader(std::unique_ptr<QFile> file,
+                 const uchar* data,
+                 qint64 size,
+                 const Encoding& encoding,
+                 const QString& lineSeparator,
+                 const BOM& bom)
+      : m_file(std::move(file)),
+        m_data(data),
+        m_size(size),
+        m_pos(0),
+        m_encoding(encoding),
+        m_lineSeparator(lineSeparator),
+        m_bom(bom),
+        m_decoder(encoding.codec()->makeDecoder()) {}
+};
+
 const QString Document::SETTINGS_PREFIX = QStringLiteral("Document");
 
 Document::Document(const QString& path,
@@ -63,13 +153,16 @@ Document::Document(const QString& path,
                    const Encoding& encoding,
                    const QString& separator,
                    const BOM& bom,
-                   Language* lang)
+                   Language* lang,
+                   bool highlights)
     : QTextDocument(text),
       m_path(path),
+      m_lang(nullptr),
       m_encoding(encoding),
       m_lineSeparator(separator),
       m_bom(bom),
-      m_syntaxHighlighter(nullptr) {
+      m_syntaxHighlighter(nullptr),
+      m_visibleViewCount(0) {
   init();
 
   int from = 0, dotPos = -1;
@@ -79,7 +172,6 @@ Document::Document(const QString& path,
     if (dotPos >= 0) {
       const QString& ext = path.mid(dotPos + 1);
       qDebug() << "ext:" << ext;
-      // todo: support firstLineMatch
       lang = LanguageProvider::languageFromExtension(ext);
       if (!lang) {
         from = dotPos + 1;
@@ -87,6 +179,9 @@ Document::Document(const QString& path,
     } else {
       const auto& filename = path.mid(path.lastIndexOf('/') + 1);
       lang = LanguageProvider::languageFromExtension(filename);
+      if (!lang) {
+        lang = LanguageProvider::languageFromFirstLine(text.left(text.indexOf('\n')));
+      }
       if (!lang) {
         lang = LanguageProvider::defaultLanguage();
         Q_ASSERT(lang);
@@ -95,7 +190,11 @@ Document::Document(const QString& path,
   }
 
   Q_ASSERT(lang);
-  setupSyntaxHighlighter(std::unique_ptr<Language>(lang), toPlainText());
+  if (highlights) {
+    setupSyntaxHighlighter(lang, toPlainText());
+  } else {
+    m_lang = lang;
+  }
   setTabWidth();
 
   // QTextDocument(text) sets modified true, so set it false again
@@ -132,7 +231,7 @@ void Document::saveState(QSettings& settings) {
 void Document::setTabWidth() {
   QString scopeName = m_lang ? m_lang->scopeName : "";
   m_tabWidthKey = Config::singleton().tabWidthKey(scopeName);
-  setTabWidth(tabWidth(m_lang.get()));
+  setTabWidth(tabWidth(m_lang));
 }
 
 void Document::setTabWidth(int tabWidth) {
@@ -178,12 +277,14 @@ void Document::init() {
 }
 
 Document::Document()
-    : m_encoding(Encoding::defaultEncoding()),
+    : m_lang(nullptr),
+      m_encoding(Encoding::defaultEncoding()),
       m_lineSeparator(LineSeparator::defaultLineSeparator().separatorStr()),
       m_bom(BOM::defaultBOM()),
-      m_syntaxHighlighter(nullptr) {
+      m_syntaxHighlighter(nullptr),
+      m_visibleViewCount(0) {
   init();
-  setupSyntaxHighlighter(std::unique_ptr<Language>(LanguageProvider::defaultLanguage()));
+  setupSyntaxHighlighter(LanguageProvider::defaultLanguage());
 }
 
 void Document::setupLayout() {
@@ -191,10 +292,13 @@ void Document::setupLayout() {
   setDocumentLayout(layout);
 }
 
-void Document::setupSyntaxHighlighter(std::unique_ptr<Language> lang, const QString& text) {
-  m_lang = std::move(lang);
+void Document::setupSyntaxHighlighter(Language* lang, const QString& text) {
+  m_lang = lang;
   if (m_lang) {
     std::unique_ptr<LanguageParser> parser(LanguageParser::create(m_lang->scopeName, text));
+    if (parser) {
+      parser->setMaxLineLength(Config::singleton().maxHighlightedLineLength());
+    }
     m_syntaxHighlighter = new SyntaxHighlighter(
         this, std::move(parser), Config::singleton().theme(), Config::singleton().font());
     connect(m_syntaxHighlighter, &SyntaxHighlighter::parseFinished, this, &Document::parseFinished);
@@ -210,6 +314,10 @@ Document::~Document() {
 
 Document* Document::create(const QString& path) {
   //  qDebug() << "Docment::create" << "path" << path;
+  if (isLargeFile(path)) {
+    return createLarge(path);
+  }
+
   if (const boost::optional<std::tuple<QString, Encoding, QString, BOM>> textAndEncAndSeparator =
           load(path)) {
     return new Document(path, std::get<0>(*textAndEncAndSeparator),
@@ -319,6 +427,67 @@ Document* Document::createBlank() {
   return new Document();
 }
 
+Document* Document::createLarge(const QString& path) {
+  qDebug("loading a large file: %s", qPrintable(path));
+  std::unique_ptr<DocumentLoader> loader = DocumentLoader::open(path, boost::none);
+  if (!loader) {
+    return nullptr;
+  }
+
+  // Syntax highlighting is off because parsing a large file takes too long
+  auto doc = new Document(path, "", loader->encoding(), loader->lineSeparator(), loader->bom(),
+                          nullptr, false);
+  doc->startLoading(std::move(loader));
+  return doc;
+}
+
+// Text is inserted chunk by chunk from the event loop, so the window stays responsive while a
+// large file is loaded.
+void Document::startLoading(std::unique_ptr<DocumentLoader> loader) {
+  m_loader = std::move(loader);
+  setUndoRedoEnabled(false);
+  QTimer::singleShot(0, this, [this] { loadNextChunk(); });
+}
+
+void Document::loadNextChunk() {
+  if (!m_loader) {
+    return;
+  }
+
+  QTextCursor cursor(this);
+  cursor.movePosition(QTextCursor::End);
+  cursor.insertText(m_loader->read());
+  emit loadProgressed(m_loader->progress());
+
+  if (m_loader->atEnd()) {
+    m_loader.reset();
+    setUndoRedoEnabled(true);
+    setModified(false);
+    emit loadFinished();
+  } else {
+    QTimer::singleShot(0, this, [this] { loadNextChunk(); });
+  }
+}
+
+bool Document::reloadLarge(const boost::optional<Encoding>& encoding) {
+  std::unique_ptr<DocumentLoader> loader = DocumentLoader::open(m_path, encoding);
+  if (!loader) {
+    return false;
+  }
+
+  // Syntax highlighting is off for a large file even if the file was small when it was opened.
+  // Deleting the highlighter removes its requests from ParseScheduler.
+  delete m_syntaxHighlighter;
+  m_syntaxHighlighter = nullptr;
+
+  clear();
+  setEncoding(loader->encoding());
+  setLineSeparator(loader->lineSeparator());
+  setBOM(loader->bom());
+  startLoading(std::move(loader));
+  return true;
+}
+
 void Document::setPath(const QString& path) {
   if (m_path != path) {
     auto oldPath = m_path;
@@ -331,14 +500,15 @@ void Document::setPath(const QString& path) {
 void Document::setLanguage(const QString& scopeName) {
   qDebug("setLanguage: %s", qPrintable(scopeName));
   Language* newLang = LanguageProvider::languageFromScope(scopeName);
-  if (m_lang.get() == newLang || (m_lang && newLang && *m_lang == *newLang)) {
+  if (m_lang == newLang || (m_lang && newLang && *m_lang == *newLang)) {
     qDebug("lang is already %s", qPrintable(scopeName));
     return;
   }
 
-  m_lang.reset(newLang);
+  m_lang = newLang;
   if (m_lang && m_syntaxHighlighter) {
     if (LanguageParser* parser = LanguageParser::create(m_lang->scopeName, toPlainText())) {
+      parser->setMaxLineLength(Config::singleton().maxHighlightedLineLength());
       m_syntaxHighlighter->setParser(*parser);
     }
   }
@@ -371,11 +541,16 @@ void Document::setBOM(const BOM& bom) {
 }
 
 std::unique_ptr<Regexp> Document::createRegexp(const QString& subString,
-                                               Document::FindFlags options) const {
+                                               Document::FindFlags options) {
   bool isCaseSensitive = options & FindFlag::FindCaseSensitively;
   bool isRegex = options & FindFlag::FindRegex;
   bool isWholeWord = options & FindFlag::FindWholeWords;
 
+  // Plain text is found by LiteralSearcher without a regex search
+  if (!isRegex && !isWholeWord) {
+    return Regexp::compileLiteral(subString, isCaseSensitive);
+  }
+
   QString str = isRegex ? subString : Regexp::escape(subString);
 
   if (isWholeWord) {
@@ -431,15 +606,12 @@ QVector<Region> Document::findAll(const Regexp* expr, int begin, int end) const
   }
 
   qDebug("findAll: %s, begin: %d, end: %d", qPrintable(expr->pattern()), begin, end);
-  auto indicesList = expr->findAllStringSubmatchIndex(toPlainText(), begin, end);
-  QVector<Region> regions(indicesList.size());
-  if (!indicesList.isEmpty()) {
-    std::transform(indicesList.begin(), indicesList.end(), regions.begin(),
-                   [=](QVector<int> indices) { return Region(indices[0], indices[1]); });
-    return regions;
-  }
-
-  return QVector<Region>();
+  QVector<Region> regions;
+  expr->forEachMatch(toPlainText(), begin, end, [&](const Region& region) {
+    regions.append(region);
+    return true;
+  });
+  return regions;
 }
 
 boost::optional<Region> Document::find(const Regexp* expr,
@@ -475,7 +647,33 @@ QString Document::scopeTree() const {
   return m_syntaxHighlighter ? m_syntaxHighlighter->scopeTree() : "";
 }
 
+void Document::addVisibleView() {
+  m_visibleViewCount++;
+  if (m_visibleViewCount == 1 && m_syntaxHighlighter) {
+    m_syntaxHighlighter->setVisible(true);
+  }
+}
+
+void Document::removeVisibleView() {
+  Q_ASSERT(m_visibleViewCount > 0);
+  m_visibleViewCount--;
+  if (m_visibleViewCount == 0 && m_syntaxHighlighter) {
+    m_syntaxHighlighter->setVisible(false);
+  }
+}
+
+void Document::setVisibleRegion(const Region& region) {
+  if (m_syntaxHighlighter) {
+    m_syntaxHighlighter->setVisibleRegion(region);
+  }
+}
+
 void Document::reload() {
+  if (isLargeFile(m_path)) {
+    reloadLarge(boost::none);
+    return;
+  }
+
   if (const boost::optional<std::tuple<QString, Encoding, QString, BOM>>
           textAndEncAndSeparatorAndBOM = load(m_path)) {
     setPlainText(std::get<0>(*textAndEncAndSeparatorAndBOM));
@@ -488,6 +686,11 @@ void Document::reload() {
 }
 
 void Document::reload(const Encoding& encoding) {
+  if (isLargeFile(m_path)) {
+    reloadLarge(encoding);
+    return;
+  }
+
   if (const boost::optional<std::tuple<QString, QString, BOM>> textAndSeparatorAndBOM =
           load(m_path, encoding)) {
     setPlainText(std::get<0>(*textAndSeparatorAndBOM));
@@ -15,6 +15,7 @@ namespace core {
 struct Language;
 class Regexp;
 class SyntaxHighlighter;
+class DocumentLoader;
 
 class Document : public QTextDocument {
   Q_OBJECT
@@ -33,8 +34,11 @@ class Document : public QTextDocument {
   static const QString SETTINGS_PREFIX;
 
   static Document* createBlank();
+  // Returns a regexp to find subString with options. Returns nullptr if it's invalid.
+  static std::unique_ptr<Regexp> createRegexp(const QString& subString, FindFlags options);
 
   // Don't call these except DocumentManager
+  // A file larger than Config::largeFileSize is loaded progressively without syntax highlighting.
   static Document* create(const QString& path = "");
   // may throw a runtime_error
   static Document* create(QSettings& settings);
@@ -45,7 +49,7 @@ class Document : public QTextDocument {
   QString path() { return m_path; }
   void setPath(const QString& path);
 
-  Language* language() { return m_lang.get(); }
+  Language* language() { return m_lang; }
   void setLanguage(const QString& scopeName);
 
   Encoding encoding() { return m_encoding; }
@@ -57,6 +61,9 @@ class Document : public QTextDocument {
   BOM bom() { return m_bom; }
   void setBOM(const BOM& bom);
 
+  // true while a large file is being loaded. The document is incomplete until loadFinished.
+  bool isLoading() const { return m_loader != nullptr; }
+
   boost::optional<Region> find(const QString& subString,
                                int from = 0,
                                int begin = 0,
@@ -79,6 +86,12 @@ class Document : public QTextDocument {
   QString scopeName(int pos) const;
   QString scopeTree() const;
 
+  // Called by views when they show or hide this document. A visible document is parsed first.
+  void addVisibleView();
+  void removeVisibleView();
+  // Called by views when they paint. The visible region of a large document is highlighted first.
+  void setVisibleRegion(const Region& region);
+
   /**
    * @brief reload from a local file and guess its encoding
    */
@@ -100,6 +113,8 @@ class Document : public QTextDocument {
   void lineSeparatorChanged(const QString& lineSeparator);
   void bomChanged(const BOM& bom);
   void parseFinished();
+  void loadProgressed(int percent);
+  void loadFinished();
 
   // private signals
   void destroying(const QString& path, QPrivateSignal);
@@ -112,25 +127,32 @@ class Document : public QTextDocument {
   friend class DocumentTest;
 
   QString m_path;
-  std::unique_ptr<Language> m_lang;
+  // owned by LanguageProvider
+  Language* m_lang;
   Encoding m_encoding;
   QString m_lineSeparator;
   BOM m_bom;
   SyntaxHighlighter* m_syntaxHighlighter;
   QString m_tabWidthKey;
+  int m_visibleViewCount;
+  std::unique_ptr<DocumentLoader> m_loader;
 
   Document(const QString& path,
            const QString& text,
            const Encoding& encoding,
            const QString& separator,
            const BOM& bom,
-           Language* lang = nullptr);
+           Language* lang = nullptr,
+           bool highlights = true);
   Document();
 
+  static Document* createLarge(const QString& path);
+  void startLoading(std::unique_ptr<DocumentLoader> loader);
+  void loadNextChunk();
+  bool reloadLarge(const boost::optional<Encoding>& encoding);
   void setupLayout();
-  void setupSyntaxHighlighter(std::unique_ptr<Language> lang, const QString& text = "");
+  void setupSyntaxHighlighter(Language* lang, const QString& text = "");
   void init();
-  std::unique_ptr<Regexp> createRegexp(const QString& subString, Document::FindFlags options) const;
   void setShowTabsAndSpaces(bool showTabsAndSpaces);
   void setTabWidth(int tabWidth);
   void setTabWidth();
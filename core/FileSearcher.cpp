@@ -0,0 +1,345 @@
+#include <cstring>
+#include <QByteArrayMatcher>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QTextCodec>
+#include <QTextStream>
+
+#include "FileSearcher.h"
+#include "Encoding.h"
+#include "Regexp.h"
+
+namespace core {
+
+namespace {
+
+// Files are searched in batches of this number to keep the overhead of tasks low
+constexpr int FILE_BATCH_SIZE = 32;
+// A file which has NUL in its first bytes is regarded as binary like git does
+constexpr int BINARY_CHECK_SIZE = 8000;
+// The encoding of a file is guessed from its prefix of this size like DocumentLoader does
+constexpr int ENCODING_CHECK_SIZE = 256 * 1024;
+// Larger files are skipped because they are too large to decode into a QString at once
+constexpr qint64 MAX_FILE_SIZE = 128 * 1024 * 1024;
+// Longer lines are cut in results
+constexpr int MAX_LINE_TEXT_LENGTH = 500;
+
+// What a find searches, shared by the tasks of the find
+struct SearchContext {
+  FileSearcher* searcher;
+  int findId;
+  std::shared_ptr<QAtomicInt> canceled;
+  QHash<QString, QString> buffers;
+  // Plain text without FindWholeWords is found by LiteralSearcher in it
+  std::unique_ptr<Regexp> regexp;
+  // Plain case sensitive text can't match a UTF-8 file which doesn't contain its UTF-8 bytes, so
+  // such a file is skipped without decoding it
+  std::unique_ptr<QByteArrayMatcher> bytesMatcher;
+  // running tasks and the walk. The last one to finish notifies findDone.
+  QAtomicInt pendingCount;
+  QAtomicInt fileCount;
+};
+
+QVector<FileMatch> searchText(const SearchContext& context, const QString& text) {
+  QVector<FileMatch> matches;
+  const QChar* data = text.constData();
+  // line and its start position of scannedPos
+  int line = 0;
+  int lineStart = 0;
+  int scannedPos = 0;
+  context.regexp->forEachMatch(text, 0, text.size(), [&](const Region& region) {
+    if (context.canceled->load() || matches.size() >= FileSearcher::MAX_MATCHES_PER_FILE) {
+      return false;
+    }
+
+    const int begin = region.begin();
+    for (; scannedPos < begin; scannedPos++) {
+      if (data[scannedPos] == QLatin1Char('\n')) {
+        line++;
+        lineStart = scannedPos + 1;
+      }
+    }
+    int lineEnd = text.indexOf(QLatin1Char('\n'), begin);
+    if (lineEnd < 0) {
+      lineEnd = text.size();
+    }
+    if (lineEnd > lineStart && data[lineEnd - 1] == QLatin1Char('\r')) {
+      lineEnd--;
+    }
+    const int length = qMax(0, qMin(region.end(), lineEnd) - begin);
+    const QString lineText = text.mid(lineStart, qMin(lineEnd - lineStart, MAX_LINE_TEXT_LENGTH));
+    matches.append(FileMatch{line, begin - lineStart, length, lineText});
+    return true;
+  });
+  return matches;
+}
+
+// Searches a file on disk through a memory mapped view of it
+QVector<FileMatch> searchFile(const SearchContext& context, const QString& path) {
+  QFile file(path);
+  const qint64 size = file.size();
+  if (size == 0 || size > MAX_FILE_SIZE || !file.open(QIODevice::ReadOnly)) {
+    return QVector<FileMatch>();
+  }
+  // QFile unmaps the file when it's destroyed
+  const char* data = reinterpret_cast<const char*>(file.map(0, size));
+  if (!data) {
+    qWarning("failed to map %s", qPrintable(path));
+    return QVector<FileMatch>();
+  }
+
+  if (std::memchr(data, '\0', qMin<qint64>(size, BINARY_CHECK_SIZE))) {
+    return QVector<FileMatch>();
+  }
+  const Encoding encoding = Encoding::guessEncoding(
+      QByteArray::fromRawData(data, static_cast<int>(qMin<qint64>(size, ENCODING_CHECK_SIZE))));
+  if (encoding != Encoding::defaultEncoding()) {
+    QTextCodec* codec = encoding.codec();
+    return codec ? searchText(context, codec->toUnicode(data, static_cast<int>(size)))
+                 : QVector<FileMatch>();
+  }
+  if (context.bytesMatcher && context.bytesMatcher->indexIn(data, static_cast<int>(size)) < 0) {
+    return QVector<FileMatch>();
+  }
+  return searchText(context, QString::fromUtf8(data, static_cast<int>(size)));
+}
+
+// Whether segments[i..] of a pattern match names[j..] of a path
+bool matchesSegments(const QVector<QRegExp>& segments, int i, const QStringList& names, int j) {
+  for (; i < segments.size(); i++, j++) {
+    if (segments[i].isEmpty()) {
+      // ** matches zero or more names
+      for (int k = j; k <= names.size(); k++) {
+        if (matchesSegments(segments, i + 1, names, k)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    if (j >= names.size() || !segments[i].exactMatch(names[j])) {
+      return false;
+    }
+  }
+  return j == names.size();
+}
+
+// Called by each task and the walk when it ends
+void release(SearchContext* context) {
+  if (!context->pendingCount.deref() && !context->canceled->load()) {
+    QMetaObject::invokeMethod(context->searcher, "findDone", Qt::QueuedConnection,
+                              Q_ARG(int, context->findId),
+                              Q_ARG(int, context->fileCount.load()));
+  }
+}
+
+// Searches a batch of files and sends the matches of each file back to FileSearcher
+class SearchTask : public QRunnable {
+ public:
+  SearchTask(std::shared_ptr<SearchContext> context, const QStringList& paths)
+      : m_context(context), m_paths(paths) {
+    m_context->pendingCount.ref();
+  }
+
+  void run() override {
+    for (const auto& path : m_paths) {
+      if (m_context->canceled->load()) {
+        break;
+      }
+
+      auto it = m_context->buffers.constFind(path);
+      const QVector<FileMatch> matches = it != m_context->buffers.constEnd()
+                                             ? searchText(*m_context, *it)
+                                             : searchFile(*m_context, path);
+      m_context->fileCount.ref();
+      if (!matches.isEmpty() && !m_context->canceled->load()) {
+        QMetaObject::invokeMethod(m_context->searcher, "fileDone", Qt::QueuedConnection,
+                                  Q_ARG(int, m_context->findId), Q_ARG(QString, path),
+                                  Q_ARG(QVector<FileMatch>, matches));
+      }
+    }
+    release(m_context.get());
+  }
+
+ private:
+  std::shared_ptr<SearchContext> m_context;
+  QStringList m_paths;
+};
+
+// Walks a directory and starts SearchTasks for the files which aren't ignored
+class WalkTask : public QRunnable {
+ public:
+  WalkTask(std::shared_ptr<SearchContext> context,
+           QThreadPool* pool,
+           const QString& dirPath,
+           const IgnorePatterns& ignorePatterns)
+      : m_context(context),
+        m_pool(pool),
+        m_dir(QDir(dirPath).absolutePath()),
+        m_ignorePatterns(ignorePatterns) {
+    m_context->pendingCount.ref();
+  }
+
+  void run() override {
+    QStringList batch;
+    QStringList dirs{m_dir.absolutePath()};
+    while (!dirs.isEmpty() && !m_context->canceled->load()) {
+      QDirIterator it(dirs.takeLast(),
+                      QDir::Files | QDir::Dirs | QDir::Hidden | QDir::NoDotAndDotDot);
+      while (it.hasNext() && !m_context->canceled->load()) {
+        const QString path = it.next();
+        const QFileInfo info = it.fileInfo();
+        // A symbolic link to a directory is skipped because it may make a cycle
+        const bool isDir = info.isDir();
+        if ((isDir && info.isSymLink()) ||
+            m_ignorePatterns.isIgnored(m_dir.relativeFilePath(path), isDir)) {
+          continue;
+        }
+
+        if (isDir) {
+          dirs.append(path);
+        } else {
+          batch.append(path);
+          if (batch.size() >= FILE_BATCH_SIZE) {
+            m_pool->start(new SearchTask(m_context, batch));
+            batch.clear();
+          }
+        }
+      }
+    }
+    if (!batch.isEmpty() && !m_context->canceled->load()) {
+      m_pool->start(new SearchTask(m_context, batch));
+    }
+    release(m_context.get());
+  }
+
+ private:
+  std::shared_ptr<SearchContext> m_context;
+  QThreadPool* m_pool;
+  QDir m_dir;
+  IgnorePatterns m_ignorePatterns;
+};
+}
+
+void IgnorePatterns::add(const QString& pattern) {
+  QString glob = pattern.trimmed();
+  if (glob.isEmpty() || glob.startsWith('#') || glob.startsWith('!')) {
+    return;
+  }
+
+  const bool matchesOnlyDir = glob.endsWith('/');
+  if (matchesOnlyDir) {
+    glob.chop(1);
+  }
+  const bool matchesPath = glob.contains('/');
+  if (glob.startsWith('/')) {
+    glob.remove(0, 1);
+  }
+  // QRegExp's * matches a slash, so each segment of a path is matched separately
+  QVector<QRegExp> segments;
+  for (const auto& segment : glob.split('/', QString::SkipEmptyParts)) {
+    segments.append(segment == "**" ? QRegExp()
+                                    : QRegExp(segment, Qt::CaseSensitive, QRegExp::WildcardUnix));
+  }
+  if (!segments.isEmpty()) {
+    m_patterns.append(Pattern{segments, matchesPath, matchesOnlyDir});
+  }
+}
+
+void IgnorePatterns::addGitignore(const QString& dirPath) {
+  QFile file(QDir(dirPath).filePath(".gitignore"));
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    return;
+  }
+
+  QTextStream in(&file);
+  while (!in.atEnd()) {
+    add(in.readLine());
+  }
+}
+
+bool IgnorePatterns::isIgnored(const QString& relativePath, bool isDir) const {
+  const QStringList names = relativePath.split('/', QString::SkipEmptyParts);
+  const QStringList lastName = names.mid(names.size() - 1);
+  for (const auto& pattern : m_patterns) {
+    if ((!pattern.matchesOnlyDir || isDir) &&
+        matchesSegments(pattern.segments, 0, pattern.matchesPath ? names : lastName, 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+FileSearcher::FileSearcher(QObject* parent)
+    : QObject(parent),
+      m_canceled(std::make_shared<QAtomicInt>(0)),
+      m_findId(0),
+      m_matchCount(0),
+      m_isRunning(false) {
+  qRegisterMetaType<QVector<core::FileMatch>>("QVector<FileMatch>");
+}
+
+FileSearcher::~FileSearcher() {
+  cancel();
+  m_pool.waitForDone();
+}
+
+bool FileSearcher::find(const QString& dirPath,
+                        const QString& text,
+                        Document::FindFlags flags,
+                        const IgnorePatterns& ignorePatterns,
+                        const QHash<QString, QString>& buffers) {
+  cancel();
+  if (text.isEmpty()) {
+    return false;
+  }
+
+  auto context = std::make_shared<SearchContext>();
+  context->regexp = Document::createRegexp(text, flags);
+  if (!context->regexp) {
+    return false;
+  }
+  if (!flags.testFlag(Document::FindFlag::FindRegex) &&
+      flags.testFlag(Document::FindFlag::FindCaseSensitively)) {
+    context->bytesMatcher.reset(new QByteArrayMatcher(text.toUtf8()));
+  }
+
+  m_canceled = std::make_shared<QAtomicInt>(0);
+  m_isRunning = true;
+  m_matchCount = 0;
+  context->searcher = this;
+  context->findId = ++m_findId;
+  context->canceled = m_canceled;
+  for (auto it = buffers.constBegin(); it != buffers.constEnd(); ++it) {
+    context->buffers.insert(QFileInfo(it.key()).absoluteFilePath(), it.value());
+  }
+  m_pool.start(new WalkTask(context, &m_pool, dirPath, ignorePatterns));
+  return true;
+}
+
+void FileSearcher::cancel() {
+  // Tasks which haven't started yet are removed, and running ones stop at their next file or match
+  m_pool.clear();
+  m_canceled->store(1);
+  m_isRunning = false;
+  // results of the canceled find which are already queued are ignored by their old id
+  ++m_findId;
+}
+
+void FileSearcher::fileDone(int findId, const QString& path, QVector<FileMatch> matches) {
+  if (findId == m_findId) {
+    m_matchCount += matches.size();
+    emit matchesFound(path, matches);
+  }
+}
+
+void FileSearcher::findDone(int findId, int fileCount) {
+  if (findId == m_findId) {
+    m_isRunning = false;
+    emit finished(fileCount, m_matchCount);
+  }
+}
+
+}  // namespace core
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <QAtomicInt>
+#include <QHash>
+#include <QObject>
+#include <QRegExp>
+#include <QThreadPool>
+#include <QVector>
+
+#include "macros.h"
+#include "Document.h"
+
+namespace core {
+
+// A match in a file found by FileSearcher
+struct FileMatch {
+  // 0 based line number, and the column and the length of the match in the line. A match over
+  // multiple lines is cut at the end of its first line.
+  int line;
+  int column;
+  int length;
+  QString lineText;
+};
+
+// Files and directories to skip, written in the glob syntax of .gitignore.
+// A pattern without a slash matches a name at any depth and a pattern with a slash matches a path
+// relative to the root. Wildcards in a path don't match a slash, but a ** segment matches any
+// number of directories. A pattern with a trailing slash matches only a directory. Negated
+// patterns (!) aren't supported.
+class IgnorePatterns {
+ public:
+  IgnorePatterns() = default;
+  ~IgnorePatterns() = default;
+  DEFAULT_COPY_AND_MOVE(IgnorePatterns)
+
+  void add(const QString& pattern);
+  // Adds the patterns in .gitignore in dirPath if it exists
+  void addGitignore(const QString& dirPath);
+  bool isIgnored(const QString& relativePath, bool isDir) const;
+
+ private:
+  struct Pattern {
+    // a segment of the path separated by slashes. An empty one is **.
+    QVector<QRegExp> segments;
+    bool matchesPath;
+    bool matchesOnlyDir;
+  };
+
+  QVector<Pattern> m_patterns;
+};
+
+// Finds a text in all the files under a directory. The directory is walked in a pool thread and
+// its files are searched in parallel by other pool threads. The matches of each file are notified
+// by matchesFound as soon as the file is searched. The encoding of a file is guessed in the same
+// way as Document does. Binary files, including ones in UTF-16 and UTF-32, are skipped.
+// A new find cancels the running one, and nothing of a canceled find is notified after it.
+// Call public methods only from the main thread.
+class FileSearcher : public QObject {
+  Q_OBJECT
+  DISABLE_COPY_AND_MOVE(FileSearcher)
+
+ public:
+  // Matches of a file after this are dropped
+  static const int MAX_MATCHES_PER_FILE = 1000;
+
+  explicit FileSearcher(QObject* parent = nullptr);
+  // Cancels the running find and waits for it
+  ~FileSearcher();
+
+  // Finds text with flags in the files under dirPath which aren't ignored. A file whose absolute
+  // path is in buffers is searched in its text in buffers instead of on disk, so a modified
+  // document is searched as it's shown. FindBackward and FindInSelection are ignored.
+  // Returns false if text is empty or an invalid regex.
+  bool find(const QString& dirPath,
+            const QString& text,
+            Document::FindFlags flags,
+            const IgnorePatterns& ignorePatterns,
+            const QHash<QString, QString>& buffers = QHash<QString, QString>());
+  void cancel();
+  bool isRunning() const { return m_isRunning; }
+
+ signals:
+  // path is absolute and matches are sorted
+  void matchesFound(const QString& path, QVector<FileMatch> matches);
+  // fileCount is the number of searched files
+  void finished(int fileCount, int matchCount);
+
+ private slots:
+  // called by pool threads through a queued connection
+  void fileDone(int findId, const QString& path, QVector<FileMatch> matches);
+  void findDone(int findId, int fileCount);
+
+ private:
+  QThreadPool m_pool;
+  // set to cancel the running tasks
+  std::shared_ptr<QAtomicInt> m_canceled;
+  int m_findId;
+  int m_matchCount;
+  bool m_isRunning;
+};
+
+}  // namespace core
+
+Q_DECLARE_METATYPE(core::FileMatch)
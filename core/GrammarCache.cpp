@@ -0,0 +1,199 @@
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include "GrammarCache.h"
+
+namespace {
+
+const quint32 MAGIC = 0x53454743;  // "SEGC"
+const QString INDEX_FILE_NAME = QStringLiteral("index.bin");
+const QString NAME_KEY = QStringLiteral("name");
+const QString SCOPE_NAME_KEY = QStringLiteral("scopeName");
+const QString FILE_TYPES_KEY = QStringLiteral("fileTypes");
+const QString FIRST_LINE_MATCH_KEY = QStringLiteral("firstLineMatch");
+const QString HIDE_FROM_USER_KEY = QStringLiteral("hideFromUser");
+
+void writeHeader(QDataStream& stream) {
+  stream << MAGIC << core::GrammarCache::VERSION;
+  stream.setVersion(QDataStream::Qt_5_6);
+}
+
+bool readHeader(QDataStream& stream) {
+  quint32 magic, version;
+  stream >> magic >> version;
+  stream.setVersion(QDataStream::Qt_5_6);
+  return stream.status() == QDataStream::Ok && magic == MAGIC &&
+         version == core::GrammarCache::VERSION;
+}
+
+bool isUpToDate(const core::GrammarCache::Entry& entry, const QFileInfo& info) {
+  return info.exists() && entry.lastModified == info.lastModified().toMSecsSinceEpoch() &&
+         entry.size == info.size();
+}
+}
+
+namespace core {
+
+// Increment this when the format or the grammar parsing changes
+const quint32 GrammarCache::VERSION = 1;
+
+GrammarCache::GrammarCache(const QString& dirPath) : m_dirPath(dirPath), m_changed(false) {
+  load();
+}
+
+boost::optional<GrammarCache::Entry> GrammarCache::entry(const QString& path) {
+  QMutexLocker locker(&m_mutex);
+  auto it = m_entries.constFind(path);
+  if (it == m_entries.constEnd() || !isUpToDate(it.value(), QFileInfo(path))) {
+    return boost::none;
+  }
+  return it.value();
+}
+
+QStringList GrammarCache::headerKeys() {
+  return QStringList{SCOPE_NAME_KEY, NAME_KEY, FILE_TYPES_KEY, FIRST_LINE_MATCH_KEY,
+                     HIDE_FROM_USER_KEY};
+}
+
+GrammarCache::Entry GrammarCache::makeEntry(const QString& path, const QVariantMap& header) {
+  const QFileInfo info(path);
+  Entry entry;
+  entry.scopeName = header.value(SCOPE_NAME_KEY).toString();
+  entry.name = header.value(NAME_KEY).toString();
+  entry.fileTypes = header.value(FILE_TYPES_KEY).toStringList();
+  entry.firstLineMatch = header.value(FIRST_LINE_MATCH_KEY).toString();
+  entry.hideFromUser = header.value(HIDE_FROM_USER_KEY).toBool();
+  entry.lastModified = info.lastModified().toMSecsSinceEpoch();
+  entry.size = info.size();
+  return entry;
+}
+
+GrammarCache::Entry GrammarCache::add(const QString& path, const QVariantMap& header) {
+  const Entry entry = makeEntry(path, header);
+  QMutexLocker locker(&m_mutex);
+  m_entries.insert(path, entry);
+  m_changed = true;
+  return entry;
+}
+
+bool GrammarCache::addGrammar(const QString& path, const QVariantMap& rootMap) {
+  const Entry entry = makeEntry(path, rootMap);
+
+  QMutexLocker locker(&m_mutex);
+  if (!QDir().mkpath(m_dirPath)) {
+    qWarning() << "failed to create" << m_dirPath;
+    return false;
+  }
+
+  QSaveFile file(grammarPath(path));
+  if (!file.open(QIODevice::WriteOnly)) {
+    qWarning() << "failed to open" << file.fileName();
+    return false;
+  }
+  QDataStream stream(&file);
+  writeHeader(stream);
+  stream << entry.lastModified << entry.size << rootMap;
+  if (stream.status() != QDataStream::Ok || !file.commit()) {
+    qWarning() << "failed to write" << file.fileName();
+    return false;
+  }
+
+  m_entries.insert(path, entry);
+  m_changed = true;
+  return true;
+}
+
+boost::optional<QVariantMap> GrammarCache::grammar(const QString& path) {
+  const auto cachedEntry = entry(path);
+  if (!cachedEntry) {
+    return boost::none;
+  }
+
+  QFile file(grammarPath(path));
+  if (!file.open(QIODevice::ReadOnly)) {
+    return boost::none;
+  }
+  QDataStream stream(&file);
+  if (!readHeader(stream)) {
+    return boost::none;
+  }
+  qint64 lastModified, size;
+  QVariantMap rootMap;
+  stream >> lastModified >> size >> rootMap;
+  if (stream.status() != QDataStream::Ok || lastModified != cachedEntry->lastModified ||
+      size != cachedEntry->size) {
+    return boost::none;
+  }
+  return rootMap;
+}
+
+bool GrammarCache::save() {
+  QMutexLocker locker(&m_mutex);
+  if (!m_changed) {
+    return true;
+  }
+  if (!QDir().mkpath(m_dirPath)) {
+    return false;
+  }
+
+  QSaveFile file(indexPath());
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  QDataStream stream(&file);
+  writeHeader(stream);
+  stream << quint32(m_entries.size());
+  for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+    const Entry& entry = it.value();
+    stream << it.key() << entry.scopeName << entry.name << entry.fileTypes << entry.firstLineMatch
+           << entry.hideFromUser << entry.lastModified << entry.size;
+  }
+  if (stream.status() != QDataStream::Ok || !file.commit()) {
+    return false;
+  }
+  m_changed = false;
+  return true;
+}
+
+QString GrammarCache::indexPath() const {
+  return m_dirPath + "/" + INDEX_FILE_NAME;
+}
+
+QString GrammarCache::grammarPath(const QString& path) const {
+  const QByteArray hash = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Md5);
+  return m_dirPath + "/" + QString::fromLatin1(hash.toHex()) + ".bin";
+}
+
+void GrammarCache::load() {
+  QFile file(indexPath());
+  if (!file.open(QIODevice::ReadOnly)) {
+    return;
+  }
+  QDataStream stream(&file);
+  if (!readHeader(stream)) {
+    qDebug() << "ignore the grammar cache of an old version";
+    return;
+  }
+
+  quint32 count;
+  stream >> count;
+  for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+    QString path;
+    Entry entry;
+    stream >> path >> entry.scopeName >> entry.name >> entry.fileTypes >> entry.firstLineMatch >>
+        entry.hideFromUser >> entry.lastModified >> entry.size;
+    m_entries.insert(path, entry);
+  }
+  if (stream.status() != QDataStream::Ok) {
+    qWarning() << "grammar cache is broken" << file.fileName();
+    m_entries.clear();
+  }
+}
+
+}  // namespace core
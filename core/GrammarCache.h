@@ -0,0 +1,66 @@
+#pragma once
+
+#include <boost/optional.hpp>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+#include "macros.h"
+
+namespace core {
+
+// Thread safe binary cache of grammar files (.tmLanguage) in a directory.
+// The index keeps what registering a grammar needs (scope name, file types and so on) keyed by the
+// path, modification time and size of the file, so startup only stats grammar files. The property
+// list of a grammar is stored with QDataStream once it's compiled, so its next use doesn't parse
+// XML.
+class GrammarCache {
+  DISABLE_COPY_AND_MOVE(GrammarCache)
+
+ public:
+  struct Entry {
+    QString scopeName;
+    QString name;
+    QStringList fileTypes;
+    QString firstLineMatch;
+    bool hideFromUser;
+    qint64 lastModified;
+    qint64 size;
+  };
+
+  static const quint32 VERSION;
+
+  // Top level keys of a grammar file an entry is made of
+  static QStringList headerKeys();
+  // Makes the entry of the grammar file at path from header (values of headerKeys)
+  static Entry makeEntry(const QString& path, const QVariantMap& header);
+
+  // Loads the index in dirPath. The directory is created when the cache is saved.
+  explicit GrammarCache(const QString& dirPath);
+  ~GrammarCache() = default;
+
+  // Returns the entry of path if it's cached and the file hasn't changed since then
+  boost::optional<Entry> entry(const QString& path);
+  // Indexes the grammar file at path with header (values of headerKeys) and returns its entry
+  Entry add(const QString& path, const QVariantMap& header);
+  // Caches rootMap parsed from the grammar file at path and indexes it. Returns false on failure.
+  bool addGrammar(const QString& path, const QVariantMap& rootMap);
+  // Returns the property list of the grammar at path if it's cached and up to date
+  boost::optional<QVariantMap> grammar(const QString& path);
+  // Writes the index if it has changed. Returns false on failure.
+  bool save();
+
+ private:
+  QString m_dirPath;
+  QMutex m_mutex;
+  QHash<QString, Entry> m_entries;
+  bool m_changed;
+
+  QString indexPath() const;
+  QString grammarPath(const QString& path) const;
+  void load();
+};
+
+}  // namespace core
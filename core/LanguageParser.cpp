@@ -8,10 +8,13 @@
 #include <QRegularExpression>
 #include <QFile>
 #include <QDir>
+#include <QElapsedTimer>
 
 #include "LanguageParser.h"
+#include "GrammarCache.h"
 #include "PListParser.h"
 #include "Regexp.h"
+#include "ScopeAtoms.h"
 
 namespace core {
 
@@ -22,26 +25,51 @@ const QString HIDE_FROM_USER_KEY = QStringLiteral("hideFromUser");
 const QString FILE_TYPES_KEY = QStringLiteral("fileTypes");
 const QString FIRST_LINE_MATCH_KEY = QStringLiteral("firstLineMatch");
 const QString SCOPE_NAME_KEY = QStringLiteral("scopeName");
+// Enough for the heredocs and raw strings being parsed in all the open documents
+const int REGEXP_CACHE_CAPACITY = 256;
 
 // Clamps v to be in the region of _min and _max
 int clamp(int min, int max, int v) {
   return qMax(min, qMin(max, v));
 }
 
-Captures toCaptures(QVariantMap map) {
+// Searches regex of pattern and counts the search while ParseProfiler is enabled
+boost::optional<MatchRegions> profiledFind(ParseState& state,
+                                           const Pattern* pattern,
+                                           Regex* regex,
+                                           const QString& str,
+                                           int beginPos,
+                                           int endPos = -1,
+                                           QList<QStringRef> capturedStrs = QList<QStringRef>()) {
+  if (!ParseProfiler::enabled()) {
+    return regex->find(str, beginPos, endPos, capturedStrs);
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  auto regions = regex->find(str, beginPos, endPos, capturedStrs);
+  PatternCounters& counters = state.counters(pattern);
+  counters.attempts++;
+  counters.nsecs += timer.nsecsElapsed();
+  counters.bytesScanned += ((endPos == -1 ? str.length() : endPos) - beginPos) * sizeof(QChar);
+  if (regions) {
+    counters.matches++;
+  }
+  return regions;
+}
+
+Captures toCaptures(const QVariantMap& map) {
   Captures captures(0);
   bool ok;
-  QMapIterator<QString, QVariant> i(map);
   static const QString nameStr = QStringLiteral("name");
 
-  while (i.hasNext()) {
-    i.next();
-    int key = i.key().toInt(&ok);
-    if (ok && i.value().canConvert<QVariantMap>()) {
-      QVariantMap subMap = i.value().toMap();
-      if (subMap.contains(nameStr)) {
-        QString name = subMap.value(nameStr).toString();
-        captures.append(Capture{key, name});
+  for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+    int key = it.key().toInt(&ok);
+    if (ok && it.value().type() == QVariant::Map) {
+      const QVariant nameVar = it.value().toMap().value(nameStr);
+      if (nameVar.isValid()) {
+        QString name = nameVar.toString();
+        captures.append(Capture{key, name, ScopeAtoms::singleton().intern(name)});
       }
     }
   }
@@ -51,14 +79,15 @@ Captures toCaptures(QVariantMap map) {
   return captures;
 }
 
-Pattern* toChildPattern(QVariantMap map, Pattern* parent, Language* lang);
+Pattern* toChildPattern(const QVariantMap& map, Pattern* parent, Language* lang);
 
-QVector<Pattern*>* toPatterns(QVariant patternsVar, Pattern* parent, Language* lang) {
-  if (patternsVar.canConvert<QVariantList>()) {
+QVector<Pattern*>* toPatterns(const QVariant& patternsVar, Pattern* parent, Language* lang) {
+  if (patternsVar.type() == QVariant::List) {
+    const QVariantList list = patternsVar.toList();
     QVector<Pattern*>* patterns = new QVector<Pattern*>(0);
-    QSequentialIterable iterable = patternsVar.value<QSequentialIterable>();
-    foreach (const QVariant& v, iterable) {
-      if (v.canConvert<QVariantMap>()) {
+    patterns->reserve(list.size());
+    for (const QVariant& v : list) {
+      if (v.type() == QVariant::Map) {
         patterns->append(toChildPattern(v.toMap(), parent, lang));
       }
     }
@@ -67,103 +96,103 @@ QVector<Pattern*>* toPatterns(QVariant patternsVar, Pattern* parent, Language* l
   return nullptr;
 }
 
-void toPattern(QVariantMap map, Pattern* pat, Language* lang) {
+// Each key is looked up once because an invalid QVariant means that the key doesn't exist.
+void toPattern(const QVariantMap& map, Pattern* pat, Language* lang) {
   // include
   static const QString include = QStringLiteral("include");
-  if (map.contains(include)) {
-    pat->include = map.value(include).toString();
+  const QVariant includeVar = map.value(include);
+  if (includeVar.isValid()) {
+    pat->include = includeVar.toString();
   }
 
   // match
   static const QString match = QStringLiteral("match");
-  if (map.contains(match)) {
-    pat->match.reset(new FixedRegex(map.value(match).toString()));
+  const QVariant matchVar = map.value(match);
+  if (matchVar.isValid()) {
+    pat->match.reset(new FixedRegex(matchVar.toString()));
   }
 
   // name
   static const QString name = QStringLiteral("name");
-  if (map.contains(name)) {
-    pat->name = map.value(name).toString().trimmed();
+  const QVariant nameVar = map.value(name);
+  if (nameVar.isValid()) {
+    pat->name = nameVar.toString().trimmed();
+    pat->nameAtom = ScopeAtoms::singleton().intern(pat->name);
   }
 
   // begin
   static const QString begin = QStringLiteral("begin");
-  if (map.contains(begin)) {
-    pat->begin.reset(new FixedRegex(map.value(begin).toString()));
+  const QVariant beginVar = map.value(begin);
+  if (beginVar.isValid()) {
+    pat->begin.reset(new FixedRegex(beginVar.toString()));
   }
 
   // beginCaptures
   static const QString beginCaptures = QStringLiteral("beginCaptures");
-  if (map.contains(beginCaptures)) {
-    QVariant beginCapturesVar = map.value(beginCaptures);
-    if (beginCapturesVar.canConvert<QVariantMap>()) {
-      pat->beginCaptures = toCaptures(beginCapturesVar.toMap());
-    }
+  const QVariant beginCapturesVar = map.value(beginCaptures);
+  if (beginCapturesVar.type() == QVariant::Map) {
+    pat->beginCaptures = toCaptures(beginCapturesVar.toMap());
   }
 
   // contentName
   static const QString contentName = QStringLiteral("contentName");
-  if (map.contains(contentName)) {
-    pat->contentName = map.value(contentName).toString().trimmed();
+  const QVariant contentNameVar = map.value(contentName);
+  if (contentNameVar.isValid()) {
+    pat->contentName = contentNameVar.toString().trimmed();
+    pat->contentNameAtom = ScopeAtoms::singleton().intern(pat->contentName);
   }
 
   // end
   static const QString end = QStringLiteral("end");
-  if (map.contains(end)) {
-    pat->end.reset(Regex::create(map.value(end).toString()));
+  const QVariant endVar = map.value(end);
+  if (endVar.isValid()) {
+    pat->end.reset(Regex::create(endVar.toString()));
   }
 
   // endCaptures
   static const QString endCaptures = QStringLiteral("endCaptures");
-  if (map.contains(endCaptures)) {
-    QVariant endCapturesVar = map.value(endCaptures);
-    if (endCapturesVar.canConvert<QVariantMap>()) {
-      pat->endCaptures = toCaptures(endCapturesVar.toMap());
-    }
+  const QVariant endCapturesVar = map.value(endCaptures);
+  if (endCapturesVar.type() == QVariant::Map) {
+    pat->endCaptures = toCaptures(endCapturesVar.toMap());
   }
 
   // captures
   static const QString captures = QStringLiteral("captures");
-  if (map.contains(captures)) {
-    QVariant capturesVar = map.value(captures);
-    if (capturesVar.canConvert<QVariantMap>()) {
-      pat->captures = toCaptures(capturesVar.toMap());
-    }
+  const QVariant capturesVar = map.value(captures);
+  if (capturesVar.type() == QVariant::Map) {
+    pat->captures = toCaptures(capturesVar.toMap());
   }
 
   // patterns
   static const QString patternsStr = QStringLiteral("patterns");
-  if (map.contains(patternsStr)) {
-    QVariant patternsVar = map.value(patternsStr);
+  const QVariant patternsVar = map.value(patternsStr);
+  if (patternsVar.isValid()) {
     pat->patterns.reset(toPatterns(patternsVar, pat, lang));
   }
 
   // repository
   static const QString repositoryStr = QStringLiteral("repository");
-  if (map.contains(repositoryStr)) {
-    QVariantMap repositoryMap = map.value(repositoryStr).toMap();
-    QMapIterator<QString, QVariant> iter(repositoryMap);
-    while (iter.hasNext()) {
-      iter.next();
-      QString key = iter.key();
-      if (iter.value().canConvert<QVariantMap>()) {
-        QVariantMap subMap = iter.value().toMap();
-        if (Pattern* pattern = toChildPattern(subMap, pat, lang)) {
-          pat->repository[key] = std::unique_ptr<Pattern>(pattern);
+  const QVariant repositoryVar = map.value(repositoryStr);
+  if (repositoryVar.isValid()) {
+    const QVariantMap repositoryMap = repositoryVar.toMap();
+    for (auto it = repositoryMap.constBegin(); it != repositoryMap.constEnd(); ++it) {
+      if (it.value().type() == QVariant::Map) {
+        if (Pattern* pattern = toChildPattern(it.value().toMap(), pat, lang)) {
+          pat->repository[it.key()] = std::unique_ptr<Pattern>(pattern);
         }
       }
     }
   }
 }
 
-RootPattern* toRootPattern(QVariantMap map, Language* lang) {
+RootPattern* toRootPattern(const QVariantMap& map, Language* lang) {
   RootPattern* pat = new RootPattern(lang);
   toPattern(map, pat, lang);
   return pat;
 }
 
 // todo: check ownership
-Pattern* toChildPattern(QVariantMap map, Pattern* parent, Language* lang) {
+Pattern* toChildPattern(const QVariantMap& map, Pattern* parent, Language* lang) {
   Pattern* pat = new Pattern(lang, parent);
   toPattern(map, pat, lang);
   return pat;
@@ -201,7 +230,7 @@ QString expandBackReferences(QString const& ptrn, QList<QStringRef> m) {
   return res;
 }
 
-QList<QStringRef> getCaptures(const QStringRef& str, QVector<Region> regions) {
+QList<QStringRef> getCaptures(const QStringRef& str, const MatchRegions& regions) {
   QList<QStringRef> capturedStrs;
   for (const auto& reg : regions) {
     capturedStrs.append(str.mid(reg.begin(), reg.length()));
@@ -221,15 +250,21 @@ Pattern* findInRepository(Pattern* pattern, const QString& key) {
   return findInRepository(pattern->parent, key);
 }
 
+int nextIndex() {
+  static QAtomicInt s_index(0);
+  return s_index.fetchAndAddOrdered(1);
+}
+
 bool inSameLine(const QString& text, int begin, int end) {
   return !text.midRef(begin, end - begin).contains('\n');
 }
 
-// Returns the expanded region that covers nodes that intersect region
-boost::optional<std::tuple<int, int>> coveringIndices(QList<Node> nodes, Region region) {
+// Returns the indices of the first and the last segments of tree that intersect region
+boost::optional<std::tuple<int, int>> coveringIndices(const ScopeTree& tree, Region region) {
   int begin = INT_MAX, end = -1;
-  for (int i = 0; i < nodes.size(); i++) {
-    if (nodes[i].region.intersects(region)) {
+  for (int i = tree.segmentAfter(region.begin());
+       i < tree.segmentCount() && tree.segmentRegion(i).begin() < region.end(); i++) {
+    if (tree.segmentRegion(i).intersects(region)) {
       begin = qMin(begin, i);
       end = qMax(end, i);
     }
@@ -241,27 +276,34 @@ boost::optional<std::tuple<int, int>> coveringIndices(QList<Node> nodes, Region
 
   return std::make_tuple(begin, end);
 }
+
+// Returns true if the content of node strictly contains region, so that the content can be
+// reparsed without matching its begin pattern again
+bool canReparseContent(const Node& node, const Region& region) {
+  return node.pattern && node.pattern->begin && node.pattern->end &&
+         node.contentRegion.begin() < region.begin() && region.end() < node.contentRegion.end();
+}
 }
 
 LanguageParser* LanguageParser::create(const QString& scopeName, const QString& data) {
   if (auto lang = LanguageProvider::languageFromScope(scopeName)) {
-    return new LanguageParser(std::unique_ptr<Language>(lang), data);
+    return new LanguageParser(lang, data);
   } else {
     return nullptr;
   }
 }
 
 boost::optional<RootNode> LanguageParser::parse() {
-  Q_ASSERT(isIdle());
-  setState(State::FullParsing);
+  if (!beginParsing(State::FullParsing)) {
+    return boost::none;
+  }
 
   const auto& txt = text();
   RootNode rootNode(m_lang->scopeName);
-  auto result = parse(txt, QList<Node>(), Region(0, txt.length()));
+  auto result = parse(txt, ScopeTree(), Region(0, txt.length()));
   auto children = std::get<0>(result);
 
-  if (isCancelRequested()) {
-    setState(State::Idle);
+  if (!endParsing(State::FullParsing)) {
     return boost::none;
   }
 
@@ -270,77 +312,184 @@ boost::optional<RootNode> LanguageParser::parse() {
 
   // root node covers everything
   rootNode.region = Region(0, txt.length());
-  setState(State::Idle);
   return rootNode;
 }
 
+// Parses top level nodes from beginPos until a node ends at or after endPos.
+// Returns the nodes and the position where the next chunk begins. Parsing chunks one after another
+// from 0 gives the same nodes as the full parse.
+boost::optional<std::tuple<QList<Node>, int>> LanguageParser::parseChunk(int beginPos, int endPos) {
+  if (!beginParsing(State::FullParsing)) {
+    return boost::none;
+  }
+
+  const auto& txt = text();
+  QList<Node> nodes;
+  int nextPos;
+  std::tie(nodes, std::ignore, nextPos) =
+      parse(txt, ScopeTree(), Region(beginPos, qMin(endPos, txt.length())));
+
+  if (!endParsing(State::FullParsing)) {
+    return boost::none;
+  }
+  return std::make_tuple(nodes, nextPos);
+}
+
+// Parses region as if no node continued from before region. Nodes are cut at the end of region.
+// The result may differ from the full parse, so use it only until the full parse reaches region.
+boost::optional<QList<Node>> LanguageParser::parseProvisionally(const Region& region) {
+  if (!beginParsing(State::FullParsing)) {
+    return boost::none;
+  }
+
+  const QString& txt = text().mid(region.begin(), region.length());
+  QList<Node> nodes = std::get<0>(parse(txt, ScopeTree(), Region(0, txt.length())));
+  for (auto& node : nodes) {
+    node.adjust(0, region.begin());
+  }
+
+  if (!endParsing(State::FullParsing)) {
+    return boost::none;
+  }
+  return nodes;
+}
+
 // parse in [begin, end) (doensn't include end)
-boost::optional<std::tuple<QList<Node>, Region>> LanguageParser::parse(QList<Node> children,
-                                                                       Region region) {
-  Q_ASSERT(isIdle());
-  setState(State::PartialParsing);
-  auto result = parse(text(), children, region);
-  auto nodes = std::get<0>(result);
-  auto parsedRegion = std::get<1>(result);
-
-  if (isCancelRequested()) {
-    setState(State::Idle);
+// Returns new nodes, the region they replace and the region whose scopes changed
+boost::optional<std::tuple<QList<Node>, Region, Region>> LanguageParser::parse(
+    const ScopeTree& tree,
+    Region region) {
+  if (!beginParsing(State::PartialParsing)) {
+    return boost::none;
+  }
+
+  const auto& txt = text();
+  QList<Node> nodes;
+  Region parsedRegion, changedRegion;
+  if (auto result = reparseInnermostNode(txt, tree, region)) {
+    nodes.append(std::get<0>(*result));
+    parsedRegion = nodes[0].region;
+    changedRegion = std::get<1>(*result);
+  } else {
+    std::tie(nodes, parsedRegion, std::ignore) = parse(txt, tree, region);
+    changedRegion = parsedRegion;
+    if (!nodes.isEmpty()) {
+      changedRegion = changedRegion.sum(
+          Region(nodes.first().region.begin(), nodes.last().region.end()));
+    }
+  }
+
+  if (!endParsing(State::PartialParsing)) {
+    return boost::none;
+  }
+  return std::make_tuple(nodes, parsedRegion, changedRegion);
+}
+
+// Reparses only the content of the innermost begin/end node which contains region.
+// Ancestors of the node tell which rules are active at the beginning of its content, so parsing
+// can resume from the line before region instead of the top level node. If the end of the node
+// changes, its parent is reparsed in the same way.
+// Returns the updated top level node and the changed region.
+boost::optional<std::tuple<Node, Region>> LanguageParser::reparseInnermostNode(
+    const QString& text,
+    const ScopeTree& tree,
+    const Region& region) {
+  const int index = tree.findSegment(region);
+  if (index < 0) {
+    return boost::none;
+  }
+
+  // Only the top level node which contains region is converted to Node
+  Node topNode = tree.toNode(index);
+  if (!canReparseContent(topNode, region)) {
     return boost::none;
   }
+  QVector<Node*> path{&topNode};
+  while (true) {
+    auto& nodeChildren = path.last()->children;
+    auto childIt = std::find_if(nodeChildren.begin(), nodeChildren.end(), [&](const Node& child) {
+      return canReparseContent(child, region);
+    });
+    if (childIt == nodeChildren.end()) {
+      break;
+    }
+    path.append(&*childIt);
+  }
 
-  setState(State::Idle);
-  return std::make_tuple(nodes, parsedRegion);
+  for (int i = path.size() - 1; i >= 0; i--) {
+    ParseState state(m_lang, m_maxLineLength);
+    if (auto changedRegion = path[i]->pattern->reparseContent(state, text, path[i], region)) {
+      return std::make_tuple(topNode, *changedRegion);
+    }
+  }
+
+  return boost::none;
 }
 
-// The main thread MUST NOT run this method because this method calls
-// QCoreApplication::processEvents to cancel
-std::tuple<QList<Node>, Region> LanguageParser::parse(const QString& text,
-                                                      QList<Node> children,
-                                                      Region region) {
+// Stops when cancel() is called from another thread.
+// Returns new nodes, the parsed region and the position where parsing stopped
+std::tuple<QList<Node>, Region, int> LanguageParser::parse(const QString& text,
+                                                           const ScopeTree& tree,
+                                                           Region region) {
   qDebug() << "parse. region:" << region.toString() << "lang:" << m_lang->scopeName;
   int endChildIndex = -1;
-  if (const auto& indices = coveringIndices(children, region)) {
+  if (const auto& indices = coveringIndices(tree, region)) {
     int beginChildIndex = std::get<0>(*indices);
     endChildIndex = std::get<1>(*indices);
 
     // expand region to cover affected children
-    region = Region(qMin(region.begin(), children[beginChildIndex].region.begin()),
-                    qMax(region.end(), children[endChildIndex].region.end()));
+    region = Region(qMin(region.begin(), tree.segmentRegion(beginChildIndex).begin()),
+                    qMax(region.end(), tree.segmentRegion(endChildIndex).end()));
   }
 
   QTime t;
   t.start();
 
-  clearCache();
-
+  ParseState state(m_lang, m_maxLineLength);
   QList<Node> nodes;
   int prevPos;
   const QLatin1Char lf('\n');
   const QLatin1Char cr('\r');
 
-  for (int pos = region.begin(); pos < region.end();) {
+  int pos = region.begin();
+  // position of the first '\n' at or after pos. Searched again only after pos passes it
+  int lfPos = -1;
+  while (pos < region.end()) {
     // check if an another parse request comes before finishing this parse. In that case, cancel
-    // this parse
-    QCoreApplication::processEvents();
+    // this parse. This is just an atomic load, so it's cheap enough to check for every token.
     if (isCancelRequested()) {
-      return std::make_tuple(QList<Node>(), region);
+      return std::make_tuple(QList<Node>(), region, pos);
+    }
+
+    const int nextLinePos = state.skipLongLine(text, pos);
+    if (nextLinePos >= 0) {
+      pos = nextLinePos;
+      continue;
     }
 
     prevPos = pos;
     // Try to find a root pattern in text from pos.
-    const auto& pair = m_lang->rootPattern->find(text, pos);
+    const auto& pair = m_lang->rootPattern->find(state, text, pos);
     Pattern* pattern = pair.first;
 
     // This regions could include empty region
     // e.g. /(^[ \t]+)?(?=#)/ in SQL.plist
-    boost::optional<QVector<Region>> regions = pair.second;
+    boost::optional<MatchRegions> regions = pair.second;
 
-    int newlinePos = text.indexOf(lf, pos);
+    if (lfPos < pos) {
+      lfPos = text.indexOf(lf, pos);
+      if (lfPos < 0) {
+        lfPos = text.length();
+      }
+    }
+    int newlinePos = lfPos < text.length() ? lfPos : -1;
     if (newlinePos > 0 && text[newlinePos - 1] == cr) {
       newlinePos--;
     }
 
     if (!regions) {
+      // No more nodes until the end
+      pos = text.length();
       break;
     } else if (newlinePos > 0 && newlinePos <= (*regions)[0].begin()) {
       pos = newlinePos;
@@ -349,15 +498,15 @@ std::tuple<QList<Node>, Region> LanguageParser::parse(const QString& text,
       }
     } else {
       Q_ASSERT(regions);
-      Node node = pattern->createNode(text, *regions);
+      Node node = pattern->createNode(state, text, *regions);
       const auto& newNodeRegion = node.region;
       pos = newNodeRegion.end();
 
       // Expand region to parse more children
-      if (0 <= endChildIndex && pos > children[endChildIndex].region.end() &&
-          endChildIndex + 1 < children.size()) {
+      if (0 <= endChildIndex && pos > tree.segmentRegion(endChildIndex).end() &&
+          endChildIndex + 1 < tree.segmentCount()) {
         endChildIndex++;
-        region.setEnd(children[endChildIndex].region.end());
+        region.setEnd(tree.segmentRegion(endChildIndex).end());
       }
 
       if (region.intersects(newNodeRegion)) {
@@ -373,8 +522,8 @@ std::tuple<QList<Node>, Region> LanguageParser::parse(const QString& text,
 
   qDebug("parse finished. elapsed: %d ms", t.elapsed());
   Region parsedRegion(region.begin(),
-                      endChildIndex >= 0 ? children[endChildIndex].region.end() : region.end());
-  return std::make_tuple(nodes, parsedRegion);
+                      endChildIndex >= 0 ? tree.segmentRegion(endChildIndex).end() : region.end());
+  return std::make_tuple(nodes, parsedRegion, pos);
 }
 
 QString LanguageParser::getData(int a, int b) {
@@ -392,10 +541,56 @@ void LanguageParser::setText(const QString& text) {
   m_text = text;
 }
 
-void LanguageParser::clearCache() {
-  if (m_lang) {
-    m_lang->clearCache();
+// Replaces charsRemoved characters at position with insertedText.
+// Returns the region of the lines affected by the edit, or boost::none if position is invalid.
+boost::optional<Region> LanguageParser::applyEdit(int position,
+                                                  int charsRemoved,
+                                                  const QString& insertedText) {
+  //   We need to extend affectedRegion to the region from the beginning of the line at beginPos
+  //   to the end of the line at endPos to support look ahead and behind regex.
+  //   e.g.
+
+  //   text:
+  //     StatusBar QComboBox::down-arrow {
+  //        /*image: url(noimg);*/
+
+  //   pattern:
+  //      <key>begin</key>
+  //      <string>\s*(?=[:.*#a-zA-Z])</string>
+  //      <key>end</key>
+  //      <string>(?=[/@{)])</string>
+  //      <key>name</key>
+  //      <string>meta.selector.css</string>
+
+  //   scope:
+  //     0-32: "meta.selector.css" - Data: "StatusBar QComboBox::down-arrow "
+
+  //   When we delete '{' at the end of line, beginPos is 32 and endPos is 33.
+  //   In this case, [0-32) is not updated without expansion because [0-32) doesn't intersect
+  //   [32-33).
+  //   But we need to update [0-32) because its end pattern has /(?=/ and end pattern should match
+  //   with '/' at pos 36
+
+  int beginPos = position;
+  int endPos = position + qMax(charsRemoved, insertedText.length());
+
+  if (insertedText.length() > charsRemoved) {
+    // When a text is added, we need to get begin and end pos based on the text after insertion
+    m_text.replace(position, charsRemoved, insertedText);
+    beginPos = beginOfLine(beginPos);
+    endPos = endOfLine(endPos);
+  } else {
+    // When a text is removed, we need to get begin and end pos based on the text before removal
+    beginPos = beginOfLine(beginPos);
+    endPos = endOfLine(endPos);
+    m_text.replace(position, charsRemoved, insertedText);
+  }
+
+  if (beginPos < 0 || endPos < 0) {
+    return boost::none;
   }
+
+  return Region(beginPos, endPos);
 }
 
 int LanguageParser::beginOfLine(int pos) {
@@ -445,34 +640,48 @@ int LanguageParser::endOfLine(int pos) {
 }
 
 bool LanguageParser::isIdle() {
-  return m_state == State::Idle;
+  return m_state.loadAcquire() == int(State::Idle);
 }
 
 void LanguageParser::setState(LanguageParser::State state) {
-  m_state = state;
+  m_state.storeRelease(int(state));
 }
 
 // Thread safe
 bool LanguageParser::isFullParsing() {
-  return m_state == State::FullParsing;
+  return m_state.loadAcquire() == int(State::FullParsing);
 }
 
 bool LanguageParser::isParsing() {
-  return m_state == State::FullParsing || m_state == State::PartialParsing;
+  const int state = m_state.loadAcquire();
+  return state == int(State::FullParsing) || state == int(State::PartialParsing);
 }
 
+// Thread safe. Parsing stops at the next token.
 void LanguageParser::cancel() {
   setState(State::CancelRequested);
 }
 
+// Called for every token, so a relaxed load is used
 bool LanguageParser::isCancelRequested() {
-  return m_state == State::CancelRequested;
+  return m_state.load() == int(State::CancelRequested);
+}
+
+// Returns false if cancel has been requested
+bool LanguageParser::beginParsing(State state) {
+  return m_state.testAndSetOrdered(int(State::Idle), int(state));
 }
 
-LanguageParser::LanguageParser() : m_state(State::Idle) {}
+// Returns false if cancel has been requested while parsing. Otherwise the state becomes Idle.
+bool LanguageParser::endParsing(State state) {
+  return m_state.testAndSetOrdered(int(state), int(State::Idle));
+}
 
-LanguageParser::LanguageParser(std::unique_ptr<Language> lang, const QString& str)
-    : m_lang(std::move(lang)), m_state(State::Idle) {
+LanguageParser::LanguageParser()
+    : m_lang(nullptr), m_maxLineLength(0), m_state(int(State::Idle)) {}
+
+LanguageParser::LanguageParser(Language* lang, const QString& str)
+    : m_lang(lang), m_maxLineLength(0), m_state(int(State::Idle)) {
   setText(str);
 }
 
@@ -524,7 +733,13 @@ bool Node::isLeaf() const {
 }
 
 void Node::adjust(int pos, int delta) {
+  // Nodes before pos don't change. Return early not to detach children shared with other trees
+  if (region.end() < pos && region.end() <= pos + delta) {
+    return;
+  }
+
   region.adjust(pos, delta);
+  contentRegion.adjust(pos, delta);
   for (auto& child : children) {
     child.adjust(pos, delta);
   }
@@ -590,25 +805,19 @@ bool Regex::hasBackReference(const QString& str) {
 }
 
 // find within [beginPos, endPos)
-boost::optional<QVector<Region>> Regex::find(Regexp* regex,
-                                             const QString& str,
-                                             int beginPos,
-                                             int endPos) {
+boost::optional<MatchRegions> Regex::find(const Regexp* regex,
+                                          const QString& str,
+                                          int beginPos,
+                                          int endPos) {
   //  qDebug("find. pattern: %s, pos: %d", qPrintable(re->pattern()), pos);
 
   if (!regex) {
     return boost::none;
   }
 
-  QVector<int> indices = regex->findStringSubmatchIndex(str, beginPos, endPos, false);
-  if (!indices.isEmpty()) {
-    Q_ASSERT(!indices.isEmpty());
-    Q_ASSERT(indices.size() % 2 == 0);
-
-    QVector<Region> regions(indices.size() / 2);
-    for (int i = 0; i < indices.size() / 2; i++) {
-      regions[i] = Region(indices.at(i * 2), indices.at(i * 2 + 1));
-    }
+  MatchRegions regions;
+  if (regex->search(str, regions, beginPos, endPos)) {
+    Q_ASSERT(!regions.isEmpty());
     return regions;
   }
   return boost::none;
@@ -622,23 +831,30 @@ Regex* Regex::create(const QString& pattern) {
   }
 }
 
-Pattern::Pattern(Language* lang, Pattern* parent) : lang(lang), parent(parent) {}
+Pattern::Pattern(Language* lang, Pattern* parent)
+    : lang(lang), parent(parent), id(lang ? lang->patternCount++ : 0), m_includedLanguage(nullptr) {
+  if (lang) {
+    lang->patterns.push_back(this);
+  }
+}
 
-std::pair<Pattern*, boost::optional<QVector<Region>>> Pattern::searchInPatterns(const QString& str,
-                                                                                int beginPos,
-                                                                                int endPos) {
+std::pair<Pattern*, boost::optional<MatchRegions>> Pattern::searchInPatterns(ParseState& state,
+                                                                             const QString& str,
+                                                                             int beginPos,
+                                                                             int endPos) {
   //  qDebug("firstMatch. pos: %d", pos);
+  QVector<Pattern*>& cachedPatterns = state.cache(this).patterns;
   int startIdx = -1;
   Pattern* resultPattern = nullptr;
-  boost::optional<QVector<Region>> resultRegions;
+  boost::optional<MatchRegions> resultRegions;
   int i = 0;
   // todo: think about better cache not to use this
   QVector<Pattern*> backslashGPatterns;
 
   while (i < cachedPatterns.length()) {
-    auto pair = cachedPatterns[i]->find(str, beginPos, endPos);
+    auto pair = cachedPatterns[i]->find(state, str, beginPos, endPos);
     Pattern* pattern = pair.first;
-    boost::optional<QVector<Region>> regions = pair.second;
+    boost::optional<MatchRegions> regions = pair.second;
 
     if (regions && regions->size() > 0) {
       // todo: consider the case when the pattern matches more than two lines
@@ -652,31 +868,24 @@ std::pair<Pattern*, boost::optional<QVector<Region>>> Pattern::searchInPatterns(
         // Regex matches multi line. Force to match it against single line.
         int newlinePos = multilineMatchedRegion.begin() + newlineIndex;
 
-        // find within [multilineMatchedRegion.begin(), newlinePos]
-        for (int beginPosInLine = multilineMatchedRegion.begin(); beginPosInLine < newlinePos;
-             beginPosInLine++) {
-          cachedPatterns[i]->clearCache();
-          pair = cachedPatterns[i]->find(str, beginPosInLine, newlinePos + 1);
+        // find within [multilineMatchedRegion.begin(), newlinePos]. A match must end within the
+        // end of the range, so one search tries every position in the line.
+        regions = boost::none;
+        if (multilineMatchedRegion.begin() < newlinePos) {
+          cachedPatterns[i]->clearCache(state);
+          pair =
+              cachedPatterns[i]->find(state, str, multilineMatchedRegion.begin(), newlinePos + 1);
           pattern = pair.first;
           regions = pair.second;
-          if (regions) {
-            break;
-          }
         }
 
         // If it's not found in previous line, find in next line [newlinePos + 1,
         // multilineMatchedRegion.end())
-        if (!regions) {
-          for (int beginPosInLine = newlinePos + 1; beginPosInLine < multilineMatchedRegion.end();
-               beginPosInLine++) {
-            cachedPatterns[i]->clearCache();
-            pair = cachedPatterns[i]->find(str, beginPosInLine, multilineMatchedRegion.end());
-            pattern = pair.first;
-            regions = pair.second;
-            if (regions) {
-              break;
-            }
-          }
+        if (!regions && newlinePos + 1 < multilineMatchedRegion.end()) {
+          cachedPatterns[i]->clearCache(state);
+          pair = cachedPatterns[i]->find(state, str, newlinePos + 1, multilineMatchedRegion.end());
+          pattern = pair.first;
+          regions = pair.second;
         }
       }
     }
@@ -698,7 +907,7 @@ std::pair<Pattern*, boost::optional<QVector<Region>>> Pattern::searchInPatterns(
       // But don't remove pattern with \G because it may match in the future with another \G
       if (cachedPatterns[i]->match && cachedPatterns[i]->match->pattern().contains(R"(\G)")) {
         backslashGPatterns.append(cachedPatterns[i]);
-        cachedPatterns[i]->clearCache();
+        cachedPatterns[i]->clearCache(state);
       }
 
       cachedPatterns.removeAt(i);
@@ -719,62 +928,60 @@ std::pair<Pattern*, boost::optional<QVector<Region>>> Pattern::searchInPatterns(
  * @param beginPos
  * @return A pair of pattern and regions found in str. The regions may include an empty region [0,0]
  */
-std::pair<Pattern*, boost::optional<QVector<Region>>> Pattern::find(const QString& str,
-                                                                    int beginPos,
-                                                                    int endPos) {
+std::pair<Pattern*, boost::optional<MatchRegions>> Pattern::find(ParseState& state,
+                                                                 const QString& str,
+                                                                 int beginPos,
+                                                                 int endPos) {
   //  qDebug(" pos: %d. data.size: %d", pos, data.size());
   int actualEndPos = endPos == -1 ? str.length() : endPos;
+  PatternCache& cache = state.cache(this);
 
-  if (!cachedStr.isEmpty() && cachedStr == str) {
-    if (!cachedResultRegions) {
+  if (!cache.str.isEmpty() && cache.str == str) {
+    if (!cache.resultRegions) {
       //      qDebug("cachedMatch is null");
       return std::make_pair(nullptr, boost::none);
     }
 
-    if ((*cachedResultRegions)[0].begin() >= beginPos &&
-        (*cachedResultRegions)[0].end() <= actualEndPos &&
-        cachedResultPattern.loadAcquire()->cachedResultRegions) {
-      //      qDebug("hits++");
-      //      hits++;
-      return std::make_pair(cachedResultPattern.loadAcquire(), cachedResultRegions);
+    if ((*cache.resultRegions)[0].begin() >= beginPos &&
+        (*cache.resultRegions)[0].end() <= actualEndPos &&
+        state.cache(cache.resultPattern).resultRegions) {
+      if (ParseProfiler::enabled()) {
+        state.counters(this).cacheHits++;
+      }
+      return std::make_pair(cache.resultPattern, cache.resultRegions);
     }
   } else {
     //    qDebug("cachedPatterns = nullptr");
-    cachedPatterns.clear();
+    cache.patterns.clear();
   }
 
-  if (cachedPatterns.isEmpty()) {
-    cachedPatterns = QVector<Pattern*>(patterns ? patterns->size() : 0);
+  if (cache.patterns.isEmpty()) {
+    cache.patterns = patterns ? *patterns : QVector<Pattern*>(0);
     //    qDebug("copying patterns to cachedPatterns. cachedPatterns.size: %d",
     //    cachedPatterns->size());
-    for (int i = 0; i < cachedPatterns.size(); i++) {
-      cachedPatterns[i] = (*patterns)[i];
-    }
 
     if (patterns) {
-      Q_ASSERT(cachedPatterns.size() == patterns->size());
+      Q_ASSERT(cache.patterns.size() == patterns->size());
     } else {
-      Q_ASSERT(cachedPatterns.size() == 0);
+      Q_ASSERT(cache.patterns.size() == 0);
     }
   }
-  //  qDebug("misses++");
-  //  misses++;
 
   Pattern* pattern = nullptr;
-  boost::optional<QVector<Region>> regions;
+  boost::optional<MatchRegions> regions;
   if (match) {
     pattern = this;
-    regions = match->find(str, beginPos, endPos);
+    regions = profiledFind(state, this, match.get(), str, beginPos, endPos);
   } else if (begin) {
     pattern = this;
-    regions = begin->find(str, beginPos, endPos);
+    regions = profiledFind(state, this, begin.get(), str, beginPos, endPos);
   } else if (!include.isEmpty()) {
     // # means an item name in the repository
     if (include.startsWith('#')) {
       QString key = include.mid(1);
       if (auto p2 = findInRepository(this, key)) {
         //        qDebug("include %s", qPrintable(include));
-        auto pair = p2->find(str, beginPos, endPos);
+        auto pair = p2->find(state, str, beginPos, endPos);
         pattern = pair.first;
         regions = pair.second;
       } else {
@@ -782,41 +989,57 @@ std::pair<Pattern*, boost::optional<QVector<Region>>> Pattern::find(const QStrin
       }
       // $self means the current syntax definition
     } else if (include == "$self") {
-      return lang->rootPattern->find(str, beginPos, endPos);
+      return lang->rootPattern->find(state, str, beginPos, endPos);
       // $base equals $self if it doesn't have a parent. When it does, $base means parent syntax
       // e.g. When source.c++ includes source.c, "include $base" in source.c means including
       // source.c++
-    } else if (include == "$base" && lang->baseLanguage) {
-      return lang->baseLanguage->rootPattern->find(str, beginPos, endPos);
-    } else if (cachedIncludedLanguage) {
-      return cachedIncludedLanguage->rootPattern->find(str, beginPos, endPos);
+    } else if (include == "$base" && state.baseLanguage()) {
+      return state.baseLanguage()->rootPattern->find(state, str, beginPos, endPos);
       // external syntax definitions e.g. source.c++
-    } else if (auto includedLang = LanguageProvider::languageFromScope(include)) {
-      cachedIncludedLanguage.reset(includedLang);
-      cachedIncludedLanguage->baseLanguage = lang;
-      return cachedIncludedLanguage->rootPattern->find(str, beginPos, endPos);
+    } else if (auto includedLang = includedLanguage()) {
+      return includedLang->rootPattern->find(state, str, beginPos, endPos);
     } else {
       qWarning() << "Include directive " + include + " failed";
     }
   } else {
-    auto pair = searchInPatterns(str, beginPos, endPos);
+    auto pair = searchInPatterns(state, str, beginPos, endPos);
     pattern = pair.first;
     regions = pair.second;
   }
 
-  cachedStr = str;
-  cachedResultRegions = regions;
-  cachedResultPattern.storeRelease(pattern);
+  cache.str = str;
+  cache.resultRegions = regions;
+  cache.resultPattern = pattern;
 
   return std::make_pair(pattern, regions);
 }
 
-Node Pattern::createNode(const QString& str, const QVector<Region>& regions) {
+Language* Pattern::includedLanguage() {
+  if (include.isEmpty() || include.startsWith('#') || include.startsWith('$')) {
+    return nullptr;
+  }
+
+  if (Language* includedLang = m_includedLanguage.loadAcquire()) {
+    return includedLang;
+  }
+
+  // LanguageProvider returns the same instance for the same scope, so it doesn't matter if
+  // another thread stores it at the same time.
+  Language* includedLang = LanguageProvider::languageFromScope(include);
+  if (includedLang) {
+    m_includedLanguage.storeRelease(includedLang);
+  }
+  return includedLang;
+}
+
+Node Pattern::createNode(ParseState& state, const QString& str, const MatchRegions& regions) {
   Q_ASSERT(!regions.isEmpty());
 
   //  qDebug() << "createNode. mo:" << *mo;
 
   Node node(name, regions[0]);
+  node.nameAtom = nameAtom;
+  node.pattern = this;
 
   if (match) {
     createCaptureNodes(regions, &node, captures);
@@ -838,23 +1061,59 @@ Node Pattern::createNode(const QString& str, const QVector<Region>& regions) {
     return node;
   }
 
-  bool found = false;
-  int i, endPos;
-
   // Store cached result regions because searchInPatterns may overwrite it.
   // If it's overwritten, next iteration in for loop has different result regions compared by
   // previous iteration
   // Don't cache cachedPatterns. It's supposed to be overwritten in searchInPatterns.
-  auto tmpCachedRegions = cachedResultRegions;
+  auto tmpCachedRegions = state.cache(this).resultRegions;
+  const QString cachedStr = state.cache(this).str;
+  QList<QStringRef> capturedStrs;
+  if (tmpCachedRegions) {
+    capturedStrs = getCaptures(QStringRef(&cachedStr), *tmpCachedRegions);
+  }
 
-  for (i = node.region.end(), endPos = str.length(); i < str.length();) {
-    // end region can include an empty region [0,0]
-    boost::optional<QVector<Region>> endMatchedRegions;
-    if (tmpCachedRegions) {
-      endMatchedRegions = end->find(str, i, -1, getCaptures(QStringRef(&cachedStr), *tmpCachedRegions));
-    } else {
-      endMatchedRegions = end->find(str, i);
+  // Keep captured strings in the node to resume parsing its content later
+  if (dynamic_cast<RegexWithBackReference*>(end.get())) {
+    foreach (const QStringRef& capturedStr, capturedStrs) {
+      node.beginCapturedStrs.append(capturedStr.toString());
+    }
+  }
+
+  const Region beginRegion = node.region;
+  node.contentRegion = Region(beginRegion.end(), beginRegion.end());
+  parseContent(state, str, &node, beginRegion, beginRegion.end(), false, capturedStrs);
+  return node;
+}
+
+// Parses the content of a begin/end node from i until the end pattern matches.
+// When oldChildren is given, this stops as soon as a new child starting at or after convergeFrom
+// is the same as one of oldChildren, because the rest is parsed in the same way as before.
+// Returns the index of the same node in oldChildren, or -1 if it parses until the end pattern.
+int Pattern::parseContent(ParseState& state,
+                          const QString& str,
+                          Node* node,
+                          const Region& beginRegion,
+                          int i,
+                          bool found,
+                          const QList<QStringRef>& capturedStrs,
+                          const QList<Node>& oldChildren,
+                          int convergeFrom) {
+  int endPos = str.length();
+  int contentEnd = str.length();
+  int oldIndex = 0;
+
+  while (i < str.length()) {
+    // A long line in the content is left as plain text. The content continues after it
+    const int nextLinePos = state.skipLongLine(str, i);
+    if (nextLinePos >= 0) {
+      i = nextLinePos;
+      endPos = contentEnd = str.length();
+      continue;
     }
+
+    // end region can include an empty region [0,0]
+    boost::optional<MatchRegions> endMatchedRegions =
+        profiledFind(state, this, end.get(), str, i, -1, capturedStrs);
     if (endMatchedRegions) {
       endPos = (*endMatchedRegions)[0].end();
     } else {
@@ -866,17 +1125,18 @@ Node Pattern::createNode(const QString& str, const QVector<Region>& regions) {
       }
 
       // set endMatchedRegions empty region at endPos
-      endMatchedRegions = QVector<Region>{Region(endPos, endPos)};
+      endMatchedRegions = MatchRegions{Region(endPos, endPos)};
     }
 
     Q_ASSERT(endMatchedRegions);
+    contentEnd = (*endMatchedRegions)[0].begin();
 
     // check if begin and end are in a same line
     bool isEndInSameLine = inSameLine(str, i, (*endMatchedRegions)[0].begin());
 
     // Search patterns between begin and end
-    if (!cachedPatterns.isEmpty()) {
-      std::pair<Pattern*, boost::optional<QVector<Region>>> pair;
+    if (!state.cache(this).patterns.isEmpty()) {
+      std::pair<Pattern*, boost::optional<MatchRegions>> pair;
       /*
        In the following rule, punctuation.separator.continuation.c exceeds the end pos of end
        pattern
@@ -895,26 +1155,39 @@ Node Pattern::createNode(const QString& str, const QVector<Region>& regions) {
              <key>name</key>
              <string>punctuation.separator.continuation.c</string>
        */
-      pair = searchInPatterns(str, i);
+      pair = searchInPatterns(state, str, i);
 
       Pattern* patternBeforeEnd = pair.first;
-      boost::optional<QVector<Region>> regionsBeforeEnd = pair.second;
+      boost::optional<MatchRegions> regionsBeforeEnd = pair.second;
       if (regionsBeforeEnd && endMatchedRegions &&
           // If end pattern exists in a same line, the begin pos of patterns must not exceed the
           // beginning of the end pattern
           (!isEndInSameLine || (*regionsBeforeEnd)[0].begin() < (*endMatchedRegions)[0].begin()) &&
           ((*regionsBeforeEnd)[0].begin() < (*endMatchedRegions)[0].begin() ||
            ((*regionsBeforeEnd)[0].begin() == (*endMatchedRegions)[0].begin() &&
-            node.region.isEmpty()))) {
+            beginRegion.isEmpty()))) {
         found = true;
-        Node r = patternBeforeEnd->createNode(str, *regionsBeforeEnd);
+        Node r = patternBeforeEnd->createNode(state, str, *regionsBeforeEnd);
         i = r.region.end();
 
         // If r->region is empty, it leads infinite loop without i++;
         if (r.region.isEmpty()) {
           i++;
         }
-        node.append(r);
+        node->append(r);
+
+        // Check if the parse caught up with the previous result
+        if (!oldChildren.isEmpty() && !r.region.isEmpty() && r.region.begin() >= convergeFrom) {
+          while (oldIndex < oldChildren.size() &&
+                 (!oldChildren[oldIndex].pattern ||
+                  oldChildren[oldIndex].region.begin() < r.region.begin())) {
+            oldIndex++;
+          }
+          if (oldIndex < oldChildren.size() && oldChildren[oldIndex].pattern == r.pattern &&
+              oldChildren[oldIndex] == r) {
+            return oldIndex;
+          }
+        }
 
         /*
          e.g. text for match
@@ -950,25 +1223,105 @@ Node Pattern::createNode(const QString& str, const QVector<Region>& regions) {
 
     // set contentName
     if (!contentName.isEmpty()) {
-      Node newNode(contentName, Region(node.region.end(), (*endMatchedRegions)[0].begin()));
-      node.append(newNode);
+      Node newNode(contentName, Region(beginRegion.end(), (*endMatchedRegions)[0].begin()));
+      newNode.nameAtom = contentNameAtom;
+      node->append(newNode);
     }
 
     if (endCaptures.length() > 0) {
-      createCaptureNodes(*endMatchedRegions, &node, endCaptures);
+      createCaptureNodes(*endMatchedRegions, node, endCaptures);
     } else {
-      createCaptureNodes(*endMatchedRegions, &node, captures);
+      createCaptureNodes(*endMatchedRegions, node, captures);
     }
 
     break;
   }
 
-  node.region.setEnd(endPos);
-  node.updateRegion();
-  return node;
+  node->contentRegion = Region(beginRegion.end(), qMax(beginRegion.end(), contentEnd));
+  node->region.setEnd(endPos);
+  node->updateRegion();
+  return -1;
 }
 
-void Pattern::createCaptureNodes(QVector<Region> regions, Node* parent, Captures captures) {
+// Reparses the content of node, which was created by this pattern, after region was edited.
+// Parsing starts right after the last child before region and stops when it catches up with the
+// previous result.
+// Returns the changed region, or boost::none if the end of node changes. In that case, the parent
+// of node needs to be reparsed.
+boost::optional<Region> Pattern::reparseContent(ParseState& state,
+                                                const QString& str,
+                                                Node* node,
+                                                const Region& region) {
+  Q_ASSERT(node->pattern == this && begin && end);
+
+  const Region beginRegion(node->region.begin(), node->contentRegion.begin());
+  const int oldEnd = node->region.end();
+
+  // Resume right after the last child which ends before region
+  int resumeIndex = -1;
+  for (int k = 0; k < node->children.size(); k++) {
+    const Node& child = node->children[k];
+    if (!child.pattern) {
+      continue;
+    }
+    if (child.region.end() > region.begin()) {
+      break;
+    }
+    resumeIndex = k;
+  }
+
+  const int resumePos =
+      resumeIndex >= 0 ? node->children[resumeIndex].region.end() : beginRegion.end();
+
+  // Keep children before the resume point. Begin captures come first in children, so they are
+  // kept even if no child is found before region.
+  QList<Node> newChildren;
+  for (int k = 0; k < node->children.size(); k++) {
+    const Node& child = node->children[k];
+    if (k > resumeIndex && (child.pattern || child.region.begin() >= beginRegion.end())) {
+      break;
+    }
+    newChildren.append(child);
+  }
+  const QList<Node> oldChildren = node->children.mid(newChildren.size());
+
+  QList<QStringRef> capturedStrs;
+  for (const QString& capturedStr : node->beginCapturedStrs) {
+    capturedStrs.append(QStringRef(&capturedStr));
+  }
+
+  // Patterns are copied to the cache when the begin pattern is found in a normal parse
+  state.cache(this).patterns = patterns ? *patterns : QVector<Pattern*>(0);
+
+  Node newNode(*node);
+  newNode.children = newChildren;
+  newNode.region = beginRegion;
+  int convergedIndex = parseContent(state, str, &newNode, beginRegion, resumePos,
+                                    resumeIndex >= 0, capturedStrs, oldChildren, region.end());
+
+  if (convergedIndex >= 0) {
+    // The rest is the same as before
+    Region changedRegion(resumePos, newNode.children.last().region.end());
+    for (int k = convergedIndex + 1; k < oldChildren.size(); k++) {
+      newNode.children.append(oldChildren[k]);
+    }
+    newNode.region = node->region;
+    newNode.contentRegion = node->contentRegion;
+    *node = newNode;
+    return changedRegion;
+  }
+
+  if (newNode.region.end() != oldEnd) {
+    return boost::none;
+  }
+
+  *node = newNode;
+  return Region(resumePos, oldEnd);
+}
+
+void Pattern::createCaptureNodes(const MatchRegions& regions,
+                                 Node* parent,
+                                 const Captures& captures) {
   QVector<int> parentIndices(regions.length());
   QVector<Node*> parents(parentIndices.length());
 
@@ -995,6 +1348,7 @@ void Pattern::createCaptureNodes(QVector<Region> regions, Node* parent, Captures
       continue;
     }
     std::shared_ptr<Node> child(new Node(v.name, regions[i]));
+    child->nameAtom = v.nameAtom;
     newChildren.append(child);
 
     parents[i] = child.get();
@@ -1016,24 +1370,102 @@ void Pattern::createCaptureNodes(QVector<Region> regions, Node* parent, Captures
   parent->moveTmpChildren();
 }
 
-void Pattern::clearCache() {
-  cachedStr.clear();
-  cachedResultPattern.storeRelease(nullptr);
-  cachedPatterns.clear();
-  cachedResultRegions = boost::none;
-  cachedIncludedLanguage.reset(nullptr);
+void Pattern::clearCache(ParseState& state) {
+  state.cache(this).clear();
+  if (auto includedLang = m_includedLanguage.loadAcquire()) {
+    state.clear(includedLang);
+  }
   if (patterns) {
-    foreach (Pattern* pat, *patterns) { pat->clearCache(); }
+    foreach (Pattern* pat, *patterns) { pat->clearCache(state); }
   }
   for (auto& pair : repository) {
     Q_ASSERT(pair.second);
-    pair.second->clearCache();
+    pair.second->clearCache(state);
+  }
+}
+
+void PatternCache::clear() {
+  str.clear();
+  resultPattern = nullptr;
+  patterns.clear();
+  resultRegions = boost::none;
+}
+
+ParseState::ParseState(Language* baseLanguage, int maxLineLength)
+    : m_baseLanguage(baseLanguage), m_maxLineLength(maxLineLength) {}
+
+ParseState::~ParseState() {
+  for (const auto& pair : m_counters) {
+    for (size_t id = 0; id < pair.second.size(); id++) {
+      if (!pair.second[id].isEmpty()) {
+        pair.first->patterns[id]->stats.add(pair.second[id]);
+      }
+    }
+  }
+}
+
+int ParseState::skipLongLine(const QString& str, int pos) const {
+  if (m_maxLineLength <= 0 || (pos > 0 && str[pos - 1] != '\n') ||
+      str.length() - pos <= m_maxLineLength ||
+      str.midRef(pos, m_maxLineLength + 1).contains('\n')) {
+    return -1;
+  }
+  const int newlinePos = str.indexOf('\n', pos + m_maxLineLength);
+  return newlinePos < 0 ? str.length() : newlinePos + 1;
+}
+
+PatternCache& ParseState::cache(const Pattern* pattern) {
+  Q_ASSERT(pattern && pattern->lang);
+  const Language* lang = pattern->lang;
+  if (lang->index >= static_cast<int>(m_caches.size())) {
+    m_caches.resize(lang->index + 1);
+  }
+
+  // Moving the outer vector keeps the buffers of the inner ones, so references returned here stay
+  // valid during a parse.
+  auto& caches = m_caches[lang->index];
+  if (caches.empty()) {
+    caches.resize(lang->patternCount);
+  }
+  Q_ASSERT(pattern->id < static_cast<int>(caches.size()));
+  return caches[pattern->id];
+}
+
+PatternCounters& ParseState::counters(const Pattern* pattern) {
+  Q_ASSERT(pattern && pattern->lang);
+  const Language* lang = pattern->lang;
+  if (lang->index >= static_cast<int>(m_counters.size())) {
+    m_counters.resize(lang->index + 1);
+  }
+
+  auto& pair = m_counters[lang->index];
+  if (pair.second.empty()) {
+    pair.first = lang;
+    pair.second.resize(lang->patternCount);
+  }
+  Q_ASSERT(pattern->id < static_cast<int>(pair.second.size()));
+  return pair.second[pattern->id];
+}
+
+void ParseState::clear() {
+  m_caches.clear();
+}
+
+void ParseState::clear(const Language* lang) {
+  if (lang->index < static_cast<int>(m_caches.size())) {
+    for (auto& cache : m_caches[lang->index]) {
+      cache.clear();
+    }
   }
 }
 
 QVector<QPair<QString, QString>> LanguageProvider::s_scopeAndLangNamePairs(0);
 QMap<QString, QString> LanguageProvider::s_scopeLangFilePathMap;
 QMap<QString, QString> LanguageProvider::s_extensionLangFilePathMap;
+std::vector<std::pair<std::unique_ptr<Regexp>, QString>>
+    LanguageProvider::s_firstLineMatchLangFilePaths;
+std::unordered_map<QString, std::unique_ptr<Language>> LanguageProvider::s_pathLangMap;
+std::unique_ptr<GrammarCache> LanguageProvider::s_grammarCache;
 QReadWriteLock LanguageProvider::s_lock;
 
 Language* LanguageProvider::defaultLanguage() {
@@ -1062,31 +1494,136 @@ Language* LanguageProvider::languageFromExtension(const QString& ext) {
   }
 }
 
+Language* LanguageProvider::languageFromFirstLine(const QString& line) {
+  QReadLocker locker(&s_lock);
+
+  for (const auto& pair : s_firstLineMatchLangFilePaths) {
+    if (pair.first->matches(line)) {
+      const QString path = pair.second;
+      locker.unlock();
+      return loadLanguage(path);
+    }
+  }
+  return nullptr;
+}
+
 Language* LanguageProvider::loadLanguage(const QString& path) {
+  {
+    QReadLocker locker(&s_lock);
+    auto it = s_pathLangMap.find(path);
+    if (it != s_pathLangMap.end()) {
+      return it->second.get();
+    }
+  }
+
+  boost::optional<QVariantMap> rootMap;
+  if (s_grammarCache) {
+    rootMap = s_grammarCache->grammar(path);
+  }
+  if (!rootMap) {
+    rootMap = readGrammar(path);
+    if (!rootMap) {
+      return nullptr;
+    }
+    if (s_grammarCache) {
+      s_grammarCache->addGrammar(path, *rootMap);
+    }
+  }
+
+  // Compile outside the lock because it's slow.
+  std::unique_ptr<Language> newLang(new Language(*rootMap));
+
+  QWriteLocker locker(&s_lock);
+
+  // Another thread may have loaded the same file in the meantime.
+  auto it = s_pathLangMap.find(path);
+  if (it != s_pathLangMap.end()) {
+    return it->second.get();
+  }
+
+  Language* lang = newLang.get();
+  s_pathLangMap[path] = std::move(newLang);
+  addToIndex(path, lang->scopeName, lang->name(), lang->fileTypes, lang->firstLineMatch,
+             lang->hideFromUser);
+  return lang;
+}
+
+bool LanguageProvider::registerLanguage(const QString& path) {
+  boost::optional<GrammarCache::Entry> entry;
+  if (s_grammarCache) {
+    entry = s_grammarCache->entry(path);
+  }
+  if (!entry) {
+    const auto header = readGrammarHeader(path);
+    if (!header) {
+      return false;
+    }
+    entry = s_grammarCache ? s_grammarCache->add(path, *header)
+                           : GrammarCache::makeEntry(path, *header);
+  }
+
+  QWriteLocker locker(&s_lock);
+  addToIndex(path, entry->scopeName, entry->name, entry->fileTypes.toVector(),
+             entry->firstLineMatch, entry->hideFromUser);
+  return true;
+}
+
+void LanguageProvider::enableCache(const QString& dirPath) {
+  s_grammarCache.reset(new GrammarCache(dirPath));
+}
+
+bool LanguageProvider::saveCache() {
+  return s_grammarCache ? s_grammarCache->save() : false;
+}
+
+boost::optional<QVariantMap> LanguageProvider::readGrammar(const QString& path) {
   QFile file(path);
   if (!file.open(QIODevice::ReadOnly)) {
     qWarning("unable to open a file %s", qPrintable(path));
-    return nullptr;
+    return boost::none;
   }
 
   QVariant root = PListParser::parsePList(&file);
   if (!root.canConvert<QVariantMap>()) {
     qWarning("root is not dict");
-    return nullptr;
+    return boost::none;
   }
+  return root.toMap();
+}
 
-  QVariantMap rootMap = root.toMap();
-  Language* lang = new Language(rootMap);
-
-  QWriteLocker locker(&s_lock);
+boost::optional<QVariantMap> LanguageProvider::readGrammarHeader(const QString& path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    qWarning("unable to open a file %s", qPrintable(path));
+    return boost::none;
+  }
 
-  if (!s_scopeLangFilePathMap.contains(lang->scopeName)) {
-    foreach (const QString& ext, lang->fileTypes) { s_extensionLangFilePathMap[ext] = path; }
-    s_scopeLangFilePathMap[lang->scopeName] = path;
-    s_scopeAndLangNamePairs.append(QPair<QString, QString>(lang->scopeName, lang->name()));
+  const QVariantMap header = PListParser::parseRootValues(&file, GrammarCache::headerKeys());
+  if (!header.contains(SCOPE_NAME_KEY)) {
+    qWarning("scopeName is not found in %s", qPrintable(path));
+    return boost::none;
   }
+  return header;
+}
 
-  return lang;
+void LanguageProvider::addToIndex(const QString& path,
+                                  const QString& scopeName,
+                                  const QString& name,
+                                  const QVector<QString>& fileTypes,
+                                  const QString& firstLineMatch,
+                                  bool hideFromUser) {
+  if (!s_scopeLangFilePathMap.contains(scopeName)) {
+    foreach (const QString& ext, fileTypes) { s_extensionLangFilePathMap[ext] = path; }
+    if (!firstLineMatch.isEmpty()) {
+      if (auto regexp = Regexp::compile(firstLineMatch)) {
+        s_firstLineMatchLangFilePaths.emplace_back(std::move(regexp), path);
+      }
+    }
+    s_scopeLangFilePathMap[scopeName] = path;
+    if (!hideFromUser) {
+      s_scopeAndLangNamePairs.append(QPair<QString, QString>(scopeName, name));
+    }
+  }
 }
 
 QVector<QPair<QString, QString>> LanguageProvider::scopeAndLangNamePairs() {
@@ -1095,21 +1632,32 @@ QVector<QPair<QString, QString>> LanguageProvider::scopeAndLangNamePairs() {
   return s_scopeAndLangNamePairs;
 }
 
+QVector<Language*> LanguageProvider::loadedLanguages() {
+  QReadLocker locker(&s_lock);
+
+  QVector<Language*> languages;
+  languages.reserve(static_cast<int>(s_pathLangMap.size()));
+  for (const auto& pair : s_pathLangMap) {
+    languages.append(pair.second.get());
+  }
+  return languages;
+}
+
 FixedRegex::FixedRegex(const QString& pattern) : Regex(), regex(Regexp::compile(pattern)) {}
 
 QString FixedRegex::pattern() {
   return regex ? regex->pattern() : "";
 }
 
-boost::optional<QVector<Region>> FixedRegex::find(const QString& str,
-                                                  int beginPos,
-                                                  int endPos,
-                                                  QList<QStringRef>) {
+boost::optional<MatchRegions> FixedRegex::find(const QString& str,
+                                               int beginPos,
+                                               int endPos,
+                                               QList<QStringRef>) {
   return Regex::find(regex.get(), str, beginPos, endPos);
 }
 
-Language::Language(QVariantMap rootMap)
-    : rootPattern(nullptr), baseLanguage(this), hideFromUser(false) {
+Language::Language(const QVariantMap& rootMap)
+    : rootPattern(nullptr), hideFromUser(false), index(nextIndex()), patternCount(0) {
   // fileTypes
   if (rootMap.contains(FILE_TYPES_KEY)) {
     QVariant fileTypesVar = rootMap.value(FILE_TYPES_KEY);
@@ -1150,12 +1698,6 @@ QString Language::name() {
   return rootPattern ? rootPattern->name : "";
 }
 
-void Language::clearCache() {
-  if (rootPattern) {
-    rootPattern->clearCache();
-  }
-}
-
 RootNode::RootNode() : Node() {}
 
 RootNode::RootNode(const QString& name) : Node(name) {}
@@ -1167,16 +1709,22 @@ void RootNode::adjust(int pos, int delta) {
   }
 }
 
-boost::optional<QVector<Region>> RegexWithBackReference::find(const QString& str,
-                                                              int beginPos,
-                                                              int endPos,
-                                                              QList<QStringRef> capturedStrs) {
-  auto regex = Regexp::compile(expandBackReferences(patternStr, capturedStrs));
+boost::optional<MatchRegions> RegexWithBackReference::find(const QString& str,
+                                                           int beginPos,
+                                                           int endPos,
+                                                           QList<QStringRef> capturedStrs) {
+  const QString expandedPattern = expandBackReferences(patternStr, capturedStrs);
+  // Regexp::compile has warned about an invalid pattern when the cache compiled it
+  auto regex = cache().get(expandedPattern);
   if (!regex) {
-    qWarning() << "failed to compile" << expandBackReferences(patternStr, capturedStrs);
     return boost::none;
   }
   return Regex::find(regex.get(), str, beginPos, endPos);
 }
 
+RegexpCache& RegexWithBackReference::cache() {
+  static RegexpCache s_cache(REGEXP_CACHE_CAPACITY);
+  return s_cache;
+}
+
 }  // namespace core
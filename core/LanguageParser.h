@@ -3,27 +3,37 @@
 #include <memory>
 #include <vector>
 #include <unordered_map>
+#include <QAtomicInt>
 #include <QVector>
 #include <QMap>
+#include <QStringList>
 #include <QDebug>
 #include <QReadWriteLock>
 #include <QThreadStorage>
+#include <QVariant>
 
 #include "macros.h"
+#include "ParseProfiler.h"
 #include "Regexp.h"
+#include "RegexpCache.h"
 #include "stlSpecialization.h"
 #include "Region.h"
+#include "ScopeTree.h"
 
 namespace core {
 
 struct Language;
 class LanguageParser;
+class ParseState;
+class GrammarCache;
 struct Node;
 struct RootNode;
 
 struct Capture {
   int key;
   QString name;
+  // atom of name in ScopeAtoms
+  int nameAtom;
 };
 
 typedef QVector<Capture> Captures;
@@ -33,7 +43,7 @@ struct Regex {
 
   virtual ~Regex() = default;
 
-  virtual boost::optional<QVector<Region>> find(
+  virtual boost::optional<MatchRegions> find(
       const QString& str,
       int beginPos,
       int endPos = -1,
@@ -44,10 +54,10 @@ struct Regex {
  protected:
   Regex() {}
 
-  boost::optional<QVector<Region>> find(Regexp* regex,
-                                        const QString& str,
-                                        int beginPos,
-                                        int endPos);
+  boost::optional<MatchRegions> find(const Regexp* regex,
+                                     const QString& str,
+                                     int beginPos,
+                                     int endPos);
 
  private:
   friend class LanguageParserTest;
@@ -63,7 +73,7 @@ struct FixedRegex : public Regex {
 
   QString pattern() override;
 
-  boost::optional<QVector<Region>> find(
+  boost::optional<MatchRegions> find(
       const QString& str,
       int beginPos,
       int endPos,
@@ -73,25 +83,33 @@ struct FixedRegex : public Regex {
 // regex with back reference. e.g. \s*\2$\n?
 // end pattern can have back references captured in begin regex
 struct RegexWithBackReference : public Regex {
+  // Compiled patterns with the back references expanded. The same captures (e.g. a heredoc
+  // delimiter) are expanded again for every line in the block, so this compiles them once.
+  static RegexpCache& cache();
+
   QString patternStr;
 
   explicit RegexWithBackReference(const QString& pattern) : Regex(), patternStr(pattern) {}
 
   QString pattern() override { return patternStr; }
 
-  boost::optional<QVector<Region>> find(
+  boost::optional<MatchRegions> find(
       const QString& str,
       int beginPos,
       int endPos,
       QList<QStringRef> capturedStrs = QList<QStringRef>()) override;
 };
 
-// This struct is mutable because it has cache
+// Pattern is immutable once its Language is compiled, so it can be shared across documents and
+// threads. Per-parse data like match caches lives in ParseState.
 struct Pattern {
   // name could be empty
   // e.g. root patterns in Property List (XML)
   QString name;
   QString contentName;
+  // atoms of name and contentName in ScopeAtoms. Interned when the grammar is compiled
+  int nameAtom = 0;
+  int contentNameAtom = 0;
   QString include;
   std::unique_ptr<Regex> match;
   Captures captures;
@@ -105,30 +123,48 @@ struct Pattern {
 
   Pattern* parent;
 
-  // If we use QStringRef, the app crashes when entering Japanese characters in Kotoeri
-  QString cachedStr;
-  QAtomicPointer<Pattern> cachedResultPattern;
-  QVector<Pattern*> cachedPatterns;
-  boost::optional<QVector<Region>> cachedResultRegions;
-  std::unique_ptr<Language> cachedIncludedLanguage;
+  // index of this pattern in lang. Used to look up its PatternCache in ParseState
+  int id;
+  // counters of ParseProfiler summed over all the parses
+  PatternStats stats;
 
   explicit Pattern(Language* lang, Pattern* parent = nullptr);
   virtual ~Pattern() = default;
 
-  std::pair<Pattern*, boost::optional<QVector<Region>>> searchInPatterns(const QString& data,
-                                                                         int pos, int endPos = -1);
+  std::pair<Pattern*, boost::optional<MatchRegions>> searchInPatterns(ParseState& state,
+                                                                      const QString& data,
+                                                                      int pos,
+                                                                      int endPos = -1);
 
   // Note: Don't add endPos because Pattern caches the result matched in [beginPos, end of data)
   // When you call find next time, find returns the chached result if beginPos > cached result's
   // begin pos
-  std::pair<Pattern*, boost::optional<QVector<Region>>> find(const QString& data, int beginPos, int endPos = -1);
-  Node createNode(const QString& data, const QVector<Region>& regions);
-  void createCaptureNodes(QVector<Region> regions,
-                          Node* parent,
-                          Captures captures);
-  void clearCache();
+  std::pair<Pattern*, boost::optional<MatchRegions>> find(ParseState& state,
+                                                          const QString& data,
+                                                          int beginPos,
+                                                          int endPos = -1);
+  Node createNode(ParseState& state, const QString& data, const MatchRegions& regions);
+  int parseContent(ParseState& state,
+                   const QString& data,
+                   Node* node,
+                   const Region& beginRegion,
+                   int i,
+                   bool found,
+                   const QList<QStringRef>& capturedStrs,
+                   const QList<Node>& oldChildren = QList<Node>(),
+                   int convergeFrom = 0);
+  boost::optional<Region> reparseContent(ParseState& state,
+                                         const QString& data,
+                                         Node* node,
+                                         const Region& region);
+  void createCaptureNodes(const MatchRegions& regions, Node* parent, const Captures& captures);
+  void clearCache(ParseState& state);
 
  private:
+  // external syntax definition resolved lazily from include (e.g. source.c++)
+  QAtomicPointer<Language> m_includedLanguage;
+
+  Language* includedLanguage();
 };
 
 class RootPattern : public Pattern {
@@ -136,40 +172,116 @@ class RootPattern : public Pattern {
   explicit RootPattern(Language* lang) : Pattern(lang) {}
 };
 
+// Per-parse cache of a Pattern
+struct PatternCache {
+  // If we use QStringRef, the app crashes when entering Japanese characters in Kotoeri
+  QString str;
+  Pattern* resultPattern = nullptr;
+  QVector<Pattern*> patterns;
+  boost::optional<MatchRegions> resultRegions;
+
+  void clear();
+};
+
+// Mutable state of a single parse. Holds the caches of all the patterns visited while parsing, so
+// that Language itself can stay immutable.
+class ParseState {
+  DISABLE_COPY(ParseState)
+
+ public:
+  // A line longer than maxLineLength is left as plain text. 0 means no limit
+  explicit ParseState(Language* baseLanguage, int maxLineLength = 0);
+  ~ParseState();
+  DEFAULT_MOVE(ParseState)
+
+  // $base refers to this language.
+  Language* baseLanguage() { return m_baseLanguage; }
+
+  // Returns the beginning of the next line if pos is the beginning of a line longer than
+  // maxLineLength, or -1
+  int skipLongLine(const QString& str, int pos) const;
+
+  PatternCache& cache(const Pattern* pattern);
+  // Counters of pattern in this parse. Use this only while ParseProfiler is enabled.
+  PatternCounters& counters(const Pattern* pattern);
+  void clear();
+  void clear(const Language* lang);
+
+ private:
+  Language* m_baseLanguage;
+  int m_maxLineLength;
+  // indexed by Language::index and Pattern::id
+  std::vector<std::vector<PatternCache>> m_caches;
+  // indexed by Language::index and Pattern::id. Added to PatternStats on destruction
+  std::vector<std::pair<const Language*, std::vector<PatternCounters>>> m_counters;
+};
+
 // Thread safe
+// LanguageProvider owns every compiled Language, so a grammar is compiled only once and shared by
+// all the documents using it.
 class LanguageProvider {
   DISABLE_COPY_AND_MOVE(LanguageProvider)
  public:
   static Language* defaultLanguage();
   static Language* languageFromScope(const QString& scopeName);
   static Language* languageFromExtension(const QString& ext);
+  // Returns the language whose firstLineMatch matches line
+  static Language* languageFromFirstLine(const QString& line);
+  // Registers and compiles the grammar at path
   static Language* loadLanguage(const QString& path);
+  // Registers the scope, file types and firstLineMatch of the grammar at path by reading only its
+  // top level keys. It's parsed and compiled on its first use.
+  static bool registerLanguage(const QString& path);
+  // Returns the scope and the name of the registered languages which aren't hidden from the user
   static QVector<QPair<QString, QString>> scopeAndLangNamePairs();
+  // Returns the compiled languages
+  static QVector<Language*> loadedLanguages();
+
+  // Caches grammars in dirPath. Call this before registering grammars and starting parser threads
+  static void enableCache(const QString& dirPath);
+  static bool saveCache();
 
  private:
   static QVector<QPair<QString, QString>> s_scopeAndLangNamePairs;
   static QMap<QString, QString> s_scopeLangFilePathMap;
   static QMap<QString, QString> s_extensionLangFilePathMap;
+  // pairs of compiled firstLineMatch and grammar file path
+  static std::vector<std::pair<std::unique_ptr<Regexp>, QString>> s_firstLineMatchLangFilePaths;
+  static std::unordered_map<QString, std::unique_ptr<Language>> s_pathLangMap;
+  static std::unique_ptr<GrammarCache> s_grammarCache;
   static QReadWriteLock s_lock;
 
+  static boost::optional<QVariantMap> readGrammar(const QString& path);
+  static boost::optional<QVariantMap> readGrammarHeader(const QString& path);
+  // Call this with the write lock
+  static void addToIndex(const QString& path,
+                         const QString& scopeName,
+                         const QString& name,
+                         const QVector<QString>& fileTypes,
+                         const QString& firstLineMatch,
+                         bool hideFromUser);
+
   LanguageProvider() = delete;
   ~LanguageProvider() = delete;
 };
 
-// Language cannot be shared (means mutable) across multiple documents because RootPattern has some
-// cache and is unique for a certain document.
+// Language is immutable after construction and shared across multiple documents.
 struct Language {
   QVector<QString> fileTypes;
   QString firstLineMatch;
   std::unique_ptr<RootPattern> rootPattern;  // patterns
   QString scopeName;
-  Language* baseLanguage;
   bool hideFromUser;
+  // unique index of this language in the process
+  const int index;
+  // number of patterns in this language
+  int patternCount;
+  // all the patterns in this language indexed by Pattern::id
+  std::vector<Pattern*> patterns;
 
-  explicit Language(QVariantMap rootMap);
+  explicit Language(const QVariantMap& rootMap);
 
   QString name();
-  void clearCache();
 
   bool operator==(const Language& other) { return scopeName == other.scopeName; }
 };
@@ -186,16 +298,28 @@ class LanguageParser {
   DEFAULT_COPY_AND_MOVE(LanguageParser)
 
   boost::optional<RootNode> parse();
-  boost::optional<std::tuple<QList<Node>, Region> > parse(QList<Node> children, Region region);
+  boost::optional<std::tuple<QList<Node>, int>> parseChunk(int beginPos, int endPos);
+  boost::optional<QList<Node>> parseProvisionally(const Region& region);
+  boost::optional<std::tuple<QList<Node>, Region, Region>> parse(const ScopeTree& tree,
+                                                                 Region region);
   QString getData(int start, int end);
+  Language* language() { return m_lang; }
 
   QString text();
 
   void setText(const QString& text);
+  boost::optional<Region> applyEdit(int position, int charsRemoved, const QString& insertedText);
 
   int beginOfLine(int pos);
   int endOfLine(int pos);
 
+  // A line longer than this is left as plain text, because highlighting e.g. minified code takes
+  // too long. 0 means no limit
+  int maxLineLength() const { return m_maxLineLength; }
+  void setMaxLineLength(int maxLineLength) { m_maxLineLength = maxLineLength; }
+
+  // The state is atomic, so these methods can be called from any thread while parsing.
+  // A canceled parser stays canceled until it's reset by setState(State::Idle).
   bool isIdle();
   void setState(State state);
   bool isFullParsing();
@@ -204,21 +328,39 @@ class LanguageParser {
   bool isCancelRequested();
 
  private:
-  std::shared_ptr<Language> m_lang;
+  Language* m_lang;
   QString m_text;
-  State m_state;
+  int m_maxLineLength;
+  // holds State
+  QAtomicInt m_state;
 
-  LanguageParser(std::unique_ptr<Language> lang, const QString& str);
+  bool beginParsing(State state);
+  bool endParsing(State state);
 
-  std::tuple<QList<Node>, Region> parse(const QString& text, QList<Node> children, Region region);
-  void clearCache();
+  LanguageParser(Language* lang, const QString& str);
+
+  std::tuple<QList<Node>, Region, int> parse(const QString& text,
+                                             const ScopeTree& tree,
+                                             Region region);
+  boost::optional<std::tuple<Node, Region>> reparseInnermostNode(const QString& text,
+                                                                 const ScopeTree& tree,
+                                                                 const Region& region);
 };
 
 struct Node {
   Region region;
   QString name;
+  // atom of name in ScopeAtoms. 0 if it isn't interned yet
+  int nameAtom = 0;
   QList<Node> children;
 
+  // Pattern which created this node. nullptr for capture and contentName nodes
+  Pattern* pattern = nullptr;
+  // Region between begin and end of a begin/end node. Parsing can resume from here after an edit
+  Region contentRegion;
+  // Strings captured by begin regex. Used to resume parsing of end regex with back references
+  QStringList beginCapturedStrs;
+
   // This is used in createCaptureNodes
   QList<Node*> tmpChildren;
 
@@ -0,0 +1,250 @@
+#include <cstring>
+#include <QtAlgorithms>
+
+#include "LiteralSearcher.h"
+
+// SSE2 is always available on x86-64. AVX2 is used only if the CPU supports it, so its functions
+// are compiled for AVX2 separately from the rest.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LITERAL_SEARCHER_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#define LITERAL_SEARCHER_AVX2
+#define TARGET_AVX2
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__GNUC__) || defined(__clang__)
+#define LITERAL_SEARCHER_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
+
+namespace {
+
+inline ushort foldAscii(ushort ch) {
+  return ch >= 'A' && ch <= 'Z' ? ch | 0x20 : ch;
+}
+
+// Returns true if Onigmo folds ch into a string with an ASCII letter, e.g. U+017F into "s" and
+// U+FB01 into "fi"
+inline bool foldsIntoAscii(ushort ch) {
+  return ch == 0x00DF || ch == 0x0130 || ch == 0x0149 || ch == 0x017F || ch == 0x01F0 ||
+         (ch >= 0x1E96 && ch <= 0x1E9E) || ch == 0x212A || (ch >= 0xFB00 && ch <= 0xFB06);
+}
+
+// Returns true if text has a character folding into ASCII in [pos, end)
+bool hasCharFoldingIntoAscii(const ushort* text, int pos, int end) {
+#ifdef LITERAL_SEARCHER_SSE2
+  // Only vectors with a character from U+00DF are checked one by one
+  const __m128i beforeFirst = _mm_set1_epi16(static_cast<short>(0x00DE));
+  const __m128i zero = _mm_setzero_si128();
+  for (; pos + 8 <= end; pos += 8) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(block, beforeFirst), zero)) != 0xFFFF) {
+      for (int i = pos; i < pos + 8; i++) {
+        if (foldsIntoAscii(text[i])) {
+          return true;
+        }
+      }
+    }
+  }
+#endif
+  for (; pos < end; pos++) {
+    if (foldsIntoAscii(text[pos])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if text starts with str, which is folded if caseSensitive is false
+bool startsWith(const ushort* text, const ushort* str, int length, bool caseSensitive) {
+  if (caseSensitive) {
+    return std::memcmp(text, str, length * sizeof(ushort)) == 0;
+  }
+  for (int i = 0; i < length; i++) {
+    if (foldAscii(text[i]) != str[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Each search function below checks the starts from pos to last, and returns the index of the
+// first occurrence or -1. A vectorized one stops when the rest is shorter than a vector, and
+// leaves pos at the first start it hasn't checked.
+
+int indexInScalar(const ushort* text,
+                  int pos,
+                  int last,
+                  const ushort* str,
+                  int length,
+                  bool caseSensitive) {
+  for (; pos <= last; pos++) {
+    const ushort ch = caseSensitive ? text[pos] : foldAscii(text[pos]);
+    if (ch == str[0] && startsWith(text + pos, str, length, caseSensitive)) {
+      return pos;
+    }
+  }
+  return -1;
+}
+
+#ifdef LITERAL_SEARCHER_SSE2
+inline __m128i foldAscii(__m128i chars) {
+  const __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi16(chars, _mm_set1_epi16('A' - 1)),
+                                        _mm_cmplt_epi16(chars, _mm_set1_epi16('Z' + 1)));
+  return _mm_or_si128(chars, _mm_and_si128(isUpper, _mm_set1_epi16(0x20)));
+}
+
+int indexInSse2(const ushort* text,
+                int& pos,
+                int last,
+                const ushort* str,
+                int length,
+                bool caseSensitive) {
+  const __m128i first = _mm_set1_epi16(static_cast<short>(str[0]));
+  const __m128i lastChar = _mm_set1_epi16(static_cast<short>(str[length - 1]));
+  for (; pos + 7 <= last; pos += 8) {
+    __m128i firstBlock = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+    __m128i lastBlock =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos + length - 1));
+    if (!caseSensitive) {
+      firstBlock = foldAscii(firstBlock);
+      lastBlock = foldAscii(lastBlock);
+    }
+    // 2 bits for each start whose first and last characters match
+    quint32 mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi16(firstBlock, first), _mm_cmpeq_epi16(lastBlock, lastChar)));
+    while (mask) {
+      const int offset = qCountTrailingZeroBits(mask) / 2;
+      if (startsWith(text + pos + offset, str, length, caseSensitive)) {
+        return pos + offset;
+      }
+      mask &= ~(3u << (offset * 2));
+    }
+  }
+  return -1;
+}
+#endif
+
+#ifdef LITERAL_SEARCHER_AVX2
+bool hasAvx2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  // The OS has to save the AVX registers too
+  __cpuid(info, 1);
+  const bool hasOsxsaveAndAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+  if (!hasOsxsaveAndAvx || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+TARGET_AVX2 int indexInAvx2(const ushort* text,
+                            int& pos,
+                            int last,
+                            const ushort* str,
+                            int length,
+                            bool caseSensitive) {
+  const __m256i first = _mm256_set1_epi16(static_cast<short>(str[0]));
+  const __m256i lastChar = _mm256_set1_epi16(static_cast<short>(str[length - 1]));
+  const __m256i beforeA = _mm256_set1_epi16('A' - 1);
+  const __m256i afterZ = _mm256_set1_epi16('Z' + 1);
+  const __m256i caseBit = _mm256_set1_epi16(0x20);
+  for (; pos + 15 <= last; pos += 16) {
+    __m256i firstBlock = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + pos));
+    __m256i lastBlock =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + pos + length - 1));
+    if (!caseSensitive) {
+      const __m256i firstIsUpper = _mm256_and_si256(_mm256_cmpgt_epi16(firstBlock, beforeA),
+                                                    _mm256_cmpgt_epi16(afterZ, firstBlock));
+      firstBlock = _mm256_or_si256(firstBlock, _mm256_and_si256(firstIsUpper, caseBit));
+      const __m256i lastIsUpper = _mm256_and_si256(_mm256_cmpgt_epi16(lastBlock, beforeA),
+                                                   _mm256_cmpgt_epi16(afterZ, lastBlock));
+      lastBlock = _mm256_or_si256(lastBlock, _mm256_and_si256(lastIsUpper, caseBit));
+    }
+    // 2 bits for each start whose first and last characters match
+    quint32 mask = static_cast<quint32>(_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi16(firstBlock, first), _mm256_cmpeq_epi16(lastBlock, lastChar))));
+    while (mask) {
+      const int offset = qCountTrailingZeroBits(mask) / 2;
+      if (startsWith(text + pos + offset, str, length, caseSensitive)) {
+        return pos + offset;
+      }
+      mask &= ~(3u << (offset * 2));
+    }
+  }
+  return -1;
+}
+#endif
+}
+
+namespace core {
+
+boost::optional<LiteralSearcher> LiteralSearcher::create(const QString& str, bool caseSensitive) {
+  if (str.isEmpty()) {
+    return boost::none;
+  }
+
+  if (caseSensitive) {
+    return LiteralSearcher(str, true);
+  }
+
+  // Folding non ASCII characters isn't supported
+  QString folded = str;
+  for (QChar& ch : folded) {
+    if (ch.unicode() >= 0x80) {
+      return boost::none;
+    }
+    ch = QChar(foldAscii(ch.unicode()));
+  }
+  return LiteralSearcher(folded, false);
+}
+
+int LiteralSearcher::indexIn(const QString& text, int begin, int end) const {
+  const int length = m_str.size();
+  const int last = qMin(end < 0 ? text.size() : end, text.size()) - length;
+  int pos = qMax(0, begin);
+  if (pos > last) {
+    return -1;
+  }
+
+  const ushort* data = reinterpret_cast<const ushort*>(text.constData());
+  const ushort* str = reinterpret_cast<const ushort*>(m_str.constData());
+  int index = -1;
+#ifdef LITERAL_SEARCHER_AVX2
+  static const bool isAvx2Supported = hasAvx2();
+  if (isAvx2Supported) {
+    index = indexInAvx2(data, pos, last, str, length, m_caseSensitive);
+  }
+#endif
+#ifdef LITERAL_SEARCHER_SSE2
+  if (index < 0) {
+    index = indexInSse2(data, pos, last, str, length, m_caseSensitive);
+  }
+#endif
+  return index >= 0 ? index : indexInScalar(data, pos, last, str, length, m_caseSensitive);
+}
+
+bool LiteralSearcher::canSearch(const QString& text, int begin, int end) const {
+  if (m_caseSensitive) {
+    return true;
+  }
+  const int last = qMin(end < 0 ? text.size() : end, text.size());
+  return !hasCharFoldingIntoAscii(reinterpret_cast<const ushort*>(text.constData()),
+                                  qMax(0, begin), last);
+}
+
+LiteralSearcher::LiteralSearcher(const QString& str, bool caseSensitive)
+    : m_str(str), m_caseSensitive(caseSensitive) {}
+
+}  // namespace core
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <boost/optional.hpp>
+#include <QString>
+
+#include "macros.h"
+
+namespace core {
+
+// Finds a plain string in UTF-16 text without a regex search.
+// Candidates are found by comparing the first and the last characters of the string with 16 (AVX2)
+// or 8 (SSE2) positions of text at once, and each candidate is verified by comparing the whole
+// string. The case insensitive variant folds only ASCII letters, so it can't search text which
+// has a non ASCII character folding into ASCII letters.
+class LiteralSearcher {
+ public:
+  // Returns none if str is empty, or if caseSensitive is false and str has a non ASCII character
+  static boost::optional<LiteralSearcher> create(const QString& str, bool caseSensitive);
+
+  ~LiteralSearcher() = default;
+  DEFAULT_COPY_AND_MOVE(LiteralSearcher)
+
+  int length() const { return m_str.size(); }
+
+  // Returns the index of the first occurrence within [begin, end), or -1. Like a forward regex
+  // search, an occurrence has to end within end. end -1 means the end of text.
+  int indexIn(const QString& text, int begin, int end = -1) const;
+  // Returns false if the case insensitive regex of str can match a character in [begin, end) which
+  // indexIn doesn't fold, like U+212A KELVIN SIGN matching "k" or U+00DF matching "ss"
+  bool canSearch(const QString& text, int begin, int end = -1) const;
+
+ private:
+  // ASCII letters are folded to lower case if m_caseSensitive is false
+  QString m_str;
+  bool m_caseSensitive;
+
+  LiteralSearcher(const QString& str, bool caseSensitive);
+};
+
+}  // namespace core
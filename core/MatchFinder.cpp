@@ -0,0 +1,141 @@
+#include <boost/optional.hpp>
+#include <QRunnable>
+
+#include "MatchFinder.h"
+#include "Regexp.h"
+
+namespace core {
+
+namespace {
+
+// Number of characters whose matches are notified at once. Cancellation is checked for each
+// chunk.
+constexpr int CHUNK_SIZE = 256 * 1024;
+
+// Searches a text in chunks in a pool thread and sends the matches back to MatchFinder
+class FindTask : public QRunnable {
+ public:
+  FindTask(MatchFinder* finder,
+           int findId,
+           std::shared_ptr<QAtomicInt> canceled,
+           std::shared_ptr<const Regexp> regexp,
+           const QString& text,
+           int begin,
+           int end)
+      : m_finder(finder),
+        m_findId(findId),
+        m_canceled(canceled),
+        m_regexp(regexp),
+        m_text(text),
+        m_begin(qBound(0, begin, text.size())),
+        m_end(end < 0 ? text.size() : qBound(m_begin, end, text.size())) {}
+
+  void run() override {
+    int matchCount = 0;
+    int pos = m_begin;
+    // the first match after the last chunk. Chunks before it are skipped without searching.
+    boost::optional<Region> nextMatch;
+    while (!m_canceled->load()) {
+      const int chunkEnd = qMin(pos + CHUNK_SIZE, m_end);
+      QVector<Region> regions;
+      int lastMatchEnd = pos;
+      if (!nextMatch || nextMatch->begin() < chunkEnd) {
+        nextMatch = boost::none;
+        // A match has to end within the searched range, so the rest of the text is searched to
+        // find a match of any length across chunkEnd. A match beginning at chunkEnd or later is
+        // left to a later chunk.
+        m_regexp->forEachMatch(m_text, pos, m_end, [&](const Region& region) {
+          if (m_canceled->load()) {
+            return false;
+          }
+          if (region.begin() >= chunkEnd && chunkEnd < m_end) {
+            nextMatch = region;
+            return false;
+          }
+          regions.append(region);
+          lastMatchEnd = region.end();
+          return true;
+        });
+      }
+
+      if (m_canceled->load()) {
+        return;
+      }
+      if (!regions.isEmpty()) {
+        matchCount += regions.size();
+        QMetaObject::invokeMethod(m_finder, "chunkDone", Qt::QueuedConnection,
+                                  Q_ARG(int, m_findId), Q_ARG(QVector<Region>, regions));
+      }
+      // No match is left after this chunk if the search didn't stop at one
+      if (chunkEnd >= m_end || !nextMatch) {
+        QMetaObject::invokeMethod(m_finder, "findDone", Qt::QueuedConnection,
+                                  Q_ARG(int, m_findId), Q_ARG(int, matchCount));
+        return;
+      }
+      // a match may continue after chunkEnd
+      pos = qMax(chunkEnd, lastMatchEnd);
+    }
+  }
+
+ private:
+  MatchFinder* m_finder;
+  int m_findId;
+  std::shared_ptr<QAtomicInt> m_canceled;
+  std::shared_ptr<const Regexp> m_regexp;
+  QString m_text;
+  int m_begin;
+  int m_end;
+};
+}
+
+MatchFinder::MatchFinder(QObject* parent)
+    : QObject(parent), m_canceled(std::make_shared<QAtomicInt>(0)), m_findId(0), m_isRunning(false) {
+  qRegisterMetaType<QVector<core::Region>>("QVector<Region>");
+
+  // finds run one at a time in order
+  m_pool.setMaxThreadCount(1);
+}
+
+MatchFinder::~MatchFinder() {
+  cancel();
+  m_pool.waitForDone();
+}
+
+void MatchFinder::find(std::shared_ptr<const Regexp> regexp,
+                       const QString& text,
+                       int begin,
+                       int end) {
+  cancel();
+  if (!regexp) {
+    return;
+  }
+
+  m_canceled = std::make_shared<QAtomicInt>(0);
+  m_isRunning = true;
+  m_pool.start(new FindTask(this, ++m_findId, m_canceled, regexp, text, begin, end));
+}
+
+void MatchFinder::cancel() {
+  // A superseded task which hasn't started yet is removed, and a running one stops at its next
+  // match or chunk
+  m_pool.clear();
+  m_canceled->store(1);
+  m_isRunning = false;
+  // results of the canceled find which are already queued are ignored by their old id
+  ++m_findId;
+}
+
+void MatchFinder::chunkDone(int findId, QVector<Region> regions) {
+  if (findId == m_findId) {
+    emit matchesFound(regions);
+  }
+}
+
+void MatchFinder::findDone(int findId, int matchCount) {
+  if (findId == m_findId) {
+    m_isRunning = false;
+    emit finished(matchCount);
+  }
+}
+
+}  // namespace core
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <QAtomicInt>
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+
+#include "macros.h"
+#include "Region.h"
+
+namespace core {
+
+class Regexp;
+
+// Finds all the matches of a regexp in a text in a pool thread, so searching a large text doesn't
+// block the UI. The text is searched in chunks and the matches in each chunk are notified by
+// matchesFound as soon as it's searched. A new find cancels the running one, and nothing of a
+// canceled find is notified after it.
+// Call public methods only from the main thread.
+class MatchFinder : public QObject {
+  Q_OBJECT
+  DISABLE_COPY_AND_MOVE(MatchFinder)
+
+ public:
+  explicit MatchFinder(QObject* parent = nullptr);
+  // Cancels the running find and waits for it
+  ~MatchFinder();
+
+  // Finds regexp in [begin, end) of text. end -1 means the end of text.
+  void find(std::shared_ptr<const Regexp> regexp,
+            const QString& text,
+            int begin = 0,
+            int end = -1);
+  void cancel();
+  bool isRunning() const { return m_isRunning; }
+
+ signals:
+  // regions are sorted and follow the ones notified before in the same find
+  void matchesFound(QVector<Region> regions);
+  void finished(int matchCount);
+
+ private slots:
+  // called by FindTask in a pool thread through a queued connection
+  void chunkDone(int findId, QVector<Region> regions);
+  void findDone(int findId, int matchCount);
+
+ private:
+  QThreadPool m_pool;
+  // set to cancel the running task
+  std::shared_ptr<QAtomicInt> m_canceled;
+  int m_findId;
+  bool m_isRunning;
+};
+
+}  // namespace core
@@ -1,90 +1,171 @@
-#include <QDomElement>
-#include <QDomNode>
-#include <QDomDocument>
+#include <vector>
+#include <QXmlStreamReader>
 
 #include "PListParser.h"
 
 namespace core {
 
+namespace {
+
+// Builds QVariantMap and QVariantList from the events
+class VariantBuilder : public PListVisitor {
+ public:
+  QVariant result() const { return m_result; }
+
+  void beginDict() override {
+    m_stack.push_back(Container{true, QVariantMap(), QVariantList(), ""});
+  }
+
+  void endDict() override {
+    QVariant map = m_stack.back().map;
+    m_stack.pop_back();
+    add(map);
+  }
+
+  void beginArray() override {
+    m_stack.push_back(Container{false, QVariantMap(), QVariantList(), ""});
+  }
+
+  void endArray() override {
+    QVariant list = m_stack.back().list;
+    m_stack.pop_back();
+    add(list);
+  }
+
+  void key(const QString& key) override { m_stack.back().key = key; }
+  void value(const QVariant& value) override { add(value); }
+
+ private:
+  struct Container {
+    bool isDict;
+    QVariantMap map;
+    QVariantList list;
+    QString key;
+  };
+
+  std::vector<Container> m_stack;
+  QVariant m_result;
+
+  void add(const QVariant& value) {
+    if (m_stack.empty()) {
+      m_result = value;
+    } else if (!m_stack.back().isDict) {
+      m_stack.back().list.append(value);
+    } else if (!m_stack.back().key.isEmpty()) {
+      m_stack.back().map.insert(m_stack.back().key, value);
+    }
+  }
+};
+}
+
+bool PListParser::parse(QIODevice* device, PListVisitor* visitor) {
+  QXmlStreamReader reader(device);
+  if (!readRoot(reader)) {
+    warn(reader);
+    return false;
+  }
+  readValue(reader, visitor);
+  if (reader.hasError()) {
+    warn(reader);
+    return false;
+  }
+  return true;
+}
+
 QVariant PListParser::parsePList(QIODevice* device) {
+  VariantBuilder builder;
+  if (!parse(device, &builder)) {
+    return QVariantMap();
+  }
+  return builder.result();
+}
+
+QVariantMap PListParser::parseRootValues(QIODevice* device, const QStringList& keys) {
   QVariantMap result;
-  QDomDocument doc;
-  QString errorMessage;
-  int errorLine;
-  int errorColumn;
-  bool success = doc.setContent(device, false, &errorMessage, &errorLine, &errorColumn);
-  if (!success) {
-    qDebug() << "PListParser Warning: Could not parse PList file!";
-    qDebug() << "Error message: " << errorMessage;
-    qDebug() << "Error line: " << errorLine;
-    qDebug() << "Error column: " << errorColumn;
+  QXmlStreamReader reader(device);
+  if (!readRoot(reader) || reader.name() != QLatin1String("dict")) {
+    qDebug() << "PListParser Warning: root is not dict";
     return result;
   }
-  QDomElement root = doc.documentElement();
-  if (root.attribute(QStringLiteral("version"), QStringLiteral("1.0")) != QLatin1String("1.0")) {
+
+  QString currentKey;
+  while (result.size() < keys.size() && reader.readNextStartElement()) {
+    if (reader.name() == QLatin1String("key")) {
+      currentKey = reader.readElementText();
+    } else if (keys.contains(currentKey)) {
+      VariantBuilder builder;
+      readValue(reader, &builder);
+      result[currentKey] = builder.result();
+    } else {
+      reader.skipCurrentElement();
+    }
+  }
+  if (reader.hasError()) {
+    warn(reader);
+  }
+  return result;
+}
+
+// Moves reader to the start element of the root value
+bool PListParser::readRoot(QXmlStreamReader& reader) {
+  if (!reader.readNextStartElement() || reader.name() != QLatin1String("plist")) {
+    return false;
+  }
+  if (reader.attributes().hasAttribute(QStringLiteral("version")) &&
+      reader.attributes().value(QStringLiteral("version")) != QLatin1String("1.0")) {
     qDebug() << "PListParser Warning: plist is using an unknown format version, parsing might fail "
                 "unexpectedly";
   }
-  return parseElement(root.firstChild().toElement());
+  return reader.readNextStartElement();
 }
 
-QVariant PListParser::parseElement(const QDomElement& e) {
-  QString tagName = e.tagName();
-  QVariant result;
+// Reports the current element to visitor and moves reader to its end element
+void PListParser::readValue(QXmlStreamReader& reader, PListVisitor* visitor) {
+  const QStringRef tagName = reader.name();
   if (tagName == QLatin1String("dict")) {
-    result = parseDictElement(e);
+    visitor->beginDict();
+    while (reader.readNextStartElement()) {
+      if (reader.name() == QLatin1String("key")) {
+        visitor->key(reader.readElementText());
+      } else {
+        readValue(reader, visitor);
+      }
+    }
+    visitor->endDict();
   } else if (tagName == QLatin1String("array")) {
-    result = parseArrayElement(e);
+    visitor->beginArray();
+    while (reader.readNextStartElement()) {
+      readValue(reader, visitor);
+    }
+    visitor->endArray();
   } else if (tagName == QLatin1String("string")) {
-    result = e.text();
+    visitor->value(reader.readElementText());
   } else if (tagName == QLatin1String("data")) {
-    result = QByteArray::fromBase64(e.text().toUtf8());
+    visitor->value(QByteArray::fromBase64(reader.readElementText().toUtf8()));
   } else if (tagName == QLatin1String("integer")) {
-    result = e.text().toInt();
+    visitor->value(reader.readElementText().toInt());
   } else if (tagName == QLatin1String("real")) {
-    result = e.text().toFloat();
+    visitor->value(reader.readElementText().toFloat());
   } else if (tagName == QLatin1String("true")) {
-    result = true;
+    reader.skipCurrentElement();
+    visitor->value(true);
   } else if (tagName == QLatin1String("false")) {
-    result = false;
+    reader.skipCurrentElement();
+    visitor->value(false);
   } else if (tagName == QLatin1String("date")) {
-    result = QDateTime::fromString(e.text(), Qt::ISODate);
+    visitor->value(QDateTime::fromString(reader.readElementText(), Qt::ISODate));
   } else {
-    qDebug() << "PListParser Warning: Invalid tag found: " << e.tagName() << e.text();
+    qDebug() << "PListParser Warning: Invalid tag found: " << tagName;
+    reader.skipCurrentElement();
+    visitor->value(QVariant());
   }
-  return result;
-}
-
-QVariantList PListParser::parseArrayElement(const QDomElement& element) {
-  QVariantList result;
-  QDomNodeList children = element.childNodes();
-  for (int i = 0; i < children.count(); i++) {
-    QDomNode child = children.at(i);
-    QDomElement e = child.toElement();
-    if (!e.isNull()) {
-      result.append(parseElement(e));
-    }
-  }
-  return result;
 }
 
-QVariantMap PListParser::parseDictElement(const QDomElement& element) {
-  QVariantMap result;
-  QDomNodeList children = element.childNodes();
-  QString currentKey;
-  for (int i = 0; i < children.count(); i++) {
-    QDomNode child = children.at(i);
-    QDomElement e = child.toElement();
-    if (!e.isNull()) {
-      QString tagName = e.tagName();
-      if (tagName == QLatin1String("key")) {
-        currentKey = e.text();
-      } else if (!currentKey.isEmpty()) {
-        result[currentKey] = parseElement(e);
-      }
-    }
-  }
-  return result;
+void PListParser::warn(const QXmlStreamReader& reader) {
+  qDebug() << "PListParser Warning: Could not parse PList file!";
+  qDebug() << "Error message: " << reader.errorString();
+  qDebug() << "Error line: " << reader.lineNumber();
+  qDebug() << "Error column: " << reader.columnNumber();
 }
 
 }  // namespace core
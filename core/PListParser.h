@@ -1,18 +1,40 @@
 #pragma once
 
 #include <QtCore>
-#include <QDomElement>
 
 namespace core {
 
+// Receives the events of a property list in document order.
+// A dict is reported as beginDict, (key, value)*, endDict where a value is a scalar, a dict or an
+// array.
+class PListVisitor {
+ public:
+  virtual ~PListVisitor() = default;
+
+  virtual void beginDict() = 0;
+  virtual void endDict() = 0;
+  virtual void beginArray() = 0;
+  virtual void endArray() = 0;
+  // key of the next value in the current dict
+  virtual void key(const QString& key) = 0;
+  // string, data, integer, real, bool or date. Invalid for an unknown tag.
+  virtual void value(const QVariant& value) = 0;
+};
+
+// Streaming property list parser with QXmlStreamReader. It doesn't build a DOM tree.
 class PListParser {
  public:
+  // Reports the root value of the property list in device to visitor. Returns false on error.
+  static bool parse(QIODevice* device, PListVisitor* visitor);
   static QVariant parsePList(QIODevice* device);
+  // Reads only the values of keys in the root dict. Other values are skipped without being
+  // converted and reading stops once all the keys are found.
+  static QVariantMap parseRootValues(QIODevice* device, const QStringList& keys);
 
  private:
-  static QVariant parseElement(const QDomElement& e);
-  static QVariantList parseArrayElement(const QDomElement& node);
-  static QVariantMap parseDictElement(const QDomElement& element);
+  static bool readRoot(QXmlStreamReader& reader);
+  static void readValue(QXmlStreamReader& reader, PListVisitor* visitor);
+  static void warn(const QXmlStreamReader& reader);
 };
 
 }  // namespace core
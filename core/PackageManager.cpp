@@ -25,7 +25,7 @@ void loadGrammers(const QString& path) {
     return;
 
   foreach (const QString& fileName, dir.entryList(tmLanguageFilter)) {
-    LanguageProvider::loadLanguage(dir.filePath(fileName));
+    LanguageProvider::registerLanguage(dir.filePath(fileName));
   }
 }
 
@@ -77,6 +77,10 @@ void PackageManager::_loadAllPackageContents() {
       loadPackageContents(path + QStringLiteral("/node_modules/") + pkg, pkg);
     }
   }
+
+  if (!LanguageProvider::saveCache()) {
+    qWarning("failed to save the grammar cache");
+  }
 }
 
 PackageManager::PackageManager() {}
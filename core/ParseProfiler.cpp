@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <QTextStream>
+
+#include "ParseProfiler.h"
+#include "LanguageParser.h"
+
+namespace {
+
+using core::Language;
+using core::Pattern;
+using core::PatternCounters;
+
+// Returns the name of pattern or its regex when it doesn't have a name
+QString describe(Pattern* pattern) {
+  if (!pattern->name.isEmpty()) {
+    return pattern->name;
+  } else if (pattern->match) {
+    return pattern->match->pattern();
+  } else if (pattern->begin) {
+    return pattern->begin->pattern();
+  } else if (!pattern->include.isEmpty()) {
+    return "include " + pattern->include;
+  }
+  return pattern->parent ? QString("patterns of " + describe(pattern->parent)) : QString("root");
+}
+
+QVariantMap toMap(const PatternCounters& counters) {
+  QVariantMap map;
+  map["attempts"] = counters.attempts;
+  map["matches"] = counters.matches;
+  map["cacheHits"] = counters.cacheHits;
+  map["msecs"] = counters.nsecs / 1e6;
+  map["bytesScanned"] = counters.bytesScanned;
+  return map;
+}
+}
+
+namespace core {
+
+QAtomicInt ParseProfiler::s_enabled(0);
+
+void PatternStats::add(const PatternCounters& counters) {
+  m_attempts.fetchAndAddRelaxed(counters.attempts);
+  m_matches.fetchAndAddRelaxed(counters.matches);
+  m_cacheHits.fetchAndAddRelaxed(counters.cacheHits);
+  m_nsecs.fetchAndAddRelaxed(counters.nsecs);
+  m_bytesScanned.fetchAndAddRelaxed(counters.bytesScanned);
+}
+
+PatternCounters PatternStats::load() const {
+  PatternCounters counters;
+  counters.attempts = m_attempts.load();
+  counters.matches = m_matches.load();
+  counters.cacheHits = m_cacheHits.load();
+  counters.nsecs = m_nsecs.load();
+  counters.bytesScanned = m_bytesScanned.load();
+  return counters;
+}
+
+void PatternStats::reset() {
+  m_attempts.store(0);
+  m_matches.store(0);
+  m_cacheHits.store(0);
+  m_nsecs.store(0);
+  m_bytesScanned.store(0);
+}
+
+bool ParseProfiler::isEnabled() {
+  return enabled();
+}
+
+void ParseProfiler::setEnabled(bool enabled) {
+  s_enabled.store(enabled ? 1 : 0);
+}
+
+void ParseProfiler::reset() {
+  for (Language* lang : LanguageProvider::loadedLanguages()) {
+    for (Pattern* pattern : lang->patterns) {
+      pattern->stats.reset();
+    }
+  }
+}
+
+QVariantList ParseProfiler::hottestPatterns(int count) {
+  std::vector<std::pair<Pattern*, PatternCounters>> patterns;
+  for (Language* lang : LanguageProvider::loadedLanguages()) {
+    for (Pattern* pattern : lang->patterns) {
+      const PatternCounters counters = pattern->stats.load();
+      if (!counters.isEmpty()) {
+        patterns.emplace_back(pattern, counters);
+      }
+    }
+  }
+
+  count = qMin(qMax(0, count), static_cast<int>(patterns.size()));
+  std::partial_sort(patterns.begin(), patterns.begin() + count, patterns.end(),
+                    [](const std::pair<Pattern*, PatternCounters>& x,
+                       const std::pair<Pattern*, PatternCounters>& y) {
+                      return x.second.nsecs > y.second.nsecs;
+                    });
+
+  QVariantList list;
+  for (int i = 0; i < count; i++) {
+    QVariantMap map = toMap(patterns[i].second);
+    map["grammar"] = patterns[i].first->lang->scopeName;
+    map["pattern"] = describe(patterns[i].first);
+    list.append(map);
+  }
+  return list;
+}
+
+QVariantList ParseProfiler::grammars() {
+  QVariantList list;
+  for (Language* lang : LanguageProvider::loadedLanguages()) {
+    PatternCounters sum;
+    for (Pattern* pattern : lang->patterns) {
+      sum += pattern->stats.load();
+    }
+    QVariantMap map = toMap(sum);
+    map["grammar"] = lang->scopeName;
+    list.append(map);
+  }
+  return list;
+}
+
+QString ParseProfiler::dump(int count) {
+  QString result;
+  QTextStream out(&result);
+  out << "msecs\tattempts\tmatches\tcache hits\tbytes scanned\tgrammar\tpattern\n";
+  for (const QVariant& var : hottestPatterns(count)) {
+    const QVariantMap map = var.toMap();
+    out << QString::number(map["msecs"].toDouble(), 'f', 3) << '\t' << map["attempts"].toLongLong()
+        << '\t' << map["matches"].toLongLong() << '\t' << map["cacheHits"].toLongLong() << '\t'
+        << map["bytesScanned"].toLongLong() << '\t' << map["grammar"].toString() << '\t'
+        << map["pattern"].toString() << '\n';
+  }
+  out.flush();
+  return result;
+}
+
+}  // namespace core
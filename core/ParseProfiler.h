@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QObject>
+#include <QVariantList>
+
+#include "macros.h"
+#include "Singleton.h"
+
+namespace core {
+
+struct Pattern;
+
+// Counters of the regex searches of a pattern
+struct PatternCounters {
+  qint64 attempts = 0;
+  qint64 matches = 0;
+  // results reused from PatternCache without searching
+  qint64 cacheHits = 0;
+  qint64 nsecs = 0;
+  // bytes of the searched ranges
+  qint64 bytesScanned = 0;
+
+  bool isEmpty() const { return attempts == 0 && cacheHits == 0; }
+  PatternCounters& operator+=(const PatternCounters& other) {
+    attempts += other.attempts;
+    matches += other.matches;
+    cacheHits += other.cacheHits;
+    nsecs += other.nsecs;
+    bytesScanned += other.bytesScanned;
+    return *this;
+  }
+};
+
+// Counters of a pattern summed over all the parses. A parser thread collects counters in its
+// ParseState and adds them here atomically when the parse ends, so no lock is taken.
+class PatternStats {
+  DISABLE_COPY_AND_MOVE(PatternStats)
+
+ public:
+  PatternStats() = default;
+  ~PatternStats() = default;
+
+  void add(const PatternCounters& counters);
+  PatternCounters load() const;
+  void reset();
+
+ private:
+  QAtomicInteger<qint64> m_attempts;
+  QAtomicInteger<qint64> m_matches;
+  QAtomicInteger<qint64> m_cacheHits;
+  QAtomicInteger<qint64> m_nsecs;
+  QAtomicInteger<qint64> m_bytesScanned;
+};
+
+// Profiles regex searches per pattern and per grammar while it's enabled.
+// Exposed to JS as ParseProfiler.
+class ParseProfiler : public QObject, public Singleton<ParseProfiler> {
+  Q_OBJECT
+  DISABLE_COPY_AND_MOVE(ParseProfiler)
+
+ public:
+  // Checked by parsers for every search, so this is a relaxed atomic load
+  static bool enabled() { return s_enabled.load(); }
+
+  ~ParseProfiler() = default;
+
+ public slots:
+  bool isEnabled();
+  void setEnabled(bool enabled);
+  // Clears the counters of all the loaded grammars
+  void reset();
+  // Returns counters of the patterns which took the longest time
+  QVariantList hottestPatterns(int count = 20);
+  // Returns counters of the loaded grammars
+  QVariantList grammars();
+  // Returns hottestPatterns as a text table
+  QString dump(int count = 20);
+
+ private:
+  static QAtomicInt s_enabled;
+
+  friend class Singleton<ParseProfiler>;
+  ParseProfiler() = default;
+};
+
+}  // namespace core
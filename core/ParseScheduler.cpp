@@ -0,0 +1,380 @@
+#include <QDebug>
+#include <QRunnable>
+#include <QThread>
+
+#include "ParseScheduler.h"
+#include "SyntaxHighlighter.h"
+
+namespace core {
+
+namespace {
+
+// A text longer than this is parsed in chunks
+constexpr int PROGRESSIVE_PARSE_THRESHOLD = 64 * 1024;
+// Number of characters parsed at once in a progressive parse. Parsing this much should fit in a
+// frame.
+constexpr int CHUNK_SIZE = 16 * 1024;
+}
+
+// Applies edits to the text of a highlighter and parses it in a pool thread.
+// The result is sent back to ParseScheduler in the main thread.
+class ParseTask : public QRunnable {
+ public:
+  ParseTask(ParseScheduler* scheduler,
+            SyntaxHighlighter* highlighter,
+            int queueId,
+            std::shared_ptr<LanguageParser> parser,
+            std::shared_ptr<ParseScheduler::Viewport> viewport,
+            bool isFullParse,
+            QVector<ParseScheduler::Edit> edits,
+            ScopeTree tree,
+            boost::optional<Region> region)
+      : m_scheduler(scheduler),
+        m_highlighter(highlighter),
+        m_queueId(queueId),
+        m_parser(parser),
+        m_viewport(viewport),
+        m_isFullParse(isFullParse),
+        m_edits(edits),
+        m_tree(std::move(tree)),
+        m_region(region) {}
+
+  void run() override {
+    // Apply edits in order. A region affected by a previous edit is moved by later edits.
+    boost::optional<Region> region = m_region;
+    for (const auto& edit : m_edits) {
+      const int delta = edit.insertedText.length() - edit.charsRemoved;
+      if (region) {
+        region->adjust(edit.position + edit.charsRemoved, delta);
+      }
+      // The tree of a full parse is replaced
+      if (!m_isFullParse) {
+        m_tree.adjust(edit.position + edit.charsRemoved, delta);
+      }
+      if (auto editRegion =
+              m_parser->applyEdit(edit.position, edit.charsRemoved, edit.insertedText)) {
+        region = region ? region->sum(*editRegion) : *editRegion;
+      } else {
+        qWarning() << "invalid edit. position:" << edit.position
+                   << "charsRemoved:" << edit.charsRemoved;
+      }
+    }
+
+    // A new request may come before this task starts
+    if (!m_parser->isCancelRequested()) {
+      if (m_isFullParse && m_parser->text().length() > PROGRESSIVE_PARSE_THRESHOLD) {
+        if (auto tree = parseProgressively()) {
+          QMetaObject::invokeMethod(m_scheduler, "fullParseDone", Qt::QueuedConnection,
+                                    Q_ARG(SyntaxHighlighter*, m_highlighter),
+                                    Q_ARG(int, m_queueId), Q_ARG(ScopeTree, *tree),
+                                    Q_ARG(bool, true));
+          return;
+        }
+      } else if (m_isFullParse) {
+        if (auto rootNode = m_parser->parse()) {
+          QMetaObject::invokeMethod(m_scheduler, "fullParseDone", Qt::QueuedConnection,
+                                    Q_ARG(SyntaxHighlighter*, m_highlighter),
+                                    Q_ARG(int, m_queueId),
+                                    Q_ARG(ScopeTree, ScopeTree::fromRootNode(*rootNode)),
+                                    Q_ARG(bool, false));
+          return;
+        }
+      } else if (region) {
+        if (auto result = m_parser->parse(m_tree, *region)) {
+          const auto newSegments = ScopeSegment::fromNodes(std::get<0>(*result));
+          m_tree.replace(newSegments, std::get<1>(*result));
+          QMetaObject::invokeMethod(
+              m_scheduler, "partialParseDone", Qt::QueuedConnection,
+              Q_ARG(SyntaxHighlighter*, m_highlighter), Q_ARG(int, m_queueId),
+              Q_ARG(QVector<ScopeSegment>, newSegments), Q_ARG(Region, std::get<1>(*result)),
+              Q_ARG(Region, std::get<2>(*result)), Q_ARG(ScopeTree, m_tree));
+          return;
+        }
+      }
+    }
+
+    QMetaObject::invokeMethod(m_scheduler, "parseCanceled", Qt::QueuedConnection,
+                              Q_ARG(SyntaxHighlighter*, m_highlighter), Q_ARG(int, m_queueId),
+                              Q_ARG(bool, bool(region)), Q_ARG(Region, region ? *region : Region()),
+                              Q_ARG(ScopeTree, m_tree));
+  }
+
+ private:
+  // Parses the text in chunks from the beginning and notifies each chunk. If the visible region is
+  // ahead of the chunks, it's parsed provisionally first.
+  boost::optional<ScopeTree> parseProgressively() {
+    const int length = m_parser->text().length();
+    ScopeTree tree(m_parser->language()->scopeName, length);
+    Region provisionalRegion;
+    int pos = 0;
+    while (pos < length) {
+      Region visibleRegion;
+      {
+        QMutexLocker locker(&m_viewport->mutex);
+        visibleRegion = m_viewport->region;
+      }
+
+      if (visibleRegion.begin() > pos && visibleRegion.end() > pos + CHUNK_SIZE &&
+          !provisionalRegion.fullyCovers(visibleRegion)) {
+        auto nodes = m_parser->parseProvisionally(visibleRegion);
+        if (!nodes) {
+          return boost::none;
+        }
+        provisionalRegion = visibleRegion;
+        notifyChunk(ScopeSegment::fromNodes(*nodes), visibleRegion);
+      }
+
+      auto result = m_parser->parseChunk(pos, pos + CHUNK_SIZE);
+      if (!result) {
+        return boost::none;
+      }
+      const int nextPos = std::get<1>(*result);
+      const auto segments = ScopeSegment::fromNodes(std::get<0>(*result));
+      notifyChunk(segments, Region(pos, nextPos));
+      tree.replace(segments, Region(pos, nextPos));
+      pos = nextPos;
+    }
+    return tree;
+  }
+
+  void notifyChunk(const QVector<ScopeSegment>& segments, const Region& region) {
+    QMetaObject::invokeMethod(m_scheduler, "fullParseChunkDone", Qt::QueuedConnection,
+                              Q_ARG(SyntaxHighlighter*, m_highlighter), Q_ARG(int, m_queueId),
+                              Q_ARG(QVector<ScopeSegment>, segments), Q_ARG(Region, region));
+  }
+
+  ParseScheduler* m_scheduler;
+  SyntaxHighlighter* m_highlighter;
+  int m_queueId;
+  std::shared_ptr<LanguageParser> m_parser;
+  std::shared_ptr<ParseScheduler::Viewport> m_viewport;
+  bool m_isFullParse;
+  QVector<ParseScheduler::Edit> m_edits;
+  ScopeTree m_tree;
+  boost::optional<Region> m_region;
+};
+
+ParseScheduler::ParseScheduler() {
+  qRegisterMetaType<core::Region>("Region");
+  qRegisterMetaType<core::ScopeTree>("ScopeTree");
+  qRegisterMetaType<QVector<core::ScopeSegment>>("QVector<ScopeSegment>");
+  qRegisterMetaType<core::SyntaxHighlighter*>("SyntaxHighlighter*");
+
+  m_pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+void ParseScheduler::parse(SyntaxHighlighter* highlighter, const LanguageParser& parser) {
+  auto it = m_queues.find(highlighter);
+  if (it == m_queues.end()) {
+    it = m_queues.emplace(highlighter, Queue()).first;
+    it->second.id = ++m_lastQueueId;
+  }
+
+  Queue& queue = it->second;
+  if (queue.isRunning) {
+    qDebug() << "cancel parsing to start full parsing with a new text";
+    queue.parser->cancel();
+  }
+
+  // Replace the parser instead of modifying it because the running task may still use it
+  queue.parser = std::make_shared<LanguageParser>(parser);
+  queue.isFullParseRequested = true;
+  queue.edits.clear();
+  queue.tree = ScopeTree();
+  queue.region = boost::none;
+  schedule(highlighter);
+}
+
+void ParseScheduler::parse(SyntaxHighlighter* highlighter,
+                           int position,
+                           int charsRemoved,
+                           const QString& insertedText) {
+  auto it = m_queues.find(highlighter);
+  if (it == m_queues.end()) {
+    qWarning() << "parser not found";
+    return;
+  }
+
+  Queue& queue = it->second;
+  if (queue.isRunning) {
+    qDebug() << "cancel parsing of the previous text";
+    queue.parser->cancel();
+    // The running full parse doesn't have this edit, so parse the whole text again
+    if (queue.isRunningFullParse) {
+      queue.isFullParseRequested = true;
+    }
+  }
+
+  queue.edits.append(Edit{position, charsRemoved, insertedText});
+  schedule(highlighter);
+}
+
+void ParseScheduler::remove(SyntaxHighlighter* highlighter) {
+  auto it = m_queues.find(highlighter);
+  if (it == m_queues.end()) {
+    return;
+  }
+
+  // The running task keeps the parser until it finishes
+  if (it->second.isRunning) {
+    it->second.parser->cancel();
+  }
+  m_queues.erase(it);
+}
+
+void ParseScheduler::setVisible(SyntaxHighlighter* highlighter, bool visible) {
+  auto it = m_queues.find(highlighter);
+  if (it != m_queues.end()) {
+    it->second.isVisible = visible;
+  }
+}
+
+void ParseScheduler::setVisibleRegion(SyntaxHighlighter* highlighter, const Region& region) {
+  auto it = m_queues.find(highlighter);
+  if (it != m_queues.end()) {
+    QMutexLocker locker(&it->second.viewport->mutex);
+    it->second.viewport->region = region;
+  }
+}
+
+void ParseScheduler::quit() {
+  for (auto& pair : m_queues) {
+    if (pair.second.isRunning) {
+      pair.second.parser->cancel();
+    }
+  }
+  m_pool.clear();
+  m_pool.waitForDone(300);
+}
+
+void ParseScheduler::schedule(SyntaxHighlighter* highlighter) {
+  auto it = m_queues.find(highlighter);
+  if (it == m_queues.end()) {
+    return;
+  }
+
+  Queue& queue = it->second;
+  if (queue.isRunning ||
+      (!queue.isFullParseRequested && queue.edits.isEmpty() && !queue.region)) {
+    return;
+  }
+
+  // No task uses this parser now, so clear the cancel request for the last task
+  queue.parser->setState(LanguageParser::State::Idle);
+
+  auto task = new ParseTask(this, highlighter, queue.id, queue.parser, queue.viewport,
+                            queue.isFullParseRequested,
+                            queue.edits, std::move(queue.tree), queue.region);
+  queue.isRunning = true;
+  queue.isRunningFullParse = queue.isFullParseRequested;
+  queue.isFullParseRequested = false;
+  queue.edits.clear();
+  queue.region = boost::none;
+
+  // QThreadPool starts a task with higher priority first
+  m_pool.start(task, queue.isVisible ? 1 : 0);
+}
+
+void ParseScheduler::finish(SyntaxHighlighter* highlighter) {
+  auto it = m_queues.find(highlighter);
+  if (it != m_queues.end()) {
+    it->second.isRunning = false;
+    it->second.isRunningFullParse = false;
+    schedule(highlighter);
+  }
+}
+
+ParseScheduler::Queue* ParseScheduler::findQueue(SyntaxHighlighter* highlighter, int queueId) {
+  auto it = m_queues.find(highlighter);
+  return it != m_queues.end() && it->second.id == queueId ? &it->second : nullptr;
+}
+
+void ParseScheduler::fullParseDone(SyntaxHighlighter* highlighter,
+                                   int queueId,
+                                   ScopeTree tree,
+                                   bool isProgressive) {
+  Queue* queue = findQueue(highlighter, queueId);
+  if (!queue) {
+    return;
+  }
+
+  // Discard the result if the text has been changed since the task started
+  if (!queue->isFullParseRequested && queue->edits.isEmpty()) {
+    qDebug() << "full parse finished";
+    queue->tree = tree;
+    // The segments have been notified by fullParseProgressed
+    emit fullParseFinished(highlighter, isProgressive ? ScopeTree() : tree, isProgressive);
+  } else {
+    queue->isFullParseRequested = true;
+  }
+  finish(highlighter);
+}
+
+void ParseScheduler::fullParseChunkDone(SyntaxHighlighter* highlighter,
+                                        int queueId,
+                                        QVector<ScopeSegment> newSegments,
+                                        Region region) {
+  Queue* queue = findQueue(highlighter, queueId);
+  if (!queue) {
+    return;
+  }
+
+  // The running task will be canceled if the text has been changed
+  if (!queue->isFullParseRequested && queue->edits.isEmpty()) {
+    emit fullParseProgressed(highlighter, newSegments, region);
+  }
+}
+
+void ParseScheduler::partialParseDone(SyntaxHighlighter* highlighter,
+                                      int queueId,
+                                      QVector<ScopeSegment> newSegments,
+                                      Region region,
+                                      Region changedRegion,
+                                      ScopeTree tree) {
+  Queue* queue = findQueue(highlighter, queueId);
+  if (!queue) {
+    return;
+  }
+
+  if (queue->isFullParseRequested) {
+    finish(highlighter);
+    return;
+  }
+
+  // The next task applies the new edits to this tree
+  queue->tree = tree;
+  // Discard the result if the text has been changed since the task started. Its region is
+  // parsed again with the new edits.
+  if (queue->edits.isEmpty()) {
+    qDebug() << "partial parse finished";
+    emit partialParseFinished(highlighter, newSegments, region, changedRegion);
+  } else {
+    queue->region = region;
+  }
+  finish(highlighter);
+}
+
+void ParseScheduler::parseCanceled(SyntaxHighlighter* highlighter,
+                                   int queueId,
+                                   bool hasRegion,
+                                   Region region,
+                                   ScopeTree tree) {
+  qDebug() << "parse canceled";
+  Queue* queue = findQueue(highlighter, queueId);
+  if (!queue) {
+    return;
+  }
+
+  if (!queue->isRunningFullParse && !queue->isFullParseRequested) {
+    // The edits have been applied to tree even if parsing was canceled
+    queue->tree = tree;
+  }
+  if (queue->isRunningFullParse) {
+    queue->isFullParseRequested = true;
+  } else if (hasRegion) {
+    queue->region = region;
+  }
+  finish(highlighter);
+}
+
+}  // namespace core
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <boost/optional.hpp>
+#include <memory>
+#include <unordered_map>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+
+#include "macros.h"
+#include "LanguageParser.h"
+#include "Singleton.h"
+#include "Region.h"
+#include "ScopeTree.h"
+
+namespace core {
+
+class SyntaxHighlighter;
+
+// Runs parse requests of SyntaxHighlighters on a thread pool sized to the number of cores.
+// Requests of a highlighter run one at a time in order, and different highlighters are parsed in
+// parallel. Highlighters shown in a view are parsed first.
+// A new request cancels the running parse of the same highlighter only, and requests waiting for it
+// are merged into one parse.
+// A large text is parsed in chunks from the beginning and each chunk is notified by
+// fullParseProgressed. The visible region is parsed provisionally before the chunks reach it.
+// The scope tree of each text is a ScopeTree, and its segments are shared with SyntaxHighlighter.
+// A partial parse converts only the top level node it reparses to Node and back.
+// Call public methods only from the main thread.
+class ParseScheduler : public QObject, public Singleton<ParseScheduler> {
+  Q_OBJECT
+ public:
+  ~ParseScheduler() = default;
+
+  // Replaces the parser of highlighter and parses its whole text
+  void parse(SyntaxHighlighter* highlighter, const LanguageParser& parser);
+  // Applies an edit to the text and the tree of highlighter and parses the lines affected by it
+  void parse(SyntaxHighlighter* highlighter,
+             int position,
+             int charsRemoved,
+             const QString& insertedText);
+  void remove(SyntaxHighlighter* highlighter);
+  void setVisible(SyntaxHighlighter* highlighter, bool visible);
+  void setVisibleRegion(SyntaxHighlighter* highlighter, const Region& region);
+  void quit();
+
+ signals:
+  // If isProgressive is true, tree is empty because all of its segments have been notified by
+  // fullParseProgressed
+  void fullParseFinished(SyntaxHighlighter* highlighter, ScopeTree tree, bool isProgressive);
+  void fullParseProgressed(SyntaxHighlighter* highlighter,
+                           QVector<ScopeSegment> newSegments,
+                           Region region);
+  void partialParseFinished(SyntaxHighlighter* highlighter,
+                            QVector<ScopeSegment> newSegments,
+                            Region region,
+                            Region changedRegion);
+
+ private slots:
+  // called by ParseTask in a pool thread through a queued connection
+  // tree is the tree of the text after the edits applied by the task
+  // queueId is the id of the queue which started the task
+  void fullParseDone(SyntaxHighlighter* highlighter,
+                     int queueId,
+                     ScopeTree tree,
+                     bool isProgressive);
+  void fullParseChunkDone(SyntaxHighlighter* highlighter,
+                          int queueId,
+                          QVector<ScopeSegment> newSegments,
+                          Region region);
+  void partialParseDone(SyntaxHighlighter* highlighter,
+                        int queueId,
+                        QVector<ScopeSegment> newSegments,
+                        Region region,
+                        Region changedRegion,
+                        ScopeTree tree);
+  void parseCanceled(SyntaxHighlighter* highlighter,
+                     int queueId,
+                     bool hasRegion,
+                     Region region,
+                     ScopeTree tree);
+
+ private:
+  friend class Singleton<ParseScheduler>;
+  friend class ParseTask;
+  friend class ParseSchedulerTest;
+
+  struct Edit {
+    int position;
+    int charsRemoved;
+    QString insertedText;
+  };
+
+  // Visible region of a highlighter. Shared with its running task
+  struct Viewport {
+    QMutex mutex;
+    Region region;
+  };
+
+  // Requests of a highlighter waiting for its running task
+  struct Queue {
+    // Unique among the queues ever created. A new highlighter may be allocated at the address of
+    // a removed one, so the results of the tasks of the removed queue are dropped by this id.
+    int id = 0;
+    // Owns the text of the document. Accessed only by the running task
+    std::shared_ptr<LanguageParser> parser;
+    std::shared_ptr<Viewport> viewport = std::make_shared<Viewport>();
+    bool isRunning = false;
+    bool isRunningFullParse = false;
+    bool isVisible = false;
+    bool isFullParseRequested = false;
+    QVector<Edit> edits;
+    // Tree of the text before edits. The running task takes it and sends it back when it finishes
+    ScopeTree tree;
+    // region of a canceled partial parse which needs to be parsed again
+    boost::optional<Region> region;
+  };
+
+  QThreadPool m_pool;
+  std::unordered_map<SyntaxHighlighter*, Queue> m_queues;
+  int m_lastQueueId = 0;
+
+  ParseScheduler();
+
+  void schedule(SyntaxHighlighter* highlighter);
+  void finish(SyntaxHighlighter* highlighter);
+  // Returns the queue of highlighter if its id is queueId
+  Queue* findQueue(SyntaxHighlighter* highlighter, int queueId);
+};
+
+}  // namespace core
@@ -1,9 +1,10 @@
 #include <memory>
 #include <QString>
 #include <QDebug>
+#include <QThreadStorage>
 
 #include "Regexp.h"
-#include "scoped_guard.h"
+#include "ParseProfiler.h"
 
 namespace {
 
@@ -19,15 +20,93 @@ bool isMetaChar(const QChar& ch) {
          ch == '$' || ch == '#' || ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' ||
          ch == '\f' || ch == '\v';
 }
+
+// OnigRegion reused by all the searches in a thread. onig_search resizes it for the number of
+// groups, so searching doesn't allocate once it has grown enough.
+class ThreadRegion {
+ public:
+  ThreadRegion() : m_region(onig_region_new()) {}
+  ~ThreadRegion() { onig_region_free(m_region, 1 /* 1:free self, 0:free contents only */); }
+
+  OnigRegion* region() { return m_region; }
+
+ private:
+  OnigRegion* m_region;
+};
+
+QThreadStorage<ThreadRegion*> s_threadRegions;
+
+OnigRegion* threadRegion() {
+  if (!s_threadRegions.hasLocalData()) {
+    s_threadRegions.setLocalData(new ThreadRegion());
+  }
+  return s_threadRegions.localData()->region();
 }
 
-namespace core {
+struct SearchCounts {
+  qint64 searches = 0;
+  qint64 skipped = 0;
+};
 
-QMutex Regexp::s_mutex;
+// Counted per thread, so parser threads don't contend for a shared counter
+QThreadStorage<SearchCounts> s_searchCounts;
 
-Regexp::~Regexp() {
-  QMutexLocker locker(&s_mutex);
+void countSearch() {
+  if (core::ParseProfiler::enabled()) {
+    s_searchCounts.localData().searches++;
+  }
+}
+
+void countSkippedSearch() {
+  if (core::ParseProfiler::enabled()) {
+    s_searchCounts.localData().skipped++;
+  }
+}
+
+void logError(int r) {
+  OnigUChar s[ONIG_MAX_ERROR_MESSAGE_LEN];
+  onig_error_code_to_str(s, r);
+  qWarning() << QString::fromLatin1((const char*)s);
+}
+
+// Converts from byte offset to char offset in utf-16 string
+int toCharPos(int bytePos) {
+  return bytePos < 0 ? bytePos : bytePos / 2;
+}
+
+// Onigmo initializes its global state lazily in the first onig_new, so compiling in several
+// threads at the same time races (https://github.com/k-takata/Onigmo/blob/master/doc/FAQ).
+// Once it is initialized, compiling and freeing different regexps don't share anything.
+void initOnigmo() {
+  static const bool initialized = [] {
+    onig_init();
+    // Older Onigmo also builds Unicode property and case fold tables on their first use
+    const QString warmUp = QStringLiteral("(?i)\\p{Alpha}");
+    const OnigUChar* pattern = reinterpret_cast<const OnigUChar*>(warmUp.utf16());
+    regex_t* reg = nullptr;
+    OnigErrorInfo einfo;
+    if (onig_new(&reg, pattern, pattern + warmUp.size() * 2, ONIG_OPTION_NONE, encoding,
+                 ONIG_SYNTAX_DEFAULT, &einfo) == ONIG_NORMAL) {
+      onig_free(reg);
+    }
+    return true;
+  }();
+  Q_UNUSED(initialized);
+}
+
+QVector<int> toIndices(const OnigRegion* region) {
+  QVector<int> indices(region->num_regs * 2);
+  for (int i = 0; i < region->num_regs; i++) {
+    indices[i * 2] = toCharPos(region->beg[i]);
+    indices[i * 2 + 1] = toCharPos(region->end[i]);
+  }
+  return indices;
+}
+}
+
+namespace core {
 
+Regexp::~Regexp() {
   onig_free(m_reg);
 }
 
@@ -58,10 +137,7 @@ std::unique_ptr<Regexp> Regexp::compile(const QString& expr) {
   const OnigUChar* pattern = reinterpret_cast<const OnigUChar*>(expr.utf16());
   Q_ASSERT(pattern);
 
-  // The plural threads should not do simultaneously that making new regexp objects or re-compiling
-  // objects or freeing objects, even if these objects are differ.
-  // https://github.com/k-takata/Onigmo/blob/master/doc/FAQ
-  QMutexLocker locker(&s_mutex);
+  initOnigmo();
 
   int r = onig_new(&reg, pattern, pattern + expr.size() * 2, ONIG_OPTION_CAPTURE_GROUP, encoding,
                    ONIG_SYNTAX_DEFAULT, &einfo);
@@ -76,6 +152,17 @@ std::unique_ptr<Regexp> Regexp::compile(const QString& expr) {
   return std::unique_ptr<Regexp>(new Regexp(reg, expr));
 }
 
+std::unique_ptr<Regexp> Regexp::compileLiteral(const QString& str, bool caseSensitive) {
+  // The regex is still used to search backward, and forward in text which LiteralSearcher can't
+  // search
+  std::unique_ptr<Regexp> regexp =
+      compile(QString(QLatin1String(caseSensitive ? "(?-i)" : "(?i)") + escape(str)));
+  if (regexp) {
+    regexp->m_literal = LiteralSearcher::create(str, caseSensitive);
+  }
+  return regexp;
+}
+
 // https://golang.org/pkg/regexp/#Regexp.FindAllStringSubmatchIndex
 QVector<QVector<int>> Regexp::findAllStringSubmatchIndex(const QString& text,
                                                          int begin,
@@ -83,6 +170,16 @@ QVector<QVector<int>> Regexp::findAllStringSubmatchIndex(const QString& text,
                                                          bool findNotEmpty) const {
   Q_ASSERT(m_reg);
 
+  QVector<QVector<int>> allIndices;
+  if (m_literal && m_literal->canSearch(text, begin, end)) {
+    const int length = m_literal->length();
+    for (int pos = m_literal->indexIn(text, begin, end); pos >= 0;
+         pos = m_literal->indexIn(text, pos + length, end)) {
+      allIndices.append(QVector<int>{pos, pos + length});
+    }
+    return allIndices;
+  }
+
   const OnigUChar *start, *range, *endOfStr;
 
   const OnigUChar* str = reinterpret_cast<const OnigUChar*>(text.utf16());
@@ -90,13 +187,9 @@ QVector<QVector<int>> Regexp::findAllStringSubmatchIndex(const QString& text,
   start = str + text.leftRef(begin).size() * 2;
   range = str + text.leftRef(end).size() * 2;
 
-  QVector<QVector<int>> allIndices;
-
+  OnigRegion* region = threadRegion();
   while (true) {
-    OnigRegion* region = onig_region_new();
-    scoped_guard guard(
-        [=] { onig_region_free(region, 1 /* 1:free self, 0:free contents only */); });
-
+    countSearch();
     int r = onig_search(m_reg, str, endOfStr, start, range, region, ONIG_OPTION_NONE);
 
     if (findNotEmpty && region->beg[0] == region->end[0]) {
@@ -104,16 +197,7 @@ QVector<QVector<int>> Regexp::findAllStringSubmatchIndex(const QString& text,
     }
 
     if (r >= 0) {
-      QVector<int> indices(region->num_regs * 2);
-
-      for (int i = 0; i < region->num_regs; i++) {
-        // Convert from byte offset to char offset in utf-8 string
-        int begCharPos = region->beg[i] < 0 ? region->beg[i] : region->beg[i] / 2;
-        indices[i * 2] = begCharPos;
-        int endCharPos = region->end[i] < 0 ? region->end[i] : region->end[i] / 2;
-        indices[i * 2 + 1] = endCharPos;
-      }
-
+      const QVector<int> indices = toIndices(region);
       if (indices.size() <= 1)
         break;
 
@@ -127,9 +211,7 @@ QVector<QVector<int>> Regexp::findAllStringSubmatchIndex(const QString& text,
     } else if (r == ONIG_MISMATCH) {
       break;
     } else { /* error */
-      OnigUChar s[ONIG_MAX_ERROR_MESSAGE_LEN];
-      onig_error_code_to_str(s, r);
-      qWarning() << QString::fromLatin1((const char*)s);
+      logError(r);
       break;
     }
   }
@@ -137,13 +219,77 @@ QVector<QVector<int>> Regexp::findAllStringSubmatchIndex(const QString& text,
   return allIndices;
 }
 
-QVector<int> Regexp::onigSearch(const OnigUChar* str,
-                                const OnigUChar* endOfStr,
-                                const OnigUChar* start,
-                                const OnigUChar* range,
-                                bool findNotEmpty) const {
-  OnigRegion* region = onig_region_new();
-  scoped_guard guard([=] { onig_region_free(region, 1 /* 1:free self, 0:free contents only */); });
+void Regexp::forEachMatch(const QString& text,
+                          int begin,
+                          int end,
+                          const std::function<bool(const Region&)>& f) const {
+  forEachSubmatch(text, begin, end, [&](const MatchRegions& regions) { return f(regions[0]); });
+}
+
+void Regexp::forEachSubmatch(const QString& text,
+                             int begin,
+                             int end,
+                             const std::function<bool(const MatchRegions&)>& f) const {
+  Q_ASSERT(m_reg);
+
+  MatchRegions regions;
+  if (m_literal && m_literal->canSearch(text, begin, end)) {
+    const int length = m_literal->length();
+    regions.resize(1);
+    for (int pos = m_literal->indexIn(text, begin, end); pos >= 0;
+         pos = m_literal->indexIn(text, pos + length, end)) {
+      regions[0] = Region(pos, pos + length);
+      if (!f(regions)) {
+        break;
+      }
+    }
+    return;
+  }
+
+  const OnigUChar* str = reinterpret_cast<const OnigUChar*>(text.utf16());
+  const OnigUChar* endOfStr = str + text.size() * 2;
+  const OnigUChar* start = str + text.leftRef(begin).size() * 2;
+  const OnigUChar* range = str + text.leftRef(end).size() * 2;
+
+  OnigRegion* region = threadRegion();
+  // onig_search searches backward if start is after range
+  while (start <= range) {
+    countSearch();
+    int r = onig_search(m_reg, str, endOfStr, start, range, region, ONIG_OPTION_NONE);
+    if (r == ONIG_MISMATCH) {
+      break;
+    } else if (r < 0) {
+      logError(r);
+      break;
+    }
+
+    regions.resize(region->num_regs);
+    for (int i = 0; i < region->num_regs; i++) {
+      regions[i] = Region(toCharPos(region->beg[i]), toCharPos(region->end[i]));
+    }
+    if (!f(regions)) {
+      break;
+    }
+
+    // f may search with another regexp in this thread, so region isn't used after it
+    start = str + regions[0].end() * 2;
+    // skip a character after an empty match not to find it again
+    if (regions[0].isEmpty()) {
+      if (start >= endOfStr) {
+        break;
+      }
+      start += onig_enc_len(encoding, start, endOfStr);
+    }
+  }
+}
+
+OnigRegion* Regexp::onigSearch(const OnigUChar* str,
+                               const OnigUChar* endOfStr,
+                               const OnigUChar* start,
+                               const OnigUChar* range,
+                               bool findNotEmpty) const {
+  countSearch();
+  OnigRegion* region = threadRegion();
 
   const OnigUChar* gpos = start ? start : str;
   int r = onig_search_gpos(m_reg, str, endOfStr, gpos, start, range, region, ONIG_OPTION_NONE);
@@ -154,36 +300,37 @@ QVector<int> Regexp::onigSearch(const OnigUChar* str,
   }
 
   if (r >= 0) {
-    QVector<int> indices(region->num_regs * 2);
-
-    for (int i = 0; i < region->num_regs; i++) {
-      // Convert from byte offset to char offset in utf-16 string
-      int begCharPos = region->beg[i] < 0 ? region->beg[i] : region->beg[i] / 2;
-      indices[i * 2] = begCharPos;
-      int endCharPos = region->end[i] < 0 ? region->end[i] : region->end[i] / 2;
-      indices[i * 2 + 1] = endCharPos;
-    }
-
-    return indices;
+    return region;
   } else if (r == ONIG_MISMATCH) {
     //    qDebug("search fail");
   } else { /* error */
-    OnigUChar s[ONIG_MAX_ERROR_MESSAGE_LEN];
-    onig_error_code_to_str(s, r);
-    qWarning() << QString::fromLatin1((const char*)s);
+    logError(r);
   }
 
-  return QVector<int>();
+  return nullptr;
 }
 
 // find within [begin, end)
-QVector<int> Regexp::findStringSubmatchIndex(const QString& text,
-                                             int begin,
-                                             int end,
-                                             bool backward,
-                                             bool findNotEmpty) const {
+OnigRegion* Regexp::searchRegion(const QString& text,
+                                 int begin,
+                                 int end,
+                                 bool backward,
+                                 bool findNotEmpty) const {
   Q_ASSERT(m_reg);
 
+  // A match starts at or after the first character which can start it. It isn't empty, so the
+  // character is before end.
+  if (m_prefilter && !backward) {
+    const int candidate = m_prefilter->indexIn(text, begin, end < 0 ? text.size() : end);
+    if (candidate < 0) {
+      countSkippedSearch();
+      return nullptr;
+    }
+    if (!m_hasGAnchor) {
+      begin = candidate;
+    }
+  }
+
   const OnigUChar *start, *range, *endOfStr;
 
   const OnigUChar* str = reinterpret_cast<const OnigUChar*>(text.utf16());
@@ -202,10 +349,70 @@ QVector<int> Regexp::findStringSubmatchIndex(const QString& text,
   return onigSearch(str, endOfStr, start, range, findNotEmpty);
 }
 
-bool Regexp::matches(const QString& text, bool findNotEmpty) {
+QVector<int> Regexp::findStringSubmatchIndex(const QString& text,
+                                             int begin,
+                                             int end,
+                                             bool backward,
+                                             bool findNotEmpty) const {
+  if (m_literal && !backward && m_literal->canSearch(text, begin, end)) {
+    const int pos = m_literal->indexIn(text, begin, end);
+    return pos >= 0 ? QVector<int>{pos, pos + m_literal->length()} : QVector<int>();
+  }
+
+  const OnigRegion* region = searchRegion(text, begin, end, backward, findNotEmpty);
+  return region ? toIndices(region) : QVector<int>();
+}
+
+bool Regexp::search(const QString& text,
+                    MatchRegions& regions,
+                    int begin,
+                    int end,
+                    bool backward,
+                    bool findNotEmpty) const {
+  if (m_literal && !backward && m_literal->canSearch(text, begin, end)) {
+    const int pos = m_literal->indexIn(text, begin, end);
+    if (pos < 0) {
+      regions.clear();
+      return false;
+    }
+    regions.resize(1);
+    regions[0] = Region(pos, pos + m_literal->length());
+    return true;
+  }
+
+  const OnigRegion* region = searchRegion(text, begin, end, backward, findNotEmpty);
+  if (!region) {
+    regions.clear();
+    return false;
+  }
+
+  regions.resize(region->num_regs);
+  for (int i = 0; i < region->num_regs; i++) {
+    regions[i] = Region(toCharPos(region->beg[i]), toCharPos(region->end[i]));
+  }
+  return true;
+}
+
+qint64 Regexp::searchCount() {
+  return s_searchCounts.localData().searches;
+}
+
+qint64 Regexp::skippedSearchCount() {
+  return s_searchCounts.localData().skipped;
+}
+
+void Regexp::resetSearchCounts() {
+  s_searchCounts.setLocalData(SearchCounts());
+}
+
+bool Regexp::matches(const QString& text, bool findNotEmpty) const {
   return !findStringSubmatchIndex(text, 0, -1, false, findNotEmpty).isEmpty();
 }
 
-Regexp::Regexp(regex_t* reg, const QString& pattern) : m_reg(reg), m_pattern(pattern) {}
+Regexp::Regexp(regex_t* reg, const QString& pattern)
+    : m_reg(reg),
+      m_pattern(pattern),
+      m_prefilter(RegexpPrefilter::create(pattern)),
+      m_hasGAnchor(pattern.contains(QStringLiteral("\\G"))) {}
 
 }  // namespace core
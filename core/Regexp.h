@@ -1,13 +1,17 @@
 #pragma once
 
 #include <oniguruma.h>
+#include <functional>
 #include <memory>
 #include <boost/optional.hpp>
+#include <QVarLengthArray>
 #include <QVector>
 #include <QStringRef>
-#include <QMutex>
 
 #include "macros.h"
+#include "Region.h"
+#include "LiteralSearcher.h"
+#include "RegexpPrefilter.h"
 
 struct re_pattern_buffer;
 typedef re_pattern_buffer OnigRegexType;
@@ -15,6 +19,10 @@ typedef OnigRegexType regex_t;
 
 namespace core {
 
+// Regions of a match and its groups. Most patterns have few enough groups to keep them inline, so
+// a search doesn't allocate.
+typedef QVarLengthArray<Region, 16> MatchRegions;
+
 class Regexp {
   DISABLE_COPY(Regexp)
 
@@ -23,8 +31,17 @@ class Regexp {
   DEFAULT_MOVE(Regexp)
 
   static std::unique_ptr<Regexp> compile(const QString& expr);
+  // Returns a regexp which matches str literally. Its forward searches are done by
+  // LiteralSearcher instead of Onigmo when it supports str.
+  static std::unique_ptr<Regexp> compileLiteral(const QString& str, bool caseSensitive);
   static QString escape(const QString& expr);
 
+  // Number of onig_search calls in the calling thread, and of the searches skipped because no
+  // character in the text can start a match. Counted only while ParseProfiler is enabled.
+  static qint64 searchCount();
+  static qint64 skippedSearchCount();
+  static void resetSearchCounts();
+
   QString pattern() const { return m_pattern; }
 
   QVector<int> findStringSubmatchIndex(const QString& text,
@@ -32,25 +49,54 @@ class Regexp {
                                        int end = -1,
                                        bool backward = false,
                                        bool findNotEmpty = false) const;
-  bool matches(const QString& text, bool findNotEmpty = false);
+  // Same as findStringSubmatchIndex but writes the match into regions instead of allocating a
+  // result. An unmatched group has the region (-1, -1). Returns false if it doesn't match.
+  bool search(const QString& text,
+              MatchRegions& regions,
+              int begin = 0,
+              int end = -1,
+              bool backward = false,
+              bool findNotEmpty = false) const;
+  bool matches(const QString& text, bool findNotEmpty = false) const;
 
   QVector<QVector<int>> findAllStringSubmatchIndex(const QString& text,
                                                    int begin = 0,
                                                    int end = -1,
                                                    bool findNotEmpty = false) const;
+  // Calls f with the whole region of each match which starts in [begin, end) in order until f
+  // returns false. Unlike findAllStringSubmatchIndex, it doesn't allocate for each match.
+  void forEachMatch(const QString& text,
+                    int begin,
+                    int end,
+                    const std::function<bool(const Region&)>& f) const;
+  // Same as forEachMatch but f takes the regions of the groups too. An unmatched group has the
+  // region (-1, -1).
+  void forEachSubmatch(const QString& text,
+                       int begin,
+                       int end,
+                       const std::function<bool(const MatchRegions&)>& f) const;
 
  private:
-  static QMutex s_mutex;
-
   regex_t* m_reg;
   QString m_pattern;
+  boost::optional<RegexpPrefilter> m_prefilter;
+  boost::optional<LiteralSearcher> m_literal;
+  // \G matches at the start of the search, so the start can't be moved to a candidate
+  bool m_hasGAnchor;
 
   Regexp(regex_t* reg, const QString& pattern);
-  QVector<int> onigSearch(const OnigUChar *str,
-                          const OnigUChar *endOfStr,
-                          const OnigUChar *start,
-                          const OnigUChar *range,
-                          bool findNotEmpty) const;
+  // These return the OnigRegion of the calling thread, which is valid until its next search, or
+  // nullptr if it doesn't match
+  OnigRegion* onigSearch(const OnigUChar* str,
+                         const OnigUChar* endOfStr,
+                         const OnigUChar* start,
+                         const OnigUChar* range,
+                         bool findNotEmpty) const;
+  OnigRegion* searchRegion(const QString& text,
+                           int begin,
+                           int end,
+                           bool backward,
+                           bool findNotEmpty) const;
 };
 
 }  // namespace core
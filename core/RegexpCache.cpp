@@ -0,0 +1,53 @@
+#include "RegexpCache.h"
+#include "Regexp.h"
+
+namespace core {
+
+RegexpCache::RegexpCache(int capacity) : m_capacity(qMax(capacity, 1)) {}
+
+std::shared_ptr<const Regexp> RegexpCache::get(const QString& pattern) {
+  {
+    QMutexLocker locker(&m_mutex);
+    auto it = m_index.constFind(pattern);
+    if (it != m_index.constEnd()) {
+      m_hitCount.fetchAndAddRelaxed(1);
+      m_entries.splice(m_entries.begin(), m_entries, it.value());
+      return m_entries.front().second;
+    }
+  }
+
+  // Compile without the lock so that other threads can look up patterns meanwhile
+  m_missCount.fetchAndAddRelaxed(1);
+  std::shared_ptr<const Regexp> regexp(Regexp::compile(pattern));
+
+  QMutexLocker locker(&m_mutex);
+  // Another thread may have compiled the same pattern meanwhile
+  auto it = m_index.constFind(pattern);
+  if (it != m_index.constEnd()) {
+    m_entries.splice(m_entries.begin(), m_entries, it.value());
+    return m_entries.front().second;
+  }
+
+  m_entries.emplace_front(pattern, regexp);
+  m_index.insert(pattern, m_entries.begin());
+  if (static_cast<int>(m_entries.size()) > m_capacity) {
+    m_index.remove(m_entries.back().first);
+    m_entries.pop_back();
+  }
+  return regexp;
+}
+
+int RegexpCache::size() const {
+  QMutexLocker locker(&m_mutex);
+  return static_cast<int>(m_entries.size());
+}
+
+void RegexpCache::clear() {
+  QMutexLocker locker(&m_mutex);
+  m_entries.clear();
+  m_index.clear();
+  m_hitCount.store(0);
+  m_missCount.store(0);
+}
+
+}  // namespace core
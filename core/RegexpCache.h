@@ -0,0 +1,48 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <utility>
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include "macros.h"
+
+namespace core {
+
+class Regexp;
+
+// Thread safe LRU cache of compiled regular expressions keyed by pattern.
+// Regexps are shared, so one evicted while another thread searches with it stays alive.
+class RegexpCache {
+  DISABLE_COPY_AND_MOVE(RegexpCache)
+
+ public:
+  explicit RegexpCache(int capacity);
+  ~RegexpCache() = default;
+
+  // Returns the compiled pattern, compiling it if it isn't cached. Returns nullptr if it is
+  // invalid. Invalid patterns are cached too.
+  std::shared_ptr<const Regexp> get(const QString& pattern);
+
+  int capacity() const { return m_capacity; }
+  int size() const;
+  int hitCount() const { return m_hitCount.load(); }
+  int missCount() const { return m_missCount.load(); }
+  void clear();
+
+ private:
+  typedef std::list<std::pair<QString, std::shared_ptr<const Regexp>>> Entries;
+
+  const int m_capacity;
+  mutable QMutex m_mutex;
+  // the most recently used first
+  Entries m_entries;
+  QHash<QString, Entries::iterator> m_index;
+  QAtomicInt m_hitCount;
+  QAtomicInt m_missCount;
+};
+
+}  // namespace core
@@ -0,0 +1,476 @@
+#include "RegexpPrefilter.h"
+
+namespace core {
+
+// Recursive descent parser for the subset of Onigmo (Ruby) syntax which matters for the first
+// character of a match. Anything else makes the result "any character".
+class RegexpPrefilterParser {
+ public:
+  explicit RegexpPrefilterParser(const QString& pattern) : m_pattern(pattern), m_pos(0) {}
+
+  boost::optional<RegexpPrefilter> parse() {
+    Flags flags;
+    Result result = parseAlternation(flags);
+    if (m_pos < m_pattern.size() || result.any || result.canBeEmpty) {
+      return boost::none;
+    }
+
+    RegexpPrefilter prefilter;
+    prefilter.m_ascii = result.ascii;
+    prefilter.m_nonAscii = result.nonAscii;
+    return prefilter;
+  }
+
+ private:
+  struct Flags {
+    bool ignoreCase = false;
+    bool extended = false;
+  };
+
+  // First characters of a sub expression
+  struct Result {
+    std::bitset<RegexpPrefilter::ASCII_SIZE> ascii;
+    bool nonAscii = false;
+    bool any = false;
+    // true if it can match an empty string, so the first character may come from the next one
+    bool canBeEmpty = false;
+
+    void add(const Result& other) {
+      ascii |= other.ascii;
+      nonAscii = nonAscii || other.nonAscii;
+      any = any || other.any;
+    }
+  };
+
+  const QString& m_pattern;
+  int m_pos;
+
+  bool atEnd() const { return m_pos >= m_pattern.size(); }
+  QChar peek(int offset = 0) const {
+    return m_pos + offset < m_pattern.size() ? m_pattern[m_pos + offset] : QChar();
+  }
+  bool accept(const char* str) {
+    const QString s = QString::fromLatin1(str);
+    if (m_pattern.midRef(m_pos, s.size()) == s) {
+      m_pos += s.size();
+      return true;
+    }
+    return false;
+  }
+
+  static Result anyChar() {
+    Result result;
+    result.any = true;
+    return result;
+  }
+
+  static Result zeroWidth() {
+    Result result;
+    result.canBeEmpty = true;
+    return result;
+  }
+
+  static void addChar(Result& result, QChar ch, const Flags& flags) {
+    const ushort code = ch.unicode();
+    if (code >= RegexpPrefilter::ASCII_SIZE) {
+      // A non ASCII character can be case folded to an ASCII one (e.g. KELVIN SIGN)
+      if (flags.ignoreCase) {
+        result.any = true;
+      }
+      result.nonAscii = true;
+      return;
+    }
+
+    result.ascii.set(code);
+    if (flags.ignoreCase && ch.isLetter()) {
+      result.ascii.set(ch.toLower().unicode());
+      result.ascii.set(ch.toUpper().unicode());
+      // e.g. LATIN SMALL LETTER LONG S matches s
+      result.nonAscii = true;
+    }
+  }
+
+  static void addRange(Result& result, QChar first, QChar last, const Flags& flags) {
+    for (ushort code = first.unicode();
+         code <= last.unicode() && code < RegexpPrefilter::ASCII_SIZE; code++) {
+      addChar(result, QChar(code), flags);
+    }
+    if (last.unicode() >= RegexpPrefilter::ASCII_SIZE) {
+      addChar(result, last, flags);
+    }
+  }
+
+  // \d, \w, \s and \h. They match non ASCII characters too in Unicode
+  static bool addClassEscape(Result& result, QChar ch) {
+    switch (ch.unicode()) {
+      case 'd':
+        addRangeAscii(result, '0', '9');
+        break;
+      case 'h':
+        addRangeAscii(result, '0', '9');
+        addRangeAscii(result, 'a', 'f');
+        addRangeAscii(result, 'A', 'F');
+        break;
+      case 'w':
+        addRangeAscii(result, '0', '9');
+        addRangeAscii(result, 'a', 'z');
+        addRangeAscii(result, 'A', 'Z');
+        result.ascii.set('_');
+        break;
+      case 's':
+        for (char space : {' ', '\t', '\n', '\r', '\f', '\v'}) {
+          result.ascii.set(space);
+        }
+        break;
+      default:
+        return false;
+    }
+    result.nonAscii = true;
+    return true;
+  }
+
+  static void addRangeAscii(Result& result, char first, char last) {
+    for (char ch = first; ch <= last; ch++) {
+      result.ascii.set(ch);
+    }
+  }
+
+  // Control character escapes like \t. Returns a null QChar if ch isn't one of them
+  static QChar controlEscape(QChar ch) {
+    switch (ch.unicode()) {
+      case 't':
+        return '\t';
+      case 'n':
+        return '\n';
+      case 'r':
+        return '\r';
+      case 'f':
+        return '\f';
+      case 'v':
+        return '\v';
+      case 'a':
+        return QChar(0x07);
+      case 'e':
+        return QChar(0x1b);
+      default:
+        return QChar();
+    }
+  }
+
+  void skipExtendedSpaces(const Flags& flags) {
+    if (!flags.extended) {
+      return;
+    }
+    while (!atEnd()) {
+      if (peek().isSpace()) {
+        m_pos++;
+      } else if (peek() == '#') {
+        while (!atEnd() && peek() != '\n') {
+          m_pos++;
+        }
+      } else {
+        break;
+      }
+    }
+  }
+
+  // alternation := sequence ('|' sequence)*
+  Result parseAlternation(Flags flags) {
+    Result result = parseSequence(flags);
+    while (peek() == '|') {
+      m_pos++;
+      Result alternative = parseSequence(flags);
+      result.add(alternative);
+      result.canBeEmpty = result.canBeEmpty || alternative.canBeEmpty;
+    }
+    return result;
+  }
+
+  // Inline options like (?i) change flags for the rest of the group
+  Result parseSequence(Flags& flags) {
+    Result result;
+    result.canBeEmpty = true;
+    while (true) {
+      skipExtendedSpaces(flags);
+      if (atEnd() || peek() == '|' || peek() == ')') {
+        return result;
+      }
+
+      Result atom = parseQuantified(flags);
+      // Only the atoms until the first one which can't be empty give the first character
+      if (result.canBeEmpty) {
+        result.add(atom);
+        result.canBeEmpty = atom.canBeEmpty;
+      }
+    }
+  }
+
+  Result parseQuantified(Flags& flags) {
+    Result atom = parseAtom(flags);
+    while (true) {
+      skipExtendedSpaces(flags);
+      if (peek() == '*' || peek() == '?') {
+        m_pos++;
+        atom.canBeEmpty = true;
+      } else if (peek() == '+') {
+        m_pos++;
+      } else if (peek() != '{' || !parseInterval(atom)) {
+        return atom;
+      }
+      // lazy or possessive
+      if (peek() == '?' || peek() == '+') {
+        m_pos++;
+      }
+    }
+  }
+
+  // {n}, {n,}, {,m} and {n,m}. Otherwise '{' is a literal
+  bool parseInterval(Result& atom) {
+    int i = m_pos + 1;
+    int min = 0;
+    bool hasMin = false;
+    while (i < m_pattern.size() && m_pattern[i].isDigit()) {
+      min = min * 10 + m_pattern[i].digitValue();
+      hasMin = true;
+      i++;
+    }
+    bool hasMax = false;
+    if (i < m_pattern.size() && m_pattern[i] == ',') {
+      i++;
+      while (i < m_pattern.size() && m_pattern[i].isDigit()) {
+        hasMax = true;
+        i++;
+      }
+    }
+    if (i >= m_pattern.size() || m_pattern[i] != '}' || (!hasMin && !hasMax)) {
+      return false;
+    }
+    m_pos = i + 1;
+    if (min == 0) {
+      atom.canBeEmpty = true;
+    }
+    return true;
+  }
+
+  Result parseAtom(Flags& flags) {
+    const QChar ch = peek();
+    m_pos++;
+    switch (ch.unicode()) {
+      case '(':
+        return parseGroup(flags);
+      case '[':
+        return parseClass(flags);
+      case '.':
+        return anyChar();
+      case '^':
+      case '$':
+        return zeroWidth();
+      case '\\':
+        return parseEscape(flags);
+      case '*':
+      case '+':
+      case '?':
+        return anyChar();
+      default: {
+        Result result;
+        addChar(result, ch, flags);
+        return result;
+      }
+    }
+  }
+
+  Result parseGroup(Flags& flags) {
+    if (accept("?#")) {
+      while (!atEnd() && peek() != ')') {
+        m_pos++;
+      }
+      m_pos++;
+      return zeroWidth();
+    }
+
+    Result result;
+    bool isLookAround = false;
+    Flags groupFlags = flags;
+    if (accept("?=") || accept("?!") || accept("?<=") || accept("?<!")) {
+      isLookAround = true;
+    } else if (accept("?:") || accept("?>")) {
+    } else if (accept("?<") || accept("?'")) {
+      // named group
+      while (!atEnd() && peek() != '>' && peek() != '\'') {
+        m_pos++;
+      }
+      m_pos++;
+    } else if (peek() == '?' && (peek(1) == '(' || peek(1) == '~')) {
+      // conditional or absent operator
+      result = parseAlternation(groupFlags);
+      result.any = true;
+      m_pos++;
+      return result;
+    } else if (peek() == '?') {
+      // options like (?i), (?x-i) or (?i:...)
+      m_pos++;
+      bool enable = true;
+      Flags optionFlags = flags;
+      while (!atEnd() && peek() != ')' && peek() != ':') {
+        switch (peek().unicode()) {
+          case '-':
+            enable = false;
+            break;
+          case 'i':
+            optionFlags.ignoreCase = enable;
+            break;
+          case 'x':
+            optionFlags.extended = enable;
+            break;
+          case 'm':
+            break;
+          default:
+            return anyChar();
+        }
+        m_pos++;
+      }
+      if (peek() == ')') {
+        // applies to the rest of the enclosing group
+        m_pos++;
+        flags = optionFlags;
+        return zeroWidth();
+      }
+      m_pos++;
+      groupFlags = optionFlags;
+    }
+
+    result = parseAlternation(groupFlags);
+    if (peek() != ')') {
+      return anyChar();
+    }
+    m_pos++;
+    return isLookAround ? zeroWidth() : result;
+  }
+
+  Result parseEscape(const Flags& flags) {
+    if (atEnd()) {
+      return anyChar();
+    }
+    const QChar ch = peek();
+    m_pos++;
+
+    Result result;
+    switch (ch.unicode()) {
+      case 'A':
+      case 'z':
+      case 'Z':
+      case 'b':
+      case 'B':
+      case 'G':
+        return zeroWidth();
+      default:
+        break;
+    }
+    if (addClassEscape(result, ch)) {
+      return result;
+    }
+    const QChar control = controlEscape(ch);
+    if (!control.isNull()) {
+      addChar(result, control, flags);
+      return result;
+    }
+    if (ch.isLetterOrNumber()) {
+      // back references, \x, \u, \p, \k, \g, \K, \R, \X and so on
+      return anyChar();
+    }
+    addChar(result, ch, flags);
+    return result;
+  }
+
+  // Called after '['. Consumes the class until the matching ']'
+  Result parseClass(const Flags& flags) {
+    Result result;
+    if (peek() == '^') {
+      m_pos++;
+      result.any = true;
+    }
+
+    bool first = true;
+    while (!atEnd()) {
+      QChar ch = peek();
+      if (ch == ']' && !first) {
+        m_pos++;
+        return result;
+      }
+      first = false;
+
+      if (ch == '[') {
+        m_pos++;
+        if (peek() == ':') {
+          // POSIX bracket like [:alpha:]
+          while (!atEnd() && !(peek() == ':' && peek(1) == ']')) {
+            m_pos++;
+          }
+          m_pos += 2;
+          result.any = true;
+        } else {
+          result.add(parseClass(flags));
+        }
+        continue;
+      }
+
+      if (ch == '&' && peek(1) == '&') {
+        // The union of both sides is a superset of their intersection
+        m_pos += 2;
+        continue;
+      }
+
+      m_pos++;
+      QChar low = ch;
+      if (ch == '\\') {
+        if (atEnd()) {
+          return anyChar();
+        }
+        const QChar escaped = peek();
+        m_pos++;
+        if (addClassEscape(result, escaped)) {
+          continue;
+        }
+        const QChar control = escaped == 'b' ? QChar(0x08) : controlEscape(escaped);
+        if (!control.isNull()) {
+          low = control;
+        } else if (escaped.isLetterOrNumber()) {
+          result.any = true;
+          continue;
+        } else {
+          low = escaped;
+        }
+      }
+
+      if (peek() == '-' && peek(1) != ']' && peek(1) != '\\' && peek(1) != '[' &&
+          m_pos + 1 < m_pattern.size()) {
+        const QChar high = peek(1);
+        m_pos += 2;
+        if (high < low) {
+          return anyChar();
+        }
+        addRange(result, low, high, flags);
+      } else {
+        addChar(result, low, flags);
+      }
+    }
+    return anyChar();
+  }
+};
+
+boost::optional<RegexpPrefilter> RegexpPrefilter::create(const QString& pattern) {
+  return RegexpPrefilterParser(pattern).parse();
+}
+
+int RegexpPrefilter::indexIn(const QString& text, int begin, int end) const {
+  const QChar* data = text.constData();
+  end = qMin(end, text.size());
+  for (int i = qMax(begin, 0); i < end; i++) {
+    if (contains(data[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+}  // namespace core
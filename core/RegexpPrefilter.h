@@ -0,0 +1,44 @@
+#pragma once
+
+#include <bitset>
+#include <boost/optional.hpp>
+#include <QString>
+
+#include "macros.h"
+
+namespace core {
+
+// Set of characters which a match of a regular expression can start with, computed from the
+// pattern without compiling it. Text which has none of them can't match, so Regexp skips
+// searching it, and the search can start at the first of them.
+// The set is conservative: a character outside it never starts a match, but a character in it may
+// not either.
+class RegexpPrefilter {
+ public:
+  // Returns none if a match can start with any character or can be empty, or if the pattern uses
+  // syntax this doesn't analyze (e.g. back references).
+  static boost::optional<RegexpPrefilter> create(const QString& pattern);
+
+  ~RegexpPrefilter() = default;
+  DEFAULT_COPY_AND_MOVE(RegexpPrefilter)
+
+  bool contains(QChar ch) const {
+    return ch.unicode() < ASCII_SIZE ? m_ascii.test(ch.unicode()) : m_nonAscii;
+  }
+
+  // Returns the index of the first character in this set within [begin, end), or -1
+  int indexIn(const QString& text, int begin, int end) const;
+
+ private:
+  friend class RegexpPrefilterParser;
+
+  static const int ASCII_SIZE = 128;
+
+  std::bitset<ASCII_SIZE> m_ascii;
+  // true if any non ASCII character can start a match
+  bool m_nonAscii = false;
+
+  RegexpPrefilter() = default;
+};
+
+}  // namespace core
@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "ScopeAtoms.h"
+
+namespace core {
+
+const int ScopeAtoms::EMPTY;
+const int ScopeStacks::EMPTY;
+
+ScopeAtoms::ScopeAtoms() {
+  m_atoms.insert(QString(), EMPTY);
+  m_names.append(QString());
+}
+
+int ScopeAtoms::intern(const QString& name) {
+  if (name.isEmpty()) {
+    return EMPTY;
+  }
+
+  {
+    QReadLocker locker(&m_lock);
+    auto it = m_atoms.constFind(name);
+    if (it != m_atoms.constEnd()) {
+      return it.value();
+    }
+  }
+
+  QWriteLocker locker(&m_lock);
+  // Another thread may have interned name after the read lock was released
+  auto it = m_atoms.constFind(name);
+  if (it != m_atoms.constEnd()) {
+    return it.value();
+  }
+  const int atom = m_names.size();
+  m_names.append(name);
+  m_atoms.insert(name, atom);
+  return atom;
+}
+
+QString ScopeAtoms::name(int atom) {
+  QReadLocker locker(&m_lock);
+  return m_names.value(atom);
+}
+
+ScopeStacks::ScopeStacks() {
+  m_entries.append(Entry{EMPTY, ScopeAtoms::EMPTY});
+}
+
+int ScopeStacks::push(int parent, int atom) {
+  if (atom == ScopeAtoms::EMPTY) {
+    return parent;
+  }
+
+  const auto key = qMakePair(parent, atom);
+  auto it = m_stacks.constFind(key);
+  if (it != m_stacks.constEnd()) {
+    return it.value();
+  }
+  const int stack = m_entries.size();
+  m_entries.append(Entry{parent, atom});
+  m_stacks.insert(key, stack);
+  return stack;
+}
+
+QString ScopeStacks::scopeName(int stack) {
+  auto& scopeAtoms = ScopeAtoms::singleton();
+  QString name;
+  for (int atom : atoms(stack)) {
+    if (!name.isEmpty()) {
+      name.append(' ');
+    }
+    name.append(scopeAtoms.name(atom));
+  }
+  return name;
+}
+
+int ScopeStacks::fromScopeName(const QString& scopeName) {
+  auto& scopeAtoms = ScopeAtoms::singleton();
+  int stack = EMPTY;
+  for (const auto& name : scopeName.splitRef(' ', QString::SkipEmptyParts)) {
+    stack = push(stack, scopeAtoms.intern(name.toString()));
+  }
+  return stack;
+}
+
+QVector<int> ScopeStacks::atoms(int stack) const {
+  QVector<int> atoms;
+  for (; stack != EMPTY; stack = m_entries[stack].parent) {
+    atoms.append(m_entries[stack].atom);
+  }
+  std::reverse(atoms.begin(), atoms.end());
+  return atoms;
+}
+
+}  // namespace core
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QHash>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+
+#include "Singleton.h"
+
+namespace core {
+
+// Interns scope names to integer atoms so that a scope tree stores an int per node instead of a
+// QString. Names in grammars are interned when they are compiled. Atoms are never released.
+// Thread safe.
+class ScopeAtoms : public Singleton<ScopeAtoms> {
+ public:
+  // Atom of an empty name
+  static const int EMPTY = 0;
+
+  ~ScopeAtoms() = default;
+
+  int intern(const QString& name);
+  QString name(int atom);
+
+ private:
+  friend class Singleton<ScopeAtoms>;
+
+  QReadWriteLock m_lock;
+  QHash<QString, int> m_atoms;
+  QVector<QString> m_names;
+
+  ScopeAtoms();
+};
+
+// Interns scope stacks (e.g. "source.c++ meta.block string.quoted") to integer ids.
+// A stack is an atom pushed onto its parent stack, so the stack of a child scope is found by one
+// hash lookup from the stack of its parent. Theme caches formats by stack id.
+// Not thread safe. Use only in the main thread.
+class ScopeStacks : public Singleton<ScopeStacks> {
+ public:
+  // Id of the empty stack
+  static const int EMPTY = 0;
+
+  ~ScopeStacks() = default;
+
+  // Returns the stack of atom pushed onto parent. An empty atom doesn't change the stack.
+  int push(int parent, int atom);
+  // Space separated scope names from the bottom of stack
+  QString scopeName(int stack);
+  // Stack of space separated scope names
+  int fromScopeName(const QString& scopeName);
+  // Atoms of stack from the bottom
+  QVector<int> atoms(int stack) const;
+
+ private:
+  friend class Singleton<ScopeStacks>;
+
+  struct Entry {
+    int parent;
+    int atom;
+  };
+
+  QHash<QPair<int, int>, int> m_stacks;
+  QVector<Entry> m_entries;
+
+  ScopeStacks();
+};
+
+}  // namespace core
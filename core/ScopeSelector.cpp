@@ -0,0 +1,341 @@
+#include <algorithm>
+
+#include "ScopeSelector.h"
+#include "ScopeAtoms.h"
+
+namespace core {
+
+namespace {
+
+bool isOperator(QChar ch) {
+  return ch == ',' || ch == '|' || ch == '&' || ch == '-' || ch == '(' || ch == ')';
+}
+
+// '-' in a name (e.g. "entity.other.inherited-class") is not an operator
+QStringList tokenize(const QString& selector) {
+  QStringList tokens;
+  int i = 0;
+  while (i < selector.size()) {
+    if (selector[i].isSpace()) {
+      i++;
+    } else if (isOperator(selector[i])) {
+      tokens.append(QString(selector[i]));
+      i++;
+    } else {
+      const int begin = i;
+      while (i < selector.size() && !selector[i].isSpace() &&
+             (selector[i] == '-' || !isOperator(selector[i]))) {
+        i++;
+      }
+      tokens.append(selector.mid(begin, i - begin));
+    }
+  }
+  return tokens;
+}
+
+// Compares scores from the top of the stack
+int compareScores(const QVector<int>& score1, const QVector<int>& score2) {
+  for (int i = score1.size() - 1; i >= 0; i--) {
+    if (score1[i] != score2[i]) {
+      return score1[i] < score2[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+void mergeScores(QVector<int>& score, const QVector<int>& other) {
+  for (int i = 0; i < score.size(); i++) {
+    score[i] = qMax(score[i], other[i]);
+  }
+}
+}
+
+// groups     := composite ((',' | '|') composite)*
+// composite  := expression (('&' | '-') expression)*
+// expression := '-' expression | '(' groups ')' | name*
+class ScopeSelectorMatcher::Parser {
+ public:
+  Parser(ScopeSelectorMatcher* matcher, const QStringList& tokens)
+      : m_matcher(matcher), m_tokens(tokens) {}
+
+  // Returns the index of the parsed expression, or -1 if there is a syntax error
+  int parse() {
+    const int expr = parseGroups();
+    return m_pos == m_tokens.size() ? expr : -1;
+  }
+
+ private:
+  ScopeSelectorMatcher* m_matcher;
+  QStringList m_tokens;
+  int m_pos = 0;
+
+  bool accept(const QString& op) {
+    if (m_pos < m_tokens.size() && m_tokens[m_pos] == op) {
+      m_pos++;
+      return true;
+    }
+    return false;
+  }
+
+  bool atName() const {
+    return m_pos < m_tokens.size() &&
+           (m_tokens[m_pos].size() > 1 || !isOperator(m_tokens[m_pos][0]));
+  }
+
+  int parseGroups() {
+    Expr expr{Expr::Type::Or, {}, {}};
+    do {
+      const int operand = parseComposite();
+      if (operand < 0) {
+        return -1;
+      }
+      expr.operands.append(operand);
+    } while (accept(",") || accept("|"));
+    return expr.operands.size() == 1 ? expr.operands[0] : m_matcher->addExpr(expr);
+  }
+
+  int parseComposite() {
+    Expr expr{Expr::Type::And, {}, {}};
+    int operand = parseExpression();
+    while (operand >= 0) {
+      expr.operands.append(operand);
+      if (accept("&")) {
+        operand = parseExpression();
+      } else if (accept("-")) {
+        operand = negate(parseExpression());
+      } else {
+        return expr.operands.size() == 1 ? expr.operands[0] : m_matcher->addExpr(expr);
+      }
+    }
+    return -1;
+  }
+
+  int parseExpression() {
+    if (accept("-")) {
+      return negate(parseExpression());
+    }
+    if (accept("(")) {
+      const int expr = parseGroups();
+      return expr >= 0 && accept(")") ? expr : -1;
+    }
+
+    // An empty path matches any scope
+    Expr path{Expr::Type::Path, {}, {}};
+    while (atName()) {
+      path.elements.append(m_matcher->addElement(m_tokens[m_pos++]));
+    }
+    return m_matcher->addExpr(path);
+  }
+
+  int negate(int operand) {
+    return operand < 0 ? -1 : m_matcher->addExpr(Expr{Expr::Type::Not, {}, {operand}});
+  }
+};
+
+bool ScopeSelectorMatcher::add(const QString& selector, int id) {
+  const int exprCount = m_exprs.size();
+  const int expr = Parser(this, tokenize(selector)).parse();
+  if (expr < 0) {
+    m_exprs.resize(exprCount);
+    return false;
+  }
+
+  const int rule = m_rules.size();
+  m_rules.append(Rule{expr, id});
+  QVector<int> keys;
+  if (collectKeys(expr, keys)) {
+    for (int key : keys) {
+      auto& rules = m_rulesByElement[key];
+      if (rules.isEmpty() || rules.last() != rule) {
+        rules.append(rule);
+      }
+    }
+  } else {
+    m_unkeyedRules.append(rule);
+  }
+  return true;
+}
+
+QVector<int> ScopeSelectorMatcher::match(int stack) {
+  const QVector<int> atoms = ScopeStacks::singleton().atoms(stack);
+  QVector<const QVector<int>*> scopes;
+  scopes.reserve(atoms.size());
+  QVector<int> candidates = m_unkeyedRules;
+  for (int atom : atoms) {
+    const QVector<int>& elements = elementsOf(atom);
+    scopes.append(&elements);
+    for (int element : elements) {
+      candidates += m_rulesByElement.value(element);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+  QVector<QPair<int, QVector<int>>> matched;
+  for (int rule : candidates) {
+    QVector<int> score(atoms.size(), 0);
+    if (evaluate(m_rules[rule].expr, scopes, score)) {
+      matched.append(qMakePair(rule, score));
+    }
+  }
+  std::sort(matched.begin(), matched.end(),
+            [](const QPair<int, QVector<int>>& m1, const QPair<int, QVector<int>>& m2) {
+              const int result = compareScores(m1.second, m2.second);
+              return result != 0 ? result > 0 : m1.first > m2.first;
+            });
+
+  QVector<int> ids;
+  ids.reserve(matched.size());
+  for (const auto& m : matched) {
+    ids.append(m_rules[m.first].id);
+  }
+  return ids;
+}
+
+QStringList ScopeSelectorMatcher::splitGroups(const QString& selector) {
+  QStringList groups;
+  int depth = 0;
+  int begin = 0;
+  for (int i = 0; i < selector.size(); i++) {
+    if (selector[i] == '(') {
+      depth++;
+    } else if (selector[i] == ')') {
+      depth--;
+    } else if (selector[i] == ',' && depth == 0) {
+      groups.append(selector.mid(begin, i - begin).trimmed());
+      begin = i + 1;
+    }
+  }
+  groups.append(selector.mid(begin).trimmed());
+  return groups;
+}
+
+int ScopeSelectorMatcher::addElement(const QString& name) {
+  auto it = m_elementIds.constFind(name);
+  if (it != m_elementIds.constEnd()) {
+    return it.value();
+  }
+
+  const int element = m_elementLengths.size();
+  m_elementLengths.append(name.count('.') + 1);
+  m_elementIds.insert(name, element);
+  // Atoms may match the new element
+  m_atomElements.clear();
+  return element;
+}
+
+int ScopeSelectorMatcher::addExpr(Expr expr) {
+  m_exprs.append(std::move(expr));
+  return m_exprs.size() - 1;
+}
+
+// Collects elements one of which must be in a stack for expr to match.
+// Returns false if expr can match a stack without any element.
+bool ScopeSelectorMatcher::collectKeys(int expr, QVector<int>& keys) const {
+  const Expr& e = m_exprs[expr];
+  switch (e.type) {
+    case Expr::Type::Path:
+      if (e.elements.isEmpty()) {
+        return false;
+      }
+      keys.append(e.elements.last());
+      return true;
+    case Expr::Type::Or:
+      for (int operand : e.operands) {
+        if (!collectKeys(operand, keys)) {
+          return false;
+        }
+      }
+      return true;
+    case Expr::Type::And:
+      for (int operand : e.operands) {
+        QVector<int> operandKeys;
+        if (collectKeys(operand, operandKeys)) {
+          keys += operandKeys;
+          return true;
+        }
+      }
+      return false;
+    case Expr::Type::Not:
+      return false;
+  }
+  return false;
+}
+
+// An element matches a scope if it is the scope or its prefix ending at a dot.
+// e.g. "string.quoted" matches "string.quoted.double" but not "string.quotedfoo"
+const QVector<int>& ScopeSelectorMatcher::elementsOf(int atom) {
+  auto it = m_atomElements.find(atom);
+  if (it != m_atomElements.end()) {
+    return it->second;
+  }
+
+  const QString name = ScopeAtoms::singleton().name(atom);
+  QVector<int> elements;
+  for (int i = 0; i <= name.size(); i++) {
+    if (i == name.size() || name[i] == '.') {
+      auto elementIt = m_elementIds.constFind(name.left(i));
+      if (elementIt != m_elementIds.constEnd()) {
+        elements.append(elementIt.value());
+      }
+    }
+  }
+  return m_atomElements.emplace(atom, elements).first->second;
+}
+
+// score[i] is the number of parts of the element matched with the i-th scope from the bottom.
+// A path matches each element with the deepest possible scope, so a selector matching deeper
+// scopes and longer elements ranks higher.
+bool ScopeSelectorMatcher::evaluate(int expr,
+                                    const QVector<const QVector<int>*>& scopes,
+                                    QVector<int>& score) const {
+  const Expr& e = m_exprs[expr];
+  switch (e.type) {
+    case Expr::Type::Path: {
+      QVector<int> pathScore(score.size(), 0);
+      int scope = scopes.size() - 1;
+      for (int i = e.elements.size() - 1; i >= 0; i--) {
+        while (scope >= 0 && !scopes[scope]->contains(e.elements[i])) {
+          scope--;
+        }
+        if (scope < 0) {
+          return false;
+        }
+        pathScore[scope] = m_elementLengths[e.elements[i]];
+        scope--;
+      }
+      mergeScores(score, pathScore);
+      return true;
+    }
+    case Expr::Type::Or: {
+      bool matched = false;
+      QVector<int> best;
+      for (int operand : e.operands) {
+        QVector<int> operandScore(score.size(), 0);
+        if (evaluate(operand, scopes, operandScore) &&
+            (!matched || compareScores(operandScore, best) > 0)) {
+          best = operandScore;
+          matched = true;
+        }
+      }
+      if (matched) {
+        mergeScores(score, best);
+      }
+      return matched;
+    }
+    case Expr::Type::And:
+      for (int operand : e.operands) {
+        if (!evaluate(operand, scopes, score)) {
+          return false;
+        }
+      }
+      return true;
+    case Expr::Type::Not: {
+      QVector<int> operandScore(score.size(), 0);
+      return !evaluate(e.operands[0], scopes, operandScore);
+    }
+  }
+  return false;
+}
+
+}  // namespace core
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <unordered_map>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "macros.h"
+
+namespace core {
+
+// Compiled TextMate scope selectors (http://manual.macromates.com/en/scope_selectors).
+// Supports descendant paths, '-' exclusion, ',' and '|' groups, '&' and parentheses.
+// Scope names in selectors are compiled to element ids, and each scope atom is mapped to the ids
+// of the elements it matches once, so matching a scope stack doesn't split or compare strings.
+// Only the rules whose key element appears in the stack are evaluated.
+class ScopeSelectorMatcher {
+  DISABLE_COPY(ScopeSelectorMatcher)
+
+ public:
+  ScopeSelectorMatcher() = default;
+  ~ScopeSelectorMatcher() = default;
+  DEFAULT_MOVE(ScopeSelectorMatcher)
+
+  // Compiles selector as a rule with id. Returns false if selector has a syntax error.
+  bool add(const QString& selector, int id);
+
+  // Returns ids of the rules which match stack (an id of ScopeStacks), the best match first.
+  // The rule added later wins a tie. An empty selector matches any stack with the lowest rank.
+  // Call this only in the main thread because it uses ScopeStacks.
+  QVector<int> match(int stack);
+
+  // Splits selector at ',' outside of parentheses
+  static QStringList splitGroups(const QString& selector);
+
+ private:
+  struct Expr {
+    enum class Type { Path, Or, And, Not };
+
+    Type type;
+    // element ids of a path from the bottom
+    QVector<int> elements;
+    // indices of m_exprs
+    QVector<int> operands;
+  };
+
+  struct Rule {
+    int expr;
+    int id;
+  };
+
+  class Parser;
+
+  QVector<Expr> m_exprs;
+  QVector<Rule> m_rules;
+  // element name (e.g. "string.quoted") -> element id
+  QHash<QString, int> m_elementIds;
+  // number of dot separated parts of each element
+  QVector<int> m_elementLengths;
+  // element id -> rules which can match only if the element is in a stack
+  QHash<int, QVector<int>> m_rulesByElement;
+  QVector<int> m_unkeyedRules;
+  // atom -> ids of the elements which match the atom
+  std::unordered_map<int, QVector<int>> m_atomElements;
+
+  int addElement(const QString& name);
+  int addExpr(Expr expr);
+  bool collectKeys(int expr, QVector<int>& keys) const;
+  const QVector<int>& elementsOf(int atom);
+  bool evaluate(int expr, const QVector<const QVector<int>*>& scopes, QVector<int>& score) const;
+};
+
+}  // namespace core
@@ -0,0 +1,340 @@
+#include "ScopeTree.h"
+#include "ScopeAtoms.h"
+#include "LanguageParser.h"
+
+namespace core {
+
+namespace {
+
+// Returns the first index in [0, size) for which pred is true. pred must be monotonic.
+template <typename Predicate>
+int lowerBound(int size, Predicate pred) {
+  int low = 0;
+  int high = size;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (pred(mid)) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
+// Returns the index of the child which covers search, or -1.
+// begin(i) and length(i) return the absolute begin and the length of the i-th child.
+template <typename BeginFn, typename LengthFn>
+int findCoveringChild(int count, const Region& search, BeginFn begin, LengthFn length) {
+  int i = lowerBound(count, [&](int k) {
+    return begin(k) >= search.begin() ||
+           Region(begin(k), begin(k) + length(k)).fullyCovers(search);
+  });
+  for (; i < count; i++) {
+    if (begin(i) > search.end()) {
+      break;
+    }
+    if (Region(begin(i), begin(i) + length(i)).fullyCovers(search)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Same as Region::adjust for a point
+int adjustPoint(int point, int pos, int delta) {
+  return point >= pos ? point + delta : qMin(point, pos + delta);
+}
+
+// Same as Region::adjust for the content region of a node. oldBegin and newBegin are the absolute
+// begin of the node before and after the edit.
+void adjustContent(ScopeNodeOrigin& origin, int oldBegin, int newBegin, int pos, int delta) {
+  Region content(oldBegin + origin.contentBegin,
+                 oldBegin + origin.contentBegin + origin.contentLength);
+  content.adjust(pos, delta);
+  origin.contentBegin = content.begin() - newBegin;
+  origin.contentLength = content.length();
+}
+
+// Adjusts the children of nodes[index]. oldBegin and newBegin are the absolute begin of
+// nodes[index] before and after the edit.
+void adjustChildren(ScopeSegment& segment,
+                    int index,
+                    int oldBegin,
+                    int newBegin,
+                    int pos,
+                    int delta) {
+  QVector<ScopeNode>& nodes = segment.nodes;
+  const int first = nodes[index].firstChild;
+  const int count = nodes[index].childCount;
+  // Children which end before this don't change
+  const int unchangedEnd = delta < 0 ? pos + delta + 1 : pos;
+  int i = first + lowerBound(count, [&](int k) {
+            const ScopeNode& child = nodes[first + k];
+            return oldBegin + child.begin + child.length >= unchangedEnd;
+          });
+
+  for (; i < first + count; i++) {
+    const int childBegin = oldBegin + nodes[i].begin;
+    const int childEnd = childBegin + nodes[i].length;
+    const int newChildBegin = adjustPoint(childBegin, pos, delta);
+    const int newChildEnd = adjustPoint(childEnd, pos, delta);
+    nodes[i].begin = newChildBegin - newBegin;
+    nodes[i].length = newChildEnd - newChildBegin;
+    // A child after pos moves with its descendants because their positions are relative
+    if (childBegin < pos) {
+      adjustContent(segment.origins[i], childBegin, newChildBegin, pos, delta);
+      adjustChildren(segment, i, childBegin, newChildBegin, pos, delta);
+    }
+  }
+}
+
+// Nodes created by patterns have atoms interned when their grammar was compiled
+int nameAtom(const Node& node) {
+  if (node.nameAtom != ScopeAtoms::EMPTY || node.name.isEmpty()) {
+    return node.nameAtom;
+  }
+  return ScopeAtoms::singleton().intern(node.name);
+}
+
+Node toNode(const ScopeSegment& segment, int index, int parentBegin) {
+  const ScopeNode& scopeNode = segment.nodes[index];
+  const ScopeNodeOrigin& origin = segment.origins[index];
+  const int begin = parentBegin + scopeNode.begin;
+  Node node(ScopeAtoms::singleton().name(scopeNode.name), Region(begin, begin + scopeNode.length));
+  node.nameAtom = scopeNode.name;
+  node.pattern = origin.pattern;
+  node.contentRegion = Region(begin + origin.contentBegin,
+                              begin + origin.contentBegin + origin.contentLength);
+  node.beginCapturedStrs = origin.beginCapturedStrs;
+  for (int i = scopeNode.firstChild; i < scopeNode.firstChild + scopeNode.childCount; i++) {
+    node.children.append(toNode(segment, i, begin));
+  }
+  return node;
+}
+
+ScopeNodeOrigin origin(const Node& node) {
+  // Only a begin/end node has a content region
+  if (!node.pattern || !node.pattern->begin) {
+    return ScopeNodeOrigin{node.pattern, 0, 0, QStringList()};
+  }
+  return ScopeNodeOrigin{node.pattern, node.contentRegion.begin() - node.region.begin(),
+                         node.contentRegion.length(), node.beginCapturedStrs};
+}
+}
+
+QVector<ScopeSegment> ScopeSegment::fromNodes(const QList<Node>& nodes) {
+  QVector<ScopeSegment> segments;
+  segments.reserve(nodes.size());
+  for (const auto& node : nodes) {
+    ScopeSegment segment;
+    segment.begin = node.region.begin();
+    segment.nodes.append(ScopeNode{0, node.region.length(), nameAtom(node), 0, 0});
+    segment.origins.append(origin(node));
+
+    // Breadth first, so that children of a node are contiguous. queue[i] is segment.nodes[i]
+    QVector<const Node*> queue{&node};
+    for (int i = 0; i < queue.size(); i++) {
+      const Node* parent = queue[i];
+      segment.nodes[i].firstChild = segment.nodes.size();
+      segment.nodes[i].childCount = parent->children.size();
+      for (const auto& child : parent->children) {
+        segment.nodes.append(ScopeNode{child.region.begin() - parent->region.begin(),
+                                       child.region.length(), nameAtom(child), 0, 0});
+        segment.origins.append(origin(child));
+        queue.append(&child);
+      }
+    }
+    segments.append(segment);
+  }
+  return segments;
+}
+
+ScopeTree::ScopeTree(const QString& rootName, int length)
+    : m_rootName(ScopeAtoms::singleton().intern(rootName)), m_length(length) {}
+
+ScopeTree ScopeTree::fromRootNode(const RootNode& rootNode) {
+  ScopeTree tree(rootNode.name, rootNode.region.end());
+  tree.m_segments = ScopeSegment::fromNodes(rootNode.children);
+  return tree;
+}
+
+void ScopeTree::setRootName(const QString& rootName) {
+  m_rootName = ScopeAtoms::singleton().intern(rootName);
+}
+
+void ScopeTree::adjust(int pos, int delta) {
+  m_length += delta;
+
+  // Segments which begin at or after pos just move
+  const int from = lowerBound(m_segments.size(), [&](int i) { return segmentBegin(i) >= pos; });
+
+  // Segments before them change only if they end in the edited region
+  for (int i = from - 1; i >= 0; i--) {
+    const int begin = segmentBegin(i);
+    const int end = begin + m_segments[i].nodes[0].length;
+    if (end < pos && end <= pos + delta) {
+      break;
+    }
+
+    ScopeSegment& segment = m_segments[i];
+    const int newBegin = adjustPoint(begin, pos, delta);
+    segment.nodes[0].length = adjustPoint(end, pos, delta) - newBegin;
+    adjustContent(segment.origins[0], begin, newBegin, pos, delta);
+    adjustChildren(segment, 0, begin, newBegin, pos, delta);
+    setSegmentBegin(i, newBegin);
+  }
+
+  if (from < m_segments.size()) {
+    shiftSegments(from, delta);
+  }
+}
+
+Region ScopeTree::replace(const QVector<ScopeSegment>& newSegments, const Region& region) {
+  Region affectedRegion(region);
+  if (!newSegments.isEmpty()) {
+    const ScopeSegment& last = newSegments.last();
+    affectedRegion.setBegin(qMin(affectedRegion.begin(), newSegments.first().begin));
+    affectedRegion.setEnd(qMax(affectedRegion.end(), last.begin + last.nodes[0].length));
+  }
+
+  // Segments are sorted and don't overlap, so the ones intersecting affectedRegion are contiguous
+  auto segmentEnd = [this](int i) { return segmentBegin(i) + m_segments[i].nodes[0].length; };
+  const int first =
+      lowerBound(m_segments.size(), [&](int i) { return segmentEnd(i) > affectedRegion.begin(); });
+  int last = first;
+  while (last < m_segments.size() && segmentBegin(last) < affectedRegion.end()) {
+    last++;
+  }
+
+  // removed segments may stick out of affectedRegion
+  Region removedRegion(affectedRegion);
+  if (first < last) {
+    removedRegion = removedRegion.sum(Region(segmentBegin(first), segmentEnd(last - 1)));
+  }
+
+  // Keep the deferred shift of the segments after the removed ones
+  const int removedCount = last - first;
+  const int count = newSegments.size();
+  if (m_shiftFrom >= last) {
+    m_shiftFrom += count - removedCount;
+  } else if (m_shiftFrom > first) {
+    m_shiftFrom = first + count;
+  }
+
+  if (count > removedCount) {
+    m_segments.insert(first, count - removedCount, ScopeSegment());
+  } else if (count < removedCount) {
+    m_segments.remove(first, removedCount - count);
+  }
+  for (int i = 0; i < count; i++) {
+    m_segments[first + i] = newSegments[i];
+    setSegmentBegin(first + i, newSegments[i].begin);
+  }
+
+  return removedRegion;
+}
+
+Region ScopeTree::segmentRegion(int index) const {
+  const int begin = segmentBegin(index);
+  return Region(begin, begin + m_segments[index].nodes[0].length);
+}
+
+int ScopeTree::segmentAfter(int pos) const {
+  return lowerBound(m_segments.size(), [&](int i) { return segmentRegion(i).end() > pos; });
+}
+
+int ScopeTree::findSegment(const Region& search) const {
+  return findCoveringChild(
+      m_segments.size(), search, [this](int k) { return segmentBegin(k); },
+      [this](int k) { return m_segments[k].nodes[0].length; });
+}
+
+Node ScopeTree::toNode(int index) const {
+  return core::toNode(m_segments[index], 0, segmentBegin(index));
+}
+
+bool ScopeTree::findScopes(const Region& search, QVector<Scope>& path) const {
+  auto& stacks = ScopeStacks::singleton();
+  const int oldSize = path.size();
+  if (path.isEmpty()) {
+    if (!region().fullyCovers(search)) {
+      return false;
+    }
+    path.append(Scope{-1, 0, region(), stacks.push(ScopeStacks::EMPTY, m_rootName)});
+  }
+
+  while (true) {
+    const Scope parent = path.last();
+    if (parent.segment == -1) {
+      int i = findCoveringChild(
+          m_segments.size(), search, [this](int k) { return segmentBegin(k); },
+          [this](int k) { return m_segments[k].nodes[0].length; });
+      if (i < 0) {
+        break;
+      }
+      const ScopeNode& node = m_segments[i].nodes[0];
+      const int begin = segmentBegin(i);
+      path.append(
+          Scope{i, 0, Region(begin, begin + node.length), stacks.push(parent.stack, node.name)});
+    } else {
+      const auto& nodes = m_segments[parent.segment].nodes;
+      const int first = nodes[parent.index].firstChild;
+      int i = findCoveringChild(
+          nodes[parent.index].childCount, search,
+          [&](int k) { return parent.region.begin() + nodes[first + k].begin; },
+          [&](int k) { return nodes[first + k].length; });
+      if (i < 0) {
+        break;
+      }
+      const ScopeNode& node = nodes[first + i];
+      const int begin = parent.region.begin() + node.begin;
+      path.append(Scope{parent.segment, first + i, Region(begin, begin + node.length),
+                        stacks.push(parent.stack, node.name)});
+    }
+  }
+
+  return path.size() > oldSize;
+}
+
+bool ScopeTree::isLeaf(const Scope& scope) const {
+  return scope.segment == -1 ? m_segments.isEmpty()
+                             : m_segments[scope.segment].nodes[scope.index].childCount == 0;
+}
+
+RootNode ScopeTree::toRootNode() const {
+  RootNode rootNode(ScopeAtoms::singleton().name(m_rootName));
+  rootNode.region = region();
+  for (int i = 0; i < m_segments.size(); i++) {
+    rootNode.children.append(toNode(i));
+  }
+  return rootNode;
+}
+
+int ScopeTree::segmentBegin(int index) const {
+  return m_segments[index].begin + (index >= m_shiftFrom ? m_shiftDelta : 0);
+}
+
+void ScopeTree::setSegmentBegin(int index, int begin) {
+  m_segments[index].begin = begin - (index >= m_shiftFrom ? m_shiftDelta : 0);
+}
+
+void ScopeTree::flushShift() {
+  for (int i = m_shiftFrom; i < m_segments.size(); i++) {
+    m_segments[i].begin += m_shiftDelta;
+  }
+  m_shiftFrom = 0;
+  m_shiftDelta = 0;
+}
+
+// Typing at the same place shifts the same segments, so the shift is accumulated until an edit
+// shifts different segments
+void ScopeTree::shiftSegments(int from, int delta) {
+  if (m_shiftDelta != 0 && m_shiftFrom != from) {
+    flushShift();
+  }
+  m_shiftFrom = from;
+  m_shiftDelta += delta;
+}
+
+}  // namespace core
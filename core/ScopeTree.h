@@ -0,0 +1,113 @@
+#pragma once
+
+#include <QList>
+#include <QMetaType>
+#include <QStringList>
+#include <QVector>
+
+#include "macros.h"
+#include "Region.h"
+
+namespace core {
+
+struct Node;
+struct RootNode;
+struct Pattern;
+
+struct ScopeNode {
+  // relative to the begin of the parent
+  int begin;
+  int length;
+  // atom of ScopeAtoms
+  int name;
+  int firstChild;
+  int childCount;
+};
+
+// What the parser needs to resume parsing inside a ScopeNode
+struct ScopeNodeOrigin {
+  // Pattern which created the node. nullptr for capture and contentName nodes
+  Pattern* pattern;
+  // content region of a begin/end node relative to the begin of the node
+  int contentBegin;
+  int contentLength;
+  // strings captured by the begin regex of a begin/end node
+  QStringList beginCapturedStrs;
+};
+
+// A top level node and its descendants in one array. Children of a node are stored contiguously,
+// so they can be searched by binary search.
+struct ScopeSegment {
+  int begin;
+  QVector<ScopeNode> nodes;
+  // origins[i] is of nodes[i]. Kept out of ScopeNode because highlighting doesn't read them
+  QVector<ScopeNodeOrigin> origins;
+
+  static QVector<ScopeSegment> fromNodes(const QList<Node>& nodes);
+};
+
+// Flat scope tree used by SyntaxHighlighter and kept by ParseScheduler for the next parse.
+// Unlike Node, positions are relative to the parent, so an edit changes only the nodes containing
+// it and their following siblings. Shifting the top level segments after an edit is deferred and
+// accumulated while edits hit the same segment.
+class ScopeTree {
+ public:
+  // A node on the path to the innermost scope. segment is -1 for the root
+  struct Scope {
+    int segment;
+    int index;
+    Region region;
+    // id of the scope stack from the root to this node in ScopeStacks
+    int stack;
+  };
+
+  ScopeTree() = default;
+  ScopeTree(const QString& rootName, int length);
+  static ScopeTree fromRootNode(const RootNode& rootNode);
+  DEFAULT_COPY_AND_MOVE(ScopeTree)
+
+  Region region() const { return Region(0, m_length); }
+  void setRootName(const QString& rootName);
+  int segmentCount() const { return m_segments.size(); }
+  Region segmentRegion(int index) const;
+  // Returns the index of the first segment which ends after pos, or segmentCount() if none
+  int segmentAfter(int pos) const;
+  // Returns the index of the segment which covers search, or -1
+  int findSegment(const Region& search) const;
+  // Converts a segment to Node with its origins, so that the parser can reparse inside it
+  Node toNode(int index) const;
+
+  // Same as Node::adjust for every node
+  void adjust(int pos, int delta);
+
+  // Replaces the segments which intersect region or newSegments with newSegments.
+  // Returns the region of the removed and added segments.
+  Region replace(const QVector<ScopeSegment>& newSegments, const Region& region);
+
+  // Appends the nodes which cover search to path, from the last node of path or from the root if
+  // path is empty. Returns false if no new node is appended.
+  // Call this only in the main thread because it uses ScopeStacks.
+  bool findScopes(const Region& search, QVector<Scope>& path) const;
+  bool isLeaf(const Scope& scope) const;
+
+  // Converts to Node for debugging and tests
+  RootNode toRootNode() const;
+
+ private:
+  int m_rootName = 0;
+  int m_length = 0;
+  QVector<ScopeSegment> m_segments;
+  // Segments from m_shiftFrom are shifted by m_shiftDelta lazily
+  int m_shiftFrom = 0;
+  int m_shiftDelta = 0;
+
+  int segmentBegin(int index) const;
+  void setSegmentBegin(int index, int begin);
+  void flushShift();
+  void shiftSegments(int from, int delta);
+};
+
+}  // namespace core
+
+Q_DECLARE_METATYPE(core::ScopeTree)
+Q_DECLARE_METATYPE(QVector<core::ScopeSegment>)
@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include "SearchMatches.h"
+#include "Regexp.h"
+
+namespace core {
+
+void SearchMatches::append(const QVector<Region>& regions) {
+  Q_ASSERT(m_regions.isEmpty() || regions.isEmpty() ||
+           m_regions.last().end() <= regions.first().begin());
+  m_regions += regions;
+}
+
+void SearchMatches::replace(const Region& region, const QVector<Region>& regions) {
+  auto range = this->range(region.begin(), region.end());
+  const int first = range.first - m_regions.constBegin();
+  int last = range.second - m_regions.constBegin();
+  if (!regions.isEmpty()) {
+    while (last < m_regions.size() && m_regions[last].begin() < regions.last().end()) {
+      last++;
+    }
+  }
+
+  m_regions.remove(first, last - first);
+  m_regions.insert(first, regions.size(), Region());
+  std::copy(regions.constBegin(), regions.constEnd(), m_regions.begin() + first);
+}
+
+void SearchMatches::adjust(int position, int charsRemoved, int charsAdded) {
+  auto range = this->range(position, position + charsRemoved);
+  const int first = range.first - m_regions.constBegin();
+  const int last = range.second - m_regions.constBegin();
+  m_regions.remove(first, last - first);
+
+  const int delta = charsAdded - charsRemoved;
+  if (delta != 0) {
+    for (int i = first; i < m_regions.size(); i++) {
+      m_regions[i] = Region(m_regions[i].begin() + delta, m_regions[i].end() + delta);
+    }
+  }
+}
+
+void SearchMatches::update(const QString& text,
+                           const Regexp& regexp,
+                           int position,
+                           int charsRemoved,
+                           int charsAdded,
+                           int searchBegin,
+                           int searchEnd) {
+  const int begin = position > 0 ? text.lastIndexOf('\n', position - 1) + 1 : 0;
+  int end = text.indexOf('\n', position + charsAdded);
+  if (end < 0) {
+    end = text.size();
+  }
+  const Region region = prepareUpdate(Region(begin, end), position, charsRemoved, charsAdded);
+  research(text, 0, true, regexp, region, searchBegin, searchEnd);
+}
+
+Region SearchMatches::prepareUpdate(const Region& lines,
+                                    int position,
+                                    int charsRemoved,
+                                    int charsAdded) {
+  int begin = lines.begin();
+  int end = lines.end();
+
+  // A match removed with the removed text may reach outside the edited lines
+  const auto removed = range(position, position + charsRemoved);
+  if (removed.first != removed.second) {
+    Region removedRegion(removed.first->begin(), (removed.second - 1)->end());
+    removedRegion.adjust(position + charsRemoved, charsAdded - charsRemoved);
+    begin = qMin(begin, removedRegion.begin());
+    end = qMax(end, removedRegion.end());
+  }
+  adjust(position, charsRemoved, charsAdded);
+
+  // The matches touching the range are replaced, so the range covers them to find them again
+  while (true) {
+    const auto touching = range(begin, end);
+    if (touching.first == touching.second ||
+        (begin <= touching.first->begin() && (touching.second - 1)->end() <= end)) {
+      break;
+    }
+    begin = qMin(begin, touching.first->begin());
+    end = qMax(end, (touching.second - 1)->end());
+  }
+  return Region(begin, end);
+}
+
+bool SearchMatches::research(const QString& text,
+                             int textBegin,
+                             bool isTail,
+                             const Regexp& regexp,
+                             const Region& region,
+                             int searchBegin,
+                             int searchEnd) {
+  const int textEnd = textBegin + text.size();
+  if (!isTail && region.end() > textEnd) {
+    return false;
+  }
+  if (searchEnd < 0 || searchEnd > textEnd) {
+    searchEnd = textEnd;
+  }
+  const int begin = qMax(region.begin(), qMax(searchBegin, textBegin));
+  int end = qMin(region.end(), searchEnd);
+  if (begin > end) {
+    return true;
+  }
+
+  // The text before the range is searched too, so that anchors and lookarounds see it. A match
+  // has to end within the searched range, so the search goes on to the end of the text to find a
+  // match of any length, and stops at a match which neither begins in the range nor follows a
+  // new one.
+  QVector<Region> regions;
+  bool isCut = false;
+  regexp.forEachMatch(text, begin - textBegin, searchEnd - textBegin, [&](const Region& match) {
+    const Region found(match.begin() + textBegin, match.end() + textBegin);
+    if (found.begin() > end) {
+      return false;
+    }
+    if (!isTail && found.end() >= textEnd) {
+      isCut = true;
+      return false;
+    }
+    regions.append(found);
+    end = qMax(end, found.end());
+    return true;
+  });
+  if (isCut) {
+    return false;
+  }
+  replace(Region(begin, end), regions);
+  return true;
+}
+
+void SearchMatches::clear() {
+  m_regions.clear();
+}
+
+std::pair<SearchMatches::const_iterator, SearchMatches::const_iterator> SearchMatches::range(
+    int begin,
+    int end) const {
+  auto first = std::lower_bound(m_regions.constBegin(), m_regions.constEnd(), begin,
+                                [](const Region& region, int pos) { return region.end() < pos; });
+  auto last = std::upper_bound(first, m_regions.constEnd(), end,
+                               [](int pos, const Region& region) { return pos < region.begin(); });
+  return std::make_pair(first, last);
+}
+
+}  // namespace core
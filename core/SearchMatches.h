@@ -0,0 +1,71 @@
+#pragma once
+
+#include <utility>
+#include <QString>
+#include <QVector>
+
+#include "macros.h"
+#include "Region.h"
+
+namespace core {
+
+class Regexp;
+
+// Search matches kept sorted in a flat array of regions. Matches never overlap, so both their
+// begins and ends are sorted and the matches in a visible region are found by binary search.
+class SearchMatches {
+ public:
+  typedef QVector<Region>::const_iterator const_iterator;
+
+  SearchMatches() = default;
+  ~SearchMatches() = default;
+  DEFAULT_COPY_AND_MOVE(SearchMatches)
+
+  // Appends regions found after the existing matches
+  void append(const QVector<Region>& regions);
+  // Replaces the matches which intersect or touch region with regions found in it. Following
+  // matches overlapping the last new one are removed too.
+  void replace(const Region& region, const QVector<Region>& regions);
+  // Moves the matches after an edit. The matches which intersect or touch the removed text are
+  // removed because they may not match anymore.
+  void adjust(int position, int charsRemoved, int charsAdded);
+  // Updates the matches of regexp in [searchBegin, searchEnd) of text after an edit of text.
+  // searchEnd -1 means the end of text. The matches are moved, and the edited lines are searched
+  // again with the matches touching them.
+  void update(const QString& text,
+              const Regexp& regexp,
+              int position,
+              int charsRemoved,
+              int charsAdded,
+              int searchBegin = 0,
+              int searchEnd = -1);
+  // The first half of update. Moves the matches after an edit and returns the region to search
+  // again, which is lines widened by the matches removed with the removed text and the matches
+  // touching it. lines is the edited lines after the edit.
+  Region prepareUpdate(const Region& lines, int position, int charsRemoved, int charsAdded);
+  // The second half of update. Replaces the matches in region with the matches of regexp found
+  // in it. text is a part of the whole text from textBegin which covers region, and isTail tells
+  // whether it lasts to the end of the whole text. Returns false without changing the matches if
+  // a match reaches the end of a part which isn't the tail, because it may be cut there.
+  bool research(const QString& text,
+                int textBegin,
+                bool isTail,
+                const Regexp& regexp,
+                const Region& region,
+                int searchBegin = 0,
+                int searchEnd = -1);
+  void clear();
+
+  int size() const { return m_regions.size(); }
+  bool isEmpty() const { return m_regions.isEmpty(); }
+  const_iterator begin() const { return m_regions.constBegin(); }
+  const_iterator end() const { return m_regions.constEnd(); }
+
+  // Returns the matches which intersect or touch [begin, end]
+  std::pair<const_iterator, const_iterator> range(int begin, int end) const;
+
+ private:
+  QVector<Region> m_regions;
+};
+
+}  // namespace core
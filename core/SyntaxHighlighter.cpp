@@ -3,18 +3,52 @@
 #include <QDebug>
 
 #include "SyntaxHighlighter.h"
+#include "ParseScheduler.h"
+#include "ScopeAtoms.h"
 #include "PListParser.h"
-#include "Util.h"
 #include "Config.h"
 #include "Theme.h"
+#include "scoped_guard.h"
 
 namespace core {
 
+namespace {
+
+// Returns the text in [position, position + length) in the same format as toPlainText
+QString plainText(QTextDocument* doc, int position, int length) {
+  QTextCursor cursor(doc);
+  cursor.setPosition(qMin(position, doc->characterCount() - 1));
+  cursor.setPosition(qMin(position + length, doc->characterCount() - 1), QTextCursor::KeepAnchor);
+  QString text = cursor.selectedText();
+  for (QChar& ch : text) {
+    switch (ch.unicode()) {
+      case 0xfdd0:  // QTextBeginningOfFrame
+      case 0xfdd1:  // QTextEndOfFrame
+      case QChar::ParagraphSeparator:
+      case QChar::LineSeparator:
+        ch = QLatin1Char('\n');
+        break;
+      case QChar::Nbsp:
+        ch = QLatin1Char(' ');
+        break;
+      default:
+        break;
+    }
+  }
+  return text;
+}
+}
+
 SyntaxHighlighter::SyntaxHighlighter(QTextDocument* doc,
                                      std::unique_ptr<LanguageParser> parser,
                                      Theme* theme,
                                      QFont font)
-    : QSyntaxHighlighter(doc), m_parser(*parser), m_theme(theme) {
+    : QSyntaxHighlighter(doc),
+      m_parser(*parser),
+      m_textLength(0),
+      m_revision(doc->revision()),
+      m_isRehighlighting(false),
+      m_theme(theme) {
   Q_ASSERT(parser);
 
   /*
@@ -29,17 +63,23 @@ SyntaxHighlighter::SyntaxHighlighter(QTextDocument* doc,
   connect(doc, &QTextDocument::contentsChange, this, &SyntaxHighlighter::updateNode);
   connect(&Config::singleton(), &Config::themeChanged, this, &SyntaxHighlighter::changeTheme);
   connect(&Config::singleton(), &Config::fontChanged, this, &SyntaxHighlighter::changeFont);
-  connect(&SyntaxHighlighterThread::singleton(), &SyntaxHighlighterThread::fullParseFinished, this,
-          [&](SyntaxHighlighter* highlighter, RootNode node) {
+  connect(&ParseScheduler::singleton(), &ParseScheduler::fullParseFinished, this,
+          [&](SyntaxHighlighter* highlighter, ScopeTree tree, bool isProgressive) {
             if (highlighter == this) {
-              fullParseFinished(node);
+              fullParseFinished(tree, isProgressive);
             }
           });
-
-  connect(&SyntaxHighlighterThread::singleton(), &SyntaxHighlighterThread::partialParseFinished,
-          this, [&](SyntaxHighlighter* highlighter, QList<Node> newNodes, Region region) {
+  connect(&ParseScheduler::singleton(), &ParseScheduler::fullParseProgressed, this,
+          [&](SyntaxHighlighter* highlighter, QVector<ScopeSegment> newSegments, Region region) {
             if (highlighter == this) {
-              partialParseFinished(newNodes, region);
+              fullParseProgressed(newSegments, region);
+            }
+          });
+  connect(&ParseScheduler::singleton(), &ParseScheduler::partialParseFinished, this,
+          [&](SyntaxHighlighter* highlighter, QVector<ScopeSegment> newSegments, Region region,
+              Region changedRegion) {
+            if (highlighter == this) {
+              partialParseFinished(newSegments, region, changedRegion);
             }
           });
 
@@ -47,41 +87,52 @@ SyntaxHighlighter::SyntaxHighlighter(QTextDocument* doc,
     m_theme->setFont(font);
   }
 
-  QMetaObject::invokeMethod(&SyntaxHighlighterThread::singleton(), "parse", Qt::QueuedConnection,
-                            Q_ARG(SyntaxHighlighter*, this), Q_ARG(LanguageParser, *m_parser));
+  startFullParse(parser->text());
 }
 
 SyntaxHighlighter::~SyntaxHighlighter() {
   qDebug("~SyntaxHighlighter");
+  ParseScheduler::singleton().remove(this);
 }
 
 void SyntaxHighlighter::setParser(LanguageParser parser) {
   m_parser = parser;
-  QMetaObject::invokeMethod(&SyntaxHighlighterThread::singleton(), "parse", Qt::QueuedConnection,
-                            Q_ARG(SyntaxHighlighter*, this), Q_ARG(LanguageParser, *m_parser));
+  startFullParse(parser.text());
+}
+
+void SyntaxHighlighter::setVisible(bool visible) {
+  ParseScheduler::singleton().setVisible(this, visible);
+}
+
+void SyntaxHighlighter::setVisibleRegion(const Region& region) {
+  ParseScheduler::singleton().setVisibleRegion(this, region);
+}
+
+void SyntaxHighlighter::startFullParse(const QString& text) {
+  LanguageParser parser(*m_parser);
+  parser.setText(text);
+  m_textLength = text.length();
+  // Release the text here. Otherwise every edit in ParseScheduler copies the whole text
+  m_parser->setText(QString());
+  ParseScheduler::singleton().parse(this, parser);
 }
 
 Region SyntaxHighlighter::scopeExtent(int point) {
   updateScope(point);
-  if (m_lastScopeNode) {
-    return m_lastScopeNode->region;
+  if (!m_lastScopes.isEmpty()) {
+    return m_lastScopes.last().region;
   }
   return Region();
 }
 
 QString SyntaxHighlighter::scopeName(int point) {
   updateScope(point);
-  return m_lastScopeName;
+  return m_lastScopes.isEmpty() ? QString()
+                                : ScopeStacks::singleton().scopeName(m_lastScopes.last().stack);
 }
 
 QString SyntaxHighlighter::scopeTree() {
-  return m_rootNode ? m_rootNode->toString(document()->toPlainText()) : "";
-}
-
-void SyntaxHighlighter::highlight(const Region& region) {
-  QMetaObject::invokeMethod(&SyntaxHighlighterThread::singleton(), "parse", Qt::QueuedConnection,
-                            Q_ARG(SyntaxHighlighter*, this), Q_ARG(LanguageParser, *m_parser),
-                            Q_ARG(QList<Node>, m_rootNode->children), Q_ARG(Region, region));
+  return m_scopeTree ? m_scopeTree->toRootNode().toString(document()->toPlainText()) : "";
 }
 
 void SyntaxHighlighter::updateNode(int position, int charsRemoved, int charsAdded) {
@@ -93,109 +144,105 @@ void SyntaxHighlighter::updateNode(int position, int charsRemoved, int charsAdde
     return;
   }
 
+  // Highlighting reports a format change as contentsChange(position, n, n). Parsing it as an edit
+  // would cancel the running parse and parse again forever. Only a text change increases the
+  // revision, but it's counted only while undo is enabled.
+  if (m_isRehighlighting) {
+    return;
+  }
+  if (document()->isUndoRedoEnabled()) {
+    if (document()->revision() == m_revision && charsRemoved == charsAdded) {
+      return;
+    }
+    m_revision = document()->revision();
+  }
+
   // position is the position after removal happeened, so we need +charsRemoved
   //
   // NOTE: When pasting a text in an empty document, charsRemoved becomes 1 and charsAdded is the
   // actual charsAdded + 1 because of this bug.
   // We need to decrement them by 1.
   // https://bugreports.qt.io/browse/QTBUG-3495
-  if (m_rootNode && m_rootNode->region.isEmpty() && charsRemoved == 1) {
+  if (m_scopeTree && m_scopeTree->region().isEmpty() && charsRemoved == 1) {
     charsRemoved--;
     charsAdded--;
   }
 
   int delta = charsAdded - charsRemoved;
 
-  if (m_rootNode) {
-    m_rootNode->adjust(position + charsRemoved, delta);
+  if (m_scopeTree) {
+    m_scopeTree->adjust(position + charsRemoved, delta);
+    clearScopeCache();
   }
 
-  //   We need to extend affectedRegion to the region from the beginning of the line at beginPos
-  //   to the end of the line at endPos to support look ahead and behind regex.
-  //   e.g.
-
-  //   text:
-  //     StatusBar QComboBox::down-arrow {
-  //        /*image: url(noimg);*/
-
-  //   pattern:
-  //      <key>begin</key>
-  //      <string>\s*(?=[:.*#a-zA-Z])</string>
-  //      <key>end</key>
-  //      <string>(?=[/@{)])</string>
-  //      <key>name</key>
-  //      <string>meta.selector.css</string>
-
-  //   scope:
-  //     0-32: "meta.selector.css" - Data: "StatusBar QComboBox::down-arrow "
-
-  //   When we delete '{' at the end of line, beginPos is 32 and endPos is 33.
-  //   In this case, [0-32) is not updated without expansion because [0-32) doesn't intersect
-  //   [32-33).
-  //   But we need to update [0-32) because its end pattern has /(?=/ and end pattern should match
-  //   with '/' at pos 36
-
-  int beginPos, endPos;
-
-  beginPos = position;
-  endPos = position + qMax(charsRemoved, charsAdded);
-
-  if (delta > 0) {
-    // When a text is added, we need to get begin and end pos based on the current document.
-    m_parser->setText(document()->toPlainText());
-    beginPos = m_parser->beginOfLine(beginPos);
-    endPos = m_parser->endOfLine(endPos);
-
-  } else {
-    // When a text is removed, we need to get begin and end pos based on the text before removal
-    beginPos = m_parser->beginOfLine(beginPos);
-    endPos = m_parser->endOfLine(endPos);
-    m_parser->setText(document()->toPlainText());
-  }
-
-  if (beginPos < 0 || endPos < 0) {
-    qWarning() << "invalid begin or end position. beginPos" << beginPos << "endPos" << endPos;
+  m_textLength += delta;
+  if (m_textLength != document()->characterCount() - 1) {
+    qWarning() << "text length mismatch. expected:" << document()->characterCount() - 1
+               << "actual:" << m_textLength;
+    startFullParse(document()->toPlainText());
     return;
   }
 
-  highlight(Region(beginPos, endPos));
+  // Send only the edit. The text and the Node tree in ParseScheduler are updated by it
+  ParseScheduler::singleton().parse(this, position, charsRemoved,
+                                    plainText(document(), position, charsAdded));
 }
 
-void SyntaxHighlighter::fullParseFinished(RootNode node) {
-  m_rootNode = node;
-  m_lastScopeNode = boost::none;
-  rehighlight();
+void SyntaxHighlighter::fullParseFinished(ScopeTree tree, bool isProgressive) {
+  // Every segment has been added and highlighted by fullParseProgressed already
+  if (!isProgressive) {
+    m_scopeTree = tree;
+    rehighlightAll();
+  }
+  clearScopeCache();
   emit parseFinished();
 }
 
-void SyntaxHighlighter::partialParseFinished(QList<Node> newNodes, Region region) {
-  Region affectedRegion(region);
-  if (newNodes.size() > 0) {
-    // Extend affectedRegion by considering newNodes
-    qDebug() << "affectedRegion:" << affectedRegion;
-    affectedRegion.setBegin(qMin(affectedRegion.begin(), newNodes[0].region.begin()));
-    affectedRegion.setEnd(qMax(affectedRegion.end(), newNodes[newNodes.size() - 1].region.end()));
+void SyntaxHighlighter::fullParseProgressed(QVector<ScopeSegment> newSegments, Region region) {
+  if (!m_scopeTree) {
+    m_scopeTree = ScopeTree(m_parser->language()->scopeName, m_textLength);
+  } else {
+    // The tree may be of the previous language
+    m_scopeTree->setRootName(m_parser->language()->scopeName);
   }
 
-  m_rootNode->removeChildren(affectedRegion);
-  m_rootNode->addChildren(newNodes);
-  m_rootNode->sortChildren();
+  // Segments of the previous chunk or the provisional parse may be longer than region
+  Region changedRegion = m_scopeTree->replace(newSegments, region);
+  clearScopeCache();
+  rehighlightRegion(changedRegion);
+}
+
+void SyntaxHighlighter::partialParseFinished(QVector<ScopeSegment> newSegments,
+                                             Region region,
+                                             Region changedRegion) {
+  m_scopeTree->replace(newSegments, region);
+  clearScopeCache();
 
-  qDebug("new children.size: %d", (int)m_rootNode->children.size());
-  //  qDebug().noquote() << *this;
+  qDebug("new segment count: %d", m_scopeTree->segmentCount());
 
-  //  qDebug().noquote() << "affectedRegion:" << affectedRegion;
+  // Only blocks in changedRegion have new scopes
+  rehighlightRegion(changedRegion);
+  emit parseFinished();
+}
+
+void SyntaxHighlighter::clearScopeCache() {
+  m_lastScopes.clear();
+}
 
-  QTextBlock affectedBlock = document()->findBlock(affectedRegion.begin());
-  while (affectedBlock.isValid() && affectedBlock.position() < affectedRegion.end()) {
-    rehighlightBlock(affectedBlock);
-    affectedBlock = affectedBlock.next();
+void SyntaxHighlighter::rehighlightRegion(const Region& region) {
+  m_isRehighlighting = true;
+  scoped_guard guard([this] { m_isRehighlighting = false; });
+  QTextBlock block = document()->findBlock(region.begin());
+  while (block.isValid() && block.position() < region.end()) {
+    rehighlightBlock(block);
+    block = block.next();
   }
+}
 
-  m_lastScopeNode = boost::none;
-  m_lastScopeBuf.clear();
-  m_lastScopeName = "";
-  emit parseFinished();
+void SyntaxHighlighter::rehighlightAll() {
+  m_isRehighlighting = true;
+  scoped_guard guard([this] { m_isRehighlighting = false; });
+  rehighlight();
 }
 
 void SyntaxHighlighter::highlightBlock(const QString& text) {
@@ -209,15 +256,16 @@ void SyntaxHighlighter::highlightBlock(const QString& text) {
 
   for (int posInText = 0; posInText < text.length();) {
     updateScope(posInDoc + posInText);
-    if (!m_lastScopeNode) {
-      //      qDebug("lastScopeNode is null. after updateScope(%d)", posInDoc + posInText);
+    if (m_lastScopes.isEmpty()) {
+      //      qDebug("no scope after updateScope(%d)", posInDoc + posInText);
       return;
     }
 
-    QTextCharFormat* format = m_theme->getFormat(m_lastScopeName);
+    // Formats are cached by scope stack, so no scope string is built here
+    QTextCharFormat* format = m_theme->getFormat(m_lastScopes.last().stack);
     if (format) {
-      if (m_lastScopeNode->isLeaf()) {
-        Region region = m_lastScopeNode->region;
+      if (m_scopeTree->isLeaf(m_lastScopes.last())) {
+        Region region = m_lastScopes.last().region;
         int length = region.end() - (posInDoc + posInText);
         //      qDebug("%d - %d  %s", region.begin(), region.end(), qPrintable(m_lastScopeName));
         //        qDebug("setFormat(%d, %d, %s",
@@ -235,74 +283,29 @@ void SyntaxHighlighter::highlightBlock(const QString& text) {
         posInText++;
       }
     } else {
-      qDebug("format not found for %s", qPrintable(m_lastScopeName));
+      qDebug("format not found for %s",
+             qPrintable(ScopeStacks::singleton().scopeName(m_lastScopes.last().stack)));
       posInText++;
     }
   }
 }
 
-boost::optional<Node> SyntaxHighlighter::findScope(const Region& search, const Node& node) {
-  int idx = Util::binarySearch(node.children.size(), [search, node](int i) {
-    return node.children[i].region.begin() >= search.begin() ||
-           node.children[i].region.fullyCovers(search);
-  });
-
-  while (static_cast<int>(idx) < node.children.size()) {
-    auto child = node.children[idx];
-    if (child.region.begin() > search.end()) {
-      break;
-    }
-    if (child.region.fullyCovers(search)) {
-      if (!node.name.isEmpty() && node != m_lastScopeNode) {
-        if (m_lastScopeBuf.length() > 0) {
-          m_lastScopeBuf.append(' ');
-        }
-        m_lastScopeBuf.append(node.name);
-      }
-      return findScope(search, node.children[idx]);
-    }
-    idx++;
-  }
-
-  if (node != m_lastScopeNode && node.region.fullyCovers(search)) {
-    if (!node.name.isEmpty()) {
-      if (m_lastScopeBuf.length() > 0) {
-        m_lastScopeBuf.append(' ');
-      }
-      m_lastScopeBuf.append(node.name);
-    }
-    return node;
-  }
-
-  return boost::none;
-}
-
 void SyntaxHighlighter::updateScope(int point) {
   //  qDebug("updateScope(point: %d)", point);
 
-  if (!m_rootNode) {
-    //    qDebug("root node is null");
+  if (!m_scopeTree) {
+    //    qDebug("scope tree is null");
     return;
   }
 
   Region search(point, point + 1);
-  if (m_lastScopeNode && m_lastScopeNode->region.fullyCovers(search)) {
-    if (m_lastScopeNode->children.size() != 0) {
-      auto no = findScope(search, *m_lastScopeNode);
-      if (no && no != m_lastScopeNode) {
-        m_lastScopeNode = no;
-        m_lastScopeName = QString(m_lastScopeBuf);
-      }
-    }
+  if (!m_lastScopes.isEmpty() && m_lastScopes.last().region.fullyCovers(search)) {
+    m_scopeTree->findScopes(search, m_lastScopes);
     return;
   }
 
-  m_lastScopeNode = boost::none;
-  m_lastScopeBuf.clear();
-  if (m_rootNode) {
-    m_lastScopeNode = findScope(search, *m_rootNode);
-  }
-  m_lastScopeName = QString(m_lastScopeBuf);
+  m_lastScopes.clear();
+  m_scopeTree->findScopes(search, m_lastScopes);
 }
 
 void SyntaxHighlighter::changeTheme(Theme* theme) {
@@ -310,13 +313,13 @@ void SyntaxHighlighter::changeTheme(Theme* theme) {
     theme->setFont(*m_theme->font());
   }
   m_theme = theme;
-  rehighlight();
+  rehighlightAll();
 }
 
 void SyntaxHighlighter::changeFont(const QFont& font) {
   if (m_theme) {
     m_theme->setFont(font);
-    rehighlight();
+    rehighlightAll();
   }
 }
 
@@ -370,80 +373,4 @@ QString SyntaxHighlighter::asHtml() {
   return tempCursor.selection().toHtml();
 }
 
-void SyntaxHighlighterThread::quit() {
-  if (m_activeParser && m_activeParser->isParsing()) {
-    m_activeParser->cancel();
-    m_thread->wait(300);
-  }
-  m_thread->quit();
-}
-
-void SyntaxHighlighterThread::parse(SyntaxHighlighter* highlighter, LanguageParser parser) {
-  if (highlighter) {
-    if (m_activeParser && m_activeParser->isParsing()) {
-      qDebug() << "Start full parsing with a new text";
-      m_activeParser->cancel();
-      // Start full parsing with a new text
-      QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
-      QTimer::singleShot(0, this, [=] { parse(highlighter, parser); });
-      return;
-    }
-
-    m_activeParser = parser;
-    auto rootNode = parser.parse();
-    if (rootNode) {
-      qDebug() << "full parse finished";
-      emit fullParseFinished(highlighter, *rootNode);
-    } else {
-      qDebug() << "full parse canceled";
-    }
-  } else {
-    qWarning() << "highlighter or parser is null";
-  }
-}
-
-void SyntaxHighlighterThread::parse(SyntaxHighlighter* highlighter,
-                                    LanguageParser parser,
-                                    QList<Node> children,
-                                    Region region) {
-  if (highlighter) {
-    if (m_activeParser) {
-      if (m_activeParser->isFullParsing()) {
-        qDebug() << "Start full parsing with a new text";
-        m_activeParser->cancel();
-        // Start full parsing with a new text
-        QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
-        QTimer::singleShot(0, this, [=] { parse(highlighter, parser); });
-        return;
-      } else if (m_activeParser->isParsing()) {
-        qDebug() << "cancel partial parsing";
-        region = m_parsingRegion ? m_parsingRegion->sum(region) : region;
-        m_activeParser->cancel();
-        // Start partial parsing with a new text and region
-        QTimer::singleShot(0, this, [&] { parse(highlighter, parser, children, region); });
-        return;
-      }
-    }
-
-    m_activeParser = parser;
-    m_parsingRegion = region;
-    auto result = parser.parse(children, region);
-    m_parsingRegion = boost::none;
-
-    if (result) {
-      qDebug() << "partial parse finished";
-      emit partialParseFinished(highlighter, std::get<0>(*result), std::get<1>(*result));
-    } else {
-      qDebug() << "partial parse canceled";
-    }
-  } else {
-    qWarning() << "highlighter or parser is null";
-  }
-}
-
-SyntaxHighlighterThread::SyntaxHighlighterThread() : m_thread(new QThread(this)) {
-  moveToThread(m_thread);
-  m_thread->start();
-}
-
 }  // namespace core
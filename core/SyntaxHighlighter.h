@@ -3,45 +3,17 @@
 #include <boost/optional.hpp>
 #include <memory>
 #include <QSyntaxHighlighter>
-#include <QThread>
 
 #include "macros.h"
 #include "LanguageParser.h"
-#include "Singleton.h"
 #include "Region.h"
+#include "ScopeTree.h"
 
 namespace core {
 
 class Theme;
 class SyntaxHighlighter;
 
-class SyntaxHighlighterThread : public QObject, public Singleton<SyntaxHighlighterThread> {
-  Q_OBJECT
- public:
-  ~SyntaxHighlighterThread() = default;
-  void quit();
-
- public slots:
-  void parse(SyntaxHighlighter* highlighter, LanguageParser parser);
-  void parse(SyntaxHighlighter* highlighter,
-             LanguageParser parser,
-             QList<Node> children,
-             Region region);
-
- signals:
-  void fullParseFinished(SyntaxHighlighter* highlighter, RootNode node);
-  void partialParseFinished(SyntaxHighlighter* highlighter, QList<Node> newNodes, Region region);
-
- private:
-  QThread* m_thread;
-  boost::optional<LanguageParser> m_activeParser;
-  boost::optional<Region> m_parsingRegion;
-
-  friend class Singleton<SyntaxHighlighterThread>;
-
-  SyntaxHighlighterThread();
-};
-
 class SyntaxHighlighter : public QSyntaxHighlighter {
   Q_OBJECT
   DISABLE_COPY(SyntaxHighlighter)
@@ -54,11 +26,16 @@ class SyntaxHighlighter : public QSyntaxHighlighter {
   ~SyntaxHighlighter();
   DEFAULT_MOVE(SyntaxHighlighter)
 
-  // accessor
-  RootNode rootNode() { return *m_rootNode; }
+  // Converts the scope tree to Node for debugging and tests
+  RootNode rootNode() { return m_scopeTree ? m_scopeTree->toRootNode() : RootNode(); }
 
   void setParser(LanguageParser parser);
 
+  // Parsing of a visible highlighter is started before the others
+  void setVisible(bool visible);
+  // The visible region of a large text is highlighted before the rest
+  void setVisibleRegion(const Region& region);
+
   // Returns the Region of the inner most Scope extent which contains "point".
   Region scopeExtent(int point);
 
@@ -69,34 +46,42 @@ class SyntaxHighlighter : public QSyntaxHighlighter {
 
   QString asHtml();
 
-  void highlight(const Region& region);
-
  signals:
   void parseFinished();
 
  public slots:
   void updateNode(int position, int charsRemoved, int charsAdded);
-  void fullParseFinished(RootNode node);
-  void partialParseFinished(QList<Node> newNodes, Region region);
+  void fullParseFinished(ScopeTree tree, bool isProgressive = false);
+  void fullParseProgressed(QVector<ScopeSegment> newSegments, Region region);
+  void partialParseFinished(QVector<ScopeSegment> newSegments, Region region, Region changedRegion);
 
  protected:
   void highlightBlock(const QString& text) override;
 
  private:
-  boost::optional<RootNode> m_rootNode;
-  boost::optional<Node> m_lastScopeNode;
-  QByteArray m_lastScopeBuf;
-  QString m_lastScopeName;
+  boost::optional<ScopeTree> m_scopeTree;
+  // Path from the root to the innermost scope found by the last updateScope
+  QVector<ScopeTree::Scope> m_lastScopes;
+  // Keeps the language of the parser. Its text is owned by ParseScheduler
   boost::optional<LanguageParser> m_parser;
+  // Length of the text in ParseScheduler to detect edits not notified by contentsChange
+  int m_textLength;
+  // Revision of the document at the last edit to tell it from a format change
+  int m_revision;
+  // Set while this highlighter changes formats, which are notified by contentsChange
+  bool m_isRehighlighting;
   Theme* m_theme;
 
-  // Given a text region, returns the innermost node covering that region.
-  // Side-effects: Writes to m_lastScopeBuf...
-  boost::optional<Node> findScope(const Region& search, const Node& node);
-
-  // Caches the full concatenated nested scope name and the innermost node that covers "point".
+  // Caches the path to the innermost node that covers "point".
   void updateScope(int point);
 
+  // Hands the text of the document to ParseScheduler and starts a full parse
+  void startFullParse(const QString& text);
+
+  void clearScopeCache();
+  void rehighlightRegion(const Region& region);
+  void rehighlightAll();
+
  private slots:
   void changeTheme(Theme* theme);
   void changeFont(const QFont& font);
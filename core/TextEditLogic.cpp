@@ -27,6 +27,56 @@ int indentLength(const QString& str, int tabWidth) {
 
   return len;
 }
+
+// A part of a replacement. group is -1 for a literal.
+struct ReplacementPart {
+  QString literal;
+  int group;
+};
+
+QVector<ReplacementPart> parseReplacement(const QString& replacement, bool expandsGroups) {
+  QVector<ReplacementPart> parts;
+  QString literal;
+  for (int i = 0; i < replacement.size(); i++) {
+    const QChar ch = replacement[i];
+    if (expandsGroups && (ch == '$' || ch == '\\') && i + 1 < replacement.size()) {
+      const QChar next = replacement[i + 1];
+      if ('0' <= next && next <= '9') {
+        if (!literal.isEmpty()) {
+          parts.append(ReplacementPart{literal, -1});
+          literal.clear();
+        }
+        parts.append(ReplacementPart{QString(), next.digitValue()});
+        i++;
+        continue;
+      } else if (next == ch) {
+        literal += ch;
+        i++;
+        continue;
+      }
+    }
+    literal += ch;
+  }
+
+  if (!literal.isEmpty()) {
+    parts.append(ReplacementPart{literal, -1});
+  }
+  return parts;
+}
+
+// Appends the replacement of a match in text to result
+void appendReplacement(QString& result,
+                       const QVector<ReplacementPart>& parts,
+                       const QString& text,
+                       const MatchRegions& regions) {
+  for (const auto& part : parts) {
+    if (part.group < 0) {
+      result += part.literal;
+    } else if (part.group < regions.size() && regions[part.group].begin() >= 0) {
+      result += text.midRef(regions[part.group].begin(), regions[part.group].length());
+    }
+  }
+}
 }
 
 void TextEditLogic::outdent(QTextDocument* doc, QTextCursor& cursor, int tabWidth) {
@@ -142,4 +192,82 @@ void TextEditLogic::indentCurrentLine(QTextDocument* doc,
   }
 }
 
+QString TextEditLogic::preservedCaseText(const QString& oldStr, const QString& newStr) {
+  if (oldStr.isEmpty()) {
+    return newStr;
+  }
+
+  QString resultStr;
+  resultStr.reserve(newStr.size());
+  for (int i = 0; i < newStr.size(); i++) {
+    const int oldStrIndex = qMin(i, oldStr.size() - 1);
+    if (oldStr[oldStrIndex].isUpper()) {
+      resultStr += newStr[i].toUpper();
+    } else {
+      resultStr += newStr[i].toLower();
+    }
+  }
+
+  return resultStr;
+}
+
+boost::optional<TextReplacement> TextEditLogic::replaceAll(const QString& text,
+                                                           const Regexp* regexp,
+                                                           const QString& replacement,
+                                                           int begin,
+                                                           int end,
+                                                           bool expandsGroups,
+                                                           bool preserveCase) {
+  if (!regexp) {
+    return boost::none;
+  }
+
+  const QVector<ReplacementPart> parts = parseReplacement(replacement, expandsGroups);
+  QString newText;
+  QString replaced;
+  int firstBegin = 0;
+  int prevEnd = 0;
+  int count = 0;
+  regexp->forEachSubmatch(text, begin, end, [&](const MatchRegions& regions) {
+    const Region& match = regions[0];
+    if (count == 0) {
+      firstBegin = match.begin();
+    } else {
+      newText += text.midRef(prevEnd, match.begin() - prevEnd);
+    }
+
+    replaced.clear();
+    appendReplacement(replaced, parts, text, regions);
+    newText += preserveCase ? preservedCaseText(text.mid(match.begin(), match.length()), replaced)
+                            : replaced;
+
+    prevEnd = match.end();
+    count++;
+    return true;
+  });
+
+  if (count == 0) {
+    return boost::none;
+  }
+  return TextReplacement{Region(firstBegin, prevEnd), newText, count};
+}
+
+boost::optional<QString> TextEditLogic::replaceMatch(const QString& text,
+                                                     const Regexp* regexp,
+                                                     const QString& replacement,
+                                                     int begin,
+                                                     int end,
+                                                     bool expandsGroups,
+                                                     bool preserveCase) {
+  MatchRegions regions;
+  if (!regexp || !regexp->search(text, regions, begin, end) ||
+      !(regions[0] == Region(begin, end))) {
+    return boost::none;
+  }
+
+  QString replaced;
+  appendReplacement(replaced, parseReplacement(replacement, expandsGroups), text, regions);
+  return preserveCase ? preservedCaseText(text.mid(begin, end - begin), replaced) : replaced;
+}
+
 }  // namespace core
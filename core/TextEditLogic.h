@@ -6,12 +6,21 @@
 #include <QTextCursor>
 
 #include "macros.h"
+#include "Region.h"
 
 namespace core {
 
 class Regexp;
 class Metadata;
 
+// Text replacing the region of a document
+struct TextReplacement {
+  Region region;
+  QString text;
+  // number of the replaced matches
+  int count;
+};
+
 /**
  * @brief This class has business logics for TextEdit
  * Created mainly for unit testing
@@ -36,6 +45,28 @@ class TextEditLogic {
                                 Metadata* metadata,
                                 bool indentUsingSpaces,
                                 int tabWidth);
+  // Returns newStr with the case of each character in oldStr
+  static QString preservedCaseText(const QString& oldStr, const QString& newStr);
+  // Replaces the matches of regexp which start in [begin, end) of text in a pass. Returns the region
+  // from the first match to the last one and its new text, which can be applied as a single edit.
+  // If expandsGroups is true, $0-$9 and \0-\9 in replacement are expanded to the groups of each
+  // match, and $$ and \\ to $ and \.
+  static boost::optional<TextReplacement> replaceAll(const QString& text,
+                                                     const Regexp* regexp,
+                                                     const QString& replacement,
+                                                     int begin,
+                                                     int end,
+                                                     bool expandsGroups,
+                                                     bool preserveCase);
+  // Returns the replacement of the match of regexp in [begin, end) of text, expanded in the same way
+  // as replaceAll, or none if [begin, end) isn't a match.
+  static boost::optional<QString> replaceMatch(const QString& text,
+                                               const Regexp* regexp,
+                                               const QString& replacement,
+                                               int begin,
+                                               int end,
+                                               bool expandsGroups,
+                                               bool preserveCase);
 
  private:
   TextEditLogic() = delete;
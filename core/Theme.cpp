@@ -1,10 +1,14 @@
+#include <vector>
 #include <QDebug>
 #include "Theme.h"
 #include "PListParser.h"
 #include "Util.h"
+#include "ScopeAtoms.h"
 
 namespace core {
 
+const int Theme::MAX_CACHED_STACKS;
+
 namespace {
 
 const QString nameStr = "name";
@@ -12,6 +16,7 @@ const QString scopeStr = "scope";
 const QString settingsStr = "settings";
 const QString foregroundStr = "foreground";
 const QString backgroundStr = "background";
+const QString gutterSettingsStr = "gutterSettings";
 const int brightnessThresholdWhite = 180;
 const int brightnessThresholdGray = 125;
 const int brightnessThresholdBlack = 60;
@@ -32,39 +37,31 @@ QString convertColorCodeToARGB(QString colorCode) {
   return QString("#%1%2").arg(colorAlpha, colorRgb);
 }
 
-void parseSettings(ColorSettings* settings,
-                   QFont::Weight* fontWeight,
-                   bool* isItalic,
-                   bool* isUnderline,
-                   QVariant var) {
-  if (!var.canConvert<QVariantMap>()) {
-    return;
-  }
-
-  QVariantMap map = var.toMap();
-  QMapIterator<QString, QVariant> iter(map);
-  while (iter.hasNext()) {
-    iter.next();
-    QString key = iter.key();
-    if (key == "fontStyle") {
-      QStringList styles = iter.value().toString().split(' ');
-      foreach (const QString& style, styles) {
-        if (style == "bold") {
-          *fontWeight = QFont::Bold;
-        } else if (style == "italic") {
-          *isItalic = true;
-        } else if (style == "underline") {
-          *isUnderline = true;
-        }
+// Applies a value in the settings dict of a scope setting or gutterSettings
+void applySetting(ColorSettings* settings,
+                  QFont::Weight* fontWeight,
+                  bool* isItalic,
+                  bool* isUnderline,
+                  const QString& key,
+                  const QVariant& value) {
+  if (key == "fontStyle") {
+    QStringList styles = value.toString().split(' ');
+    foreach (const QString& style, styles) {
+      if (style == "bold") {
+        *fontWeight = QFont::Bold;
+      } else if (style == "italic") {
+        *isItalic = true;
+      } else if (style == "underline") {
+        *isUnderline = true;
       }
-    } else {
-      QString colorCode = iter.value().toString();
-      QColor color;
+    }
+  } else {
+    QString colorCode = value.toString();
+    QColor color;
 
-      color.setNamedColor(convertColorCodeToARGB(colorCode));
-      if (color.isValid()) {
-        (*settings)[key] = color;
-      }
+    color.setNamedColor(convertColorCodeToARGB(colorCode));
+    if (color.isValid()) {
+      (*settings)[key] = color;
     }
   }
 }
@@ -134,37 +131,109 @@ QColor getSelectedBorderColor() {
   return QColor::fromRgb(41, 98, 255);  // Blue A700
 }
 
-ScopeSetting* toScopeSetting(QVariant var) {
-  if (!var.canConvert<QVariantMap>()) {
-    return nullptr;
-  }
+// Builds the name, the scope settings and the gutter settings of a theme from the events of its
+// tmTheme, so that no QVariantMap of the whole file is built
+class ThemeBuilder : public PListVisitor {
+ public:
+  explicit ThemeBuilder(Theme* theme) : m_theme(theme) {}
 
-  QVariantMap map = var.toMap();
-  ScopeSetting* scopeSetting = new ScopeSetting();
+  bool hasRootDict() const { return m_hasRootDict; }
+  // Returns gutterSettings if the theme has it
+  std::unique_ptr<ColorSettings> takeGutterSettings() { return std::move(m_gutterSettings); }
 
-  // name
-  if (map.contains(nameStr)) {
-    scopeSetting->name = map.value(nameStr).toString();
-  }
+  void beginDict() override { push(true); }
+  void endDict() override { m_stack.pop_back(); }
+  void beginArray() override { push(false); }
+  void endArray() override { m_stack.pop_back(); }
+  void key(const QString& key) override { m_key = key; }
 
-  // scope
-  if (map.contains(scopeStr)) {
-    QStringList scopeList = map.value(scopeStr).toString().split(',');
-    for (int i = 0; i < scopeList.length(); i++) {
-      scopeList[i] = scopeList[i].trimmed();
+  void value(const QVariant& value) override {
+    switch (m_stack.empty() ? Container::Other : m_stack.back()) {
+      case Container::Root:
+        if (m_key == nameStr) {
+          m_theme->name = value.toString();
+        }
+        break;
+      case Container::ScopeSettings:
+        // A setting which isn't a dict is kept as null
+        m_theme->scopeSettings.append(nullptr);
+        break;
+      case Container::ScopeSetting: {
+        ScopeSetting* setting = m_theme->scopeSettings.last();
+        if (m_key == nameStr) {
+          setting->name = value.toString();
+        } else if (m_key == scopeStr) {
+          setting->scopeSelectors = ScopeSelectorMatcher::splitGroups(value.toString());
+        } else if (m_key == settingsStr) {
+          setting->colorSettings.reset(new ColorSettings());
+        }
+        break;
+      }
+      case Container::ScopeColors: {
+        ScopeSetting* setting = m_theme->scopeSettings.last();
+        applySetting(setting->colorSettings.get(), &setting->fontWeight, &setting->isItalic,
+                     &setting->isUnderline, m_key, value);
+        break;
+      }
+      case Container::GutterSettings:
+        applySetting(m_gutterSettings.get(), &m_theme->gutterFontWeight,
+                     &m_theme->isGutterItalic, &m_theme->isGutterUnderline, m_key, value);
+        break;
+      case Container::Other:
+        break;
     }
-    scopeSetting->scopeSelectors = scopeList;
   }
 
-  // settings
-  if (map.contains(settingsStr)) {
-    scopeSetting->colorSettings.reset(new ColorSettings());
-    parseSettings(scopeSetting->colorSettings.get(), &(scopeSetting->fontWeight),
-                  &(scopeSetting->isItalic), &(scopeSetting->isUnderline), map.value(settingsStr));
+ private:
+  // What a dict or an array in the tmTheme is
+  enum class Container {
+    Root,
+    // settings array in the root
+    ScopeSettings,
+    ScopeSetting,
+    // settings dict in a scope setting
+    ScopeColors,
+    GutterSettings,
+    Other,
+  };
+
+  Theme* m_theme;
+  std::vector<Container> m_stack;
+  // key of the next value in the current dict
+  QString m_key;
+  bool m_hasRootDict = false;
+  std::unique_ptr<ColorSettings> m_gutterSettings;
+
+  void push(bool isDict) {
+    Container container = Container::Other;
+    switch (m_stack.empty() ? Container::Root : m_stack.back()) {
+      case Container::Root:
+        if (m_stack.empty()) {
+          m_hasRootDict = isDict;
+          container = isDict ? Container::Root : Container::Other;
+        } else if (m_key == settingsStr && !isDict) {
+          container = Container::ScopeSettings;
+        } else if (m_key == gutterSettingsStr && isDict) {
+          m_gutterSettings.reset(new ColorSettings());
+          container = Container::GutterSettings;
+        }
+        break;
+      case Container::ScopeSettings:
+        m_theme->scopeSettings.append(isDict ? new ScopeSetting() : nullptr);
+        container = isDict ? Container::ScopeSetting : Container::Other;
+        break;
+      case Container::ScopeSetting:
+        if (m_key == settingsStr) {
+          m_theme->scopeSettings.last()->colorSettings.reset(new ColorSettings());
+          container = isDict ? Container::ScopeColors : Container::Other;
+        }
+        break;
+      default:
+        break;
+    }
+    m_stack.push_back(container);
   }
-
-  return scopeSetting;
-}
+};
 }
 
 Theme* Theme::loadTheme(const QString& filename) {
@@ -174,41 +243,24 @@ Theme* Theme::loadTheme(const QString& filename) {
     return nullptr;
   }
 
-  QVariant root = PListParser::parsePList(&file);
-  if (!root.canConvert<QVariantMap>()) {
+  // The first scope setting is the base color in the following process
+  Theme* theme = new Theme();
+  ThemeBuilder builder(theme);
+  if (!PListParser::parse(&file, &builder) || !builder.hasRootDict()) {
     qWarning("root is not dict");
+    qDeleteAll(theme->scopeSettings);
+    delete theme;
     return nullptr;
   }
 
-  Theme* theme = new Theme();
-  QVariantMap rootMap = root.toMap();
-
-  // name
-  if (rootMap.contains(nameStr)) {
-    theme->name = rootMap.value(nameStr).toString();
-  }
-
-  // create base theme
-  if (rootMap.contains(settingsStr)) {
-    QVariantList settingList = rootMap.value(settingsStr).toList();
-    foreach (const QVariant& var, settingList) {
-      // This is the base color in the following process,
-      theme->scopeSettings.append(toScopeSetting(var));
-    }
-  }
-
   // text edit settings (TextEdit)
   theme->textEditSettings.reset(new ColorSettings());
   parseSettings(theme->textEditSettings.get(), createTextEditSettingsColors(theme));
 
   // gutter settings (LineNumberArea)
-  const QString gutterSettingsStr = "gutterSettings";
-  theme->gutterSettings.reset(new ColorSettings());
-
-  if (rootMap.contains(gutterSettingsStr)) {
-    parseSettings(theme->gutterSettings.get(), &(theme->gutterFontWeight), &(theme->isGutterItalic),
-                  &(theme->isGutterUnderline), rootMap.value(gutterSettingsStr));
-  } else {
+  theme->gutterSettings = builder.takeGutterSettings();
+  if (!theme->gutterSettings) {
+    theme->gutterSettings.reset(new ColorSettings());
     parseSettings(theme->gutterSettings.get(), createGutterSettingsColors(theme));
   }
 
@@ -442,54 +494,6 @@ ColorSettings Theme::createConsleSettingsColors(const Theme* theme) {
   return createStatusBarSettingsColors(theme);
 }
 
-// Return the rank of scopeSelector for scope
-// Return the rank greater than or equal to 0 if scopeSelector matches scope
-// Return -1 if it doesn't match scope
-int Theme::rank(const QString& scopeSelector, const QString& scope) {
-  // An empty scope selector will match all scopes but with the lowest possible rank
-  // http://manual.macromates.com/en/scope_selectors
-  if (scopeSelector.isEmpty()) {
-    return 0;
-  }
-
-  int score = -1;
-  for (int i = 0; i < qMin(scopeSelector.length(), scope.length()); i++) {
-    if (scopeSelector[i] == scope[i]) {
-      score++;
-    }
-  }
-
-  if (score >= 0) {
-    score++;
-  }
-  return score;
-}
-
-QVector<ScopeSetting*> Theme::getMatchedSettings(const QString& scope) {
-  std::vector<std::tuple<Rank, ScopeSetting*>> settingsWithRank;
-  foreach (ScopeSetting* setting, scopeSettings) {
-    foreach (const QString& selector, setting->scopeSelectors) {
-      Rank rank(selector, scope);
-      if (rank.isValid()) {
-        settingsWithRank.push_back(std::make_pair(rank, setting));
-      }
-    }
-  }
-
-  std::sort(
-      settingsWithRank.begin(), settingsWithRank.end(),
-      [](const std::tuple<Rank, ScopeSetting*>& s1, const std::tuple<Rank, ScopeSetting*>& s2) {
-        return std::get<0>(s1) > std::get<0>(s2);
-      });
-
-  QVector<ScopeSetting*> matchedSettings;
-  for (std::tuple<Rank, ScopeSetting*>& setting : settingsWithRank) {
-    matchedSettings.append(std::get<1>(setting));
-  }
-
-  return matchedSettings;
-}
-
 void Theme::setFont(const QFont& font) {
   m_font = font;
 
@@ -526,199 +530,98 @@ QString Theme::projectTreeViewHorizontalScrollBarStyle() const {
 }
 
 QTextCharFormat* Theme::getFormat(const QString& scope) {
+  return getFormat(ScopeStacks::singleton().fromScopeName(scope));
+}
+
+QTextCharFormat* Theme::getFormat(int stack) {
   if (scopeSettings.isEmpty())
     return nullptr;
 
   // check cache
-  if (m_cachedFormats.count(scope) != 0) {
-    return m_cachedFormats.at(scope).get();
+  auto it = m_cachedStackFormats.find(stack);
+  if (it != m_cachedStackFormats.end()) {
+    return it->second;
   }
 
-  std::unique_ptr<QTextCharFormat> format(new QTextCharFormat());
-
-  if (m_font) {
-    format->setFontFamily((*m_font).family());
-    format->setFontPointSize((*m_font).pointSizeF());
+  if (!m_selectorMatcher) {
+    compileSelectors();
   }
 
-  QVector<ScopeSetting*> matchedSettings = getMatchedSettings(scope);
-  if (!matchedSettings.isEmpty()) {
-    // foreground
-    foreach (ScopeSetting* setting, matchedSettings) {
-      if (setting->colorSettings->contains(foregroundStr)) {
-        const QColor& fg = setting->colorSettings->value(foregroundStr);
-        Q_ASSERT(fg.isValid());
-        format->setForeground(fg);
-        break;
-      }
+  // The best matched setting which has each property wins
+  int foreground = -1;
+  int background = -1;
+  int fontStyle = -1;
+  for (int i : m_selectorMatcher->match(stack)) {
+    ColorSettings* colorSettings = scopeSettings[i]->colorSettings.get();
+    if (foreground < 0 && colorSettings && colorSettings->contains(foregroundStr)) {
+      foreground = i;
     }
-
-    // background
-    foreach (ScopeSetting* setting, matchedSettings) {
-      if (setting->colorSettings->contains(backgroundStr)) {
-        const QColor& bg = setting->colorSettings->value(backgroundStr);
-        Q_ASSERT(bg.isValid());
-        format->setBackground(bg);
-        break;
-      }
+    if (background < 0 && colorSettings && colorSettings->contains(backgroundStr)) {
+      background = i;
     }
-
-    // font style
-    foreach (ScopeSetting* setting, matchedSettings) {
-      if (setting->hasFontStyle()) {
-        format->setFontWeight(setting->fontWeight);
-        format->setFontItalic(setting->isItalic);
-        format->setFontUnderline(setting->isUnderline);
-        break;
-      }
+    if (fontStyle < 0 && scopeSettings[i]->hasFontStyle()) {
+      fontStyle = i;
     }
   }
 
-  auto result = format.get();
-  m_cachedFormats.insert(std::make_pair(scope, std::move(format)));
-  return result;
+  QTextCharFormat* format = cachedFormat(foreground, background, fontStyle);
+  if (m_cachedStackFormats.size() >= MAX_CACHED_STACKS) {
+    m_cachedStackFormats.clear();
+  }
+  m_cachedStackFormats.insert(std::make_pair(stack, format));
+  return format;
 }
 
-Rank::Rank(const QString& scopeSelector, const QString& scope) {
-  if (scopeSelector.isEmpty()) {
-    m_state = State::Empty;
-  } else {
-    QVector<QStringRef> selectors = scopeSelector.splitRef(QStringLiteral(" "));
-    QVector<QStringRef> scopes = scope.splitRef(QStringLiteral(" "));
-    QVector<int> scores(scopes.size(), 0);
-
-    if (selectors.size() > scopes.size()) {
-      m_state = State::Invalid;
-      return;
+void Theme::compileSelectors() {
+  m_selectorMatcher.reset(new ScopeSelectorMatcher());
+  for (int i = 0; i < scopeSettings.size(); i++) {
+    if (!scopeSettings[i]) {
+      continue;
     }
-
-    int selectorsIndex = 0, scopesIndex = 0;
-    bool lastMatched = false;
-    for (; selectorsIndex < selectors.size() && scopesIndex < scopes.size(); scopesIndex++) {
-      int rank = calcRank(selectors[selectorsIndex], scopes[scopesIndex]);
-      if (rank > 0) {
-        scores[scopesIndex] = rank;
-        selectorsIndex++;
-        lastMatched = true;
-      } else if (lastMatched) {
-        m_state = State::Invalid;
-        return;
+    foreach (const QString& selector, scopeSettings[i]->scopeSelectors) {
+      if (!m_selectorMatcher->add(selector, i)) {
+        qWarning("invalid scope selector: %s", qPrintable(selector));
       }
     }
-
-    // if selectorsIndex is less than selectors.size(),
-    // it means not all the selectors matches
-    if (selectorsIndex < selectors.size()) {
-      m_state = State::Invalid;
-      return;
-    }
-
-    int zeroCount = 0;
-    foreach (int score, scores) {
-      if (score == 0) {
-        zeroCount++;
-      }
-    }
-    if (zeroCount == scores.size()) {
-      m_state = State::Invalid;
-    } else {
-      m_state = State::Valid;
-      m_scores = scores;
-    }
   }
 }
 
-bool Rank::operator>(const Rank& r2) const {
-  if (this->isInvalid() || r2.isInvalid()) {
-    return false;
+QTextCharFormat* Theme::cachedFormat(int foreground, int background, int fontStyle) {
+  const auto key = std::make_tuple(foreground, background, fontStyle);
+  auto it = m_cachedFormats.find(key);
+  if (it != m_cachedFormats.end()) {
+    return it->second.get();
   }
 
-  if (this->isEmpty() && r2.isEmpty()) {
-    return true;
-  } else if (this->isEmpty() && !r2.isEmpty()) {
-    return false;
-  } else if (r2.isEmpty()) {
-    return true;
-  }
-
-  if (this->m_scores.size() != r2.m_scores.size()) {
-    throw std::runtime_error("can't compare. m_scores size don't match");
-  }
-
-  int i = this->m_scores.size() - 1;
-  while (i >= 0) {
-    if (this->m_scores[i] > r2.m_scores[i]) {
-      return true;
-    } else if (this->m_scores[i] < r2.m_scores[i]) {
-      return false;
-    }
-    i--;
-  }
-
-  // r1 equals to r2
-  return false;
-}
-
-bool Rank::operator<(const Rank& r2) const {
-  if (this->isInvalid() || r2.isInvalid()) {
-    return false;
-  }
-
-  if (this->isEmpty() && r2.isEmpty()) {
-    return true;
-  } else if (this->isEmpty() && !r2.isEmpty()) {
-    return true;
-  } else if (r2.isEmpty()) {
-    return false;
-  }
-
-  if (this->m_scores.size() != r2.m_scores.size()) {
-    throw std::runtime_error("can't compare. m_scores size don't match");
-  }
+  std::unique_ptr<QTextCharFormat> format(new QTextCharFormat());
 
-  int i = this->m_scores.size() - 1;
-  while (i >= 0) {
-    if (this->m_scores[i] < r2.m_scores[i]) {
-      return true;
-    } else if (this->m_scores[i] > r2.m_scores[i]) {
-      return false;
-    }
-    i--;
+  if (m_font) {
+    format->setFontFamily((*m_font).family());
+    format->setFontPointSize((*m_font).pointSizeF());
   }
 
-  // r1 equals to r2
-  return false;
-}
-
-// singleScopeSelector and singleScope must NOT have a space
-int Rank::calcRank(const QStringRef& singleScopeSelector, const QStringRef& singleScope) {
-  if (singleScopeSelector.size() > singleScope.size()) {
-    return 0;
+  if (foreground >= 0) {
+    const QColor& fg = scopeSettings[foreground]->colorSettings->value(foregroundStr);
+    Q_ASSERT(fg.isValid());
+    format->setForeground(fg);
   }
 
-  int score = 0;
-  int from = 0;
-  int dotIndex = singleScope.indexOf('.', from);
-
-  while (dotIndex != -1 && from < singleScopeSelector.size()) {
-    if (singleScope.mid(from, dotIndex - from) == singleScopeSelector.mid(from, dotIndex - from)) {
-      score++;
-    } else {
-      return 0;
-    }
-    from = dotIndex + 1;
-    dotIndex = singleScope.indexOf('.', from);
+  if (background >= 0) {
+    const QColor& bg = scopeSettings[background]->colorSettings->value(backgroundStr);
+    Q_ASSERT(bg.isValid());
+    format->setBackground(bg);
   }
 
-  if (from < singleScope.size() && from < singleScopeSelector.size()) {
-    if (singleScope.mid(from) == singleScopeSelector.mid(from)) {
-      score++;
-    } else {
-      return 0;
-    }
+  if (fontStyle >= 0) {
+    ScopeSetting* setting = scopeSettings[fontStyle];
+    format->setFontWeight(setting->fontWeight);
+    format->setFontItalic(setting->isItalic);
+    format->setFontUnderline(setting->isUnderline);
   }
 
-  return score;
+  auto result = format.get();
+  m_cachedFormats.insert(std::make_pair(key, std::move(format)));
+  return result;
 }
 
 bool ScopeSetting::hasFontStyle() {
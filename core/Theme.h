@@ -1,6 +1,8 @@
 #pragma once
 
+#include <map>
 #include <memory>
+#include <tuple>
 #include <unordered_map>
 #include <QMap>
 #include <QString>
@@ -10,6 +12,7 @@
 
 #include "macros.h"
 #include "LanguageParser.h"
+#include "ScopeSelector.h"
 #include "stlSpecialization.h"
 
 namespace core {
@@ -48,9 +51,11 @@ class Theme {
   DEFAULT_MOVE(Theme)
 
   static Theme* loadTheme(const QString& filename);
-  static int rank(const QString& scope, const QString& scope2);
 
+  // Call these only in the main thread because they use ScopeStacks
   QTextCharFormat* getFormat(const QString& scope);
+  // stack is an id of ScopeStacks
+  QTextCharFormat* getFormat(int stack);
 
   std::unique_ptr<ColorSettings> textEditSettings;
   std::unique_ptr<ColorSettings> gutterSettings;
@@ -80,7 +85,8 @@ class Theme {
   QString projectTreeViewHorizontalScrollBarStyle() const;
 
  private:
-  static ScopeSetting* matchedSetting(const QString& scope);
+  // Max number of stacks in m_cachedStackFormats
+  static const int MAX_CACHED_STACKS = 10000;
 
   static ColorSettings createTextEditSettingsColors(const Theme* theme);
   static ColorSettings createGutterSettingsColors(const Theme* theme);
@@ -93,7 +99,14 @@ class Theme {
   static ColorSettings createFindReplaceViewSettingsColors(const Theme* theme);
   static ColorSettings createConsleSettingsColors(const Theme* theme);
 
-  std::unordered_map<QString, std::unique_ptr<QTextCharFormat>> m_cachedFormats;
+  // Selectors of scopeSettings compiled on the first getFormat. Rule ids are indices of
+  // scopeSettings.
+  std::unique_ptr<ScopeSelectorMatcher> m_selectorMatcher;
+  // Formats keyed by the indices of the settings which give foreground, background and font style
+  // (-1 if none). The number of formats is bounded by the combinations the theme can produce.
+  std::map<std::tuple<int, int, int>, std::unique_ptr<QTextCharFormat>> m_cachedFormats;
+  // Formats in m_cachedFormats keyed by scope stack id. Cleared when it exceeds MAX_CACHED_STACKS
+  std::unordered_map<int, QTextCharFormat*> m_cachedStackFormats;
 
   // tmTheme file doesn't have a font setting.
   // Ideally, SyntaxHighlighter should have a font setting, but calling setFont in highlightBlock
@@ -101,34 +114,11 @@ class Theme {
   // As a workaround, Theme keeps a font setting and apply it when creating QTextCharFormat.
   boost::optional<QFont> m_font;
 
-  QVector<ScopeSetting*> getMatchedSettings(const QString& scope);
+  void compileSelectors();
+  QTextCharFormat* cachedFormat(int foreground, int background, int fontStyle);
 
   QString verticalScrollBarBaseStyle() const;
   QString horizontalScrollBarBaseStyle() const;
 };
 
-class Rank {
-  enum class State { Valid, Invalid, Empty };
-
- public:
-  Rank(const QString& scopeSelector, const QString& scope);
-  ~Rank() = default;
-
-  bool isValid() const { return m_state == State::Valid || m_state == State::Empty; }
-  bool isInvalid() const { return m_state == State::Invalid; }
-  bool isEmpty() const { return m_state == State::Empty; }
-
-  bool operator>(const Rank& r) const;
-  bool operator<(const Rank& r) const;
-  bool operator>=(const Rank&) { throw std::runtime_error("operator >= not implemented"); }
-  bool operator<=(const Rank&) { throw std::runtime_error("operator <= not implemented"); }
-  bool operator!=(const Rank&) { throw std::runtime_error("operator != not implemented"); }
-
- private:
-  static int calcRank(const QStringRef& scopeSelector, const QStringRef& singleScope);
-
-  QVector<int> m_scores;
-  State m_state;
-};
-
 }  // namespace core
@@ -173,6 +173,8 @@ v8::Local<v8::Value> V8Util::toV8Value(v8::Isolate* isolate, const QVariant& var
       return v8::Uint32::New(isolate, var.toUInt());
     case QVariant::Double:
       return v8::Number::New(isolate, var.toDouble());
+    case QVariant::LongLong:
+      return v8::Number::New(isolate, static_cast<double>(var.toLongLong()));
     case QVariant::ByteArray: {
       MaybeLocal<Object> maybeBuffer =
           node::Buffer::New(isolate, var.toByteArray().data(), var.toByteArray().size());
@@ -193,6 +195,14 @@ v8::Local<v8::Value> V8Util::toV8Value(v8::Isolate* isolate, const QVariant& var
       }
       return array;
     }
+    case QVariant::Map: {
+      const QVariantMap& map = var.toMap();
+      Local<Object> obj = Object::New(isolate);
+      for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+        obj->Set(toV8String(isolate, it.key()), toV8Value(isolate, it.value()));
+      }
+      return obj;
+    }
     default:
       qWarning() << "can't convert" << var.typeName() << "to Local<Value>";
       return v8::Undefined(isolate);
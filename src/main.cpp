@@ -22,6 +22,7 @@
 #include "core/ConditionManager.h"
 #include "core/Condition.h"
 #include "core/PackageManager.h"
+#include "core/LanguageParser.h"
 #include "core/Config.h"
 #include "core/ThemeManager.h"
 #include "core/Util.h"
@@ -32,6 +33,7 @@
 #include "node_main.h"
 
 using core::PackageManager;
+using core::LanguageProvider;
 using core::Config;
 using core::ConditionManager;
 using core::Condition;
@@ -90,6 +92,7 @@ int main(int argc, char** argv) {
   ConditionManager::singleton().add(GrammerCondition::name,
                                     std::unique_ptr<Condition>(new GrammerCondition()));
 
+  LanguageProvider::enableCache(Constants::singleton().grammarCachePath());
   PackageManager::singleton()._loadAllPackageContents();
 
   ThemeManager::load();
@@ -1,6 +1,8 @@
 #include <QtTest/QtTest>
 #include <QTextBlock>
+#include <QTemporaryDir>
 
+#include "Config.h"
 #include "Document.h"
 #include "Regexp.h"
 #include "LanguageParser.h"
@@ -107,6 +109,75 @@ ccc)";
     QVERIFY(spy.wait());
     QCOMPARE(jsErbDoc.language()->scopeName, QStringLiteral("text.html.ruby"));
   }
+
+  void createLarge() {
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/Plain text.tmLanguage"));
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/large.txt";
+
+    // The 8 bytes header and 9 bytes lines make the first 4MB chunk boundary split \r\n and the
+    // second one split a multibyte character
+    const int lineCount = 1000000;
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("header\r\n");
+    const QByteArray line = QString::fromUtf8("line \u00e9\r\n").toUtf8();
+    QCOMPARE(line.size(), 9);
+    for (int i = 0; i < lineCount; i++) {
+      file.write(line);
+    }
+    file.close();
+
+    std::unique_ptr<Document> doc(Document::createLarge(path));
+    QVERIFY(doc);
+    QVERIFY(doc->isLoading());
+    QCOMPARE(doc->lineSeparator(), QStringLiteral("\r\n"));
+    QVERIFY(!doc->m_syntaxHighlighter);
+
+    QSignalSpy spy(doc.get(), &Document::loadFinished);
+    QVERIFY(spy.wait(30000));
+    QVERIFY(!doc->isLoading());
+    QVERIFY(!doc->isModified());
+    QVERIFY(!doc->isUndoAvailable());
+    QCOMPARE(doc->blockCount(), lineCount + 2);
+    QCOMPARE(doc->findBlockByNumber(lineCount).text(), QString::fromUtf8("line \u00e9"));
+  }
+
+  // A file which has grown larger than the threshold is reloaded without syntax highlighting
+  void reloadGrownFile() {
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/Plain text.tmLanguage"));
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.path() + "/grown.txt";
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("line\n");
+    file.close();
+
+    std::unique_ptr<Document> doc(Document::create(path));
+    QVERIFY(doc);
+    QVERIFY(!doc->isLoading());
+    QVERIFY(doc->m_syntaxHighlighter);
+
+    const QByteArray line("line\n");
+    QVERIFY(file.open(QIODevice::Append));
+    for (qint64 size = line.size(); size <= Config::singleton().largeFileSize();
+         size += line.size()) {
+      file.write(line);
+    }
+    file.close();
+
+    doc->reload();
+    QVERIFY(doc->isLoading());
+    QVERIFY(!doc->m_syntaxHighlighter);
+
+    QSignalSpy spy(doc.get(), &Document::loadFinished);
+    QVERIFY(spy.wait(30000));
+    QCOMPARE(qint64(doc->toPlainText().size()), QFileInfo(path).size());
+    QVERIFY(!doc->m_syntaxHighlighter);
+  }
 };
 
 }  // namespace core
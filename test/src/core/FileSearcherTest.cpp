@@ -0,0 +1,193 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+#include "FileSearcher.h"
+
+namespace core {
+
+namespace {
+
+void writeFile(const QDir& dir, const QString& relativePath, const QByteArray& content) {
+  QFileInfo(dir.filePath(relativePath)).dir().mkpath(".");
+  QFile file(dir.filePath(relativePath));
+  QVERIFY(file.open(QIODevice::WriteOnly));
+  file.write(content);
+}
+
+// Finds text in dir and waits for the matches of all the files
+QMap<QString, QVector<FileMatch>> findAll(const QDir& dir,
+                                          const QString& text,
+                                          Document::FindFlags flags = 0,
+                                          const IgnorePatterns& ignorePatterns = IgnorePatterns(),
+                                          const QHash<QString, QString>& buffers = {}) {
+  FileSearcher searcher;
+  QMap<QString, QVector<FileMatch>> matches;
+  QObject::connect(&searcher, &FileSearcher::matchesFound,
+                   [&](const QString& path, QVector<FileMatch> fileMatches) {
+                     matches.insert(dir.relativeFilePath(path), fileMatches);
+                   });
+  QSignalSpy spy(&searcher, &FileSearcher::finished);
+  if (searcher.find(dir.path(), text, flags, ignorePatterns, buffers)) {
+    spy.wait();
+  }
+  return matches;
+}
+}
+
+class FileSearcherTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void ignorePatterns() {
+    IgnorePatterns patterns;
+    patterns.add("*.o");
+    patterns.add("build/");
+    patterns.add("/docs/*.html");
+    patterns.add("# comment");
+
+    QVERIFY(patterns.isIgnored("main.o", false));
+    QVERIFY(patterns.isIgnored("src/main.o", false));
+    QVERIFY(patterns.isIgnored("build", true));
+    QVERIFY(patterns.isIgnored("src/build", true));
+    QVERIFY(!patterns.isIgnored("build", false));
+    QVERIFY(patterns.isIgnored("docs/index.html", false));
+    QVERIFY(!patterns.isIgnored("src/docs/index.html", false));
+    QVERIFY(!patterns.isIgnored("main.cpp", false));
+    QVERIFY(!patterns.isIgnored("# comment", false));
+  }
+
+  // A wildcard in a path doesn't match a slash, but ** matches any number of directories
+  void ignorePathPatterns() {
+    IgnorePatterns patterns;
+    patterns.add("src/*.o");
+    patterns.add("docs/**/*.html");
+
+    QVERIFY(patterns.isIgnored("src/main.o", false));
+    QVERIFY(!patterns.isIgnored("src/sub/main.o", false));
+    QVERIFY(patterns.isIgnored("docs/index.html", false));
+    QVERIFY(patterns.isIgnored("docs/api/core/index.html", false));
+    QVERIFY(!patterns.isIgnored("src/docs/index.html", false));
+  }
+
+  void find() {
+    QTemporaryDir tmpDir;
+    QVERIFY(tmpDir.isValid());
+    QDir dir(tmpDir.path());
+    writeFile(dir, "a.txt", "foo\nbar foo\r\nbaz");
+    writeFile(dir, "sub/b.txt", "Foo");
+    writeFile(dir, "c.txt", "nothing");
+
+    auto matches = findAll(dir, "foo", Document::FindFlag::FindCaseSensitively);
+    QCOMPARE(matches.size(), 1);
+    const auto& aMatches = matches["a.txt"];
+    QCOMPARE(aMatches.size(), 2);
+    QCOMPARE(aMatches[0].line, 0);
+    QCOMPARE(aMatches[0].column, 0);
+    QCOMPARE(aMatches[0].length, 3);
+    QCOMPARE(aMatches[0].lineText, QString("foo"));
+    QCOMPARE(aMatches[1].line, 1);
+    QCOMPARE(aMatches[1].column, 4);
+    QCOMPARE(aMatches[1].lineText, QString("bar foo"));
+
+    // case insensitive literal
+    matches = findAll(dir, "foo");
+    QCOMPARE(matches.size(), 2);
+    QCOMPARE(matches["sub/b.txt"].size(), 1);
+
+    // regex
+    matches = findAll(dir, "ba[rz]", Document::FindFlag::FindRegex);
+    QCOMPARE(matches.size(), 1);
+    QCOMPARE(matches["a.txt"].size(), 2);
+    QCOMPARE(matches["a.txt"][1].line, 2);
+
+    // whole word
+    writeFile(dir, "d.txt", "food foo");
+    matches = findAll(dir, "foo", Document::FindFlag::FindWholeWords);
+    QCOMPARE(matches["d.txt"].size(), 1);
+    QCOMPARE(matches["d.txt"][0].column, 5);
+
+    // invalid regex
+    FileSearcher searcher;
+    QVERIFY(!searcher.find(dir.path(), "(", Document::FindFlag::FindRegex, IgnorePatterns()));
+  }
+
+  void skipBinaryAndIgnoredFiles() {
+    QTemporaryDir tmpDir;
+    QVERIFY(tmpDir.isValid());
+    QDir dir(tmpDir.path());
+    writeFile(dir, "a.txt", "foo");
+    writeFile(dir, "binary.dat", QByteArray("foo\0bar", 7));
+    writeFile(dir, "build/b.txt", "foo");
+    writeFile(dir, "c.log", "foo");
+    writeFile(dir, ".gitignore", "build/\n*.log\n");
+
+    IgnorePatterns patterns;
+    patterns.addGitignore(dir.path());
+    const auto matches = findAll(dir, "foo", 0, patterns);
+    QCOMPARE(matches.keys(), QList<QString>{"a.txt"});
+  }
+
+  // A file in another encoding than UTF-8 is decoded in its guessed encoding
+  void findInOtherEncodings() {
+    QTemporaryDir tmpDir;
+    QVERIFY(tmpDir.isValid());
+    QDir dir(tmpDir.path());
+    for (const auto& name : {"SHIFT_JIS.txt", "EUC-JP.txt", "UTF-8.txt"}) {
+      QVERIFY(QFile::copy(QString("testdata/encoding-test/") + name, dir.filePath(name)));
+    }
+
+    const QString text = QString::fromUtf8("世界");
+    auto matches = findAll(dir, text);
+    QCOMPARE(matches.size(), 3);
+    QCOMPARE(matches["SHIFT_JIS.txt"][0].lineText, QString::fromUtf8("こんにちは世界！"));
+    QCOMPARE(matches["EUC-JP.txt"][0].lineText, QString::fromUtf8("こんにちは世界！"));
+    // The UTF-8 bytes of a case sensitive text aren't looked for in a file in another encoding
+    matches = findAll(dir, text, Document::FindFlag::FindCaseSensitively);
+    QCOMPARE(matches.size(), 3);
+  }
+
+  // A file in buffers is searched in its text in buffers instead of on disk
+  void findInBuffers() {
+    QTemporaryDir tmpDir;
+    QVERIFY(tmpDir.isValid());
+    QDir dir(tmpDir.path());
+    writeFile(dir, "a.txt", "foo");
+    writeFile(dir, "b.txt", "bar");
+
+    const QHash<QString, QString> buffers{{dir.filePath("a.txt"), "bar\nbar"}};
+    const auto matches = findAll(dir, "bar", 0, IgnorePatterns(), buffers);
+    QCOMPARE(matches.size(), 2);
+    QCOMPARE(matches["a.txt"].size(), 2);
+    QCOMPARE(matches["b.txt"].size(), 1);
+  }
+
+  // Nothing of a canceled find is notified
+  void cancel() {
+    QTemporaryDir tmpDir;
+    QVERIFY(tmpDir.isValid());
+    QDir dir(tmpDir.path());
+    for (int i = 0; i < 200; i++) {
+      writeFile(dir, QString("%1.txt").arg(i), "foo");
+    }
+
+    FileSearcher searcher;
+    QSignalSpy matchesSpy(&searcher, &FileSearcher::matchesFound);
+    QSignalSpy finishedSpy(&searcher, &FileSearcher::finished);
+    QVERIFY(searcher.find(dir.path(), "foo", 0, IgnorePatterns()));
+    searcher.cancel();
+    QVERIFY(!searcher.isRunning());
+    QVERIFY(!finishedSpy.wait(500));
+    QCOMPARE(matchesSpy.count(), 0);
+
+    // a new find after the cancel finds all the files
+    QVERIFY(searcher.find(dir.path(), "foo", 0, IgnorePatterns()));
+    QVERIFY(finishedSpy.wait());
+    QCOMPARE(finishedSpy.first()[0].toInt(), 200);
+    QCOMPARE(finishedSpy.first()[1].toInt(), 200);
+    QCOMPARE(matchesSpy.count(), 200);
+  }
+};
+
+}  // namespace core
+
+QTEST_MAIN(core::FileSearcherTest)
+#include "FileSearcherTest.moc"
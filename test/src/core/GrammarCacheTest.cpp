@@ -0,0 +1,107 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+#include "GrammarCache.h"
+#include "PListParser.h"
+
+namespace core {
+
+namespace {
+
+QVariantMap parse(const QString& path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return QVariantMap();
+  }
+  return PListParser::parsePList(&file).toMap();
+}
+
+QVariantMap parseHeader(const QString& path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return QVariantMap();
+  }
+  return PListParser::parseRootValues(&file, GrammarCache::headerKeys());
+}
+}
+
+class GrammarCacheTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void addAndLoad() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString grammarPath = dir.path() + "/YAML.plist";
+    QVERIFY(QFile::copy("testdata/grammers/YAML.plist", grammarPath));
+    const QVariantMap rootMap = parse(grammarPath);
+    QVERIFY(!rootMap.isEmpty());
+
+    {
+      GrammarCache cache(dir.path() + "/cache");
+      QVERIFY(!cache.entry(grammarPath));
+      const auto entry = cache.add(grammarPath, parseHeader(grammarPath));
+      QCOMPARE(entry.scopeName, QString("source.yaml"));
+      QCOMPARE(entry.name, QString("YAML"));
+      QVERIFY(entry.fileTypes.contains("yml"));
+      // only the index is made until the grammar is added
+      QVERIFY(!cache.grammar(grammarPath));
+      QVERIFY(cache.addGrammar(grammarPath, rootMap));
+      QVERIFY(cache.save());
+    }
+
+    GrammarCache cache(dir.path() + "/cache");
+    const auto entry = cache.entry(grammarPath);
+    QVERIFY(entry);
+    QCOMPARE(entry->scopeName, QString("source.yaml"));
+    QCOMPARE(entry->fileTypes, rootMap.value("fileTypes").toStringList());
+    const auto cachedMap = cache.grammar(grammarPath);
+    QVERIFY(cachedMap);
+    QCOMPARE(*cachedMap, rootMap);
+  }
+
+  void parseRootValues() {
+    const QVariantMap header = parseHeader("testdata/grammers/Ruby.plist");
+    const QVariantMap rootMap = parse("testdata/grammers/Ruby.plist");
+    QCOMPARE(header.size(), 4);
+    for (const auto& key : header.keys()) {
+      QCOMPARE(header.value(key), rootMap.value(key));
+    }
+    QCOMPARE(header.value("firstLineMatch").toString(), QString("^#!/.*\\bruby"));
+    QVERIFY(!header.contains("patterns"));
+  }
+
+  void modifiedFile() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString grammarPath = dir.path() + "/YAML.plist";
+    QVERIFY(QFile::copy("testdata/grammers/YAML.plist", grammarPath));
+
+    GrammarCache cache(dir.path() + "/cache");
+    cache.add(grammarPath, parse(grammarPath));
+    QVERIFY(cache.entry(grammarPath));
+
+    QFile file(grammarPath);
+    QVERIFY(file.open(QIODevice::Append));
+    file.write("\n");
+    file.close();
+    QVERIFY(!cache.entry(grammarPath));
+    QVERIFY(!cache.grammar(grammarPath));
+  }
+
+  void brokenIndex() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QFile index(dir.path() + "/index.bin");
+    QVERIFY(index.open(QIODevice::WriteOnly));
+    index.write("broken");
+    index.close();
+
+    GrammarCache cache(dir.path());
+    QVERIFY(!cache.entry("testdata/grammers/YAML.plist"));
+  }
+};
+
+}  // namespace core
+
+QTEST_MAIN(core::GrammarCacheTest)
+#include "GrammarCacheTest.moc"
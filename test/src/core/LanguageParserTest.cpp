@@ -9,6 +9,56 @@
 
 namespace core {
 
+namespace {
+
+// Applies an insertion to parser and tree as ParseScheduler does, and reparses the edited lines.
+// Returns the changed region and checks that the new tree is the same as the full parse.
+Region insertAndReparse(LanguageParser* parser, ScopeTree& tree, int pos, const QString& str) {
+  tree.adjust(pos, str.length());
+  auto editRegion = parser->applyEdit(pos, 0, str);
+  if (!editRegion) {
+    qFatal("invalid edit");
+  }
+  auto result = parser->parse(tree, *editRegion);
+  if (!result) {
+    qFatal("parse canceled");
+  }
+  tree.replace(ScopeSegment::fromNodes(std::get<0>(*result)), std::get<1>(*result));
+
+  std::unique_ptr<LanguageParser> fullParser(
+      LanguageParser::create(parser->language()->scopeName, parser->text()));
+  auto expected = fullParser->parse();
+  if (!expected) {
+    qFatal("parse canceled");
+  }
+  TestUtil::compareLineByLine(tree.toRootNode().toString(parser->text()),
+                              expected->toString(parser->text()));
+  return std::get<2>(*result);
+}
+
+QString readCppTest() {
+  QFile file("testdata/cppTest.cpp");
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    qFatal("failed to open cppTest.cpp");
+  }
+  return QTextStream(&file).readAll();
+}
+
+// Parses in run() without an event loop, as a pool thread of ParseScheduler does
+class ParseThread : public QThread {
+ public:
+  explicit ParseThread(LanguageParser* parser) : m_parser(parser) {}
+
+  boost::optional<RootNode> rootNode;
+
+ protected:
+  void run() override { rootNode = m_parser->parse(); }
+
+ private:
+  LanguageParser* m_parser;
+};
+}
+
 class LanguageParserTest : public QObject {
   Q_OBJECT
  private slots:
@@ -66,9 +116,37 @@ class LanguageParserTest : public QObject {
     auto lang = LanguageProvider::loadLanguage("testdata/grammers/C++.tmLanguage");
     auto langFromScope = LanguageProvider::languageFromScope(lang->scopeName);
     QVERIFY(langFromScope);
+    // compiled language is shared
+    QCOMPARE(langFromScope, lang);
+    QCOMPARE(LanguageProvider::loadLanguage("testdata/grammers/C++.tmLanguage"), lang);
     QVERIFY(!LanguageProvider::languageFromScope("missing scope"));
   }
 
+  void registerLanguage() {
+    QVERIFY(LanguageProvider::registerLanguage("testdata/grammers/Ruby.plist"));
+    auto lang = LanguageProvider::languageFromExtension("rb");
+    QVERIFY(lang);
+    QCOMPARE(lang->scopeName, QString("source.ruby"));
+    QCOMPARE(LanguageProvider::languageFromFirstLine("#!/usr/bin/env ruby"), lang);
+    QVERIFY(!LanguageProvider::languageFromFirstLine("#!/bin/sh"));
+    QVERIFY(!LanguageProvider::registerLanguage("testdata/grammers/missing.plist"));
+  }
+
+  // A hidden language isn't listed, and listing languages doesn't load them
+  void registerHiddenLanguage() {
+    QVERIFY(LanguageProvider::registerLanguage("testdata/grammers/Hidden.tmLanguage"));
+    const auto pairs = LanguageProvider::scopeAndLangNamePairs();
+    QVERIFY(!pairs.contains(qMakePair(QString("source.hidden"), QString("Hidden"))));
+    QVERIFY(pairs.contains(qMakePair(QString("source.ruby"), QString("Ruby"))));
+    for (auto lang : LanguageProvider::loadedLanguages()) {
+      QVERIFY(lang->scopeName != "source.hidden");
+    }
+    // It's still found by its scope
+    auto lang = LanguageProvider::languageFromScope("source.hidden");
+    QVERIFY(lang);
+    QVERIFY(lang->hideFromUser);
+  }
+
   void parseTmLanguage() {
     const QVector<QString> files(
         {"testdata/grammers/C++.tmLanguage", "testdata/grammers/C.tmLanguage",
@@ -516,6 +594,118 @@ WHERE email = <%= quote @email %>)";
     TestUtil::compareLineByLine(root->toString(text), result);
   }
 
+  // A match across lines is searched again within the line, and a shorter match found there
+  void multiLineMatchIsFoundWithinLine() {
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/MultiLineMatch.tmLanguage"));
+
+    const QString text = "a c\nb";
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.multiline", text));
+    auto root = parser->parse();
+    QVERIFY(root);
+    QCOMPARE(root->children.size(), 1);
+    QCOMPARE(root->children[0].region, Region(2, 3));
+  }
+
+  // Every token of a long line matches across lines first, and the number of searches grows
+  // linearly with the length of the line
+  void multiLineMatchSearchCountIsLinear() {
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/MultiLineMatch.tmLanguage"));
+    ParseProfiler& profiler = ParseProfiler::singleton();
+
+    auto countAttempts = [&](int tokenCount) -> qint64 {
+      const QString text = QString("ac").repeated(tokenCount) + "\nb";
+      profiler.reset();
+      profiler.setEnabled(true);
+      auto root =
+          std::unique_ptr<LanguageParser>(LanguageParser::create("source.multiline", text))
+              ->parse();
+      profiler.setEnabled(false);
+      if (!root || root->children.size() != tokenCount) {
+        return -1;
+      }
+
+      for (const QVariant& var : profiler.grammars()) {
+        const QVariantMap map = var.toMap();
+        if (map["grammar"].toString() == "source.multiline") {
+          return map["attempts"].toLongLong();
+        }
+      }
+      return -1;
+    };
+
+    const qint64 attempts = countAttempts(200);
+    const qint64 doubledAttempts = countAttempts(400);
+    profiler.reset();
+    QVERIFY(attempts > 0);
+    QVERIFY(doubledAttempts > 0);
+    // Searching again from every position in the line would make it about 4 times
+    QVERIFY(doubledAttempts <= attempts * 2 + 10);
+  }
+
+  void maxLineLengthTest() {
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/YAML.plist"));
+
+    const QString longLine = "- title: " + QString(100, 'a');
+    const QString text = "menu:\n" + longLine + "\nkey: value";
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.yaml", text));
+    parser->setMaxLineLength(50);
+    auto root = parser->parse();
+    QVERIFY(root);
+
+    // The long line is left as plain text and the next line is highlighted
+    const Region longLineRegion(6, 6 + longLine.size());
+    QVERIFY(root->children.size() >= 2);
+    for (const auto& child : root->children) {
+      QVERIFY(!child.region.intersects(longLineRegion));
+    }
+    QCOMPARE(root->children.last().region.begin(), longLineRegion.end() + 1);
+  }
+
+  void parseProfilerTest() {
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/YAML.plist"));
+    const QString text = "menu:\n- title: hoge\n  id: foo # comment\nkey: 'value'";
+    ParseProfiler& profiler = ParseProfiler::singleton();
+    profiler.reset();
+
+    // nothing is counted while it's disabled
+    QVERIFY(!profiler.isEnabled());
+    QVERIFY(std::unique_ptr<LanguageParser>(LanguageParser::create("source.yaml", text))->parse());
+    QVERIFY(profiler.hottestPatterns().isEmpty());
+
+    profiler.setEnabled(true);
+    QVERIFY(std::unique_ptr<LanguageParser>(LanguageParser::create("source.yaml", text))->parse());
+    profiler.setEnabled(false);
+
+    const QVariantList patterns = profiler.hottestPatterns(5);
+    QVERIFY(!patterns.isEmpty());
+    QVERIFY(patterns.size() <= 5);
+    double prevMsecs = patterns.first().toMap()["msecs"].toDouble();
+    for (const QVariant& var : patterns) {
+      const QVariantMap map = var.toMap();
+      QCOMPARE(map["grammar"].toString(), QString("source.yaml"));
+      QVERIFY(!map["pattern"].toString().isEmpty());
+      QVERIFY(map["attempts"].toLongLong() + map["cacheHits"].toLongLong() > 0);
+      QVERIFY(map["msecs"].toDouble() <= prevMsecs);
+      prevMsecs = map["msecs"].toDouble();
+    }
+
+    bool yamlFound = false;
+    for (const QVariant& var : profiler.grammars()) {
+      const QVariantMap map = var.toMap();
+      if (map["grammar"].toString() == "source.yaml") {
+        yamlFound = true;
+        QVERIFY(map["attempts"].toLongLong() > 0);
+        QVERIFY(map["matches"].toLongLong() > 0);
+        QVERIFY(map["bytesScanned"].toLongLong() > 0);
+      }
+    }
+    QVERIFY(yamlFound);
+    QVERIFY(profiler.dump().contains("source.yaml"));
+
+    profiler.reset();
+    QVERIFY(profiler.hottestPatterns().isEmpty());
+  }
+
   void rubyHeredocTest() {
     const QVector<QString> files({"testdata/grammers/Ruby.plist"});
 
@@ -721,6 +911,135 @@ a {
     QCOMPARE(parser->endOfLine(17), 16);   // end of document
     QCOMPARE(parser->endOfLine(100), 16);  // end of document
   }
+
+  void applyEdit() {
+    const QVector<QString> files({"testdata/grammers/CSS.plist"});
+
+    foreach (QString fn, files) { QVERIFY(LanguageProvider::loadLanguage(fn)); }
+
+    QString text = R"(
+a {
+  hoge: 0;
+})";
+
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.css", text));
+
+    // insert 'x' before 'h'
+    auto region = parser->applyEdit(7, 0, "x");
+    QVERIFY(region);
+    QCOMPARE(*region, Region(5, 16));
+    QCOMPARE(parser->text(), QString("\na {\n  xhoge: 0;\n}"));
+
+    // remove 'x'
+    region = parser->applyEdit(7, 1, "");
+    QVERIFY(region);
+    QCOMPARE(*region, Region(5, 16));
+    QCOMPARE(parser->text(), text);
+
+    // replace "a {\n  hoge" with "b"
+    region = parser->applyEdit(1, 10, "b");
+    QVERIFY(region);
+    QCOMPARE(*region, Region(1, 15));
+    QCOMPARE(parser->text(), QString("\nb: 0;\n}"));
+  }
+
+  // An edit inside a block reparses the content of the innermost block from the line before the
+  // edit, and stops when a new node is the same as an old one.
+  void reparseInsideBlock() {
+    const QVector<QString> files(
+        {"testdata/grammers/C.tmLanguage", "testdata/grammers/C++.tmLanguage"});
+    foreach (QString fn, files) { QVERIFY(LanguageProvider::loadLanguage(fn)); }
+
+    QString text = R"(namespace foo {
+class hoge {
+  void foo();
+  int bar;
+  int baz;
+};
+})";
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.c++", text));
+    auto root = parser->parse();
+    QVERIFY(root);
+    ScopeTree tree = ScopeTree::fromRootNode(*root);
+
+    const Region changedRegion =
+        insertAndReparse(parser.get(), tree, text.indexOf("int bar;"), "unsigned ");
+    QVERIFY(changedRegion.begin() > parser->text().indexOf("class"));
+    // the parse stopped before the end of the class
+    QVERIFY(changedRegion.end() < parser->text().indexOf("};"));
+  }
+
+  // If the end of a block moves, the enclosing blocks are tried and the top level node is
+  // reparsed at last
+  void reparseWhenEndOfBlockMoves() {
+    const QVector<QString> files(
+        {"testdata/grammers/C.tmLanguage", "testdata/grammers/C++.tmLanguage"});
+    foreach (QString fn, files) { QVERIFY(LanguageProvider::loadLanguage(fn)); }
+
+    QString text = R"(namespace foo {
+class hoge {
+  void foo();
+  int bar;
+};
+}
+int a;)";
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.c++", text));
+    auto root = parser->parse();
+    QVERIFY(root);
+    ScopeTree tree = ScopeTree::fromRootNode(*root);
+
+    // An unclosed comment moves the end of the class and the namespace
+    const Region changedRegion =
+        insertAndReparse(parser.get(), tree, text.indexOf("void"), "/*");
+    QCOMPARE(changedRegion.end(), parser->text().length());
+  }
+
+  // A parser works in a thread without an event loop and gives the same tree as in this thread
+  void parseInThreadWithoutEventLoop() {
+    const QVector<QString> files(
+        {"testdata/grammers/C.tmLanguage", "testdata/grammers/C++.tmLanguage"});
+    foreach (QString fn, files) { QVERIFY(LanguageProvider::loadLanguage(fn)); }
+
+    const QString text = readCppTest();
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.c++", text));
+    ParseThread thread(parser.get());
+    thread.start();
+    QVERIFY(thread.wait());
+    QVERIFY(thread.rootNode);
+    QVERIFY(parser->isIdle());
+
+    auto expected = parser->parse();
+    QVERIFY(expected);
+    TestUtil::compareLineByLine(thread.rootNode->toString(text), expected->toString(text));
+  }
+
+  // A cancel from another thread stops the running parse, and the parser is usable again after
+  // it's reset to Idle
+  void cancelFromAnotherThread() {
+    const QVector<QString> files(
+        {"testdata/grammers/C.tmLanguage", "testdata/grammers/C++.tmLanguage"});
+    foreach (QString fn, files) { QVERIFY(LanguageProvider::loadLanguage(fn)); }
+
+    // Large enough not to finish before the cancel
+    const QString text = readCppTest().repeated(500);
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.c++", text));
+    ParseThread thread(parser.get());
+    thread.start();
+    QTRY_VERIFY(parser->isFullParsing());
+    parser->cancel();
+    QVERIFY(thread.wait());
+
+    QVERIFY(!thread.rootNode);
+    QVERIFY(parser->isCancelRequested());
+    // A canceled parser doesn't start a new parse
+    QVERIFY(!parser->parse());
+
+    parser->setState(LanguageParser::State::Idle);
+    QVERIFY(parser->isIdle());
+    parser->setText(readCppTest());
+    QVERIFY(parser->parse());
+    QVERIFY(parser->isIdle());
+  }
 };
 
 }  // namespace core
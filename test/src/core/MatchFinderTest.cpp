@@ -0,0 +1,260 @@
+#include <QtTest/QtTest>
+
+#include "MatchFinder.h"
+#include "Regexp.h"
+#include "SearchMatches.h"
+
+namespace core {
+
+namespace {
+
+// Finds all the matches with finder and waits for them
+SearchMatches findAll(MatchFinder& finder, const QString& pattern, const QString& text) {
+  SearchMatches matches;
+  auto connection = QObject::connect(&finder, &MatchFinder::matchesFound,
+                                     [&](QVector<Region> regions) { matches.append(regions); });
+  QSignalSpy spy(&finder, &MatchFinder::finished);
+  finder.find(Regexp::compile(pattern), text);
+  spy.wait();
+  QObject::disconnect(connection);
+  return matches;
+}
+
+// Searches text with pattern and applies an insertion to text and matches
+void insertAndUpdate(SearchMatches& matches,
+                     const QString& pattern,
+                     QString& text,
+                     int pos,
+                     const QString& str) {
+  text.insert(pos, str);
+  matches.update(text, *Regexp::compile(pattern), pos, 0, str.size());
+}
+
+// Compares matches with a search of the whole text
+void compareWithFullSearch(const SearchMatches& matches,
+                           const QString& pattern,
+                           const QString& text) {
+  const auto expected = Regexp::compile(pattern)->findAllStringSubmatchIndex(text);
+  QCOMPARE(matches.size(), expected.size());
+  int i = 0;
+  for (const auto& region : matches) {
+    QCOMPARE(region, Region(expected[i][0], expected[i][1]));
+    i++;
+  }
+}
+}
+
+class MatchFinderTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void find() {
+    MatchFinder finder;
+    const QString text = "foo bar\nfoo baz";
+    SearchMatches matches = findAll(finder, "fo+", text);
+    QCOMPARE(matches.size(), 2);
+    QCOMPARE(*matches.begin(), Region(0, 3));
+    QCOMPARE(*(matches.begin() + 1), Region(8, 11));
+    QVERIFY(!finder.isRunning());
+
+    QVERIFY(findAll(finder, "qux", text).isEmpty());
+  }
+
+  // A text larger than a chunk is searched in chunks with the same results as a single search
+  void findInChunks() {
+    QString text;
+    for (int i = 0; i < 200000; i++) {
+      text += "abc";
+    }
+    const QString pattern = "bca";
+    MatchFinder finder;
+    QSignalSpy spy(&finder, &MatchFinder::matchesFound);
+    SearchMatches matches = findAll(finder, pattern, text);
+    QVERIFY(spy.count() > 1);
+
+    const auto expected = Regexp::compile(pattern)->findAllStringSubmatchIndex(text);
+    QCOMPARE(matches.size(), expected.size());
+    int i = 0;
+    for (const auto& region : matches) {
+      QCOMPARE(region, Region(expected[i][0], expected[i][1]));
+      i++;
+    }
+  }
+
+  // A match across the end of a chunk is found once
+  void findAcrossChunks() {
+    const int chunkSize = 256 * 1024;
+    QString text(chunkSize * 2, 'x');
+    text.replace(chunkSize - 1, 3, "abc");
+    text.replace(chunkSize * 2 - 2, 2, "ab");
+    MatchFinder finder;
+    SearchMatches matches = findAll(finder, "abc|ab", text);
+    QCOMPARE(matches.size(), 2);
+    QCOMPARE(*matches.begin(), Region(chunkSize - 1, chunkSize + 2));
+    QCOMPARE(*(matches.begin() + 1), Region(chunkSize * 2 - 2, chunkSize * 2));
+  }
+
+  // A match longer than a chunk is found whole, and chunks without a match are skipped
+  void findLongMatchAcrossChunks() {
+    const int chunkSize = 256 * 1024;
+    QString text(chunkSize * 4, 'x');
+    text[chunkSize - 10] = 'a';
+    text[chunkSize * 2 + 10] = 'b';
+    text[chunkSize * 4 - 2] = 'a';
+    text[chunkSize * 4 - 1] = 'b';
+    MatchFinder finder;
+    SearchMatches matches = findAll(finder, "ax*b", text);
+    QCOMPARE(matches.size(), 2);
+    QCOMPARE(*matches.begin(), Region(chunkSize - 10, chunkSize * 2 + 11));
+    QCOMPARE(*(matches.begin() + 1), Region(chunkSize * 4 - 2, chunkSize * 4));
+  }
+
+  // Nothing of a canceled find is notified
+  void cancel() {
+    QString text;
+    for (int i = 0; i < 200000; i++) {
+      text += "abc";
+    }
+    MatchFinder finder;
+    QSignalSpy foundSpy(&finder, &MatchFinder::matchesFound);
+    QSignalSpy finishedSpy(&finder, &MatchFinder::finished);
+    finder.find(Regexp::compile("a"), text);
+    finder.find(Regexp::compile("xyz"), text);
+    QVERIFY(finishedSpy.wait());
+    QCOMPARE(foundSpy.count(), 0);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy.first().first().toInt(), 0);
+
+    finder.find(Regexp::compile("a"), text);
+    finder.cancel();
+    QTest::qWait(100);
+    QCOMPARE(foundSpy.count(), 0);
+    QCOMPARE(finishedSpy.count(), 1);
+  }
+
+  void range() {
+    SearchMatches matches;
+    matches.append({Region(0, 3), Region(5, 5), Region(10, 12)});
+    matches.append({Region(20, 25)});
+
+    auto range = matches.range(4, 11);
+    QCOMPARE(static_cast<int>(range.second - range.first), 2);
+    QCOMPARE(*range.first, Region(5, 5));
+
+    // a match touching the range
+    range = matches.range(3, 4);
+    QCOMPARE(static_cast<int>(range.second - range.first), 1);
+    QCOMPARE(*range.first, Region(0, 3));
+
+    range = matches.range(13, 19);
+    QVERIFY(range.first == range.second);
+
+    range = matches.range(0, 100);
+    QCOMPARE(static_cast<int>(range.second - range.first), 4);
+  }
+
+  void replace() {
+    SearchMatches matches;
+    matches.append({Region(0, 3), Region(5, 7), Region(10, 12), Region(20, 25)});
+
+    matches.replace(Region(4, 11), {Region(6, 8)});
+    QCOMPARE(matches.size(), 3);
+    QCOMPARE(*(matches.begin() + 1), Region(6, 8));
+    QCOMPARE(*(matches.begin() + 2), Region(20, 25));
+
+    // a new match overlapping the following one replaces it
+    matches.replace(Region(9, 15), {Region(14, 22)});
+    QCOMPARE(matches.size(), 3);
+    QCOMPARE(*(matches.begin() + 2), Region(14, 22));
+  }
+
+  void adjust() {
+    SearchMatches matches;
+    matches.append({Region(0, 3), Region(5, 7), Region(10, 12)});
+
+    // insert 2 characters at 8
+    matches.adjust(8, 0, 2);
+    QCOMPARE(matches.size(), 3);
+    QCOMPARE(*(matches.begin() + 1), Region(5, 7));
+    QCOMPARE(*(matches.begin() + 2), Region(12, 14));
+
+    // remove [6, 9). The match containing it is removed
+    matches.adjust(6, 3, 0);
+    QCOMPARE(matches.size(), 2);
+    QCOMPARE(*matches.begin(), Region(0, 3));
+    QCOMPARE(*(matches.begin() + 1), Region(9, 11));
+  }
+
+  // The edited lines are searched again and the other matches are moved
+  void update() {
+    const QString pattern = "ba[rz]";
+    QString text = "foo bar\nbaz\nbar";
+    SearchMatches matches;
+    matches.append({Region(4, 7), Region(8, 11), Region(12, 15)});
+
+    insertAndUpdate(matches, pattern, text, 9, "xba");
+    QCOMPARE(text, QString("foo bar\nbxbaaz\nbar"));
+    compareWithFullSearch(matches, pattern, text);
+  }
+
+  // A multi line match which the edit removes is searched again from its beginning, and a new one
+  // can reach after the edited lines
+  void updateMultiLineMatch() {
+    const QString pattern = R"(foo\nbar+)";
+    QString text = "foo\nbar x\nfoo\nbar";
+    SearchMatches matches;
+    matches.append({Region(0, 7), Region(10, 17)});
+
+    insertAndUpdate(matches, pattern, text, 7, "r");
+    compareWithFullSearch(matches, pattern, text);
+    QCOMPARE(*matches.begin(), Region(0, 8));
+
+    const QString longPattern = R"(a[\s\S]*?b)";
+    text = "x\ny\nb";
+    matches.clear();
+    insertAndUpdate(matches, longPattern, text, 0, "a");
+    compareWithFullSearch(matches, longPattern, text);
+    QCOMPARE(*matches.begin(), Region(0, 6));
+  }
+
+  // Lookarounds see the text outside the edited lines
+  void updateWithLookaround() {
+    const QString pattern = R"((?<=foo\n)bar)";
+    QString text = "foo\nba";
+    SearchMatches matches;
+    insertAndUpdate(matches, pattern, text, 6, "r");
+    QCOMPARE(matches.size(), 1);
+    QCOMPARE(*matches.begin(), Region(4, 7));
+  }
+
+  // Only a part of the text around the edit is searched, and a match which reaches the end of
+  // the part isn't taken because it may be cut there
+  void researchPart() {
+    const QString pattern = "ba[rz]";
+    QString text = "foo\nbar\nbaz\nbar\nfoo";
+    SearchMatches matches;
+    matches.append({Region(4, 7), Region(8, 11), Region(12, 15)});
+    text.insert(9, "x");
+    Region region = matches.prepareUpdate(Region(8, 12), 9, 0, 1);
+    QCOMPARE(region, Region(8, 12));
+    // the lines "bar\nbxaz\nbar" from 4
+    QVERIFY(matches.research(text.mid(4, 12), 4, false, *Regexp::compile(pattern), region));
+    QCOMPARE(matches.size(), 2);
+    QCOMPARE(*matches.begin(), Region(4, 7));
+    QCOMPARE(*(matches.begin() + 1), Region(13, 16));
+
+    const QString longPattern = R"(b[\s\S]*)";
+    text = "b\nx\ny\nf";
+    matches.clear();
+    region = matches.prepareUpdate(Region(0, 1), 0, 0, 1);
+    QVERIFY(!matches.research(text.left(5), 0, false, *Regexp::compile(longPattern), region));
+    QVERIFY(matches.isEmpty());
+    QVERIFY(matches.research(text, 0, true, *Regexp::compile(longPattern), region));
+    QCOMPARE(matches.size(), 1);
+    QCOMPARE(*matches.begin(), Region(0, 7));
+  }
+};
+
+}  // namespace core
+
+QTEST_MAIN(core::MatchFinderTest)
+#include "MatchFinderTest.moc"
@@ -0,0 +1,152 @@
+#include <functional>
+#include <QtTest/QtTest>
+
+#ifdef Q_OS_LINUX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "PListParser.h"
+#include "DomPListParser.h"
+#include "Theme.h"
+
+namespace core {
+
+namespace {
+
+// bundled grammars and themes
+QStringList plistFiles() {
+  QStringList files;
+  QDir grammarDir("testdata/grammers");
+  for (const auto& name : grammarDir.entryList({"*.tmLanguage", "*.plist"}, QDir::Files)) {
+    files.append(grammarDir.filePath(name));
+  }
+  QDir themeDir("testdata");
+  for (const auto& name : themeDir.entryList({"*.tmTheme"}, QDir::Files)) {
+    files.append(themeDir.filePath(name));
+  }
+  return files;
+}
+
+// Parses all the files and returns how many of them have been parsed into a dict
+int parseAll(const QStringList& files, std::function<QVariant(QIODevice*)> parse) {
+  int count = 0;
+  for (const auto& path : files) {
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly) && !parse(&file).toMap().isEmpty()) {
+      count++;
+    }
+  }
+  return count;
+}
+
+QStringList themeFiles() {
+  QDir dir("../resources/themes");
+  QStringList files;
+  for (const auto& name : dir.entryList({"*.tmTheme"}, QDir::Files)) {
+    files.append(dir.filePath(name));
+  }
+  return files;
+}
+
+#ifdef Q_OS_LINUX
+// Returns a value in kB of /proc/self/status
+qint64 statusValue(const QByteArray& name) {
+  QFile file("/proc/self/status");
+  if (!file.open(QIODevice::ReadOnly)) {
+    return -1;
+  }
+  for (const auto& line : file.readAll().split('\n')) {
+    if (line.startsWith(name + ":")) {
+      return line.mid(name.size() + 1).trimmed().split(' ').first().toLongLong();
+    }
+  }
+  return -1;
+}
+
+// Runs f in a child process and returns how much its peak RSS has grown in kB.
+// A child process is used because the peak RSS of this process never decreases.
+qint64 peakMemoryGrowth(std::function<void()> f) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    const qint64 before = statusValue("VmRSS");
+    f();
+    const qint64 growth = statusValue("VmHWM") - before;
+    ssize_t written = write(fds[1], &growth, sizeof(growth));
+    _exit(written == sizeof(growth) ? 0 : 1);
+  }
+  close(fds[1]);
+  qint64 growth = -1;
+  if (pid < 0 || read(fds[0], &growth, sizeof(growth)) != sizeof(growth)) {
+    growth = -1;
+  }
+  close(fds[0]);
+  if (pid > 0) {
+    waitpid(pid, nullptr, 0);
+  }
+  return growth;
+}
+#endif
+}
+
+class PListParserBenchmark : public QObject {
+  Q_OBJECT
+ private:
+  QStringList files = plistFiles();
+
+ private slots:
+  void parseWithDomDocument() {
+    QVERIFY(!files.isEmpty());
+    QBENCHMARK { QCOMPARE(parseAll(files, DomPListParser::parsePList), files.size()); }
+  }
+
+  void parseWithStreamReader() {
+    QVERIFY(!files.isEmpty());
+    QBENCHMARK { QCOMPARE(parseAll(files, PListParser::parsePList), files.size()); }
+  }
+
+  // Parsing themes into QVariantMap, which Theme::loadTheme did before, compared with loading them
+  // from the parse events. loadTheme also builds the colors, which the first case doesn't.
+  void parseThemesIntoVariantMap() {
+    const QStringList themes = themeFiles();
+    QVERIFY(!themes.isEmpty());
+    QBENCHMARK { QCOMPARE(parseAll(themes, PListParser::parsePList), themes.size()); }
+  }
+
+  void buildThemesDirectly() {
+    const QStringList themes = themeFiles();
+    QVERIFY(!themes.isEmpty());
+    QBENCHMARK {
+      for (const auto& path : themes) {
+        std::unique_ptr<Theme> theme(Theme::loadTheme(path));
+        QVERIFY(theme);
+        qDeleteAll(theme->scopeSettings);
+      }
+    }
+  }
+
+  void peakMemory() {
+#ifdef Q_OS_LINUX
+    const qint64 domGrowth =
+        peakMemoryGrowth([&] { parseAll(files, DomPListParser::parsePList); });
+    const qint64 streamGrowth =
+        peakMemoryGrowth([&] { parseAll(files, PListParser::parsePList); });
+    QVERIFY(domGrowth >= 0);
+    QVERIFY(streamGrowth >= 0);
+    qDebug() << "peak RSS growth of" << files.size() << "files. QDomDocument:" << domGrowth
+             << "[kB], QXmlStreamReader:" << streamGrowth << "[kB]";
+#else
+    QSKIP("peak memory is measured only on Linux");
+#endif
+  }
+};
+
+}  // namespace core
+
+QTEST_MAIN(core::PListParserBenchmark)
+#include "PListParserBenchmark.moc"
@@ -0,0 +1,120 @@
+#include <QtTest/QtTest>
+
+#include "PListParser.h"
+#include "DomPListParser.h"
+
+namespace core {
+
+namespace {
+
+// grammars and themes in testdata and the themes bundled with the app
+QStringList plistFiles() {
+  QStringList files;
+  QDirIterator grammarIt("testdata/grammers", {"*.tmLanguage", "*.plist"}, QDir::Files,
+                         QDirIterator::Subdirectories);
+  while (grammarIt.hasNext()) {
+    files.append(grammarIt.next());
+  }
+  const QStringList themeDirs({"testdata", "../resources/themes"});
+  for (const auto& dirPath : themeDirs) {
+    QDir dir(dirPath);
+    for (const auto& name : dir.entryList({"*.tmTheme"}, QDir::Files)) {
+      files.append(dir.filePath(name));
+    }
+  }
+  return files;
+}
+
+QVariant parseWithStreamReader(const QByteArray& plist) {
+  QBuffer buffer;
+  buffer.setData(plist);
+  buffer.open(QIODevice::ReadOnly);
+  return PListParser::parsePList(&buffer);
+}
+
+QVariant parseWithDom(const QByteArray& plist) {
+  QBuffer buffer;
+  buffer.setData(plist);
+  buffer.open(QIODevice::ReadOnly);
+  return DomPListParser::parsePList(&buffer);
+}
+}
+
+class PListParserTest : public QObject {
+  Q_OBJECT
+ private slots:
+  // Every file gives the same value as the former QDomDocument parser
+  void sameAsDomParser() {
+    const QStringList files = plistFiles();
+    QVERIFY(files.size() > 20);
+    for (const auto& path : files) {
+      QFile file(path);
+      QVERIFY2(file.open(QIODevice::ReadOnly), qPrintable(path));
+      const QByteArray plist = file.readAll();
+      const QVariant value = parseWithStreamReader(plist);
+      QVERIFY2(!value.toMap().isEmpty(), qPrintable(path));
+      QVERIFY2(value == parseWithDom(plist), qPrintable(path));
+    }
+  }
+
+  // Value types which the grammars and themes don't use
+  void allValueTypes() {
+    const QByteArray plist = R"(<?xml version="1.0" encoding="UTF-8"?>
+<plist version="1.0">
+<dict>
+  <key>data</key>
+  <data>aGVsbG8=</data>
+  <key>real</key>
+  <real>1.5</real>
+  <key>date</key>
+  <date>2016-03-01T12:34:56Z</date>
+  <key>integer</key>
+  <integer>-3</integer>
+  <key>bools</key>
+  <array>
+    <true/>
+    <false/>
+  </array>
+  <key>nested</key>
+  <dict>
+    <key>string</key>
+    <string>a &amp; b</string>
+    <key>empty</key>
+    <array/>
+  </dict>
+  <key>unknown</key>
+  <foo>bar</foo>
+</dict>
+</plist>)";
+
+    const QVariant value = parseWithStreamReader(plist);
+    QCOMPARE(value, parseWithDom(plist));
+
+    const QVariantMap map = value.toMap();
+    QCOMPARE(map["data"].toByteArray(), QByteArray("hello"));
+    QCOMPARE(map["real"].toFloat(), 1.5f);
+    QCOMPARE(map["date"].toDateTime(), QDateTime(QDate(2016, 3, 1), QTime(12, 34, 56), Qt::UTC));
+    QCOMPARE(map["integer"].toInt(), -3);
+    QCOMPARE(map["bools"].toList(), QVariantList({true, false}));
+    QCOMPARE(map["nested"].toMap()["string"].toString(), QString("a & b"));
+    QVERIFY(map["nested"].toMap()["empty"].toList().isEmpty());
+    QVERIFY(map.contains("unknown"));
+    QVERIFY(!map["unknown"].isValid());
+  }
+
+  void parseRootValues() {
+    QFile file("testdata/grammers/C++.tmLanguage");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QVariantMap all = parseWithStreamReader(file.readAll()).toMap();
+    file.seek(0);
+    const QVariantMap values = PListParser::parseRootValues(&file, {"scopeName", "fileTypes"});
+    QCOMPARE(values.size(), 2);
+    QCOMPARE(values["scopeName"], all["scopeName"]);
+    QCOMPARE(values["fileTypes"], all["fileTypes"]);
+  }
+};
+
+}  // namespace core
+
+QTEST_MAIN(core::PListParserTest)
+#include "PListParserTest.moc"
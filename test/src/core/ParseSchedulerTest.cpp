@@ -0,0 +1,325 @@
+#include <type_traits>
+#include <QtTest/QtTest>
+#include <QSemaphore>
+#include <QTextDocument>
+
+#include "LanguageParser.h"
+#include "ParseScheduler.h"
+#include "SyntaxHighlighter.h"
+#include "TestUtil.h"
+#include "Theme.h"
+#include "scoped_guard.h"
+
+namespace core {
+
+namespace {
+
+const QString CPP_TEXT = R"(namespace foo {
+class hoge {
+  void foo();
+  int bar;
+};
+}
+)";
+
+// Larger than the threshold of progressive parsing
+const QString LARGE_CPP_TEXT = CPP_TEXT.repeated(2000);
+
+const QString CSS_TEXT = R"(a {
+  color: red;
+}
+)";
+
+// Occupies a pool thread until it's released
+class BlockingTask : public QRunnable {
+ public:
+  BlockingTask(QSemaphore* started, QSemaphore* released)
+      : m_started(started), m_released(released) {}
+
+  void run() override {
+    m_started->release();
+    m_released->acquire();
+  }
+
+ private:
+  QSemaphore* m_started;
+  QSemaphore* m_released;
+};
+
+// Occupies the only pool thread of ParseScheduler, so that new tasks wait until it's released
+class PoolBlocker {
+ public:
+  explicit PoolBlocker(QThreadPool* pool) : m_pool(pool) {
+    m_pool->setMaxThreadCount(1);
+    m_pool->start(new BlockingTask(&m_started, &m_released));
+    m_started.acquire();
+  }
+
+  ~PoolBlocker() {
+    release();
+    m_pool->setMaxThreadCount(QThread::idealThreadCount());
+  }
+
+  void release() {
+    if (!m_isReleased) {
+      m_isReleased = true;
+      m_released.release();
+    }
+  }
+
+ private:
+  QThreadPool* m_pool;
+  QSemaphore m_started;
+  QSemaphore m_released;
+  bool m_isReleased = false;
+};
+
+// Highlighters have a theme, so that highlighting reports format changes as contentsChange
+std::unique_ptr<Theme> s_theme;
+
+std::unique_ptr<SyntaxHighlighter> createHighlighter(QTextDocument* doc, const QString& scope) {
+  std::unique_ptr<LanguageParser> parser(LanguageParser::create(scope, doc->toPlainText()));
+  return std::unique_ptr<SyntaxHighlighter>(
+      new SyntaxHighlighter(doc, std::move(parser), s_theme.get(), QFont()));
+}
+
+// Compares the tree of highlighter with the full parse of its document
+void compareWithFullParse(SyntaxHighlighter* highlighter, const QString& scope) {
+  const QString text = highlighter->document()->toPlainText();
+  std::unique_ptr<LanguageParser> parser(LanguageParser::create(scope, text));
+  auto rootNode = parser->parse();
+  QVERIFY(rootNode);
+  TestUtil::compareLineByLine(highlighter->rootNode().toString(text), rootNode->toString(text));
+}
+
+// Lines in the second half of LARGE_CPP_TEXT, which is more than a chunk ahead of the beginning
+Region largeVisibleRegion() {
+  const int begin = LARGE_CPP_TEXT.indexOf("namespace", LARGE_CPP_TEXT.length() / 2);
+  return Region(begin, begin + CPP_TEXT.length() * 100);
+}
+
+void insertText(QTextDocument* doc, int pos, const QString& text) {
+  QTextCursor cursor(doc);
+  cursor.setPosition(pos);
+  cursor.insertText(text);
+}
+}
+
+class ParseSchedulerTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void initTestCase() {
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/C.tmLanguage"));
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/C++.tmLanguage"));
+    QVERIFY(LanguageProvider::loadLanguage("testdata/grammers/CSS.plist"));
+    s_theme.reset(Theme::loadTheme("testdata/Monokai.tmTheme"));
+    QVERIFY(s_theme);
+  }
+
+  void cleanupTestCase() { s_theme.reset(); }
+
+  // Documents parsed in parallel get the same trees as parsed one by one
+  void parseInParallel() {
+    QTextDocument cppDoc(CPP_TEXT.repeated(50));
+    QTextDocument cssDoc(CSS_TEXT.repeated(50));
+    auto cppHighlighter = createHighlighter(&cppDoc, "source.c++");
+    QSignalSpy cppSpy(cppHighlighter.get(), &SyntaxHighlighter::parseFinished);
+    auto cssHighlighter = createHighlighter(&cssDoc, "source.css");
+    QSignalSpy cssSpy(cssHighlighter.get(), &SyntaxHighlighter::parseFinished);
+
+    QTRY_COMPARE(cppSpy.count(), 1);
+    QTRY_COMPARE(cssSpy.count(), 1);
+    compareWithFullParse(cppHighlighter.get(), "source.c++");
+    compareWithFullParse(cssHighlighter.get(), "source.css");
+  }
+
+  // Edits which come while a document is parsed are merged into one parse. Edits of another
+  // document don't cancel it.
+  void coalesceEdits() {
+    QTextDocument doc1(CPP_TEXT);
+    QTextDocument doc2(CPP_TEXT);
+    auto highlighter1 = createHighlighter(&doc1, "source.c++");
+    QSignalSpy spy1(highlighter1.get(), &SyntaxHighlighter::parseFinished);
+    auto highlighter2 = createHighlighter(&doc2, "source.c++");
+    QSignalSpy spy2(highlighter2.get(), &SyntaxHighlighter::parseFinished);
+    QTRY_COMPARE(spy1.count(), 1);
+    QTRY_COMPARE(spy2.count(), 1);
+
+    QSignalSpy partialSpy(&ParseScheduler::singleton(), &ParseScheduler::partialParseFinished);
+    const int pos = CPP_TEXT.indexOf("bar");
+    for (int i = 0; i < 10; i++) {
+      insertText(&doc1, pos, "x");
+      insertText(&doc2, pos, "y");
+    }
+
+    QTRY_COMPARE(partialSpy.count(), 2);
+    QTest::qWait(100);
+    QCOMPARE(partialSpy.count(), 2);
+    QVERIFY(partialSpy[0][0].value<SyntaxHighlighter*>() !=
+            partialSpy[1][0].value<SyntaxHighlighter*>());
+    compareWithFullParse(highlighter1.get(), "source.c++");
+    compareWithFullParse(highlighter2.get(), "source.c++");
+  }
+
+  // A result which finished before a newer edit is dropped, and the edit is parsed with it
+  void dropStaleResult() {
+    QTextDocument doc(CPP_TEXT);
+    auto highlighter = createHighlighter(&doc, "source.c++");
+    QSignalSpy spy(highlighter.get(), &SyntaxHighlighter::parseFinished);
+    QTRY_COMPARE(spy.count(), 1);
+
+    QSignalSpy partialSpy(&ParseScheduler::singleton(), &ParseScheduler::partialParseFinished);
+    insertText(&doc, CPP_TEXT.indexOf("bar"), "/*");
+    // The result is queued but not delivered until the event loop runs
+    ParseScheduler::singleton().m_pool.waitForDone();
+    insertText(&doc, CPP_TEXT.indexOf("void"), "int a; ");
+
+    QTRY_COMPARE(partialSpy.count(), 1);
+    QTest::qWait(100);
+    QCOMPARE(partialSpy.count(), 1);
+    compareWithFullParse(highlighter.get(), "source.c++");
+  }
+
+  // A visible document is parsed before the invisible ones waiting for a pool thread
+  void prioritizeVisibleDocument() {
+    QTextDocument invisibleDoc(CPP_TEXT);
+    QTextDocument visibleDoc(CPP_TEXT);
+    auto invisibleHighlighter = createHighlighter(&invisibleDoc, "source.c++");
+    QSignalSpy invisibleSpy(invisibleHighlighter.get(), &SyntaxHighlighter::parseFinished);
+    auto visibleHighlighter = createHighlighter(&visibleDoc, "source.c++");
+    QSignalSpy visibleSpy(visibleHighlighter.get(), &SyntaxHighlighter::parseFinished);
+    QTRY_COMPARE(invisibleSpy.count(), 1);
+    QTRY_COMPARE(visibleSpy.count(), 1);
+    visibleHighlighter->setVisible(true);
+
+    QVector<SyntaxHighlighter*> order;
+    auto connection = connect(&ParseScheduler::singleton(), &ParseScheduler::partialParseFinished,
+                              [&](SyntaxHighlighter* highlighter) { order.append(highlighter); });
+
+    // Both parses wait for the only pool thread
+    PoolBlocker blocker(&ParseScheduler::singleton().m_pool);
+    const int pos = CPP_TEXT.indexOf("bar");
+    insertText(&invisibleDoc, pos, "x");
+    insertText(&visibleDoc, pos, "x");
+    blocker.release();
+
+    QTRY_COMPARE(order.size(), 2);
+    QCOMPARE(order[0], visibleHighlighter.get());
+    QCOMPARE(order[1], invisibleHighlighter.get());
+
+    disconnect(connection);
+  }
+
+  // The result of a removed highlighter doesn't reach a new highlighter at the same address
+  void dropResultOfRemovedHighlighter() {
+    QTextDocument oldDoc(CSS_TEXT);
+    QTextDocument newDoc(CPP_TEXT);
+    QSignalSpy finishedSpy(&ParseScheduler::singleton(), &ParseScheduler::fullParseFinished);
+    std::aligned_storage<sizeof(SyntaxHighlighter), alignof(SyntaxHighlighter)>::type storage;
+    auto highlighter = reinterpret_cast<SyntaxHighlighter*>(&storage);
+
+    // The task of the removed highlighter is still waiting for a pool thread
+    PoolBlocker blocker(&ParseScheduler::singleton().m_pool);
+    new (highlighter) SyntaxHighlighter(
+        &oldDoc, std::unique_ptr<LanguageParser>(LanguageParser::create("source.css", CSS_TEXT)),
+        s_theme.get(), QFont());
+    highlighter->~SyntaxHighlighter();
+    new (highlighter) SyntaxHighlighter(
+        &newDoc, std::unique_ptr<LanguageParser>(LanguageParser::create("source.c++", CPP_TEXT)),
+        s_theme.get(), QFont());
+    scoped_guard guard([highlighter] { highlighter->~SyntaxHighlighter(); });
+    QSignalSpy spy(highlighter, &SyntaxHighlighter::parseFinished);
+    blocker.release();
+
+    // The canceled result of the removed one would make the new one parse twice
+    QTRY_COMPARE(spy.count(), 1);
+    QTest::qWait(100);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(finishedSpy.count(), 1);
+    compareWithFullParse(highlighter, "source.c++");
+  }
+
+  // A text under the threshold is parsed at once, and a larger one in chunks from the beginning
+  void parseProgressively() {
+    QSignalSpy finishedSpy(&ParseScheduler::singleton(), &ParseScheduler::fullParseFinished);
+    QSignalSpy progressedSpy(&ParseScheduler::singleton(), &ParseScheduler::fullParseProgressed);
+    QTextDocument smallDoc(CPP_TEXT.repeated(50));
+    auto smallHighlighter = createHighlighter(&smallDoc, "source.c++");
+    QTRY_COMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy[0][2].toBool(), false);
+    QCOMPARE(progressedSpy.count(), 0);
+
+    finishedSpy.clear();
+    QTextDocument largeDoc(LARGE_CPP_TEXT);
+    auto largeHighlighter = createHighlighter(&largeDoc, "source.c++");
+    QTRY_COMPARE(finishedSpy.count(), 1);
+    QCOMPARE(finishedSpy[0][2].toBool(), true);
+    // Highlighting the chunks doesn't start another parse
+    QTest::qWait(100);
+    QCOMPARE(finishedSpy.count(), 1);
+    QVERIFY(progressedSpy.count() > 1);
+    int pos = 0;
+    for (const auto& args : progressedSpy) {
+      const Region region = args[2].value<Region>();
+      QCOMPARE(region.begin(), pos);
+      pos = region.end();
+    }
+    QCOMPARE(pos, LARGE_CPP_TEXT.length());
+    compareWithFullParse(largeHighlighter.get(), "source.c++");
+  }
+
+  // The visible region ahead of the first chunk is parsed before the chunks, and the chunks
+  // replace it later
+  void parseVisibleRegionFirst() {
+    QSignalSpy progressedSpy(&ParseScheduler::singleton(), &ParseScheduler::fullParseProgressed);
+    QTextDocument doc(LARGE_CPP_TEXT);
+    const Region visibleRegion = largeVisibleRegion();
+    std::unique_ptr<SyntaxHighlighter> highlighter;
+    {
+      PoolBlocker blocker(&ParseScheduler::singleton().m_pool);
+      highlighter = createHighlighter(&doc, "source.c++");
+      highlighter->setVisibleRegion(visibleRegion);
+    }
+    QSignalSpy spy(highlighter.get(), &SyntaxHighlighter::parseFinished);
+
+    QTRY_COMPARE(spy.count(), 1);
+    QVERIFY(progressedSpy.count() > 1);
+    QCOMPARE(progressedSpy[0][2].value<Region>(), visibleRegion);
+    QCOMPARE(progressedSpy[1][2].value<Region>().begin(), 0);
+    compareWithFullParse(highlighter.get(), "source.c++");
+  }
+
+  // An edit cancels the provisional parse of the visible region, and the edited text is parsed
+  // again from the beginning
+  void cancelProvisionalParse() {
+    QSignalSpy progressedSpy(&ParseScheduler::singleton(), &ParseScheduler::fullParseProgressed);
+    QTextDocument doc(LARGE_CPP_TEXT);
+    const Region visibleRegion = largeVisibleRegion();
+    PoolBlocker blocker(&ParseScheduler::singleton().m_pool);
+    auto highlighter = createHighlighter(&doc, "source.c++");
+    highlighter->setVisibleRegion(visibleRegion);
+    QSignalSpy spy(highlighter.get(), &SyntaxHighlighter::parseFinished);
+
+    // The task stops just before the provisional parse while the viewport is locked
+    auto viewport = ParseScheduler::singleton().m_queues[highlighter.get()].viewport;
+    viewport->mutex.lock();
+    blocker.release();
+    QTest::qWait(100);
+    insertText(&doc, 0, "/*");
+    viewport->mutex.unlock();
+
+    QTRY_COMPARE(spy.count(), 1);
+    QTest::qWait(100);
+    QCOMPARE(spy.count(), 1);
+    // Only the parse of the edited text is notified
+    QVERIFY(progressedSpy.count() > 1);
+    QCOMPARE(progressedSpy[0][2].value<Region>(), visibleRegion);
+    QCOMPARE(progressedSpy.last()[2].value<Region>().end(), doc.characterCount() - 1);
+    compareWithFullParse(highlighter.get(), "source.c++");
+  }
+};
+
+}  // namespace core
+
+QTEST_MAIN(core::ParseSchedulerTest)
+#include "ParseSchedulerTest.moc"
@@ -0,0 +1,56 @@
+#include <QtTest/QtTest>
+
+#include "Regexp.h"
+#include "RegexpCache.h"
+
+namespace core {
+
+class RegexpCacheTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void get() {
+    RegexpCache cache(2);
+    auto regexp = cache.get("a+");
+    QVERIFY(regexp);
+    QCOMPARE(regexp->pattern(), QString("a+"));
+    QCOMPARE(cache.missCount(), 1);
+    QCOMPARE(cache.hitCount(), 0);
+
+    QCOMPARE(cache.get("a+"), regexp);
+    QCOMPARE(cache.missCount(), 1);
+    QCOMPARE(cache.hitCount(), 1);
+  }
+
+  void invalidPattern() {
+    RegexpCache cache(2);
+    QVERIFY(!cache.get("(a"));
+    QVERIFY(!cache.get("(a"));
+    QCOMPARE(cache.missCount(), 1);
+    QCOMPARE(cache.hitCount(), 1);
+  }
+
+  void evictLeastRecentlyUsed() {
+    RegexpCache cache(2);
+    auto a = cache.get("a");
+    cache.get("b");
+    // a is used more recently than b
+    cache.get("a");
+    cache.get("c");
+    QCOMPARE(cache.size(), 2);
+
+    QCOMPARE(cache.get("a"), a);
+    QCOMPARE(cache.missCount(), 3);
+    cache.get("b");
+    QCOMPARE(cache.missCount(), 4);
+
+    // An evicted regexp is still usable
+    cache.clear();
+    QCOMPARE(cache.size(), 0);
+    QVERIFY(a->matches("a"));
+  }
+};
+
+}  // namespace core
+
+QTEST_MAIN(core::RegexpCacheTest)
+#include "RegexpCacheTest.moc"
@@ -1,7 +1,12 @@
 #include <QtTest/QtTest>
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "Regexp.h"
+#include "ParseProfiler.h"
+#include "scoped_guard.h"
 
 namespace core {
 
@@ -56,6 +61,23 @@ class RegexpTest : public QObject {
     QVERIFY(indices.isEmpty());
   }
 
+  void search() {
+    auto reg = Regexp::compile(R"((<\?)\s*([-_a-zA-Z0-9]+)(x)?)");
+    MatchRegions regions;
+    QVERIFY(reg->search(R"(<?xml version="1.0"?>)", regions));
+    QCOMPARE(regions.size(), 4);
+    QCOMPARE(regions[0], Region(0, 5));
+    QCOMPARE(regions[1], Region(0, 2));
+    QCOMPARE(regions[2], Region(2, 5));
+    QCOMPARE(regions[3], Region(-1, -1));
+
+    // regions are reused and cleared when it doesn't match
+    QVERIFY(reg->search("a<? b", regions, 1));
+    QCOMPARE(regions[0], Region(1, 5));
+    QVERIFY(!reg->search("aaa", regions));
+    QVERIFY(regions.isEmpty());
+  }
+
   void findStringSubmatchIndexInRegion() {
     auto reg = Regexp::compile(R"(a(x*)b)");
     QString str = R"(-ab-axb-)";
@@ -120,6 +142,42 @@ axb-)";
     QVERIFY(indices.isEmpty());
   }
 
+  void forEachMatch() {
+    auto reg = Regexp::compile(R"(a(x*)b)");
+    const QString str = R"(-ab-axb-axxb-)";
+    QVector<Region> regions;
+    reg->forEachMatch(str, 0, -1, [&](const Region& region) {
+      regions.append(region);
+      return true;
+    });
+    QCOMPARE(regions, QVector<Region>({Region(1, 3), Region(4, 7), Region(8, 12)}));
+
+    // only matches starting in [begin, end)
+    regions.clear();
+    reg->forEachMatch(str, 2, 5, [&](const Region& region) {
+      regions.append(region);
+      return true;
+    });
+    QCOMPARE(regions, QVector<Region>({Region(4, 7)}));
+
+    // stop when f returns false
+    regions.clear();
+    reg->forEachMatch(str, 0, -1, [&](const Region& region) {
+      regions.append(region);
+      return false;
+    });
+    QCOMPARE(regions.size(), 1);
+
+    // empty matches
+    reg = Regexp::compile(R"(^)");
+    regions.clear();
+    reg->forEachMatch("aa\nbb\ncc", 0, -1, [&](const Region& region) {
+      regions.append(region);
+      return true;
+    });
+    QCOMPARE(regions, QVector<Region>({Region(0, 0), Region(3, 3), Region(6, 6)}));
+  }
+
   void findStringSubmatchIndexInJapanese() {
     auto reg = Regexp::compile(u8R"((いう(?:(a))?)\s*([あいうえお]+))");
     QString str = u8R"(あいうあいうえおかきくけこ)";
@@ -241,6 +299,201 @@ axb-)";
              QString(R"(\[\]\{\}\(\)\|\-\*\.\\a\?\+\^\$\#\ )"));
     QCOMPARE(Regexp::escape("\t\n\r\f\v"), QString("\\\t\\\n\\\r\\\f\\\v"));
   }
+
+  // Compiling, searching and freeing regexps in several threads at the same time
+  void compileInThreads() {
+    const int threadCount = 8;
+    const int iterations = 200;
+    auto shared = Regexp::compile(R"((?i)\b(\w+)\s*=\s*\1\b)");
+    QVERIFY(shared.get());
+    std::atomic<int> failures(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < iterations; i++) {
+          const QString id = QString::number(t * iterations + i);
+          auto reg = Regexp::compile(QString(R"((?i)\p{Alpha}+_%1|(?<n>\d+)\k<n>)").arg(id));
+          const QVector<int> expected({0, 4 + id.size(), -1, -1});
+          if (!reg || reg->findStringSubmatchIndex("xyz_" + id) != expected) {
+            failures++;
+          }
+          if (!shared->matches("Foo = foo")) {
+            failures++;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    QCOMPARE(failures.load(), 0);
+  }
+
+  void prefilter_data() {
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<QString>("firstChars");
+    QTest::addColumn<QString>("otherChars");
+
+    QTest::newRow("literal") << "abc" << "a" << "bcA ";
+    QTest::newRow("alternation") << "foo|bar" << "fb" << "oar";
+    QTest::newRow("optional") << "a?b*c" << "abc" << "d";
+    QTest::newRow("interval") << "a{0,2}b" << "ab" << "c";
+    QTest::newRow("group") << "(?:(a)|[x-z])+" << "axyz" << "bw";
+    QTest::newRow("class") << R"([\d_-])" << "09_-" << "a";
+    QTest::newRow("escape") << R"(\.\t)" << "." << "\t";
+    QTest::newRow("anchor") << R"(^\s*\#)" << " \t#" << "a";
+    QTest::newRow("lookbehind") << "(?<=a)b" << "b" << "a";
+    QTest::newRow("ignoreCase") << "(?i)ab" << "aA" << "bB";
+    QTest::newRow("extended") << "(?x) a # comment\n b" << "a" << " #b";
+    QTest::newRow("nonAscii") << "あ" << "あ" << "a";
+  }
+
+  void prefilter() {
+    QFETCH(QString, pattern);
+    QFETCH(QString, firstChars);
+    QFETCH(QString, otherChars);
+
+    auto prefilter = RegexpPrefilter::create(pattern);
+    QVERIFY(prefilter);
+    for (QChar ch : firstChars) {
+      QVERIFY2(prefilter->contains(ch), qPrintable(QString(ch)));
+    }
+    for (QChar ch : otherChars) {
+      QVERIFY2(!prefilter->contains(ch), qPrintable(QString(ch)));
+    }
+  }
+
+  void prefilterForAnyChar_data() {
+    QTest::addColumn<QString>("pattern");
+
+    QTest::newRow("dot") << "a|.";
+    QTest::newRow("empty") << "a*";
+    QTest::newRow("zeroWidth") << R"(\b)";
+    QTest::newRow("negatedClass") << "[^a]";
+    QTest::newRow("backReference") << R"((a)?\1)";
+    QTest::newRow("unicodeEscape") << R"(\x41)";
+    QTest::newRow("nonAsciiIgnoreCase") << "(?i)K";
+  }
+
+  void prefilterForAnyChar() {
+    QFETCH(QString, pattern);
+    QVERIFY(!RegexpPrefilter::create(pattern));
+  }
+
+  void skipSearchByPrefilter() {
+    auto reg = Regexp::compile("foo|bar");
+    // searches are counted only while profiling
+    ParseProfiler::singleton().setEnabled(true);
+    scoped_guard guard([] { ParseProfiler::singleton().setEnabled(false); });
+    Regexp::resetSearchCounts();
+    QVERIFY(reg->findStringSubmatchIndex("xxxxxxxx").isEmpty());
+    QCOMPARE(Regexp::searchCount(), qint64(0));
+    QCOMPARE(Regexp::skippedSearchCount(), qint64(1));
+
+    // a match ends within end
+    QCOMPARE(reg->findStringSubmatchIndex("xxbarx", 0, 5), QVector<int>({2, 5}));
+    QCOMPARE(reg->findStringSubmatchIndex("xxbarx", 0, 2), QVector<int>());
+    QCOMPARE(Regexp::searchCount(), qint64(1));
+    QCOMPARE(Regexp::skippedSearchCount(), qint64(2));
+
+    // \G matches at begin, so begin can't be moved to a candidate
+    reg = Regexp::compile(R"(\Gb)");
+    QCOMPARE(reg->findStringSubmatchIndex("ab", 0), QVector<int>());
+    QCOMPARE(reg->findStringSubmatchIndex("ab", 1), QVector<int>({1, 2}));
+  }
+
+  void compileLiteral_data() {
+    QTest::addColumn<QString>("str");
+    QTest::addColumn<bool>("caseSensitive");
+
+    QTest::newRow("char") << "a" << true;
+    QTest::newRow("string") << "abA" << true;
+    QTest::newRow("ignoreCase") << "abA" << false;
+    QTest::newRow("symbols") << "a.*[" << false;
+    QTest::newRow("long") << "aAbBaAbBaAbBaAbBaAbB" << false;
+    QTest::newRow("nonAscii") << "あa" << true;
+    QTest::newRow("nonAsciiIgnoreCase") << "あa" << false;
+  }
+
+  // A literal regexp finds the same matches as the escaped regex
+  void compileLiteral() {
+    QFETCH(QString, str);
+    QFETCH(bool, caseSensitive);
+
+    auto literal = Regexp::compileLiteral(str, caseSensitive);
+    auto reg = Regexp::compile(QString(QLatin1String(caseSensitive ? "(?-i)" : "(?i)") +
+                                       Regexp::escape(str)));
+    QVERIFY(literal);
+    QVERIFY(reg);
+
+    // Matches are put around the ends of vectors
+    const QString chars = "aAbBあ.*[x";
+    QString text;
+    for (int i = 0; i < 200; i++) {
+      text += chars[(i * 7 + i / 3) % chars.size()];
+      if (i % 37 == 0) {
+        text += str;
+      }
+    }
+    text += str.toUpper();
+    QCOMPARE(literal->findAllStringSubmatchIndex(text), reg->findAllStringSubmatchIndex(text));
+    for (int begin = 0; begin < 40; begin += 3) {
+      for (int end = begin; end < 60; end += 5) {
+        QCOMPARE(literal->findStringSubmatchIndex(text, begin, end),
+                 reg->findStringSubmatchIndex(text, begin, end));
+      }
+    }
+    QCOMPARE(literal->findStringSubmatchIndex(text, text.size(), 0, true),
+             reg->findStringSubmatchIndex(text, text.size(), 0, true));
+  }
+
+  void compileLiteralFoldingNonAscii_data() {
+    QTest::addColumn<QString>("str");
+    QTest::addColumn<QString>("text");
+
+    QTest::newRow("kelvinSign") << "k" << QString::fromUtf8("abKb");
+    QTest::newRow("longS") << "s" << QString::fromUtf8("abſb");
+    QTest::newRow("sharpS") << "ss" << QString::fromUtf8("abßb");
+    QTest::newRow("ligature") << "fi" << QString::fromUtf8("abﬁb");
+  }
+
+  // A case insensitive literal finds a non ASCII character which the regex folds into ASCII,
+  // so forward and backward searches agree
+  void compileLiteralFoldingNonAscii() {
+    QFETCH(QString, str);
+    QFETCH(QString, text);
+
+    auto literal = Regexp::compileLiteral(str, false);
+    auto reg = Regexp::compile("(?i)" + Regexp::escape(str));
+    QVERIFY(literal);
+    QVERIFY(reg);
+
+    const QVector<int> backward = literal->findStringSubmatchIndex(text, text.size(), 0, true);
+    QCOMPARE(literal->findStringSubmatchIndex(text), backward);
+    QCOMPARE(literal->findStringSubmatchIndex(text), reg->findStringSubmatchIndex(text));
+    QCOMPARE(literal->findAllStringSubmatchIndex(text), reg->findAllStringSubmatchIndex(text));
+  }
+
+  void compileLiteralWithoutSearch() {
+    auto reg = Regexp::compileLiteral("Bar", false);
+    ParseProfiler::singleton().setEnabled(true);
+    scoped_guard guard([] { ParseProfiler::singleton().setEnabled(false); });
+    Regexp::resetSearchCounts();
+    // a match ends within end
+    QCOMPARE(reg->findStringSubmatchIndex("xxbarx", 0, 5), QVector<int>({2, 5}));
+    QCOMPARE(reg->findStringSubmatchIndex("xxbarx", 0, 4), QVector<int>());
+    QCOMPARE(reg->findAllStringSubmatchIndex("barBAR"),
+             QVector<QVector<int>>({{0, 3}, {3, 6}}));
+    QCOMPARE(reg->findStringSubmatchIndex(QString::fromUtf8("あbar")), QVector<int>({1, 4}));
+    QCOMPARE(Regexp::searchCount(), qint64(0));
+    // the regex searches text with a character folding into ASCII
+    QCOMPARE(reg->findStringSubmatchIndex(QString::fromUtf8("ſbar")), QVector<int>({1, 4}));
+    QCOMPARE(Regexp::searchCount(), qint64(1));
+
+    // an empty string is searched by the regex
+    QVERIFY(Regexp::compileLiteral("", true));
+  }
 };
 
 }  // namespace core
@@ -0,0 +1,115 @@
+#include <QtTest/QtTest>
+
+#include "ScopeAtoms.h"
+#include "ScopeSelector.h"
+
+namespace core {
+
+namespace {
+
+int stack(const QString& scopeName) {
+  return ScopeStacks::singleton().fromScopeName(scopeName);
+}
+
+QVector<int> match(const QString& selector, const QString& scopeName) {
+  ScopeSelectorMatcher matcher;
+  matcher.add(selector, 0);
+  return matcher.match(stack(scopeName));
+}
+
+bool matches(const QString& selector, const QString& scopeName) {
+  return !match(selector, scopeName).isEmpty();
+}
+}
+
+class ScopeSelectorTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void match_data();
+  void match();
+  void rank();
+  void splitGroups();
+  void syntaxError();
+};
+
+void ScopeSelectorTest::match_data() {
+  QTest::addColumn<QString>("selector");
+  QTest::addColumn<QString>("scope");
+  QTest::addColumn<bool>("expected");
+
+  QTest::newRow("prefix") << "string.quoted" << "source.php string.quoted.double" << true;
+  QTest::newRow("prefix at a dot") << "string.quote" << "source.php string.quoted" << false;
+  QTest::newRow("longer than scope") << "string.quoted.foo" << "source.php string.quoted"
+                                     << false;
+  QTest::newRow("ancestor") << "source.php" << "source.php string.quoted" << true;
+  QTest::newRow("descendant") << "source string" << "source.php string.quoted" << true;
+  QTest::newRow("wrong order") << "string source" << "source.php string.quoted" << false;
+  QTest::newRow("name with hyphen") << "entity.other.inherited-class"
+                                    << "source.c++ entity.other.inherited-class.c++" << true;
+  QTest::newRow("empty") << "" << "source.php string.quoted" << true;
+  QTest::newRow("exclusion") << "string - string.regexp" << "source.js string.quoted" << true;
+  QTest::newRow("excluded") << "string - string.regexp" << "source.js string.regexp" << false;
+  QTest::newRow("excluded ancestor") << "string - source.js" << "source.js string.quoted"
+                                     << false;
+  QTest::newRow("group") << "comment, string" << "source.js string.quoted" << true;
+  QTest::newRow("pipe") << "comment | string" << "source.js string.quoted" << true;
+  QTest::newRow("and") << "source & string" << "source.js string.quoted" << true;
+  QTest::newRow("and not matched") << "source & comment" << "source.js string.quoted" << false;
+  QTest::newRow("parentheses") << "(source.js, source.ts) - string" << "source.ts comment"
+                               << true;
+  QTest::newRow("parentheses excluded") << "(source.js, source.ts) - string"
+                                        << "source.ts string" << false;
+  QTest::newRow("nested exclusion") << "source - (string, comment)" << "source.ts comment.line"
+                                    << false;
+  QTest::newRow("negation only") << "-comment" << "source.ts string" << true;
+}
+
+void ScopeSelectorTest::match() {
+  QFETCH(QString, selector);
+  QFETCH(QString, scope);
+  QFETCH(bool, expected);
+
+  QCOMPARE(matches(selector, scope), expected);
+}
+
+// The winner is the selector which matches the deepest scope, then matches more of it, then the
+// same rules applied to the rest of the scopes. The rule added later wins a tie.
+// http://manual.macromates.com/en/scope_selectors
+void ScopeSelectorTest::rank() {
+  ScopeSelectorMatcher matcher;
+  matcher.add("", 0);
+  matcher.add("source.php", 1);
+  matcher.add("string", 2);
+  matcher.add("string.quoted", 3);
+  matcher.add("source.php string", 4);
+  matcher.add("comment", 5);
+  matcher.add("source.php string.quoted", 6);
+  matcher.add("string.quoted - comment", 7);
+  QCOMPARE(matcher.match(stack("source.php string.quoted")), (QVector<int>{6, 7, 3, 4, 2, 1, 0}));
+
+  // the best group of a rule gives its rank
+  ScopeSelectorMatcher groups;
+  groups.add("string", 0);
+  groups.add("source, string.quoted", 1);
+  QCOMPARE(groups.match(stack("source.php string.quoted")), (QVector<int>{1, 0}));
+}
+
+void ScopeSelectorTest::splitGroups() {
+  QCOMPARE(ScopeSelectorMatcher::splitGroups("comment"), QStringList("comment"));
+  QCOMPARE(ScopeSelectorMatcher::splitGroups("constant.character, constant.other"),
+           (QStringList{"constant.character", "constant.other"}));
+  QCOMPARE(ScopeSelectorMatcher::splitGroups("(a, b) - c,d"), (QStringList{"(a, b) - c", "d"}));
+}
+
+void ScopeSelectorTest::syntaxError() {
+  ScopeSelectorMatcher matcher;
+  QVERIFY(!matcher.add("(source string", 0));
+  QVERIFY(!matcher.add("source)", 1));
+  QVERIFY(matcher.add("string", 2));
+  QCOMPARE(matcher.match(stack("source string")), QVector<int>{2});
+}
+
+}  // namespace core
+
+QTEST_MAIN(core::ScopeSelectorTest)
+#include "ScopeSelectorTest.moc"
@@ -0,0 +1,189 @@
+#include <QtTest/QtTest>
+
+#include "LanguageParser.h"
+#include "ScopeAtoms.h"
+#include "ScopeTree.h"
+
+namespace core {
+
+namespace {
+
+// 0         1         2
+// 0123456789012345678901234
+// aaaa bbbbbbbbbb cccc dddd
+RootNode createRootNode() {
+  RootNode root("source.test");
+  root.region = Region(0, 25);
+  Node a("a", Region(0, 4));
+  Node b("b", Region(5, 15));
+  Node b1("b1", Region(6, 10));
+  b1.children.append(Node("b11", Region(7, 9)));
+  b.children.append(b1);
+  b.children.append(Node("", Region(10, 12)));
+  b.children.append(Node("b3", Region(12, 14)));
+  Node c("c", Region(16, 20));
+  Node d("d", Region(21, 25));
+  root.children << a << b << c << d;
+  return root;
+}
+
+QString scopeName(const QVector<ScopeTree::Scope>& path) {
+  return ScopeStacks::singleton().scopeName(path.last().stack);
+}
+
+QString format(const RootNode& root) {
+  return root.toString(QString(root.region.end(), 'x'));
+}
+}
+
+class ScopeTreeTest : public QObject {
+  Q_OBJECT
+ private slots:
+  void adjust_data();
+  void adjust();
+  void adjustRepeatedly();
+  void adjustContentRegion();
+  void replace();
+  void findScopes();
+  void scopeStacks();
+};
+
+void ScopeTreeTest::adjust_data() {
+  QTest::addColumn<int>("pos");
+  QTest::addColumn<int>("delta");
+
+  QTest::newRow("insert at the beginning") << 0 << 3;
+  QTest::newRow("insert inside a nested node") << 8 << 2;
+  QTest::newRow("insert between top level nodes") << 16 << 1;
+  QTest::newRow("insert at the end") << 25 << 4;
+  QTest::newRow("remove inside a nested node") << 9 << -1;
+  QTest::newRow("remove across nodes") << 13 << -6;
+  QTest::newRow("remove across top level nodes") << 18 << -10;
+}
+
+// ScopeTree::adjust must be the same as RootNode::adjust
+void ScopeTreeTest::adjust() {
+  QFETCH(int, pos);
+  QFETCH(int, delta);
+
+  RootNode root = createRootNode();
+  ScopeTree tree = ScopeTree::fromRootNode(root);
+  QCOMPARE(format(tree.toRootNode()), format(root));
+
+  root.adjust(pos, delta);
+  tree.adjust(pos, delta);
+  QCOMPARE(format(tree.toRootNode()), format(root));
+}
+
+void ScopeTreeTest::adjustRepeatedly() {
+  RootNode root = createRootNode();
+  ScopeTree tree = ScopeTree::fromRootNode(root);
+
+  // typing at the same place accumulates the deferred shift
+  for (int i = 0; i < 3; i++) {
+    root.adjust(8 + i, 1);
+    tree.adjust(8 + i, 1);
+  }
+  QCOMPARE(format(tree.toRootNode()), format(root));
+
+  // an edit at another place
+  root.adjust(2, 1);
+  tree.adjust(2, 1);
+  QCOMPARE(format(tree.toRootNode()), format(root));
+}
+
+// The origin of a begin/end node is kept, and its content region is adjusted like Node::adjust
+void ScopeTreeTest::adjustContentRegion() {
+  Pattern pattern(nullptr);
+  pattern.begin.reset(Regex::create("b"));
+  RootNode root = createRootNode();
+  Node& b = root.children[1];
+  b.pattern = &pattern;
+  b.contentRegion = Region(6, 14);
+  b.beginCapturedStrs = QStringList{"b"};
+  ScopeTree tree = ScopeTree::fromRootNode(root);
+
+  const QVector<QPair<int, int>> edits{{8, 2}, {13, -6}, {2, 1}};
+  for (const auto& edit : edits) {
+    root.adjust(edit.first, edit.second);
+    tree.adjust(edit.first, edit.second);
+    const Node node = tree.toNode(1);
+    QCOMPARE(node.region, root.children[1].region);
+    QCOMPARE(node.pattern, &pattern);
+    QCOMPARE(node.contentRegion, root.children[1].contentRegion);
+    QCOMPARE(node.beginCapturedStrs, QStringList{"b"});
+  }
+  QCOMPARE(tree.segmentRegion(1), root.children[1].region);
+  QCOMPARE(tree.findSegment(Region(7, 8)), 1);
+  QCOMPARE(tree.segmentAfter(root.children[1].region.end()), 2);
+}
+
+void ScopeTreeTest::replace() {
+  RootNode root = createRootNode();
+  ScopeTree tree = ScopeTree::fromRootNode(root);
+  // leave a deferred shift
+  tree.adjust(2, 1);
+  root.adjust(2, 1);
+
+  QList<Node> newNodes{Node("e", Region(6, 10)), Node("f", Region(11, 13))};
+  Region removedRegion = tree.replace(ScopeSegment::fromNodes(newNodes), Region(6, 12));
+  // b is removed
+  QCOMPARE(removedRegion, Region(6, 16));
+
+  root.removeChildren(Region(6, 13));
+  root.addChildren(newNodes);
+  root.sortChildren();
+  QCOMPARE(format(tree.toRootNode()), format(root));
+  QCOMPARE(tree.segmentCount(), 5);
+}
+
+void ScopeTreeTest::findScopes() {
+  ScopeTree tree = ScopeTree::fromRootNode(createRootNode());
+
+  QVector<ScopeTree::Scope> path;
+  QVERIFY(tree.findScopes(Region(7, 8), path));
+  QCOMPARE(scopeName(path), QStringLiteral("source.test b b1 b11"));
+  QCOMPARE(path.last().region, Region(7, 9));
+  QVERIFY(tree.isLeaf(path.last()));
+
+  // a node with an empty name isn't a part of the scope name
+  path.clear();
+  QVERIFY(tree.findScopes(Region(10, 11), path));
+  QCOMPARE(scopeName(path), QStringLiteral("source.test b"));
+
+  // between nodes
+  path.clear();
+  QVERIFY(tree.findScopes(Region(15, 16), path));
+  QCOMPARE(scopeName(path), QStringLiteral("source.test"));
+  QVERIFY(!tree.isLeaf(path.last()));
+
+  // continue from the last scope
+  path.clear();
+  QVERIFY(tree.findScopes(Region(6, 7), path));
+  QCOMPARE(scopeName(path), QStringLiteral("source.test b b1"));
+  QVERIFY(tree.findScopes(Region(8, 9), path));
+  QCOMPARE(scopeName(path), QStringLiteral("source.test b b1 b11"));
+
+  path.clear();
+  QVERIFY(!tree.findScopes(Region(30, 31), path));
+}
+
+void ScopeTreeTest::scopeStacks() {
+  auto& atoms = ScopeAtoms::singleton();
+  auto& stacks = ScopeStacks::singleton();
+
+  int source = stacks.push(ScopeStacks::EMPTY, atoms.intern("source.test"));
+  int string = stacks.push(source, atoms.intern("string.quoted"));
+  QCOMPARE(stacks.scopeName(string), QStringLiteral("source.test string.quoted"));
+
+  // the same stack has the same id
+  QCOMPARE(stacks.push(source, atoms.intern("string.quoted")), string);
+  // an empty name doesn't change the stack
+  QCOMPARE(stacks.push(string, ScopeAtoms::EMPTY), string);
+  QVERIFY(stacks.push(string, atoms.intern("source.test")) != source);
+}
+
+}  // namespace core
+
+QTEST_MAIN(core::ScopeTreeTest)
+#include "ScopeTreeTest.moc"
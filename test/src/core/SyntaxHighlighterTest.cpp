@@ -146,6 +146,54 @@ class hoge {
     checkRegion(cppHighlighter.rootNode(), cppHighlighter.rootNode().region);
   }
 
+  void updateNodeInsideBlock() {
+    const QVector<QString> files(
+        {"testdata/grammers/C.tmLanguage", "testdata/grammers/C++.tmLanguage"});
+
+    foreach (QString fn, files) { QVERIFY(LanguageProvider::loadLanguage(fn)); }
+    QString text = QString(R"(
+namespace foo {
+class hoge {
+  void foo();
+  int bar;
+};
+}
+)").trimmed();
+    QTextDocument doc(text);
+    std::unique_ptr<LanguageParser> parser(LanguageParser::create("source.c++", doc.toPlainText()));
+    SyntaxHighlighter highlighter(&doc, std::move(parser), theme, font);
+    QSignalSpy spy(&highlighter, &SyntaxHighlighter::parseFinished);
+    QVERIFY(spy.wait());
+
+    // Edit a line inside class
+    QTextCursor cursor(&doc);
+    int pos = text.indexOf("int bar;");
+    cursor.setPosition(pos);
+    QString str = "unsigned ";
+    cursor.insertText(str);
+    highlighter.updateNode(pos, 0, str.length());
+    QVERIFY(spy.wait());
+    checkRegion(highlighter.rootNode(), highlighter.rootNode().region);
+
+    // The result must be the same as the full parse
+    QTextDocument expectedDoc(doc.toPlainText());
+    std::unique_ptr<LanguageParser> expectedParser(
+        LanguageParser::create("source.c++", expectedDoc.toPlainText()));
+    SyntaxHighlighter expectedHighlighter(&expectedDoc, std::move(expectedParser), theme, font);
+    QSignalSpy expectedSpy(&expectedHighlighter, &SyntaxHighlighter::parseFinished);
+    QVERIFY(expectedSpy.wait());
+    TestUtil::compareLineByLine(highlighter.rootNode().toString(doc.toPlainText()),
+                                expectedHighlighter.rootNode().toString(expectedDoc.toPlainText()));
+
+    // Open a comment which changes the end of class
+    pos = doc.toPlainText().indexOf("void");
+    cursor.setPosition(pos);
+    cursor.insertText("/*");
+    highlighter.updateNode(pos, 0, 2);
+    QVERIFY(spy.wait());
+    checkRegion(highlighter.rootNode(), highlighter.rootNode().region);
+  }
+
   void updateNodeWithPaste() {
     const QVector<QString> files({"testdata/grammers/CSS.plist"});
 
@@ -208,6 +208,80 @@ class TextEditLogicTest : public QObject {
         "\t";
     QCOMPARE(doc.toPlainText(), expectedText);
   }
+
+  void preservedCaseText() {
+    QCOMPARE(TextEditLogic::preservedCaseText("Hoge", "foobar"), QString("Foobar"));
+    QCOMPARE(TextEditLogic::preservedCaseText("HOGE", "foobar"), QString("FOOBAR"));
+    QCOMPARE(TextEditLogic::preservedCaseText("", "fooBar"), QString("fooBar"));
+  }
+
+  void replaceAll() {
+    const QString text = "foo bar foo\nbaz foo";
+    auto regexp = Regexp::compile("foo");
+    auto replacement =
+        TextEditLogic::replaceAll(text, regexp.get(), "hoge", 0, -1, false, false);
+    QVERIFY(replacement);
+    QCOMPARE(replacement->count, 3);
+    // from the first match to the last one
+    QCOMPARE(replacement->region, Region(0, text.size()));
+    QCOMPARE(replacement->text, QString("hoge bar hoge\nbaz hoge"));
+
+    // only in [begin, end)
+    replacement = TextEditLogic::replaceAll(text, regexp.get(), "hoge", 1, 12, false, false);
+    QVERIFY(replacement);
+    QCOMPARE(replacement->count, 1);
+    QCOMPARE(replacement->region, Region(8, 11));
+    QCOMPARE(replacement->text, QString("hoge"));
+
+    QVERIFY(!TextEditLogic::replaceAll(text, Regexp::compile("qux").get(), "hoge", 0, -1, false,
+                                       false));
+  }
+
+  void replaceAllWithGroups() {
+    const QString text = "key1=Value1, key2=value2";
+    auto regexp = Regexp::compile("(\\w+)=(\\w+)");
+    auto replacement =
+        TextEditLogic::replaceAll(text, regexp.get(), "$2:\\1$$", 0, -1, true, false);
+    QVERIFY(replacement);
+    QCOMPARE(replacement->count, 2);
+    QCOMPARE(replacement->text, QString("Value1:key1$, value2:key2$"));
+
+    // groups aren't expanded in a literal replacement
+    replacement = TextEditLogic::replaceAll(text, regexp.get(), "$2", 0, -1, false, false);
+    QVERIFY(replacement);
+    QCOMPARE(replacement->text, QString("$2, $2"));
+
+    // preserve the case of each match
+    regexp = Regexp::compile("(?i)hoge");
+    replacement =
+        TextEditLogic::replaceAll("Hoge hoge HOGE", regexp.get(), "foo", 0, -1, false, true);
+    QVERIFY(replacement);
+    QCOMPARE(replacement->text, QString("Foo foo FOO"));
+  }
+
+  void replaceMatch() {
+    const QString text = "key1=Value1, key2=value2";
+    auto regexp = Regexp::compile("(\\w+)=(\\w+)");
+    // groups are expanded in the same way as replaceAll
+    auto replacement =
+        TextEditLogic::replaceMatch(text, regexp.get(), "$2:\\1$$", 13, 24, true, false);
+    QVERIFY(replacement);
+    QCOMPARE(*replacement, QString("value2:key2$"));
+    replacement = TextEditLogic::replaceMatch(text, regexp.get(), "$2", 13, 24, false, false);
+    QVERIFY(replacement);
+    QCOMPARE(*replacement, QString("$2"));
+
+    // the region isn't a match
+    QVERIFY(!TextEditLogic::replaceMatch(text, regexp.get(), "$2", 12, 24, true, false));
+    QVERIFY(!TextEditLogic::replaceMatch(text, regexp.get(), "$2", 0, 4, true, false));
+
+    // lookarounds see the text around the region
+    regexp = Regexp::compile("(?<=, )(\\w+=\\w+)");
+    QVERIFY(!TextEditLogic::replaceMatch(text, regexp.get(), "[$1]", 0, 11, true, false));
+    replacement = TextEditLogic::replaceMatch(text, regexp.get(), "[$1]", 13, 24, true, false);
+    QVERIFY(replacement);
+    QCOMPARE(*replacement, QString("[key2=value2]"));
+  }
 };
 
 }  // namespace core
@@ -2,9 +2,25 @@
 #include <QtTest/QtTest>
 
 #include "Theme.h"
+#include "ScopeAtoms.h"
+#include "PListParser.h"
+#include "ScopeSelector.h"
 
 namespace core {
 
+namespace {
+
+// Compares the #RRGGBB colors in settings of a tmTheme with colors
+void compareColors(const ColorSettings& colors, const QVariantMap& settings) {
+  for (auto it = settings.constBegin(); it != settings.constEnd(); ++it) {
+    const QString code = it.value().toString();
+    if (code.length() == 7 && QColor(code).isValid()) {
+      QCOMPARE(colors.value(it.key()), QColor(code));
+    }
+  }
+}
+}
+
 class ThemeTest : public QObject {
   Q_OBJECT
  private slots:
@@ -86,6 +102,19 @@ class ThemeTest : public QObject {
     QCOMPARE(format->foreground().color(), QColor("#AE81FF"));
   }
 
+  void getFormatByStack() {
+    Theme* theme = Theme::loadTheme("testdata/Monokai.tmTheme");
+    auto& atoms = ScopeAtoms::singleton();
+    auto& stacks = ScopeStacks::singleton();
+    int stack = stacks.push(ScopeStacks::EMPTY, atoms.intern("text.xml"));
+    stack = stacks.push(stack, atoms.intern("entity.name.tag.localname.xml"));
+
+    auto format = theme->getFormat(stack);
+    QVERIFY(format);
+    QCOMPARE(format, theme->getFormat("text.xml entity.name.tag.localname.xml"));
+    QCOMPARE(format->foreground().color(), QColor("#F92672"));
+  }
+
   void skipEmptySettings() {
     //  <dict>
     //    <key>name</key>
@@ -116,68 +145,42 @@ class ThemeTest : public QObject {
     QCOMPARE(format->foreground().color(), QColor("#BB3700"));
   }
 
-  //  The winner is the scope selector which (in order of precedence):
-  //  1. Match the element deepest down in the scope e.g. string wins over source.php when the scope
-  //  is
-  //  source.php string.quoted.
-  //  2. Match most of the deepest element e.g. string.quoted wins over string.
-  //  3. Rules 1 and 2 applied again to the scope selector when removing the deepest element (in the
-  //  case of a tie), e.g. text source string wins over source string.
-  //  http://manual.macromates.com/en/scope_selectors
-  void rank() {
-    //    int score = Theme::rank("variable.parameter", "variable.parameter.preprocessor.c");
-    Rank rank("source.php", "source.php string.quoted");
-    Rank rank2("string", "source.php string.quoted");
-    Rank rank3("string.quoted", "source.php string.quoted");
-    Rank rank4("source.php string", "source.php string.quoted");
-    QVERIFY(rank2 > rank);
-    QVERIFY(rank3 > rank2);
-    QVERIFY(rank4 > rank);
-    QVERIFY(rank4 > rank2);
-    QVERIFY(rank4 < rank3);
-
-    Rank rank10("text source string", "text source string");
-    Rank rank11("text source", "text source string");
-    Rank rank12("text", "text source string");
-    QVERIFY(rank11 < rank10);
-    QVERIFY(rank12 < rank11);
-    QVERIFY(rank12 < rank10);
-
-    Rank rank13("meta.property-value.css constant.numeric.css",
-                "source.css meta.property-list.css meta.property-value.css constant.numeric.css "
-                "keyword.other.unit.css");
-    QVERIFY(!rank13.isInvalid());
-
-    Rank rankInvalid("php", "source.php string.quoted");
-    QVERIFY(rankInvalid.isInvalid());
-
-    Rank rankInvalid2("text string", "text source string");
-    QVERIFY(rankInvalid2.isInvalid());
-
-    Rank rankInvalid3("string.quoted.foo", "source.php string.quoted");
-    QVERIFY(rankInvalid3.isInvalid());
-
-    Rank rankInvalid4("string.foo", "source.php string.quoted");
-    QVERIFY(rankInvalid4.isInvalid());
-
-    /*
-     in Espresso Libre
-     <key>name</key>
-     <string>Embedded source</string>
-     <key>scope</key>
-     <string>text source, string.unquoted</string>
-
-     this shouldn't match with source.c++
-     */
-    Rank rankInvalid5("text source", "source.c++ hoge");
-    QVERIFY(rankInvalid5.isInvalid());
-
-    // empty selector matches any scope but with the lowest rank
-    Rank rankEmpty("", "source.php string.quoted");
-    QVERIFY(rankEmpty.isEmpty());
-
-    Rank rankValid("entity.name.tag", "entity.name.tag.localname.xml");
-    QVERIFY(rankValid.isValid());
+  // A theme built from the events of its file has the names, the selectors and the settings in the
+  // QVariantMap of the file
+  void sameAsVariantMap() {
+    QDir dir("../resources/themes");
+    const QStringList names = dir.entryList({"*.tmTheme"}, QDir::Files);
+    QVERIFY(!names.isEmpty());
+    for (const auto& name : names) {
+      const QString path = dir.filePath(name);
+      std::unique_ptr<Theme> theme(Theme::loadTheme(path));
+      QVERIFY2(theme, qPrintable(path));
+      QFile file(path);
+      QVERIFY(file.open(QIODevice::ReadOnly));
+      const QVariantMap root = PListParser::parsePList(&file).toMap();
+
+      QCOMPARE(theme->name, root["name"].toString());
+      const QVariantList settings = root["settings"].toList();
+      QCOMPARE(theme->scopeSettings.size(), settings.size());
+      for (int i = 0; i < settings.size(); i++) {
+        const QVariantMap setting = settings[i].toMap();
+        const ScopeSetting* scopeSetting = theme->scopeSettings[i];
+        QVERIFY2(scopeSetting, qPrintable(path));
+        QCOMPARE(scopeSetting->name, setting["name"].toString());
+        if (setting.contains("scope")) {
+          QCOMPARE(scopeSetting->scopeSelectors,
+                   ScopeSelectorMatcher::splitGroups(setting["scope"].toString()));
+        }
+        if (setting.contains("settings")) {
+          QVERIFY2(scopeSetting->colorSettings, qPrintable(path));
+          compareColors(*scopeSetting->colorSettings, setting["settings"].toMap());
+        }
+      }
+      if (root.contains("gutterSettings")) {
+        compareColors(*theme->gutterSettings, root["gutterSettings"].toMap());
+      }
+      qDeleteAll(theme->scopeSettings);
+    }
   }
 };
 
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QDateTime>
+#include <QDomDocument>
+#include <QDomElement>
+#include <QDomNode>
+#include <QVariant>
+
+#include "core/macros.h"
+
+// The former QDomDocument based PListParser. Tests compare PListParser with it.
+class DomPListParser {
+  DISABLE_COPY_AND_MOVE(DomPListParser)
+
+ public:
+  static QVariant parsePList(QIODevice* device) {
+    QVariantMap result;
+    QDomDocument doc;
+    if (!doc.setContent(device, false)) {
+      return result;
+    }
+    QDomElement root = doc.documentElement();
+    return parseElement(root.firstChild().toElement());
+  }
+
+ private:
+  DomPListParser() = delete;
+  ~DomPListParser() = delete;
+
+  static QVariant parseElement(const QDomElement& e) {
+    QString tagName = e.tagName();
+    QVariant result;
+    if (tagName == QLatin1String("dict")) {
+      result = parseDictElement(e);
+    } else if (tagName == QLatin1String("array")) {
+      result = parseArrayElement(e);
+    } else if (tagName == QLatin1String("string")) {
+      result = e.text();
+    } else if (tagName == QLatin1String("data")) {
+      result = QByteArray::fromBase64(e.text().toUtf8());
+    } else if (tagName == QLatin1String("integer")) {
+      result = e.text().toInt();
+    } else if (tagName == QLatin1String("real")) {
+      result = e.text().toFloat();
+    } else if (tagName == QLatin1String("true")) {
+      result = true;
+    } else if (tagName == QLatin1String("false")) {
+      result = false;
+    } else if (tagName == QLatin1String("date")) {
+      result = QDateTime::fromString(e.text(), Qt::ISODate);
+    }
+    return result;
+  }
+
+  static QVariantList parseArrayElement(const QDomElement& element) {
+    QVariantList result;
+    QDomNodeList children = element.childNodes();
+    for (int i = 0; i < children.count(); i++) {
+      QDomElement e = children.at(i).toElement();
+      if (!e.isNull()) {
+        result.append(parseElement(e));
+      }
+    }
+    return result;
+  }
+
+  static QVariantMap parseDictElement(const QDomElement& element) {
+    QVariantMap result;
+    QDomNodeList children = element.childNodes();
+    QString currentKey;
+    for (int i = 0; i < children.count(); i++) {
+      QDomElement e = children.at(i).toElement();
+      if (!e.isNull()) {
+        if (e.tagName() == QLatin1String("key")) {
+          currentKey = e.text();
+        } else if (!currentKey.isEmpty()) {
+          result[currentKey] = parseElement(e);
+        }
+      }
+    }
+    return result;
+  }
+};
@@ -18,12 +18,12 @@
 #include "Helper.h"
 #include "core/ObjectStore.h"
 #include "core/Constants.h"
-#include "core/SyntaxHighlighter.h"
+#include "core/ParseScheduler.h"
 #include "core/Util.h"
 
 using core::Constants;
 using core::ObjectStore;
-using core::SyntaxHighlighterThread;
+using core::ParseScheduler;
 using core::Util;
 
 App* App::s_app = nullptr;
@@ -191,7 +191,7 @@ void App::cleanup() {
   // emit destroyed signal to JS side before shutting down Node
   ObjectStore::clearAssociatedJSObjects();
 
-  SyntaxHighlighterThread::singleton().quit();
+  ParseScheduler::singleton().quit();
 
   Helper::singleton().cleanup();
 
@@ -78,6 +78,12 @@ bool DocumentManager::save(Document* doc, bool beforeClose) {
     return false;
   }
 
+  // Saving a partially loaded document would truncate the file
+  if (doc->isLoading()) {
+    qWarning("%s is still loading", qPrintable(doc->path()));
+    return false;
+  }
+
   if (doc->path().isEmpty()) {
     QString newFilePath = saveAs(doc, beforeClose);
     return !newFilePath.isEmpty();
@@ -127,6 +133,11 @@ bool DocumentManager::save(Document* doc, bool beforeClose) {
 }
 
 QString DocumentManager::saveAs(Document* doc, bool beforeClose) {
+  if (doc->isLoading()) {
+    qWarning("%s is still loading", qPrintable(doc->path()));
+    return QString();
+  }
+
   QString filePath =
       QFileDialog::getSaveFileName(nullptr, QObject::tr("Save As"), doc->path(), QString());
   if (!filePath.isEmpty()) {
@@ -193,6 +204,18 @@ std::shared_ptr<core::Document> DocumentManager::create(const QString& path) {
   return registerDoc(doc);
 }
 
+QHash<QString, QString> DocumentManager::modifiedDocumentTexts() {
+  QHash<QString, QString> texts;
+  for (auto it = m_pathDocHash.constBegin(); it != m_pathDocHash.constEnd(); ++it) {
+    // A document which is still loading is incomplete, so its file is read instead
+    auto doc = it.value().lock();
+    if (doc && doc->isModified() && !doc->isLoading()) {
+      texts.insert(it.key(), doc->toPlainText());
+    }
+  }
+  return texts;
+}
+
 std::shared_ptr<core::Document> DocumentManager::getOrCreate(QSettings& settings) {
   auto doc = Document::create(settings);
   if (!doc) {
@@ -30,6 +30,8 @@ class DocumentManager : public QObject, public core::Singleton<DocumentManager>
   // may throw a runtime_error
   std::shared_ptr<core::Document> getOrCreate(QSettings& settings);
   std::shared_ptr<core::Document> find(const QString& objectName);
+  // Returns the texts of the modified documents by their paths
+  QHash<QString, QString> modifiedDocumentTexts();
 
  public slots:
   int open(const QString& filename);
@@ -0,0 +1,189 @@
+#include <QDir>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QTextBlock>
+#include <QVBoxLayout>
+
+#include "FindInFilesView.h"
+#include "App.h"
+#include "DocumentManager.h"
+#include "TabView.h"
+#include "TextEdit.h"
+#include "Window.h"
+#include "core/Config.h"
+
+using core::Config;
+using core::Document;
+using core::FileMatch;
+using core::FileSearcher;
+using core::IgnorePatterns;
+
+namespace {
+const char* FIND_IN_FILES_TEXT = QT_TRANSLATE_NOOP("FindInFilesView", "Find in Files");
+const char* MATCH_CASE_TEXT = QT_TRANSLATE_NOOP("FindInFilesView", "Match Case");
+const char* REGEX_TEXT = QT_TRANSLATE_NOOP("FindInFilesView", "Regex");
+const char* WHOLE_WORD_TEXT = QT_TRANSLATE_NOOP("FindInFilesView", "Whole Word");
+
+// data roles of a match item
+const int PATH_ROLE = Qt::UserRole;
+const int LINE_ROLE = Qt::UserRole + 1;
+const int COLUMN_ROLE = Qt::UserRole + 2;
+const int LENGTH_ROLE = Qt::UserRole + 3;
+}
+
+FindInFilesView::FindInFilesView(QWidget* parent)
+    : CustomWidget(parent),
+      m_lineEdit(new QLineEdit(this)),
+      m_matchCaseChk(new QCheckBox(tr(MATCH_CASE_TEXT), this)),
+      m_regexChk(new QCheckBox(tr(REGEX_TEXT), this)),
+      m_wholeWordChk(new QCheckBox(tr(WHOLE_WORD_TEXT), this)),
+      m_statusLabel(new QLabel(this)),
+      m_resultTree(new QTreeWidget(this)),
+      m_searcher(new FileSearcher(this)) {
+  m_lineEdit->setAttribute(Qt::WA_MacShowFocusRect, 0);
+  m_lineEdit->setPlaceholderText(tr(FIND_IN_FILES_TEXT));
+  m_resultTree->setHeaderHidden(true);
+  m_resultTree->setUniformRowHeights(true);
+  m_resultTree->header()->setSectionResizeMode(QHeaderView::ResizeToContents);
+
+  QHBoxLayout* inputLayout = new QHBoxLayout;
+  inputLayout->setContentsMargins(0, 0, 0, 0);
+  inputLayout->addWidget(m_lineEdit);
+  inputLayout->addWidget(m_matchCaseChk);
+  inputLayout->addWidget(m_regexChk);
+  inputLayout->addWidget(m_wholeWordChk);
+  inputLayout->addWidget(m_statusLabel);
+
+  QVBoxLayout* layout = new QVBoxLayout(this);
+  layout->setContentsMargins(3, 1, 0, 0);
+  layout->setSpacing(0);
+  layout->addLayout(inputLayout);
+  layout->addWidget(m_resultTree);
+  setLayout(layout);
+
+  connect(m_lineEdit, &QLineEdit::returnPressed, this, &FindInFilesView::find);
+  connect(m_resultTree, &QTreeWidget::itemActivated, this, &FindInFilesView::openMatch);
+  connect(m_searcher, &FileSearcher::matchesFound, this, &FindInFilesView::addMatches);
+  connect(m_searcher, &FileSearcher::finished, this, &FindInFilesView::showResult);
+}
+
+void FindInFilesView::show() {
+  QWidget::show();
+  if (auto textEdit = App::instance()->activeTextEdit()) {
+    const QString selectedText = textEdit->textCursor().selectedText();
+    if (!selectedText.isEmpty() && !selectedText.contains(QChar::ParagraphSeparator)) {
+      m_lineEdit->setText(selectedText);
+    }
+  }
+  m_lineEdit->setFocus();
+  m_lineEdit->selectAll();
+}
+
+void FindInFilesView::hide() {
+  cancel();
+  QWidget::hide();
+  if (auto textEdit = App::instance()->activeTextEdit()) {
+    textEdit->setFocus();
+  }
+}
+
+void FindInFilesView::find() {
+  m_resultTree->clear();
+  auto win = qobject_cast<Window*>(window());
+  m_dirPath = win ? win->projectDirPath() : QString();
+  if (m_dirPath.isEmpty()) {
+    m_statusLabel->setText(tr("Open a folder to find in files"));
+    return;
+  }
+
+  Document::FindFlags flags;
+  if (m_matchCaseChk->isChecked()) {
+    flags |= Document::FindFlag::FindCaseSensitively;
+  }
+  if (m_regexChk->isChecked()) {
+    flags |= Document::FindFlag::FindRegex;
+  }
+  if (m_wholeWordChk->isChecked()) {
+    flags |= Document::FindFlag::FindWholeWords;
+  }
+
+  IgnorePatterns ignorePatterns;
+  for (const auto& pattern : Config::singleton().findInFilesExcludePatterns()) {
+    ignorePatterns.add(pattern);
+  }
+  ignorePatterns.addGitignore(m_dirPath);
+
+  // Modified documents are searched as they are shown instead of their files
+  if (m_searcher->find(m_dirPath, m_lineEdit->text(), flags, ignorePatterns,
+                       DocumentManager::singleton().modifiedDocumentTexts())) {
+    m_statusLabel->setText(tr("Searching..."));
+  } else {
+    m_statusLabel->setText(m_lineEdit->text().isEmpty() ? QString() : tr("Invalid pattern"));
+  }
+}
+
+void FindInFilesView::cancel() {
+  if (m_searcher->isRunning()) {
+    m_searcher->cancel();
+    m_statusLabel->setText(tr("Canceled"));
+  }
+}
+
+void FindInFilesView::addMatches(const QString& path, QVector<FileMatch> matches) {
+  QTreeWidgetItem* fileItem = new QTreeWidgetItem(m_resultTree);
+  const QString relativePath = QDir(m_dirPath).relativeFilePath(path);
+  fileItem->setText(0, QStringLiteral("%1 (%2)").arg(QDir::toNativeSeparators(relativePath),
+                                                     QString::number(matches.size())));
+  fileItem->setData(0, PATH_ROLE, path);
+  fileItem->setData(0, LINE_ROLE, matches.first().line);
+  fileItem->setData(0, COLUMN_ROLE, matches.first().column);
+  fileItem->setData(0, LENGTH_ROLE, matches.first().length);
+
+  for (const auto& match : matches) {
+    QTreeWidgetItem* item = new QTreeWidgetItem(fileItem);
+    item->setText(0, QStringLiteral("%1: %2").arg(QString::number(match.line + 1),
+                                                  match.lineText.trimmed()));
+    item->setData(0, PATH_ROLE, path);
+    item->setData(0, LINE_ROLE, match.line);
+    item->setData(0, COLUMN_ROLE, match.column);
+    item->setData(0, LENGTH_ROLE, match.length);
+  }
+  fileItem->setExpanded(true);
+}
+
+void FindInFilesView::showResult(int fileCount, int matchCount) {
+  m_statusLabel->setText(tr("%1 matches in %2 files (%3 files searched)")
+                             .arg(matchCount)
+                             .arg(m_resultTree->topLevelItemCount())
+                             .arg(fileCount));
+}
+
+void FindInFilesView::openMatch(QTreeWidgetItem* item) {
+  TabView* tabView = App::instance()->getActiveTabViewOrCreate();
+  if (!tabView) {
+    qWarning("active tab view is null");
+    return;
+  }
+
+  const int index = tabView->open(item->data(0, PATH_ROLE).toString());
+  auto textEdit = qobject_cast<TextEdit*>(tabView->widget(index));
+  if (!textEdit || !textEdit->document()) {
+    return;
+  }
+
+  const int line = item->data(0, LINE_ROLE).toInt();
+  const QTextBlock block = textEdit->document()->findBlockByNumber(line);
+  if (!block.isValid()) {
+    return;
+  }
+  // The document may have been changed after the find
+  const int blockEnd = block.position() + block.length() - 1;
+  const int begin = qMin(block.position() + item->data(0, COLUMN_ROLE).toInt(), blockEnd);
+  QTextCursor cursor(block);
+  cursor.setPosition(begin);
+  cursor.setPosition(qMin(begin + item->data(0, LENGTH_ROLE).toInt(), blockEnd),
+                     QTextCursor::KeepAnchor);
+  textEdit->setTextCursor(cursor);
+  textEdit->centerCursor();
+  textEdit->setFocus();
+}
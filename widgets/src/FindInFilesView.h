@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QCheckBox>
+#include <QLabel>
+#include <QLineEdit>
+#include <QTreeWidget>
+
+#include "CustomWidget.h"
+#include "core/macros.h"
+#include "core/FileSearcher.h"
+
+// Finds a text in the files of the project opened in the window and shows the matches grouped by
+// file. Matches are added as soon as each file is searched, and activating one opens it.
+class FindInFilesView : public CustomWidget {
+  Q_OBJECT
+  DISABLE_COPY(FindInFilesView)
+
+ public:
+  explicit FindInFilesView(QWidget* parent);
+  ~FindInFilesView() = default;
+  DEFAULT_MOVE(FindInFilesView)
+
+ public slots:
+  void show();
+  void hide();
+  // Starts finding the text in the line edit. The running find is canceled.
+  void find();
+  void cancel();
+
+ private:
+  QLineEdit* m_lineEdit;
+  QCheckBox* m_matchCaseChk;
+  QCheckBox* m_regexChk;
+  QCheckBox* m_wholeWordChk;
+  QLabel* m_statusLabel;
+  QTreeWidget* m_resultTree;
+  core::FileSearcher* m_searcher;
+  QString m_dirPath;
+
+  void addMatches(const QString& path, QVector<core::FileMatch> matches);
+  void showResult(int fileCount, int matchCount);
+  void openMatch(QTreeWidgetItem* item);
+};
+
+Q_DECLARE_METATYPE(FindInFilesView*)
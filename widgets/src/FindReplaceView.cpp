@@ -63,15 +63,8 @@ FindReplaceView::FindReplaceView(QWidget* parent)
   connect(ui->lineEditForFind, &LineEdit::returnPressed, this, &FindReplaceView::findNext);
   connect(ui->lineEditForFind, &LineEdit::shiftReturnPressed, this, &FindReplaceView::findPrevious);
   connect(ui->lineEditForFind, &LineEdit::textChanged, this, [=](const QString&) {
-    int result = highlightMatches();
+    highlightMatches();
     selectFirstMatch();
-    QPalette palette;
-    if (!ui->lineEditForFind->text().isEmpty() && result == 0) {
-      palette.setColor(QPalette::Text, Qt::red);
-    } else {
-      palette.setColor(QPalette::Text, Qt::black);
-    }
-    ui->lineEditForFind->setPalette(palette);
   });
   connect(ui->lineEditForFind, &LineEdit::focusIn, this, [=] {
     updateActiveCursorPos();
@@ -259,9 +252,7 @@ void FindReplaceView::findText(const QString& text, Document::FindFlags flags) {
   findText(text, -1, flags);
 }
 
-int FindReplaceView::highlightMatches() {
-  int result = 0;
-
+void FindReplaceView::highlightMatches() {
   if (TextEdit* textEdit = qobject_cast<TextEdit*>(m_activeView)) {
     int begin = 0, end = -1;
     if (ui->inSelectionChk->isChecked()) {
@@ -269,21 +260,38 @@ int FindReplaceView::highlightMatches() {
       end = m_selectionEndPos;
     }
 
-    result =
-        textEdit->highlightSearchMatches(ui->lineEditForFind->text(), begin, end, getFindFlags());
+    textEdit->highlightSearchMatches(ui->lineEditForFind->text(), begin, end, getFindFlags());
+  }
+}
+
+void FindReplaceView::updateMatchCount(int count, bool isFinished) {
+  if (ui->lineEditForFind->text().isEmpty()) {
+    ui->matchCountLabel->clear();
+  } else if (isFinished) {
+    ui->matchCountLabel->setText(tr("%1 matches").arg(count));
+  } else {
+    // more matches may be found
+    ui->matchCountLabel->setText(tr("%1+ matches").arg(count));
   }
 
-  return result;
+  QPalette palette;
+  if (!ui->lineEditForFind->text().isEmpty() && isFinished && count == 0) {
+    palette.setColor(QPalette::Text, Qt::red);
+  } else {
+    palette.setColor(QPalette::Text, Qt::black);
+  }
+  ui->lineEditForFind->setPalette(palette);
 }
 
 void FindReplaceView::setActiveView(QWidget* view) {
-  if (m_connectionForContentsChanged) {
-    QObject::disconnect(m_connectionForContentsChanged);
-  }
   if (m_connectionForCursorPositionChanged) {
     QObject::disconnect(m_connectionForCursorPositionChanged);
   }
+  if (m_connectionForSearchMatchCountChanged) {
+    QObject::disconnect(m_connectionForSearchMatchCountChanged);
+  }
   clearSearchHighlight();
+  updateMatchCount(0, true);
 
   m_activeView = view;
 
@@ -291,22 +299,13 @@ void FindReplaceView::setActiveView(QWidget* view) {
   if (newTextEdit) {
     qDebug() << "new TextEdit:" << newTextEdit->document()->path();
 
-    int begin = 0, end = -1;
-    if (ui->inSelectionChk->isChecked()) {
-      begin = m_selectionStartPos;
-      end = m_selectionEndPos;
-    }
-    m_connectionForContentsChanged =
-        connect(newTextEdit->document(), &core::Document::contentsChanged, newTextEdit, [=] {
-          if (newTextEdit->isSearchMatchesHighlighted()) {
-            newTextEdit->highlightSearchMatches(ui->lineEditForFind->text(), begin, end,
-                                                getFindFlags());
-          }
-        }, Qt::UniqueConnection);
-
     m_connectionForCursorPositionChanged =
         connect(newTextEdit, &TextEdit::cursorPositionChanged, newTextEdit,
                 [=] { m_selectedRegion = boost::none; }, Qt::UniqueConnection);
+
+    m_connectionForSearchMatchCountChanged =
+        connect(newTextEdit, &TextEdit::searchMatchCountChanged, this,
+                &FindReplaceView::updateMatchCount, Qt::UniqueConnection);
   }
 
   if (isVisible()) {
@@ -364,7 +363,8 @@ void FindReplaceView::selectFirstMatch() {
 void FindReplaceView::replace() {
   Q_ASSERT(ui->lineEditForReplace);
   if (auto textEdit = qobject_cast<TextEdit*>(m_activeView)) {
-    textEdit->replaceSelection(ui->lineEditForReplace->text(), ui->preserveCaseChk->isChecked());
+    textEdit->replaceSelection(ui->lineEditForFind->text(), ui->lineEditForReplace->text(),
+                               getFindFlags(), ui->preserveCaseChk->isChecked());
     highlightMatches();
     m_replaceHistoryModel.prepend(ui->lineEditForReplace->text());
   }
@@ -30,7 +30,8 @@ class FindReplaceView : public CustomWidget {
   ~FindReplaceView();
   DEFAULT_MOVE(FindReplaceView)
 
-  int highlightMatches();
+  // Highlights matches in the active view. They are found in the background.
+  void highlightMatches();
   void setActiveView(QWidget* view);
 
  public slots:
@@ -58,8 +59,8 @@ class FindReplaceView : public CustomWidget {
   core::HistoryModel m_searchHistoryModel;
   core::HistoryModel m_replaceHistoryModel;
   QWidget* m_activeView;
-  QMetaObject::Connection m_connectionForContentsChanged;
   QMetaObject::Connection m_connectionForCursorPositionChanged;
+  QMetaObject::Connection m_connectionForSearchMatchCountChanged;
 
   void findFromActiveCursor();
   void findText(const QString& text, int searchStartPos, core::Document::FindFlags flags = 0);
@@ -69,6 +70,7 @@ class FindReplaceView : public CustomWidget {
   void updateSelectionRegion();
   void updateActiveCursorPos();
   void selectFirstMatch();
+  void updateMatchCount(int count, bool isFinished);
   void replace();
   void replaceAll();
 
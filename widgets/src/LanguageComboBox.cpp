@@ -8,12 +8,8 @@ LanguageComboBox::LanguageComboBox(QWidget* parent) : ComboBox(parent) {
   std::sort(pairs.begin(), pairs.end(), [](QPair<QString, QString> x, QPair<QString, QString> y) {
     return x.second < y.second;
   });
-  foreach (const auto& pair, pairs) {
-    auto lang = LanguageProvider::languageFromScope(pair.first);
-    if (lang && !lang->hideFromUser) {
-      addItem(pair.second, pair.first);
-    }
-  }
+  // The languages aren't loaded here. Hidden ones are excluded by scopeAndLangNamePairs
+  foreach (const auto& pair, pairs) { addItem(pair.second, pair.first); }
   // resize is needed because currentIndexChanged isn't fired for the first time
   resize(currentIndex());
 }
@@ -9,6 +9,7 @@
 #include "Console.h"
 #include "TextEdit.h"
 #include "FindReplaceView.h"
+#include "FindInFilesView.h"
 #include "WebPage.h"
 #include "WebChannel.h"
 #include "core/Condition.h"
@@ -46,6 +47,7 @@ void MetaTypeInitializer::init() {
   qRegisterMetaType<QEvent*>();
   qRegisterMetaType<QEvent::Type>("QEvent::Type");
   qRegisterMetaType<FindReplaceView*>();
+  qRegisterMetaType<FindInFilesView*>();
   qRegisterMetaType<QtMsgType>();
   qRegisterMetaType<const QValidator*>();  // for LineEdit::setValidator(const QValidator*)
   qRegisterMetaType<WebChannel*>();
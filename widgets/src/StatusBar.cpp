@@ -244,3 +244,11 @@ void StatusBar::setLineSeparator(const QString& separator) {
 void StatusBar::setBOM(const BOM& bom) {
   m_bomComboBox->setCurrentBOM(bom);
 }
+
+void StatusBar::setLoadProgress(int percent) {
+  if (percent < 100) {
+    showMessage(tr("Loading... %1%").arg(percent));
+  } else {
+    clearMessage();
+  }
+}
@@ -31,6 +31,7 @@ class StatusBar : public QStatusBar{
   void setEncoding(const core::Encoding& encoding);
   void setLineSeparator(const QString& separator);
   void setBOM(const core::BOM& bom);
+  void setLoadProgress(int percent);
   void setActiveTextEditLanguage();
   void setActiveTextEditEncoding();
   void setActiveTextEditLineSeparator();
@@ -20,6 +20,7 @@
 #include "core/Constants.h"
 #include "core/BOM.h"
 #include "core/Region.h"
+#include "core/MatchFinder.h"
 #include "core/Util.h"
 #include "core/TextCursor.h"
 #include "core/scoped_guard.h"
@@ -34,6 +35,7 @@ using core::TextEditLogic;
 using core::Theme;
 using core::ColorSettings;
 using core::Regexp;
+using core::MatchFinder;
 using core::Constants;
 using core::BOM;
 using core::Region;
@@ -43,34 +45,14 @@ using core::scoped_guard;
 
 namespace {
 const QString DEFAULT_SCOPE = "text.plain";
-
-QString preservedCaseText(const QString& oldStr, const QString& newStr) {
-  if (oldStr.isEmpty()) {
-    return newStr;
-  }
-
-  QString resultStr;
-  int oldStrIndex;
-  for (int i = 0; i < newStr.size(); i++) {
-    if (i > oldStr.size() - 1) {
-      oldStrIndex = oldStr.size() - 1;
-    } else {
-      oldStrIndex = i;
-    }
-
-    if (oldStr[oldStrIndex].isUpper()) {
-      resultStr = resultStr + newStr[i].toUpper();
-    } else {
-      resultStr = resultStr + newStr[i].toLower();
-    }
-  }
-
-  return resultStr;
-}
+// After an edit, search matches are found again in the edited lines with the text this long before
+// them for lookbehinds and after them for long matches
+const int SEARCH_CONTEXT_LENGTH = 1024;
+const int SEARCH_LOOKAHEAD_LENGTH = 16 * 1024;
 
 void insertText(QTextCursor& cursor, const QString& text, bool preserveCase) {
   if (preserveCase) {
-    cursor.insertText(preservedCaseText(cursor.selectedText(), text));
+    cursor.insertText(TextEditLogic::preservedCaseText(cursor.selectedText(), text));
   } else {
     cursor.insertText(text);
   }
@@ -203,19 +185,38 @@ void TextEditPrivate::setupConnections(std::shared_ptr<core::Document> document)
     QObject::disconnect(m_document.get(), &Document::lineSeparatorChanged, q,
                         &TextEdit::lineSeparatorChanged);
     QObject::disconnect(m_document.get(), &Document::bomChanged, q, &TextEdit::bomChanged);
+    QObject::disconnect(m_document.get(), &Document::loadProgressed, q,
+                        &TextEdit::loadProgressed);
+    QObject::disconnect(m_document.get(), &Document::loadFinished, q, nullptr);
     QObject::disconnect(m_document.get(), SIGNAL(contentsChanged()), q,
                         SLOT(outdentCurrentLineIfNecessary()));
+    QObject::disconnect(m_document.get(), SIGNAL(contentsChange(int, int, int)), q,
+                        SLOT(updateSearchMatches(int, int, int)));
+    if (m_isVisible) {
+      m_document->removeVisibleView();
+    }
   }
 
   m_document = document;
+  m_visibleRegion = Region();
+  if (m_document && m_isVisible) {
+    m_document->addVisibleView();
+  }
   QObject::connect(m_document.get(), &Document::pathUpdated, q, &TextEdit::pathUpdated);
   QObject::connect(m_document.get(), &Document::languageChanged, q, &TextEdit::languageChanged);
   QObject::connect(m_document.get(), &Document::encodingChanged, q, &TextEdit::encodingChanged);
   QObject::connect(m_document.get(), &Document::lineSeparatorChanged, q,
                    &TextEdit::lineSeparatorChanged);
   QObject::connect(m_document.get(), &Document::bomChanged, q, &TextEdit::bomChanged);
+  QObject::connect(m_document.get(), &Document::loadProgressed, q, &TextEdit::loadProgressed);
+  // Editing is disabled until a large file is loaded
+  setLockedForLoading(m_document->isLoading());
+  QObject::connect(m_document.get(), &Document::loadFinished, q,
+                   [this] { setLockedForLoading(false); });
   QObject::connect(m_document.get(), SIGNAL(contentsChanged()), q,
                    SLOT(outdentCurrentLineIfNecessary()));
+  QObject::connect(m_document.get(), SIGNAL(contentsChange(int, int, int)), q,
+                   SLOT(updateSearchMatches(int, int, int)));
 }
 
 boost::optional<Region> TextEditPrivate::find(const QString& text,
@@ -292,7 +293,136 @@ void TextEditPrivate::outdentOneLevel(QTextCursor& currentVisibleCursor) {
  * @brief Outdent one level
  * @param currentVisibleCursor
  */
-TextEditPrivate::TextEditPrivate(TextEdit* textEdit) : q_ptr(textEdit), m_document(nullptr) {}
+TextEditPrivate::TextEditPrivate(TextEdit* textEdit)
+    : q_ptr(textEdit),
+      m_document(nullptr),
+      m_matchFinder(nullptr),
+      m_searchBegin(0),
+      m_searchEnd(-1),
+      m_searchRevision(-1),
+      m_hasStaleSearchMatches(false),
+      m_isVisible(false),
+      m_isLockedForLoading(false),
+      m_wasReadOnly(false) {}
+
+void TextEditPrivate::setLockedForLoading(bool locked) {
+  Q_Q(TextEdit);
+  if (locked == m_isLockedForLoading) {
+    return;
+  }
+
+  m_isLockedForLoading = locked;
+  if (locked) {
+    m_wasReadOnly = q->isReadOnly();
+    q->setReadOnly(true);
+  } else {
+    q->setReadOnly(m_wasReadOnly);
+  }
+}
+
+void TextEditPrivate::startSearch() {
+  // The previous matches stay until the new find reports, so typing in the find box doesn't
+  // flicker
+  m_hasStaleSearchMatches = true;
+  m_searchRevision = m_document->revision();
+  m_matchFinder->find(m_searchRegexp, m_document->toPlainText(), m_searchBegin, m_searchEnd);
+}
+
+void TextEditPrivate::addSearchMatches(const QVector<Region>& regions) {
+  Q_Q(TextEdit);
+  if (m_hasStaleSearchMatches) {
+    m_searchMatches.clear();
+    m_hasStaleSearchMatches = false;
+  }
+  m_searchMatches.append(regions);
+  q->update();
+  emit q->searchMatchCountChanged(m_searchMatches.size(), false);
+}
+
+void TextEditPrivate::finishSearch(int matchCount) {
+  Q_Q(TextEdit);
+  if (m_hasStaleSearchMatches) {
+    m_searchMatches.clear();
+    m_hasStaleSearchMatches = false;
+    q->update();
+  }
+  Q_ASSERT(m_searchMatches.size() == matchCount);
+  emit q->searchMatchCountChanged(matchCount, true);
+}
+
+// Keeps the search matches up to date after an edit. The matches are moved and only the edited
+// lines are searched again.
+void TextEditPrivate::updateSearchMatches(int position, int charsRemoved, int charsAdded) {
+  Q_Q(TextEdit);
+  if (!m_searchRegexp) {
+    return;
+  }
+
+  // SyntaxHighlighter reports a format change as contentsChange(position, n, n). Only a text
+  // change increases the revision, but it's counted only while undo is enabled.
+  if (m_document->isUndoRedoEnabled()) {
+    if (m_document->revision() == m_searchRevision) {
+      return;
+    }
+    m_searchRevision = m_document->revision();
+  }
+
+  if (m_searchEnd >= 0) {
+    Region searchRegion(m_searchBegin, m_searchEnd);
+    searchRegion.adjust(position + charsRemoved, charsAdded - charsRemoved);
+    m_searchBegin = searchRegion.begin();
+    m_searchEnd = searchRegion.end();
+  }
+
+  // The running find searches the text before the edit
+  if (m_matchFinder->isRunning()) {
+    startSearch();
+    return;
+  }
+
+  // Only the lines around the edit are copied and searched instead of the whole text
+  const QTextBlock firstLine = m_document->findBlock(position);
+  const QTextBlock lastLine = m_document->findBlock(position + charsAdded);
+  const Region lines(firstLine.position(), lastLine.position() + lastLine.length() - 1);
+  const Region region = m_searchMatches.prepareUpdate(lines, position, charsRemoved, charsAdded);
+  QTextBlock block = m_document->findBlock(qMax(0, region.begin() - SEARCH_CONTEXT_LENGTH));
+  const int textBegin = block.position();
+  QString text;
+  for (; block.isValid() && block.position() <= region.end() + SEARCH_LOOKAHEAD_LENGTH;
+       block = block.next()) {
+    if (block.position() > textBegin) {
+      text += QLatin1Char('\n');
+    }
+    text += block.text();
+  }
+  // Same as toPlainText
+  text.replace(QChar::Nbsp, QLatin1Char(' '));
+
+  // A match longer than the lookahead is found by searching the whole text again in a pool thread
+  if (!m_searchMatches.research(text, textBegin, !block.isValid(), *m_searchRegexp, region,
+                                m_searchBegin, m_searchEnd)) {
+    startSearch();
+    return;
+  }
+  q->update();
+  emit q->searchMatchCountChanged(m_searchMatches.size(), true);
+}
+
+// Tells the document whether this view shows it
+void TextEditPrivate::setVisible(bool visible) {
+  if (m_isVisible == visible) {
+    return;
+  }
+
+  m_isVisible = visible;
+  if (m_document) {
+    if (visible) {
+      m_document->addVisibleView();
+    } else {
+      m_document->removeVisibleView();
+    }
+  }
+}
 
 void TextEditPrivate::outdentCurrentLineIfNecessary() {
   if (!m_document || !m_document->language()) {
@@ -316,6 +446,7 @@ void TextEditPrivate::outdentCurrentLineIfNecessary() {
 TextEdit::TextEdit(QWidget* parent)
     : QPlainTextEdit(parent), d_ptr(new TextEditPrivate(this)), m_showLineNumber(true) {
   d_ptr->m_lineNumberArea = new LineNumberArea(this);
+  d_ptr->m_matchFinder = new MatchFinder(this);
   d_ptr->setWordWrap(Config::singleton().wordWrap());
 
   Q_D(TextEdit);
@@ -334,6 +465,10 @@ TextEdit::TextEdit(QWidget* parent)
   connect(&Config::singleton(), &Config::endOfLineStrChanged, this,
           [=](const QString&) { update(); });
   connect(this, SIGNAL(saved()), this, SLOT(clearDirtyMarker()));
+  connect(d->m_matchFinder, &MatchFinder::matchesFound, this,
+          [=](QVector<Region> regions) { d->addSearchMatches(regions); });
+  connect(d->m_matchFinder, &MatchFinder::finished, this,
+          [=](int matchCount) { d->finishSearch(matchCount); });
   connect(&Config::singleton(), SIGNAL(wordWrapChanged(bool)), this, SLOT(setWordWrap(bool)));
 
   // Set default values
@@ -343,6 +478,7 @@ TextEdit::TextEdit(QWidget* parent)
 }
 
 TextEdit::~TextEdit() {
+  d_ptr->setVisible(false);
   if (d_ptr->m_document) {
     emit destroying(d_ptr->m_document->path(), QPrivateSignal());
   }
@@ -540,6 +676,16 @@ void TextEdit::resizeEvent(QResizeEvent* e) {
       QRect(cr.left(), cr.top(), lineNumberAreaWidth(), cr.height()));
 }
 
+void TextEdit::showEvent(QShowEvent* e) {
+  QPlainTextEdit::showEvent(e);
+  d_ptr->setVisible(true);
+}
+
+void TextEdit::hideEvent(QHideEvent* e) {
+  QPlainTextEdit::hideEvent(e);
+  d_ptr->setVisible(false);
+}
+
 void TextEdit::lineNumberAreaPaintEvent(QPaintEvent* event) {
   if (!m_showLineNumber) {
     return;
@@ -583,19 +729,31 @@ void TextEdit::lineNumberAreaPaintEvent(QPaintEvent* event) {
 void TextEdit::paintEvent(QPaintEvent* e) {
   QPlainTextEdit::paintEvent(e);
 
+  // Let the parser highlight the visible region before the rest. A cursor blink repaints too, so
+  // the region is sent only when it changes.
+  QTextBlock lastVisibleBlock = cursorForPosition(viewport()->rect().bottomRight()).block();
+  const Region visibleRegion(firstVisibleBlock().position(),
+                             lastVisibleBlock.position() + lastVisibleBlock.length());
+  if (d_ptr->m_document && !(visibleRegion == d_ptr->m_visibleRegion)) {
+    d_ptr->m_visibleRegion = visibleRegion;
+    d_ptr->m_document->setVisibleRegion(visibleRegion);
+  }
+
   QPainter painter(viewport());
   painter.setRenderHint(QPainter::Antialiasing);
 
-  // highlight search matched texts
-  foreach (const Region& region, d_ptr->m_searchMatchedRegions) {
-    QTextCursor beginCursor(document()->docHandle(), region.begin());
-    QTextCursor endCursor(document()->docHandle(), region.end());
-    int beginPos = beginCursor.positionInBlock();
-    QTextBlock block = beginCursor.block();
-    QTextBlock endBlock = endCursor.block();
+  // highlight search matched texts in the visible region
+  const auto matches = d_ptr->m_searchMatches.range(visibleRegion.begin(), visibleRegion.end());
+  for (auto it = matches.first; it != matches.second; ++it) {
+    // A match continuing outside is drawn only within the visible blocks
+    const int matchBegin = qMax(it->begin(), visibleRegion.begin());
+    const int matchEnd = qMin(it->end(), visibleRegion.end());
+    QTextBlock block = document()->findBlock(matchBegin);
+    const QTextBlock endBlock = document()->findBlock(matchEnd);
+    int beginPos = matchBegin - block.position();
     do {
       int endPos =
-          block == endBlock ? endCursor.positionInBlock() : block.position() + block.length();
+          block == endBlock ? matchEnd - endBlock.position() : block.position() + block.length();
       QTextLine textLine = block.layout()->lineForTextPosition(beginPos);
       // textLine is invalid when the character at beginPos is a new line
       if (textLine.isValid()) {
@@ -693,32 +851,60 @@ void TextEdit::setTheme(core::Theme* theme) {
   d->setTheme(theme);
 }
 
-int TextEdit::highlightSearchMatches(const QString& text,
-                                     int begin,
-                                     int end,
-                                     Document::FindFlags flags) {
-  d_ptr->m_searchMatchedRegions.clear();
-
-  auto regions = document()->findAll(text, begin, end, flags);
-  for (const auto& region : regions) {
-    d_ptr->m_searchMatchedRegions.append(region);
+void TextEdit::highlightSearchMatches(const QString& text,
+                                      int begin,
+                                      int end,
+                                      Document::FindFlags flags) {
+  Q_D(TextEdit);
+  Document* doc = document();
+  std::shared_ptr<const Regexp> regexp =
+      doc && !text.isEmpty() ? doc->createRegexp(text, flags) : nullptr;
+  if (!regexp) {
+    clearSearchHighlight();
+    emit searchMatchCountChanged(0, true);
+    return;
   }
-  update();
-  return regions.size();
+
+  d->m_searchRegexp = regexp;
+  d->m_searchBegin = begin;
+  d->m_searchEnd = end;
+  d->startSearch();
 }
 
 void TextEdit::clearSearchHighlight() {
-  d_ptr->m_searchMatchedRegions.clear();
+  d_ptr->m_matchFinder->cancel();
+  d_ptr->m_searchRegexp.reset();
+  d_ptr->m_searchMatches.clear();
+  d_ptr->m_hasStaleSearchMatches = false;
   update();
 }
 
-void TextEdit::replaceSelection(const QString& text, bool preserveCase) {
+void TextEdit::replaceSelection(const QString& findText,
+                                const QString& replaceText,
+                                Document::FindFlags flags,
+                                bool preserveCase) {
   QTextCursor cursor = textCursor();
-  if (cursor.hasSelection()) {
-    cursor.beginEditBlock();
-    insertText(cursor, text, preserveCase);
-    cursor.endEditBlock();
+  Document* doc = document();
+  if (!cursor.hasSelection() || !doc) {
+    return;
+  }
+
+  boost::optional<QString> replacement;
+  if (!findText.isEmpty()) {
+    std::unique_ptr<Regexp> regexp = doc->createRegexp(findText, flags);
+    // The selection is matched in the whole text so that lookarounds see the text around it
+    replacement = TextEditLogic::replaceMatch(
+        doc->toPlainText(), regexp.get(), replaceText, cursor.selectionStart(),
+        cursor.selectionEnd(), flags.testFlag(Document::FindFlag::FindRegex), preserveCase);
   }
+
+  cursor.beginEditBlock();
+  if (replacement) {
+    cursor.insertText(*replacement);
+  } else {
+    insertText(cursor, replaceText, preserveCase);
+  }
+  cursor.endEditBlock();
 }
 
 void TextEdit::replaceAllSelection(const QString& findText,
@@ -727,22 +913,27 @@ void TextEdit::replaceAllSelection(const QString& findText,
                                    int end,
                                    Document::FindFlags flags,
                                    bool preserveCase) {
-  if (Document* doc = document()) {
-    QTextCursor currentCursor = textCursor();
-    currentCursor.beginEditBlock();
-
-    int delta = 0;
-    for (const auto& region : doc->findAll(findText, begin, end, flags)) {
-      QTextCursor cursor(doc->docHandle(), region.begin() + delta);
-      cursor.setPosition(region.end() + delta, QTextCursor::KeepAnchor);
-      delta += (replaceText.size() - cursor.selectedText().size());
-      insertText(cursor, replaceText, preserveCase);
-    }
+  Document* doc = document();
+  if (!doc || findText.isEmpty()) {
+    return;
+  }
 
-    currentCursor.endEditBlock();
-    clearSearchHighlight();
-    update();
+  clearSearchHighlight();
+  std::unique_ptr<Regexp> regexp = doc->createRegexp(findText, flags);
+  // The new text from the first match to the last one is built in a pass and applied as a single
+  // edit, so the document is changed, highlighted again and undone only once.
+  const auto replacement =
+      TextEditLogic::replaceAll(doc->toPlainText(), regexp.get(), replaceText, begin, end,
+                                flags.testFlag(Document::FindFlag::FindRegex), preserveCase);
+  if (replacement) {
+    QTextCursor cursor(doc);
+    cursor.setPosition(replacement->region.begin());
+    cursor.setPosition(replacement->region.end(), QTextCursor::KeepAnchor);
+    cursor.beginEditBlock();
+    cursor.insertText(replacement->text);
+    cursor.endEditBlock();
   }
+  update();
 }
 
 void TextEdit::insertNewLine() {
@@ -1000,7 +1191,7 @@ void TextEdit::loadState(QSettings& settings) {
 }
 
 bool TextEdit::isSearchMatchesHighlighted() {
-  return !d_ptr->m_searchMatchedRegions.isEmpty();
+  return d_ptr->m_matchFinder->isRunning() || !d_ptr->m_searchMatches.isEmpty();
 }
 
 QString TextEdit::scopeName() {
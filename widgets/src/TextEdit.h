@@ -57,12 +57,19 @@ class TextEdit : public QPlainTextEdit, public core::ICloneable<TextEdit> {
                                      int begin = 0,
                                      int end = -1,
                                      core::Document::FindFlags flags = 0);
-  int highlightSearchMatches(const QString& text,
-                             int begin,
-                             int end,
-                             core::Document::FindFlags flags = 0);
+  // Finds text in a pool thread and highlights the matches progressively.
+  // searchMatchCountChanged notifies the number of matches.
+  void highlightSearchMatches(const QString& text,
+                              int begin,
+                              int end,
+                              core::Document::FindFlags flags = 0);
   void clearSearchHighlight();
-  void replaceSelection(const QString& text, bool preserveCase = false);
+  // Replaces the selection with replaceText. If the selection is a match of findText, groups in
+  // replaceText are expanded as in replaceAllSelection.
+  void replaceSelection(const QString& findText,
+                        const QString& replaceText,
+                        core::Document::FindFlags flags = 0,
+                        bool preserveCase = false);
   void replaceAllSelection(const QString& findText,
                            const QString& replaceText,
                            int begin,
@@ -112,12 +119,18 @@ class TextEdit : public QPlainTextEdit, public core::ICloneable<TextEdit> {
   void lineSeparatorChanged(const QString& separator);
   void bomChanged(const core::BOM& bom);
   void showLineNumberChanged(bool visible);
+  // emitted while underlying document is loading a large file
+  void loadProgressed(int percent);
+  // emitted while search matches are found by highlightSearchMatches
+  void searchMatchCountChanged(int count, bool isFinished);
 
   // private signals
   void destroying(const QString& path, QPrivateSignal);
 
  protected:
   void resizeEvent(QResizeEvent* event) override;
+  void showEvent(QShowEvent* e) override;
+  void hideEvent(QHideEvent* e) override;
   void paintEvent(QPaintEvent* e) override;
   void wheelEvent(QWheelEvent* event) override;
   void keyPressEvent(QKeyEvent* event) override;
@@ -150,6 +163,7 @@ class TextEdit : public QPlainTextEdit, public core::ICloneable<TextEdit> {
   Q_PRIVATE_SLOT(d_func(), void updateLineNumberArea(const QRect&, int))
   Q_PRIVATE_SLOT(d_func(), void clearDirtyMarker())
   Q_PRIVATE_SLOT(d_func(), void setWordWrap(bool))
+  Q_PRIVATE_SLOT(d_func(), void updateSearchMatches(int, int, int))
 };
 
 Q_DECLARE_METATYPE(TextEdit*)
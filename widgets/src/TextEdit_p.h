@@ -4,8 +4,10 @@
 
 #include "TextEdit.h"
 #include "core/Region.h"
+#include "core/SearchMatches.h"
 
 namespace core {
+class MatchFinder;
 class Regexp;
 class Theme;
 class Document;
@@ -22,7 +24,24 @@ class TextEditPrivate {
   TextEdit* q_ptr;
   LineNumberArea* m_lineNumberArea;
   std::shared_ptr<core::Document> m_document;
-  QVector<core::Region> m_searchMatchedRegions;
+  core::SearchMatches m_searchMatches;
+  // finds search matches in a pool thread. Owned by TextEdit
+  core::MatchFinder* m_matchFinder;
+  // regexp and range of the highlighted search. null while nothing is highlighted
+  std::shared_ptr<const core::Regexp> m_searchRegexp;
+  int m_searchBegin;
+  int m_searchEnd;
+  // revision of m_document when the search matches were last updated
+  int m_searchRevision;
+  // true until the running find replaces the matches of the previous find
+  bool m_hasStaleSearchMatches;
+  bool m_isVisible;
+  // Editing is locked while m_document is loading. The read only state from before the lock is
+  // restored when it's unlocked.
+  bool m_isLockedForLoading;
+  bool m_wasReadOnly;
+  // visible region last sent to m_document
+  core::Region m_visibleRegion;
 
   QString prevLineText(int prevCount = 1, core::Regexp* ignorePattern = nullptr);
   void indentOneLevel(QTextCursor& currentVisibleCursor);
@@ -38,6 +57,12 @@ class TextEditPrivate {
   void emitBOMChanged(const core::BOM& bom);
   void setWordWrap(bool wordWrap);
   void setupConnections(std::shared_ptr<core::Document> document);
+  void setVisible(bool visible);
+  void setLockedForLoading(bool locked);
+  void startSearch();
+  void addSearchMatches(const QVector<core::Region>& regions);
+  void finishSearch(int matchCount);
+  void updateSearchMatches(int position, int charsRemoved, int charsAdded);
   boost::optional<core::Region> find(const QString& text,
                           int from,
                           int begin,
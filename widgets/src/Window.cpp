@@ -16,6 +16,7 @@
 #include "Splitter.h"
 #include "TabView.h"
 #include "FindReplaceView.h"
+#include "FindInFilesView.h"
 #include "MenuBar.h"
 #include "CommandAction.h"
 #include "util/YamlUtil.h"
@@ -51,6 +52,7 @@ Window::Window(QWidget* parent, Qt::WindowFlags flags)
       m_tabViewGroup(new TabViewGroup(this)),
       m_projectView(nullptr),
       m_findReplaceView(new FindReplaceView(this)),
+      m_findInFilesView(new FindInFilesView(this)),
       m_console(new Console(this)),
       m_firstPaintEventFired(false),
       m_horizontalSplitter(new QSplitter(Qt::Horizontal, this)) {
@@ -100,9 +102,11 @@ Window::Window(QWidget* parent, Qt::WindowFlags flags)
   ui->rootSplitter->setHandleWidth(0);
   ui->rootSplitter->setContentsMargins(0, 0, 0, 0);
   ui->rootSplitter->addWidget(m_horizontalSplitter);
+  ui->rootSplitter->addWidget(m_findInFilesView);
   ui->rootSplitter->addWidget(m_console);
-  ui->rootSplitter->setSizes(QList<int>{500, 100});
+  ui->rootSplitter->setSizes(QList<int>{500, 200, 100});
 
+  m_findInFilesView->hide();
   m_console->hide();
 
   setTheme(Config::singleton().theme());
@@ -182,6 +186,8 @@ void Window::updateConnection(QWidget* oldView, QWidget* newView) {
     disconnect(oldEditView, &TextEdit::lineSeparatorChanged, ui->statusBar,
                &StatusBar::setLineSeparator);
     disconnect(oldEditView, &TextEdit::bomChanged, ui->statusBar, &StatusBar::setBOM);
+    disconnect(oldEditView, &TextEdit::loadProgressed, ui->statusBar,
+               &StatusBar::setLoadProgress);
     disconnect(oldEditView, &TextEdit::pathUpdated, this, &Window::updateTitle);
   }
 
@@ -192,6 +198,7 @@ void Window::updateConnection(QWidget* oldView, QWidget* newView) {
     connect(newEditView, &TextEdit::lineSeparatorChanged, ui->statusBar,
             &StatusBar::setLineSeparator);
     connect(newEditView, &TextEdit::bomChanged, ui->statusBar, &StatusBar::setBOM);
+    connect(newEditView, &TextEdit::loadProgressed, ui->statusBar, &StatusBar::setLoadProgress);
     connect(newEditView, &TextEdit::pathUpdated, this, &Window::updateTitle);
   }
 }
@@ -439,6 +446,10 @@ TabView* Window::getActiveTabViewOrCreate() {
   }
 }
 
+QString Window::projectDirPath() {
+  return m_projectView ? m_projectView->dirPath() : QString();
+}
+
 bool Window::openDir(const QString& dirPath) {
   if (!m_projectView) {
     m_projectView = new ProjectTreeView(this);
@@ -15,6 +15,7 @@ class StatusBar;
 class ProjectTreeView;
 class TabViewGroup;
 class FindReplaceView;
+class FindInFilesView;
 class TextEdit;
 class Toolbar;
 class Console;
@@ -67,6 +68,8 @@ class Window : public QMainWindow {
   // accessor
   TabViewGroup* tabViewGroup() { return m_tabViewGroup; }
   bool isProjectOpend() { return m_projectView != nullptr; }
+  // Returns an empty string if no project is opened
+  QString projectDirPath();
 
   void show();
   void closeEvent(QCloseEvent* event) override;
@@ -82,6 +85,7 @@ class Window : public QMainWindow {
   StatusBar* statusBar();
   Console* console() { return m_console; }
   FindReplaceView* findReplaceView() { return m_findReplaceView; }
+  FindInFilesView* findInFilesView() { return m_findInFilesView; }
   TabView* activeTabView();
 
  signals:
@@ -103,6 +107,7 @@ class Window : public QMainWindow {
   TabViewGroup* m_tabViewGroup;
   ProjectTreeView* m_projectView;
   FindReplaceView* m_findReplaceView;
+  FindInFilesView* m_findInFilesView;
   Console* m_console;
   bool m_firstPaintEventFired;
 
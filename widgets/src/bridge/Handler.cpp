@@ -29,6 +29,7 @@
 #include "WebPage.h"
 #include "WebChannel.h"
 #include "Console.h"
+#include "FindInFilesView.h"
 #include "FindReplaceView.h"
 #include "util/YamlUtil.h"
 #include "core/Font.h"
@@ -46,6 +47,7 @@
 #include "core/TextBlock.h"
 #include "core/MessageHandler.h"
 #include "core/PackageManager.h"
+#include "core/ParseProfiler.h"
 #include "core/TextOption.h"
 #include "core/Completer.h"
 #include "core/StringListModel.h"
@@ -67,6 +69,7 @@ using core::Event;
 using core::TextCursor;
 using core::TextBlock;
 using core::PackageManager;
+using core::ParseProfiler;
 using core::TextOption;
 using core::Completer;
 using core::StringListModel;
@@ -239,6 +242,8 @@ void bridge::Handler::lateInit(const v8::FunctionCallbackInfo<Value>& args) {
                   Util::stripNamespace(ProjectManager::staticMetaObject.className()));
   setSingletonObj(exports, &PackageManager::singleton(),
                   Util::stripNamespace(PackageManager::staticMetaObject.className()));
+  setSingletonObj(exports, &ParseProfiler::singleton(),
+                  Util::stripNamespace(ParseProfiler::staticMetaObject.className()));
 
   // Config::get returns config whose type is decided based on ConfigDefinition, so we need to
   // handle it specially
@@ -252,6 +257,7 @@ void bridge::Handler::lateInit(const v8::FunctionCallbackInfo<Value>& args) {
   registerClass<DialogButtonBox>(exports);
   registerClass<Event>(exports);
   registerClass<FileDialog>(exports);
+  registerClass<FindInFilesView>(exports);
   registerClass<FindReplaceView>(exports);
   registerClass<Label>(exports);
   registerClass<LineEdit>(exports);